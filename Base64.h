@@ -0,0 +1,251 @@
+// Base64.h
+// Standard-alphabet, padded base64 (byte-compatible with sodium_base64_VARIANT_ORIGINAL) that
+// writes into caller-supplied buffers. x86 builds pick an AVX2 or SSSE3 kernel at runtime
+// (24 or 12 input bytes per step); everything else, and the tail of every call, is scalar.
+// Decoding is as strict as libsodium: padding required, no whitespace, zero trailing bits.
+#ifndef BASE64_H
+#define BASE64_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define B64_X86 1
+#include <immintrin.h>
+#else
+#define B64_X86 0
+#endif
+
+enum B64Impl { B64_SCALAR = 0, B64_SSSE3 = 1, B64_AVX2 = 2 };
+
+inline size_t b64_encoded_len(size_t bin_len) { return (bin_len + 2) / 3 * 4; }
+// Upper bound for the decoded size; the exact size is returned by b64_decode.
+inline size_t b64_decoded_maxlen(size_t b64_len) { return b64_len / 4 * 3; }
+
+static const char B64_ALPHABET[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// --- scalar kernels ---
+inline size_t b64_encode_scalar(char *out, const unsigned char *in, size_t n) {
+    char *o = out;
+    size_t i = 0;
+    for (; i + 3 <= n; i += 3) {
+        uint32_t v = ((uint32_t)in[i] << 16) | ((uint32_t)in[i + 1] << 8) | in[i + 2];
+        o[0] = B64_ALPHABET[v >> 18];
+        o[1] = B64_ALPHABET[(v >> 12) & 63];
+        o[2] = B64_ALPHABET[(v >> 6) & 63];
+        o[3] = B64_ALPHABET[v & 63];
+        o += 4;
+    }
+    if (i < n) {
+        uint32_t v = (uint32_t)in[i] << 16;
+        if (i + 1 < n) v |= (uint32_t)in[i + 1] << 8;
+        o[0] = B64_ALPHABET[v >> 18];
+        o[1] = B64_ALPHABET[(v >> 12) & 63];
+        o[2] = i + 1 < n ? B64_ALPHABET[(v >> 6) & 63] : '=';
+        o[3] = '=';
+        o += 4;
+    }
+    return (size_t)(o - out);
+}
+
+// 0..63 for alphabet characters, 0xff otherwise.
+inline const unsigned char *b64_decode_table() {
+    static const struct Table {
+        unsigned char v[256];
+        Table() {
+            std::memset(v, 0xff, sizeof(v));
+            for (int i = 0; i < 64; ++i) v[(unsigned char)B64_ALPHABET[i]] = (unsigned char)i;
+        }
+    } table;
+    return table.v;
+}
+
+// Decodes whole unpadded quads; returns false on any non-alphabet character.
+inline bool b64_decode_quads_scalar(unsigned char *out, const char *in, size_t quads) {
+    const unsigned char *t = b64_decode_table();
+    for (size_t q = 0; q < quads; ++q, in += 4, out += 3) {
+        uint32_t a = t[(unsigned char)in[0]], b = t[(unsigned char)in[1]];
+        uint32_t c = t[(unsigned char)in[2]], d = t[(unsigned char)in[3]];
+        if ((a | b | c | d) & 0x80) return false;
+        uint32_t v = (a << 18) | (b << 12) | (c << 6) | d;
+        out[0] = (unsigned char)(v >> 16);
+        out[1] = (unsigned char)(v >> 8);
+        out[2] = (unsigned char)v;
+    }
+    return true;
+}
+
+#if B64_X86
+// --- SSSE3 / AVX2 kernels (Mula's pshufb/multiply-shift scheme) ---
+// Encode: spread 3 bytes over a 32-bit lane, extract the four 6-bit indices with two
+// multiplies, then map index -> ASCII by adding a per-range offset looked up with pshufb.
+__attribute__((target("ssse3"))) inline __m128i b64_enc_translate_sse(__m128i in) {
+    in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+    __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+    __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+    __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+    __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+    __m128i idx = _mm_or_si128(t1, t3);
+    __m128i r = _mm_subs_epu8(idx, _mm_set1_epi8(51));
+    __m128i less = _mm_cmpgt_epi8(_mm_set1_epi8(26), idx);
+    r = _mm_or_si128(r, _mm_and_si128(less, _mm_set1_epi8(13)));
+    const __m128i offsets = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                          '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+                                          '/' - 63, 'A', 0, 0);
+    return _mm_add_epi8(_mm_shuffle_epi8(offsets, r), idx);
+}
+
+// Decode: classify by range to get (value - char) offsets and a validity mask, then pack
+// 4x6 bits into 3 bytes with maddubs/madd and a byte shuffle. Returns false on a bad character.
+__attribute__((target("ssse3"))) inline bool b64_dec_translate_sse(__m128i c, __m128i *packed) {
+    __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('A' - 1)), _mm_cmplt_epi8(c, _mm_set1_epi8('Z' + 1)));
+    __m128i lower = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('a' - 1)), _mm_cmplt_epi8(c, _mm_set1_epi8('z' + 1)));
+    __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('0' - 1)), _mm_cmplt_epi8(c, _mm_set1_epi8('9' + 1)));
+    __m128i plus = _mm_cmpeq_epi8(c, _mm_set1_epi8('+'));
+    __m128i slash = _mm_cmpeq_epi8(c, _mm_set1_epi8('/'));
+    __m128i valid = _mm_or_si128(_mm_or_si128(upper, lower), _mm_or_si128(_mm_or_si128(digit, plus), slash));
+    if (_mm_movemask_epi8(valid) != 0xffff) return false;
+    __m128i shift = _mm_or_si128(_mm_or_si128(_mm_and_si128(upper, _mm_set1_epi8(-65)), _mm_and_si128(lower, _mm_set1_epi8(-71))),
+                                 _mm_or_si128(_mm_or_si128(_mm_and_si128(digit, _mm_set1_epi8(4)), _mm_and_si128(plus, _mm_set1_epi8(19))),
+                                              _mm_and_si128(slash, _mm_set1_epi8(16))));
+    __m128i v = _mm_add_epi8(c, shift);
+    __m128i ab_cd = _mm_maddubs_epi16(v, _mm_set1_epi32(0x01400140));
+    __m128i abcd = _mm_madd_epi16(ab_cd, _mm_set1_epi32(0x00011000));
+    *packed = _mm_shuffle_epi8(abcd, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+    return true;
+}
+
+// Both kernels leave the tail to the scalar code; loads/stores stay inside the buffers.
+__attribute__((target("ssse3"))) inline size_t b64_encode_ssse3(char *out, const unsigned char *in, size_t n) {
+    size_t i = 0, o = 0;
+    for (; i + 16 <= n; i += 12, o += 16)
+        _mm_storeu_si128((__m128i*)(out + o), b64_enc_translate_sse(_mm_loadu_si128((const __m128i*)(in + i))));
+    return o + b64_encode_scalar(out + o, in + i, n - i);
+}
+
+// Decodes leading quads of in[0..n) while at least `keep` characters remain; returns chars used.
+__attribute__((target("ssse3"))) inline size_t b64_decode_ssse3(unsigned char *out, const char *in, size_t n, size_t keep) {
+    size_t i = 0, o = 0;
+    for (; i + 16 + keep <= n; i += 16, o += 12) {
+        __m128i packed;
+        if (!b64_dec_translate_sse(_mm_loadu_si128((const __m128i*)(in + i)), &packed)) break;
+        _mm_storeu_si128((__m128i*)(out + o), packed);
+    }
+    return i;
+}
+
+__attribute__((target("avx2"))) inline size_t b64_encode_avx2(char *out, const unsigned char *in, size_t n) {
+    size_t i = 0, o = 0;
+    const __m256i shuf = _mm256_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+                                         10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+    const __m256i offsets = _mm256_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                             '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+                                             '/' - 63, 'A', 0, 0,
+                                             'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                             '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+                                             '/' - 63, 'A', 0, 0);
+    // lane 0 takes in[i..i+12), lane 1 in[i+12..i+24); each 16-byte load reads 4 bytes past its group
+    for (; i + 28 <= n; i += 24, o += 32) {
+        __m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)(in + i))),
+                                            _mm_loadu_si128((const __m128i*)(in + i + 12)), 1);
+        v = _mm256_shuffle_epi8(v, shuf);
+        __m256i t1 = _mm256_mulhi_epu16(_mm256_and_si256(v, _mm256_set1_epi32(0x0fc0fc00)), _mm256_set1_epi32(0x04000040));
+        __m256i t3 = _mm256_mullo_epi16(_mm256_and_si256(v, _mm256_set1_epi32(0x003f03f0)), _mm256_set1_epi32(0x01000010));
+        __m256i idx = _mm256_or_si256(t1, t3);
+        __m256i r = _mm256_subs_epu8(idx, _mm256_set1_epi8(51));
+        __m256i less = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), idx);
+        r = _mm256_or_si256(r, _mm256_and_si256(less, _mm256_set1_epi8(13)));
+        _mm256_storeu_si256((__m256i*)(out + o), _mm256_add_epi8(_mm256_shuffle_epi8(offsets, r), idx));
+    }
+    return o + b64_encode_ssse3(out + o, in + i, n - i);
+}
+
+__attribute__((target("avx2"))) inline size_t b64_decode_avx2(unsigned char *out, const char *in, size_t n, size_t keep) {
+    size_t i = 0, o = 0;
+    for (; i + 32 + keep <= n; i += 32, o += 24) {
+        __m256i c = _mm256_loadu_si256((const __m256i*)(in + i));
+        __m256i upper = _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8('A' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), c));
+        __m256i lower = _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8('a' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), c));
+        __m256i digit = _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8('0' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), c));
+        __m256i plus = _mm256_cmpeq_epi8(c, _mm256_set1_epi8('+'));
+        __m256i slash = _mm256_cmpeq_epi8(c, _mm256_set1_epi8('/'));
+        __m256i valid = _mm256_or_si256(_mm256_or_si256(upper, lower), _mm256_or_si256(_mm256_or_si256(digit, plus), slash));
+        if (_mm256_movemask_epi8(valid) != -1) break;
+        __m256i shift = _mm256_or_si256(
+            _mm256_or_si256(_mm256_and_si256(upper, _mm256_set1_epi8(-65)), _mm256_and_si256(lower, _mm256_set1_epi8(-71))),
+            _mm256_or_si256(_mm256_or_si256(_mm256_and_si256(digit, _mm256_set1_epi8(4)), _mm256_and_si256(plus, _mm256_set1_epi8(19))),
+                            _mm256_and_si256(slash, _mm256_set1_epi8(16))));
+        __m256i v = _mm256_add_epi8(c, shift);
+        __m256i abcd = _mm256_madd_epi16(_mm256_maddubs_epi16(v, _mm256_set1_epi32(0x01400140)), _mm256_set1_epi32(0x00011000));
+        abcd = _mm256_shuffle_epi8(abcd, _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+                                                          2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+        // 12 bytes per lane -> 24 contiguous bytes
+        abcd = _mm256_permutevar8x32_epi32(abcd, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7));
+        _mm256_storeu_si256((__m256i*)(out + o), abcd);
+    }
+    return i + b64_decode_ssse3(out + o, in + i, n - i, keep);
+}
+#endif
+
+inline B64Impl b64_detect() {
+#if B64_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return B64_AVX2;
+    if (__builtin_cpu_supports("ssse3")) return B64_SSSE3;
+#endif
+    return B64_SCALAR;
+}
+inline B64Impl b64_best_impl() {
+    static const B64Impl impl = b64_detect();
+    return impl;
+}
+inline const char *b64_impl_name(B64Impl impl) {
+    return impl == B64_AVX2 ? "avx2" : impl == B64_SSSE3 ? "ssse3" : "scalar";
+}
+
+// Writes exactly b64_encoded_len(n) characters (no NUL) to `out`; returns that length.
+inline size_t b64_encode(char *out, const unsigned char *in, size_t n, B64Impl impl = b64_best_impl()) {
+#if B64_X86
+    if (impl == B64_AVX2) return b64_encode_avx2(out, in, n);
+    if (impl == B64_SSSE3) return b64_encode_ssse3(out, in, n);
+#endif
+    (void)impl;
+    return b64_encode_scalar(out, in, n);
+}
+
+// Decodes `n` characters into `out` (room for b64_decoded_maxlen(n) bytes) and stores the
+// decoded length in *out_len. Returns false on malformed input.
+inline bool b64_decode(unsigned char *out, size_t *out_len, const char *in, size_t n, B64Impl impl = b64_best_impl()) {
+    if (n % 4 != 0) return false;
+    if (n == 0) { *out_len = 0; return true; }
+    size_t pad = in[n - 1] == '=' ? (in[n - 2] == '=' ? 2 : 1) : 0;
+    size_t done = 0;
+    // vector stores write 16/32 bytes for 12/24 decoded, so keep the last 8/16 characters
+    // (at least 4 bytes of output beyond each store) for the scalar path.
+#if B64_X86
+    if (impl == B64_AVX2) done = b64_decode_avx2(out, in, n, 16);
+    else if (impl == B64_SSSE3) done = b64_decode_ssse3(out, in, n, 8);
+#endif
+    (void)impl;
+    size_t full = n / 4 - 1; // quads before the final one
+    if (!b64_decode_quads_scalar(out + done / 4 * 3, in + done, full - done / 4)) return false;
+
+    const unsigned char *t = b64_decode_table();
+    const char *q = in + n - 4;
+    unsigned char *o = out + full * 3;
+    uint32_t a = t[(unsigned char)q[0]], b = t[(unsigned char)q[1]];
+    uint32_t c = pad >= 2 ? 0 : t[(unsigned char)q[2]];
+    uint32_t d = pad >= 1 ? 0 : t[(unsigned char)q[3]];
+    if ((a | b | c | d) & 0x80) return false;
+    uint32_t v = (a << 18) | (b << 12) | (c << 6) | d;
+    // non-zero bits beyond the last byte are rejected, as libsodium does
+    if ((pad == 1 && (v & 0xff)) || (pad == 2 && (v & 0xffff))) return false;
+    o[0] = (unsigned char)(v >> 16);
+    if (pad < 2) o[1] = (unsigned char)(v >> 8);
+    if (pad < 1) o[2] = (unsigned char)v;
+    *out_len = full * 3 + 3 - pad;
+    return true;
+}
+
+#endif // BASE64_H
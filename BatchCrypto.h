@@ -0,0 +1,161 @@
+// BatchCrypto.h
+// Multi-threaded bulk AEAD: seals or opens N independent records across a worker pool.
+#ifndef BATCHCRYPTO_H
+#define BATCHCRYPTO_H
+
+#include "Encryption.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// One unit of batch work. `input` is plaintext for seal() and nonce||ciphertext for open();
+// it must stay valid for the duration of the call. `output` keeps its capacity between batches.
+struct AeadRecord {
+    ByteSpan input;
+    SecureString output; // plaintext after open(), so kept in secure memory
+    bool ok = false;
+    std::string error;
+};
+
+class AeadBatchEngine {
+public:
+    // threads == 0 picks std::thread::hardware_concurrency(). The calling thread
+    // always takes part, so a single-thread engine runs everything inline.
+    explicit AeadBatchEngine(unsigned threads = 0) {
+        if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+        for (unsigned i = 1; i < threads; ++i) workers.emplace_back([this] { workerLoop(); });
+    }
+    ~AeadBatchEngine() {
+        {
+            std::lock_guard<std::mutex> lk(m);
+            stopping = true;
+        }
+        cv.notify_all();
+        for (auto &t : workers) t.join();
+    }
+    AeadBatchEngine(const AeadBatchEngine &) = delete;
+    AeadBatchEngine &operator=(const AeadBatchEngine &) = delete;
+
+    unsigned threadCount() const { return (unsigned)workers.size() + 1; }
+
+    // Runs fn(i) for every i in [0, n) across the pool and returns when all are done.
+    // The first exception thrown by fn is rethrown here after the batch drains.
+    void parallelFor(size_t n, const std::function<void(size_t)> &fn) {
+        if (n == 0) return;
+        if (workers.empty() || n == 1) {
+            for (size_t i = 0; i < n; ++i) fn(i);
+            return;
+        }
+        std::lock_guard<std::mutex> batch(batchMutex); // one batch in flight per engine
+        {
+            std::lock_guard<std::mutex> lk(m);
+            job = &fn;
+            jobSize = n;
+            chunk = std::max<size_t>(1, n / (threadCount() * 8));
+            next.store(0);
+            pending = workers.size();
+            failure = nullptr;
+            ++generation;
+        }
+        cv.notify_all();
+        drain();
+        std::unique_lock<std::mutex> lk(m);
+        doneCv.wait(lk, [this] { return pending == 0; });
+        job = nullptr;
+        if (failure) std::rethrow_exception(failure);
+    }
+
+    // Seals every record with `key` under `suite`; returns the number of records that failed.
+    size_t seal(std::vector<AeadRecord> &records, ByteSpan key, SuiteId suite = SUITE_LEGACY) {
+        std::atomic<size_t> failures{0};
+        parallelFor(records.size(), [&](size_t i) {
+            AeadRecord &r = records[i];
+            try {
+                r.output.resize(aead_boxed_len(suite, r.input.size()));
+                r.output.resize(encrypt_aead(MutableByteSpan(r.output), r.input, key, suite));
+                r.ok = true;
+                r.error.clear();
+            } catch (const std::exception &e) {
+                r.ok = false;
+                r.error = e.what();
+                failures.fetch_add(1);
+            }
+        });
+        return failures.load();
+    }
+
+    // Opens every record with `key` (any suite, mixed); returns the number of records that failed.
+    size_t open(std::vector<AeadRecord> &records, ByteSpan key) {
+        std::atomic<size_t> failures{0};
+        parallelFor(records.size(), [&](size_t i) {
+            AeadRecord &r = records[i];
+            try {
+                r.output.resize(aead_plain_len(r.input.size()));
+                r.output.resize(decrypt_aead(MutableByteSpan(r.output), r.input, key));
+                r.ok = true;
+                r.error.clear();
+            } catch (const std::exception &e) {
+                r.ok = false;
+                r.error = e.what();
+                failures.fetch_add(1);
+            }
+        });
+        return failures.load();
+    }
+
+private:
+    void drain() {
+        for (;;) {
+            size_t begin = next.fetch_add(chunk);
+            if (begin >= jobSize) return;
+            size_t end = std::min(jobSize, begin + chunk);
+            for (size_t i = begin; i < end; ++i) {
+                try {
+                    (*job)(i);
+                } catch (...) {
+                    std::lock_guard<std::mutex> lk(m);
+                    if (!failure) failure = std::current_exception();
+                }
+            }
+        }
+    }
+
+    void workerLoop() {
+        uint64_t seen = 0;
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lk(m);
+                cv.wait(lk, [&] { return stopping || generation != seen; });
+                if (stopping) return;
+                seen = generation;
+            }
+            drain();
+            std::lock_guard<std::mutex> lk(m);
+            if (--pending == 0) doneCv.notify_one();
+        }
+    }
+
+    std::vector<std::thread> workers;
+    std::mutex batchMutex;
+    std::mutex m;
+    std::condition_variable cv;
+    std::condition_variable doneCv;
+    const std::function<void(size_t)> *job = nullptr;
+    size_t jobSize = 0;
+    size_t chunk = 1;
+    std::atomic<size_t> next{0};
+    size_t pending = 0;
+    uint64_t generation = 0;
+    bool stopping = false;
+    std::exception_ptr failure;
+};
+
+#endif // BATCHCRYPTO_H
@@ -0,0 +1,114 @@
+// BoundedQueue.h
+// Blocking bounded FIFO connecting pipeline stages. push blocks while the queue is full, which
+// is how a slow stage pushes back on the ones feeding it; pop blocks while it is empty. After
+// close(), pushes fail and pops drain what is left, then return false so workers can exit.
+// Urgent items (pushUrgent) skip that: they never wait for room and are popped before the rest,
+// so an SOS overtakes a backlog already in the pipeline; popUrgent() serves only them.
+#ifndef BOUNDEDQUEUE_H
+#define BOUNDEDQUEUE_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+
+template <class T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) : cap(capacity ? capacity : 1) {}
+
+    bool push(T item) {
+        std::unique_lock<std::mutex> lock(mu);
+        notFull.wait(lock, [&] { return closed || q.size() < cap; });
+        if (closed) return false;
+        q.push_back(std::move(item));
+        notEmpty.notify_one();
+        return true;
+    }
+
+    bool pushUrgent(T item) {
+        std::lock_guard<std::mutex> lock(mu);
+        if (closed) return false;
+        urgent.push_back(std::move(item));
+        notEmpty.notify_one();
+        notUrgent.notify_one();
+        return true;
+    }
+
+    // Waits until push() would not block, or `stop()` holds (checked under the queue's lock,
+    // again on every wake()); false only when it gave up for `stop()`. For a single pusher.
+    template <class Stop>
+    bool waitForRoom(Stop stop) {
+        std::unique_lock<std::mutex> lock(mu);
+        notFull.wait(lock, [&] { return closed || q.size() < cap || stop(); });
+        return closed || q.size() < cap;
+    }
+    void wake() {
+        std::lock_guard<std::mutex> lock(mu);
+        notFull.notify_all();
+    }
+
+    bool pop(T &out) {
+        std::unique_lock<std::mutex> lock(mu);
+        notEmpty.wait(lock, [&] { return closed || !urgent.empty() || !q.empty(); });
+        return take(out);
+    }
+
+    // pop() that gives up at `deadline`: false on timeout too.
+    template <class TimePoint>
+    bool popUntil(T &out, TimePoint deadline) {
+        std::unique_lock<std::mutex> lock(mu);
+        if (!notEmpty.wait_until(lock, deadline, [&] { return closed || !urgent.empty() || !q.empty(); })) return false;
+        return take(out);
+    }
+
+    bool popUrgent(T &out) {
+        std::unique_lock<std::mutex> lock(mu);
+        notUrgent.wait(lock, [&] { return closed || !urgent.empty(); });
+        if (urgent.empty()) return false;
+        out = std::move(urgent.front());
+        urgent.pop_front();
+        return true;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(mu);
+        closed = true;
+        notFull.notify_all();
+        notEmpty.notify_all();
+        notUrgent.notify_all();
+    }
+
+    // Closed with nothing left: every pop fails from now on.
+    bool drained() const {
+        std::lock_guard<std::mutex> lock(mu);
+        return closed && urgent.empty() && q.empty();
+    }
+
+    size_t size() const {
+        std::lock_guard<std::mutex> lock(mu);
+        return urgent.size() + q.size();
+    }
+
+private:
+    bool take(T &out) {
+        if (!urgent.empty()) {
+            out = std::move(urgent.front());
+            urgent.pop_front();
+            return true;
+        }
+        if (q.empty()) return false;
+        out = std::move(q.front());
+        q.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+
+    mutable std::mutex mu;
+    std::condition_variable notFull, notEmpty, notUrgent;
+    std::deque<T> q, urgent;
+    size_t cap;
+    bool closed = false;
+};
+
+#endif // BOUNDEDQUEUE_H
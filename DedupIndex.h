@@ -0,0 +1,203 @@
+// DedupIndex.h
+// Coalesces repeated submissions of the same message. Plaintexts are fingerprinted with keyed
+// BLAKE2b (a key derived from the master key, so fingerprints say nothing about content to
+// anyone without it). A rotating pair of bloom filters remembers every fingerprint of the last
+// one to two windows in fixed memory and screens out the common no-duplicate case; a bounded
+// exact set of recent fingerprints tracks the pending copy each duplicate folds into.
+//
+// A duplicate of a message still pending (and first seen within the window) is not queued: it
+// bumps the pending copy's repeat count. If it carries a higher priority, it is queued at that
+// priority instead and the older copy is superseded, so the repeat count goes out once, at the
+// highest priority seen. A message that fails to be queued after admit() must release() its
+// token, or later repeats would fold into a copy that does not exist.
+#ifndef DEDUPINDEX_H
+#define DEDUPINDEX_H
+
+#include "Encryption.h"
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+class DedupIndex {
+public:
+    using Fingerprint = std::array<unsigned char, 16>;
+    using Clock = std::chrono::steady_clock;
+
+    struct Stats {
+        uint64_t coalesced = 0;     // duplicates folded into a pending copy
+        uint64_t raised = 0;        // duplicates that re-queued the message at a higher priority
+        uint64_t lateRepeats = 0;   // seen within the window, but the earlier copy was already sent
+    };
+
+    DedupIndex(ByteSpan masterKey, std::chrono::milliseconds window, size_t exactCapacity = 4096,
+               size_t bloomBits = (size_t)1 << 20)
+        : window(window), capacity(exactCapacity ? exactCapacity : 1),
+          bloom{std::vector<uint64_t>((bloomBits + 63) / 64), std::vector<uint64_t>((bloomBits + 63) / 64)},
+          rotated(Clock::now()) {
+        static const char label[] = "lifecore dedup key";
+        if (crypto_generichash(key, sizeof(key), (const unsigned char*)label, sizeof(label) - 1, masterKey.data(),
+                               std::min(masterKey.size(), (size_t)crypto_generichash_KEYBYTES_MAX)) != 0)
+            throw std::runtime_error("dedup key derivation failed");
+    }
+    ~DedupIndex() { sodium_memzero(key, sizeof(key)); }
+    DedupIndex(const DedupIndex &) = delete;
+    DedupIndex &operator=(const DedupIndex &) = delete;
+
+    // 0 disables coalescing.
+    void setWindow(std::chrono::milliseconds w) {
+        std::lock_guard<std::mutex> lock(mu);
+        window = w;
+    }
+
+    // Returns a token for a message to queue, or 0 when `plaintext` was folded into a pending copy.
+    uint64_t admit(ByteSpan plaintext, int priority) {
+        Fingerprint fp = fingerprint(plaintext);
+        std::lock_guard<std::mutex> lock(mu);
+        uint64_t token = nextToken++;
+        if (window.count() <= 0) return token;
+        Clock::time_point now = Clock::now();
+        rotate(now);
+        bool maybe = bloom_has(fp);
+        bloom_add(fp);
+        if (maybe) {
+            auto it = exact.find(fp);
+            if (it != exact.end() && it->second.pending && now - it->second.firstSeen <= window) {
+                Entry &e = it->second;
+                ++e.repeats;
+                if (priority >= e.priority) { ++stats.coalesced; return 0; }
+                ++stats.raised;
+                tokens[e.token].superseded = true;
+                tokens[token] = TokenInfo{fp, false, e.token, e.priority};
+                e.token = token;
+                e.priority = priority;
+                return token;
+            }
+            ++stats.lateRepeats;
+        }
+        auto it = exact.find(fp);
+        if (it == exact.end()) {
+            order.push_back(fp);
+            if (order.size() > capacity) { exact.erase(order.front()); order.pop_front(); }
+        }
+        exact[fp] = Entry{token, priority, 1, now, true};
+        tokens[token] = TokenInfo{fp, false, 0, 0};
+        return token;
+    }
+
+    // Undoes admit() for a message that never made it into the queue: a copy it superseded is
+    // live again (with its own priority and count), otherwise later repeats start a new message.
+    void release(uint64_t token) {
+        if (!token) return;
+        std::lock_guard<std::mutex> lock(mu);
+        auto t = tokens.find(token);
+        if (t == tokens.end()) return;
+        TokenInfo info = t->second;
+        tokens.erase(t);
+        auto it = exact.find(info.fp);
+        if (it == exact.end() || it->second.token != token) return;
+        Entry &e = it->second;
+        auto prev = info.replaced ? tokens.find(info.replaced) : tokens.end();
+        if (prev != tokens.end()) {
+            prev->second.superseded = false;
+            e.token = info.replaced;
+            e.priority = info.replacedPriority;
+            --e.repeats;
+            --stats.raised;
+        } else {
+            e.pending = false;
+        }
+    }
+
+    // Called when the message with `token` is about to go out: how many submissions it stands
+    // for, or 0 if a higher-priority copy replaced it (drop it). Token 0 (not deduplicated) is 1.
+    uint32_t claim(uint64_t token) {
+        if (!token) return 1;
+        std::lock_guard<std::mutex> lock(mu);
+        auto t = tokens.find(token);
+        if (t == tokens.end()) return 1;
+        TokenInfo info = t->second;
+        tokens.erase(t);
+        if (info.superseded) return 0;
+        auto it = exact.find(info.fp);
+        if (it == exact.end() || it->second.token != token || !it->second.pending) return 1;
+        it->second.pending = false; // later repeats start a new message
+        return it->second.repeats;
+    }
+
+    Stats counters() const {
+        std::lock_guard<std::mutex> lock(mu);
+        return stats;
+    }
+
+private:
+    struct FingerprintHash {
+        size_t operator()(const Fingerprint &f) const { size_t h; std::memcpy(&h, f.data(), sizeof(h)); return h; }
+    };
+    struct Entry {
+        uint64_t token;
+        int priority;
+        uint32_t repeats;
+        Clock::time_point firstSeen;
+        bool pending;
+    };
+    struct TokenInfo {
+        Fingerprint fp;
+        bool superseded;
+        uint64_t replaced;    // the copy this one superseded (0: none), restored by release()
+        int replacedPriority;
+    };
+
+    Fingerprint fingerprint(ByteSpan plaintext) const {
+        Fingerprint fp;
+        crypto_generichash(fp.data(), fp.size(), plaintext.data(), plaintext.size(), key, sizeof(key));
+        return fp;
+    }
+
+    // Each filter covers one window; lookups consult both, so a fingerprint is remembered for
+    // at least one full window after it was added.
+    void rotate(Clock::time_point now) {
+        if (now - rotated < window) return;
+        bool skipped = now - rotated >= 2 * window;
+        std::swap(bloom[0], bloom[1]);
+        std::fill(bloom[0].begin(), bloom[0].end(), 0);
+        if (skipped) std::fill(bloom[1].begin(), bloom[1].end(), 0);
+        rotated = now;
+    }
+    // four 32-bit probes straight from the (uniform) fingerprint
+    size_t probe(const Fingerprint &fp, int i) const {
+        uint32_t v;
+        std::memcpy(&v, fp.data() + 4 * i, sizeof(v));
+        return v % (bloom[0].size() * 64);
+    }
+    bool bloom_has(const Fingerprint &fp) const {
+        for (const auto &bits : bloom) {
+            bool all = true;
+            for (int i = 0; i < 4 && all; ++i) { size_t b = probe(fp, i); all = (bits[b / 64] >> (b % 64)) & 1; }
+            if (all) return true;
+        }
+        return false;
+    }
+    void bloom_add(const Fingerprint &fp) {
+        for (int i = 0; i < 4; ++i) { size_t b = probe(fp, i); bloom[0][b / 64] |= (uint64_t)1 << (b % 64); }
+    }
+
+    mutable std::mutex mu;
+    unsigned char key[crypto_generichash_KEYBYTES];
+    std::chrono::milliseconds window;
+    size_t capacity;
+    std::vector<uint64_t> bloom[2]; // [0] current window, [1] previous
+    Clock::time_point rotated;
+    std::unordered_map<Fingerprint, Entry, FingerprintHash> exact;
+    std::deque<Fingerprint> order; // insertion order of `exact`, for eviction
+    std::unordered_map<uint64_t, TokenInfo> tokens; // queued messages still holding a token
+    uint64_t nextToken = 1;
+    Stats stats;
+};
+
+#endif // DEDUPINDEX_H
@@ -2,15 +2,65 @@
 #ifndef ENCRYPTION_H
 #define ENCRYPTION_H
 
+#include <algorithm>
 #include <string>
 #include <vector>
 #include <stdexcept>
 #include <sodium.h>
 #include <fstream>
 #include <cstring>
+#include <cstdint>
+#include <cstdlib>
+#include <type_traits>
+#include <utility>
+
+#include "Base64.h"
+#include "SecureMemory.h"
 
 static const size_t SALT_LEN = crypto_pwhash_SALTBYTES; // 16
 static const size_t MASTER_KEY_LEN = crypto_aead_xchacha20poly1305_ietf_KEYBYTES; // 32
+static const size_t AEAD_NONCE_LEN = crypto_aead_xchacha20poly1305_ietf_NPUBBYTES; // 24
+static const size_t AEAD_TAG_LEN = crypto_aead_xchacha20poly1305_ietf_ABYTES; // 16
+static const size_t AEAD_OVERHEAD = AEAD_NONCE_LEN + AEAD_TAG_LEN;
+
+// --- Non-owning byte spans (std::span-style views usable from C++17) ---
+// ByteSpan binds to anything with data()/size() (std::string, std::vector, std::array of
+// unsigned char, ...); MutableByteSpan only binds to writable containers.
+class ByteSpan {
+public:
+    ByteSpan() = default;
+    ByteSpan(const void *p, size_t n) : p_((const unsigned char*)p), n_(n) {}
+    template <class C, typename = typename std::enable_if<
+        std::is_convertible<decltype(std::declval<const C&>().data()), const void*>::value>::type>
+    ByteSpan(const C &c) : p_((const unsigned char*)c.data()), n_(c.size() * sizeof(*c.data())) {}
+
+    const unsigned char *data() const { return p_; }
+    size_t size() const { return n_; }
+    bool empty() const { return n_ == 0; }
+    ByteSpan subspan(size_t off, size_t n) const { return ByteSpan(p_ + off, n); }
+    ByteSpan subspan(size_t off) const { return ByteSpan(p_ + off, n_ - off); }
+private:
+    const unsigned char *p_ = nullptr;
+    size_t n_ = 0;
+};
+
+class MutableByteSpan {
+public:
+    MutableByteSpan() = default;
+    MutableByteSpan(void *p, size_t n) : p_((unsigned char*)p), n_(n) {}
+    template <class C, typename = typename std::enable_if<
+        std::is_convertible<decltype(std::declval<C&>().data()), void*>::value>::type>
+    MutableByteSpan(C &c) : p_((unsigned char*)c.data()), n_(c.size() * sizeof(*c.data())) {}
+
+    unsigned char *data() const { return p_; }
+    size_t size() const { return n_; }
+    bool empty() const { return n_ == 0; }
+    MutableByteSpan subspan(size_t off, size_t n) const { return MutableByteSpan(p_ + off, n); }
+    MutableByteSpan subspan(size_t off) const { return MutableByteSpan(p_ + off, n_ - off); }
+private:
+    unsigned char *p_ = nullptr;
+    size_t n_ = 0;
+};
 
 inline void init_crypto() {
     if (sodium_init() < 0) throw std::runtime_error("libsodium init failed");
@@ -40,77 +90,330 @@ inline std::vector<unsigned char> read_binary_file(const std::string &path) {
 }
 
 // --- Argon2id (crypto_pwhash) KDF: derive master key from passphrase + salt ---
-inline std::string derive_master_key(const std::string &pass, const std::vector<unsigned char> &salt) {
+inline SecureString derive_master_key(ByteSpan pass, const std::vector<unsigned char> &salt,
+                                      unsigned long long opslimit, size_t memlimit, int alg) {
     if (salt.size() != SALT_LEN) throw std::runtime_error("salt size mismatch");
-    std::string key(MASTER_KEY_LEN, '\0');
+    SecureString key(MASTER_KEY_LEN, '\0');
     if (crypto_pwhash((unsigned char*)key.data(), key.size(),
-                      pass.c_str(), pass.size(),
-                      salt.data(),
-                      crypto_pwhash_OPSLIMIT_INTERACTIVE,
-                      crypto_pwhash_MEMLIMIT_INTERACTIVE,
-                      crypto_pwhash_ALG_DEFAULT) != 0) {
+                      (const char*)pass.data(), pass.size(),
+                      salt.data(), opslimit, memlimit, alg) != 0) {
         throw std::runtime_error("crypto_pwhash failed - out of memory");
     }
     return key;
 }
+inline SecureString derive_master_key(ByteSpan pass, const std::vector<unsigned char> &salt) {
+    return derive_master_key(pass, salt,
+                             crypto_pwhash_OPSLIMIT_INTERACTIVE,
+                             crypto_pwhash_MEMLIMIT_INTERACTIVE,
+                             crypto_pwhash_ALG_DEFAULT);
+}
+
+// Short public fingerprint of a key (BLAKE2b keyed by it, over a fixed label), for tagging
+// stored data with the key that sealed it. Reveals nothing usable about the key.
+inline uint64_t key_id(ByteSpan key) {
+    static const char label[] = "lifecore key id";
+    unsigned char h[16];
+    if (crypto_generichash(h, sizeof(h), (const unsigned char*)label, sizeof(label) - 1, key.data(),
+                           std::min(key.size(), (size_t)crypto_generichash_KEYBYTES_MAX)) != 0)
+        throw std::runtime_error("key id hash failed");
+    uint64_t id = 0;
+    for (int i = 7; i >= 0; --i) id = (id << 8) | h[i];
+    return id;
+}
 
-// --- Base64 helpers (libsodium) ---
+// --- Base64 helpers (Base64.h; same output as sodium_base64_VARIANT_ORIGINAL) ---
+// Buffer-reusing variants: `out` keeps its capacity between calls.
+inline void binToBase64(std::string &out, ByteSpan bin) {
+    out.resize(b64_encoded_len(bin.size()));
+    b64_encode(&out[0], bin.data(), bin.size());
+}
+inline void base64ToBin(std::vector<unsigned char> &out, const char *b64, size_t len) {
+    out.resize(b64_decoded_maxlen(len));
+    size_t bin_len = 0;
+    if (!b64_decode(out.data(), &bin_len, b64, len)) throw std::runtime_error("Base64 decode failed");
+    out.resize(bin_len);
+}
+inline void base64ToBin(std::vector<unsigned char> &out, const std::string &b64) {
+    base64ToBin(out, b64.data(), b64.size());
+}
 inline std::string binToBase64(const unsigned char *bin, size_t binlen) {
-    size_t out_len = sodium_base64_encoded_len(binlen, sodium_base64_VARIANT_ORIGINAL);
-    std::string out(out_len, '\0');
-    sodium_bin2base64(&out[0], out_len, bin, binlen, sodium_base64_VARIANT_ORIGINAL);
-    out.resize(strlen(out.c_str()));
+    std::string out;
+    binToBase64(out, ByteSpan(bin, binlen));
     return out;
 }
 inline std::vector<unsigned char> base64ToBin(const std::string &b64) {
-    size_t bin_maxlen = b64.size();
-    std::vector<unsigned char> bin(bin_maxlen);
-    size_t bin_len = 0;
-    if (sodium_base642bin(bin.data(), bin_maxlen,
-                          b64.c_str(), b64.size(),
-                          NULL, &bin_len, NULL,
-                          sodium_base64_VARIANT_ORIGINAL) != 0) {
-        throw std::runtime_error("Base64 decode failed");
-    }
-    bin.resize(bin_len);
+    std::vector<unsigned char> bin;
+    base64ToBin(bin, b64);
     return bin;
 }
 
-// --- AEAD encrypt/decrypt: returns nonce||ciphertext or decrypts same ---
-inline std::string encrypt_aead(const std::string &plaintext, const std::string &key) {
+// --- Cipher suites ---
+// Suite-tagged blobs are suite_id || nonce || ciphertext || tag, with the id byte bound as
+// associated data, followed by the caller's `ad` if any (it is not stored: the opener passes the
+// same bytes). Untagged nonce||ciphertext||tag blobs (SUITE_LEGACY) are XChaCha20-Poly1305 and
+// are what encrypt_aead() without a suite still writes.
+enum SuiteId : uint8_t { SUITE_LEGACY = 0, SUITE_XCHACHA20POLY1305 = 1, SUITE_AES256GCM = 2 };
+
+struct XChaCha20Poly1305Suite {
+    static const SuiteId ID = SUITE_XCHACHA20POLY1305;
+    static const size_t NONCE_LEN = crypto_aead_xchacha20poly1305_ietf_NPUBBYTES;
+    static const size_t TAG_LEN = crypto_aead_xchacha20poly1305_ietf_ABYTES;
+    static bool available() { return true; }
+    static void seal(unsigned char *c, unsigned long long *clen, const unsigned char *m, size_t mlen,
+                     const unsigned char *ad, size_t adlen, const unsigned char *npub, const unsigned char *k) {
+        crypto_aead_xchacha20poly1305_ietf_encrypt(c, clen, m, mlen, ad, adlen, NULL, npub, k);
+    }
+    static int open(unsigned char *m, unsigned long long *mlen, const unsigned char *c, size_t clen,
+                    const unsigned char *ad, size_t adlen, const unsigned char *npub, const unsigned char *k) {
+        return crypto_aead_xchacha20poly1305_ietf_decrypt(m, mlen, NULL, c, clen, ad, adlen, npub, k);
+    }
+};
+
+// Needs AES-NI + PCLMUL (libsodium has no portable fallback). Random 96-bit nonces keep
+// collisions negligible for well under 2^32 blobs per key.
+struct Aes256GcmSuite {
+    static const SuiteId ID = SUITE_AES256GCM;
+    static const size_t NONCE_LEN = crypto_aead_aes256gcm_NPUBBYTES;
+    static const size_t TAG_LEN = crypto_aead_aes256gcm_ABYTES;
+    static bool available() { return crypto_aead_aes256gcm_is_available() == 1; }
+    static void seal(unsigned char *c, unsigned long long *clen, const unsigned char *m, size_t mlen,
+                     const unsigned char *ad, size_t adlen, const unsigned char *npub, const unsigned char *k) {
+        crypto_aead_aes256gcm_encrypt(c, clen, m, mlen, ad, adlen, NULL, npub, k);
+    }
+    static int open(unsigned char *m, unsigned long long *mlen, const unsigned char *c, size_t clen,
+                    const unsigned char *ad, size_t adlen, const unsigned char *npub, const unsigned char *k) {
+        return crypto_aead_aes256gcm_decrypt(m, mlen, NULL, c, clen, ad, adlen, npub, k);
+    }
+};
+
+// Fastest suite on this host (call after init_crypto()). AES-256-GCM blobs can only be opened
+// on hosts with AES-NI, so LIFECORE_SUITE=xchacha20poly1305 pins the portable suite.
+inline SuiteId best_suite() {
+    const char *pin = std::getenv("LIFECORE_SUITE");
+    if (pin && std::strcmp(pin, "xchacha20poly1305") == 0) return SUITE_XCHACHA20POLY1305;
+    return Aes256GcmSuite::available() ? SUITE_AES256GCM : SUITE_XCHACHA20POLY1305;
+}
+inline const char *suite_name(SuiteId suite) {
+    switch (suite) {
+    case SUITE_LEGACY: return "xchacha20poly1305 (untagged)";
+    case SUITE_XCHACHA20POLY1305: return "xchacha20poly1305";
+    case SUITE_AES256GCM: return "aes256gcm";
+    }
+    return "unknown";
+}
+
+// --- Size helpers for the boxed layouts ---
+inline size_t aead_boxed_len(size_t plaintext_len) { return plaintext_len + AEAD_OVERHEAD; }
+template <class Suite> inline size_t suite_boxed_len(size_t plaintext_len) {
+    return 1 + Suite::NONCE_LEN + plaintext_len + Suite::TAG_LEN;
+}
+inline size_t aead_boxed_len(SuiteId suite, size_t plaintext_len) {
+    switch (suite) {
+    case SUITE_XCHACHA20POLY1305: return suite_boxed_len<XChaCha20Poly1305Suite>(plaintext_len);
+    case SUITE_AES256GCM: return suite_boxed_len<Aes256GcmSuite>(plaintext_len);
+    default: return aead_boxed_len(plaintext_len);
+    }
+}
+// Smallest overhead of any layout, so aead_plain_len() is large enough for every suite;
+// decrypt_aead() returns the exact length.
+static const size_t AEAD_MIN_OVERHEAD = 1 + crypto_aead_aes256gcm_NPUBBYTES + crypto_aead_aes256gcm_ABYTES;
+inline size_t aead_plain_len(size_t boxed_len) { return boxed_len < AEAD_MIN_OVERHEAD ? 0 : boxed_len - AEAD_MIN_OVERHEAD; }
+
+// --- AEAD into caller-provided buffers (no allocation) ---
+// Writes nonce||ciphertext||tag into `out` and returns the number of bytes written.
+// In-place: the plaintext may already sit at out.data() + AEAD_NONCE_LEN.
+inline size_t encrypt_aead(MutableByteSpan out, ByteSpan plaintext, ByteSpan key, ByteSpan ad = ByteSpan()) {
     if (key.size() != MASTER_KEY_LEN) throw std::runtime_error("Invalid key size");
-    std::string nonce(crypto_aead_xchacha20poly1305_ietf_NPUBBYTES, '\0');
-    randombytes_buf(&nonce[0], nonce.size());
-    size_t max_ct_len = plaintext.size() + crypto_aead_xchacha20poly1305_ietf_ABYTES;
-    std::vector<unsigned char> ciphertext(max_ct_len);
+    if (out.size() < aead_boxed_len(plaintext.size())) throw std::runtime_error("Output buffer too small");
+    unsigned char *nonce = out.data();
+    randombytes_buf(nonce, AEAD_NONCE_LEN);
     unsigned long long clen = 0;
     crypto_aead_xchacha20poly1305_ietf_encrypt(
-        ciphertext.data(), &clen,
-        (const unsigned char*)plaintext.data(), plaintext.size(),
-        NULL, 0, NULL,
-        (const unsigned char*)nonce.data(),
-        (const unsigned char*)key.data()
-    );
-    std::string out = nonce;
-    out.append((char*)ciphertext.data(), (size_t)clen);
-    return out;
+        out.data() + AEAD_NONCE_LEN, &clen,
+        plaintext.data(), plaintext.size(),
+        ad.data(), ad.size(), NULL, nonce, key.data());
+    return AEAD_NONCE_LEN + (size_t)clen;
 }
-inline std::string decrypt_aead(const std::string &boxed, const std::string &key) {
+// Thrown when a tag does not verify (wrong key, damaged or forged data); every other failure
+// (bad sizes, a suite this CPU lacks) is a plain runtime_error.
+struct AeadAuthError : std::runtime_error {
+    AeadAuthError() : std::runtime_error("Decryption failed (auth)") {}
+};
+
+// Opens an untagged nonce||ciphertext||tag blob into `out` and returns the plaintext length.
+// In-place: `out` may start at boxed.data() + AEAD_NONCE_LEN.
+inline size_t decrypt_aead_legacy(MutableByteSpan out, ByteSpan boxed, ByteSpan key, ByteSpan ad = ByteSpan()) {
     if (key.size() != MASTER_KEY_LEN) throw std::runtime_error("Invalid key size");
-    if (boxed.size() < crypto_aead_xchacha20poly1305_ietf_NPUBBYTES + crypto_aead_xchacha20poly1305_ietf_ABYTES)
-        throw std::runtime_error("Ciphertext too short");
-    const unsigned char* nonce = (const unsigned char*)boxed.data();
-    const unsigned char* cdata = (const unsigned char*)(boxed.data() + crypto_aead_xchacha20poly1305_ietf_NPUBBYTES);
-    size_t csize = boxed.size() - crypto_aead_xchacha20poly1305_ietf_NPUBBYTES;
-    std::vector<unsigned char> decrypted(csize);
+    if (boxed.size() < AEAD_OVERHEAD) throw std::runtime_error("Ciphertext too short");
+    if (out.size() < boxed.size() - AEAD_OVERHEAD) throw std::runtime_error("Output buffer too small");
     unsigned long long dlen = 0;
     if (crypto_aead_xchacha20poly1305_ietf_decrypt(
-            decrypted.data(), &dlen, NULL,
-            cdata, csize, NULL, 0,
-            nonce, (const unsigned char*)key.data()) != 0) {
-        throw std::runtime_error("Decryption failed (auth)");
+            out.data(), &dlen, NULL,
+            boxed.data() + AEAD_NONCE_LEN, boxed.size() - AEAD_NONCE_LEN,
+            ad.data(), ad.size(), boxed.data(), key.data()) != 0) {
+        throw AeadAuthError();
+    }
+    return (size_t)dlen;
+}
+
+// The associated data of a tagged blob: its id byte, then `ad`. Copies only when `ad` is given.
+class SuiteAd {
+public:
+    SuiteAd(const unsigned char *id, ByteSpan ad) : p(id), n(1) {
+        if (ad.empty()) return;
+        buf.reserve(1 + ad.size());
+        buf.push_back(*id);
+        buf.insert(buf.end(), ad.data(), ad.data() + ad.size());
+        p = buf.data();
+        n = buf.size();
     }
-    return std::string((char*)decrypted.data(), (size_t)dlen);
+    const unsigned char *data() const { return p; }
+    size_t size() const { return n; }
+
+private:
+    std::vector<unsigned char> buf;
+    const unsigned char *p;
+    size_t n;
+};
+
+// Writes suite_id||nonce||ciphertext||tag into `out` and returns the number of bytes written.
+// In-place: the plaintext may already sit at out.data() + 1 + Suite::NONCE_LEN.
+template <class Suite>
+inline size_t seal_suite(MutableByteSpan out, ByteSpan plaintext, ByteSpan key, ByteSpan ad = ByteSpan()) {
+    if (!Suite::available()) throw std::runtime_error("Cipher suite not available on this CPU");
+    if (key.size() != MASTER_KEY_LEN) throw std::runtime_error("Invalid key size");
+    if (out.size() < suite_boxed_len<Suite>(plaintext.size())) throw std::runtime_error("Output buffer too small");
+    unsigned char *nonce = out.data() + 1;
+    out.data()[0] = Suite::ID;
+    randombytes_buf(nonce, Suite::NONCE_LEN);
+    unsigned long long clen = 0;
+    SuiteAd bound(out.data(), ad);
+    Suite::seal(nonce + Suite::NONCE_LEN, &clen, plaintext.data(), plaintext.size(), bound.data(), bound.size(), nonce, key.data());
+    return 1 + Suite::NONCE_LEN + (size_t)clen;
+}
+// Opens a blob tagged with Suite::ID. In-place: `out` may start at boxed.data() + 1 + NONCE_LEN.
+template <class Suite>
+inline size_t open_suite(MutableByteSpan out, ByteSpan boxed, ByteSpan key, ByteSpan ad = ByteSpan()) {
+    if (key.size() != MASTER_KEY_LEN) throw std::runtime_error("Invalid key size");
+    if (boxed.size() < suite_boxed_len<Suite>(0)) throw std::runtime_error("Ciphertext too short");
+    if (boxed.data()[0] != Suite::ID) throw std::runtime_error("Cipher suite mismatch");
+    if (!Suite::available()) throw std::runtime_error("Cipher suite not available on this CPU");
+    if (out.size() < boxed.size() - suite_boxed_len<Suite>(0)) throw std::runtime_error("Output buffer too small");
+    unsigned long long dlen = 0;
+    SuiteAd bound(boxed.data(), ad);
+    if (Suite::open(out.data(), &dlen, boxed.data() + 1 + Suite::NONCE_LEN, boxed.size() - 1 - Suite::NONCE_LEN,
+                    bound.data(), bound.size(), boxed.data() + 1, key.data()) != 0) {
+        throw AeadAuthError();
+    }
+    return (size_t)dlen;
+}
+
+// Seals with the given suite; SUITE_LEGACY writes the untagged XChaCha20-Poly1305 layout.
+inline size_t encrypt_aead(MutableByteSpan out, ByteSpan plaintext, ByteSpan key, SuiteId suite, ByteSpan ad = ByteSpan()) {
+    switch (suite) {
+    case SUITE_LEGACY: return encrypt_aead(out, plaintext, key, ad);
+    case SUITE_XCHACHA20POLY1305: return seal_suite<XChaCha20Poly1305Suite>(out, plaintext, key, ad);
+    case SUITE_AES256GCM: return seal_suite<Aes256GcmSuite>(out, plaintext, key, ad);
+    }
+    throw std::runtime_error("Unknown cipher suite");
+}
+
+// Offset of the ciphertext inside a tagged blob, or 0 if the first byte is not a suite id.
+inline size_t suite_body_offset(ByteSpan boxed) {
+    if (boxed.size() == 0) return 0;
+    switch (boxed.data()[0]) {
+    case SUITE_XCHACHA20POLY1305: return 1 + XChaCha20Poly1305Suite::NONCE_LEN;
+    case SUITE_AES256GCM: return 1 + Aes256GcmSuite::NONCE_LEN;
+    }
+    return 0;
+}
+
+// Opens any blob (tagged with either suite, or untagged) into `out` and returns the plaintext
+// length. An untagged blob whose random nonce happens to start with a suite id fails the tagged
+// attempt's authentication first and is then opened as legacy, so mixed-suite files need no
+// per-record flag. Other failures are not masked: an AES-GCM blob on a CPU without AES-NI says so.
+inline size_t decrypt_aead(MutableByteSpan out, ByteSpan boxed, ByteSpan key, ByteSpan ad = ByteSpan()) {
+    if (suite_body_offset(boxed)) {
+        if (boxed.data()[0] == SUITE_AES256GCM && !Aes256GcmSuite::available()) {
+            // only the legacy layout can be tried here
+            try { return decrypt_aead_legacy(out, boxed, key, ad); }
+            catch (const AeadAuthError &) { throw std::runtime_error("Cipher suite not available on this CPU"); }
+        }
+        try {
+            if (boxed.data()[0] == SUITE_AES256GCM) return open_suite<Aes256GcmSuite>(out, boxed, key, ad);
+            return open_suite<XChaCha20Poly1305Suite>(out, boxed, key, ad);
+        } catch (const AeadAuthError &) {
+            // not (validly) tagged: fall through to the legacy layout
+        }
+    }
+    return decrypt_aead_legacy(out, boxed, key, ad);
+}
+
+// Opens a boxed buffer in place and returns a view of the plaintext inside it.
+// libsodium wipes the output on authentication failure, so a failed attempt
+// destroys the buffer: use the copying overload when trying several keys.
+inline ByteSpan decrypt_aead_inplace(MutableByteSpan boxed, ByteSpan key) {
+    const size_t off = suite_body_offset(ByteSpan(boxed));
+    // an AES-GCM tag this CPU cannot open leaves only the legacy layout to try
+    const bool unavailable = off && boxed.data()[0] == SUITE_AES256GCM && !Aes256GcmSuite::available();
+    if (off && !unavailable) {
+        // keep a copy: if this is really an untagged blob, the failed tagged attempt wipes it
+        SecureBuffer backup(boxed.data(), boxed.data() + boxed.size());
+        try {
+            MutableByteSpan body = boxed.subspan(off);
+            size_t n = boxed.data()[0] == SUITE_AES256GCM ? open_suite<Aes256GcmSuite>(body, ByteSpan(backup), key)
+                                                          : open_suite<XChaCha20Poly1305Suite>(body, ByteSpan(backup), key);
+            return ByteSpan(body.data(), n);
+        } catch (const AeadAuthError &) {
+            std::memcpy(boxed.data(), backup.data(), backup.size());
+        }
+    }
+    if (boxed.size() < AEAD_OVERHEAD) throw std::runtime_error("Ciphertext too short");
+    MutableByteSpan body = boxed.subspan(AEAD_NONCE_LEN);
+    try {
+        size_t n = decrypt_aead_legacy(body, ByteSpan(boxed), key);
+        return ByteSpan(body.data(), n);
+    } catch (const AeadAuthError &) {
+        if (unavailable) throw std::runtime_error("Cipher suite not available on this CPU");
+        throw;
+    }
+}
+
+// --- Detached-tag AEAD, always in place over `buf` ---
+inline void encrypt_aead_detached(MutableByteSpan buf, unsigned char nonce[AEAD_NONCE_LEN],
+                                  unsigned char tag[AEAD_TAG_LEN], ByteSpan key) {
+    if (key.size() != MASTER_KEY_LEN) throw std::runtime_error("Invalid key size");
+    randombytes_buf(nonce, AEAD_NONCE_LEN);
+    crypto_aead_xchacha20poly1305_ietf_encrypt_detached(
+        buf.data(), tag, NULL, buf.data(), buf.size(),
+        NULL, 0, NULL, nonce, key.data());
+}
+inline void decrypt_aead_detached(MutableByteSpan buf, const unsigned char nonce[AEAD_NONCE_LEN],
+                                  const unsigned char tag[AEAD_TAG_LEN], ByteSpan key) {
+    if (key.size() != MASTER_KEY_LEN) throw std::runtime_error("Invalid key size");
+    if (crypto_aead_xchacha20poly1305_ietf_decrypt_detached(
+            buf.data(), NULL, buf.data(), buf.size(), tag,
+            NULL, 0, nonce, key.data()) != 0) {
+        throw AeadAuthError();
+    }
+}
+
+// --- AEAD encrypt/decrypt: returns nonce||ciphertext or decrypts same ---
+inline std::string encrypt_aead(const std::string &plaintext, ByteSpan key) {
+    std::string out(aead_boxed_len(plaintext.size()), '\0');
+    out.resize(encrypt_aead(MutableByteSpan(out), ByteSpan(plaintext), key));
+    return out;
+}
+inline std::string decrypt_aead(const std::string &boxed, ByteSpan key) {
+    std::string out(aead_plain_len(boxed.size()), '\0');
+    out.resize(decrypt_aead(MutableByteSpan(out), ByteSpan(boxed), key));
+    return out;
+}
+// Same, but the plaintext (an unwrapped key, a message) lands in pooled secure memory.
+inline SecureString decrypt_aead_secure(ByteSpan boxed, ByteSpan key) {
+    SecureString out(aead_plain_len(boxed.size()), '\0');
+    out.resize(decrypt_aead(MutableByteSpan(out), boxed, key));
+    return out;
 }
 
 #endif // ENCRYPTION_H
@@ -0,0 +1,451 @@
+// Journal.h
+// Write-ahead journal for the pending queue (modules/emergency_messenger/journal/). Every
+// enqueue, dequeue and ack is appended as a checksummed record to the current segment
+// (wal-<n>.log); a committer thread writes and fsyncs whatever has accumulated in one go, so
+// concurrent enqueues share an fsync (group commit) and each costs O(record), not O(queue).
+// On open the snapshot and then the segments are replayed; a torn or corrupt tail ends a segment.
+// Once enough has been appended since the last snapshot, the live set is written to a new
+// snapshot and the segments it covers are deleted, which keeps replay time bounded.
+// Only the location of each live ENQUEUE record is kept in memory, not the message itself;
+// compaction copies the records from the old files, and recovered() reads them back.
+//
+// Record: len u32 | type u8 | payload | BLAKE2b-128 over len..payload (integers little-endian)
+//   ENQUEUE: id u64, priority u8, text_len u32, text, attachment_len u32, attachment
+//   DEQUEUE / ACK: id u64
+//   META (snapshot only, first record): next_id u64, base u64 = first segment not folded in
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <sodium.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#if defined(_WIN32)
+  #include <io.h>
+#else
+  #include <unistd.h>
+#endif
+
+static const char JOURNAL_MAGIC[4] = {'L', 'C', 'W', 'J'};
+static const uint8_t JOURNAL_VERSION = 1;
+static const size_t JOURNAL_FILE_HEADER_LEN = 8; // magic(4) version(1) reserved(3)
+static const size_t JOURNAL_CHECKSUM_LEN = 16;
+static const uint32_t JOURNAL_MAX_RECORD = 64u << 20;
+
+enum JournalRecordType : uint8_t { JR_ENQUEUE = 1, JR_DEQUEUE = 2, JR_ACK = 3, JR_META = 4 };
+
+struct JournalEntry {
+    uint64_t id = 0;
+    int priority = 2;
+    std::string text;       // message ciphertext
+    std::string attachment;
+};
+
+class QueueJournal {
+public:
+    // Replays the journal in `dir` (created if missing); throws std::runtime_error on I/O failure.
+    explicit QueueJournal(const std::string &dir, size_t segmentBytes = 4u << 20, size_t compactBytes = 16u << 20)
+        : dir(dir), segmentBytes(segmentBytes), compactBytes(compactBytes) {
+        std::filesystem::create_directories(dir);
+        replay();
+        open_segment(lastSegment + 1);
+        // every start opens a fresh segment; fold them up before they pile up
+        if (replayedSegments >= 4) compact(currentSegment);
+        committer = std::thread(&QueueJournal::commit_loop, this);
+    }
+    QueueJournal(const QueueJournal &) = delete;
+    QueueJournal &operator=(const QueueJournal &) = delete;
+
+    // Commits everything appended so far, then stops.
+    ~QueueJournal() {
+        {
+            std::lock_guard<std::mutex> lock(mu);
+            stopping = true;
+        }
+        work.notify_all();
+        committer.join();
+        if (fd >= 0) ::close(fd);
+    }
+
+    // Messages enqueued and not yet acked, in enqueue order, read back from the journal files.
+    std::vector<JournalEntry> recovered() const {
+        std::lock_guard<std::mutex> lock(mu);
+        std::vector<JournalEntry> out;
+        RecordReader reader(*this);
+        std::string rec;
+        for (const auto &kv : live) {
+            if (kv.second.file == PENDING_FILE) continue;
+            JournalEntry e;
+            reader.read(kv.second, rec);
+            if (parse_enqueue((const unsigned char*)rec.data() + 4, (uint32_t)(rec.size() - 4 - JOURNAL_CHECKSUM_LEN), e))
+                out.push_back(std::move(e));
+        }
+        return out;
+    }
+
+    // Returns the message id once the record is on disk.
+    uint64_t enqueue(int priority, const std::string &text, const std::string &attachment) {
+        std::unique_lock<std::mutex> lock(mu);
+        if (failed) throw std::runtime_error("journal write failed");
+        uint64_t id = nextId++, pos = pending.size();
+        append_entry(pending, id, priority, text, attachment);
+        live[id] = LiveRef{PENDING_FILE, pos, (uint32_t)(pending.size() - pos)};
+        pendingIds.push_back(id);
+        uint64_t lsn = ++appendedLsn;
+        work.notify_one();
+        durable.wait(lock, [&] { return durableLsn >= lsn || failed; });
+        if (failed) throw std::runtime_error("journal write failed");
+        return id;
+    }
+
+    // Dequeue and ack are not waited on: losing one only means a resend after a crash.
+    void dequeue(uint64_t id) { append_id(JR_DEQUEUE, id); }
+    void ack(uint64_t id) { append_id(JR_ACK, id); }
+
+    size_t liveCount() const {
+        std::lock_guard<std::mutex> lock(mu);
+        return live.size();
+    }
+
+private:
+    // Where a live ENQUEUE record is: a segment number, SNAPSHOT_FILE, or PENDING_FILE (not yet
+    // written; offset is into `pending`). offset/size cover the whole framed record.
+    static const uint64_t SNAPSHOT_FILE = UINT64_MAX, PENDING_FILE = UINT64_MAX - 1;
+    struct LiveRef {
+        uint64_t file;
+        uint64_t offset;
+        uint32_t size;
+    };
+
+    // Reads framed records back out of snapshot/segment files, keeping each file open.
+    class RecordReader {
+    public:
+        explicit RecordReader(const QueueJournal &j) : j(j) {}
+        void read(const LiveRef &ref, std::string &out) {
+            std::ifstream &in = files[ref.file];
+            if (!in.is_open()) in.open(ref.file == SNAPSHOT_FILE ? j.snapshot_path() : j.segment_path(ref.file), std::ios::binary);
+            out.resize(ref.size);
+            in.clear();
+            in.seekg((std::streamoff)ref.offset);
+            if (!in.read(&out[0], ref.size)) throw std::runtime_error("journal record unreadable");
+        }
+    private:
+        const QueueJournal &j;
+        std::map<uint64_t, std::ifstream> files;
+    };
+
+    static void put_u32(std::string &b, uint32_t v) { for (int i = 0; i < 4; ++i) b.push_back((char)(v >> (8 * i))); }
+    static void put_u64(std::string &b, uint64_t v) { for (int i = 0; i < 8; ++i) b.push_back((char)(v >> (8 * i))); }
+    static uint32_t get_u32(const unsigned char *p) { return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24; }
+    static uint64_t get_u64(const unsigned char *p) { return (uint64_t)get_u32(p) | (uint64_t)get_u32(p + 4) << 32; }
+
+    // Frames the record started at `start` (len placeholder + type + payload already in `b`).
+    static void seal_record(std::string &b, size_t start) {
+        uint32_t len = (uint32_t)(b.size() - start - 4);
+        for (int i = 0; i < 4; ++i) b[start + i] = (char)(len >> (8 * i));
+        unsigned char sum[JOURNAL_CHECKSUM_LEN];
+        crypto_generichash(sum, sizeof(sum), (const unsigned char*)b.data() + start, b.size() - start, NULL, 0);
+        b.append((const char*)sum, sizeof(sum));
+    }
+    static void append_entry(std::string &b, uint64_t id, int priority, const std::string &text, const std::string &attachment) {
+        size_t start = b.size();
+        put_u32(b, 0);
+        b.push_back((char)JR_ENQUEUE);
+        put_u64(b, id);
+        b.push_back((char)priority);
+        put_u32(b, (uint32_t)text.size());
+        b += text;
+        put_u32(b, (uint32_t)attachment.size());
+        b += attachment;
+        seal_record(b, start);
+    }
+    // r points at the type byte; len covers type + payload.
+    static bool parse_enqueue(const unsigned char *r, uint32_t len, JournalEntry &e) {
+        const unsigned char *q = r + 1, *end = r + len;
+        if (r[0] != JR_ENQUEUE || end - q < 8 + 1 + 4) return false;
+        e.id = get_u64(q); q += 8;
+        e.priority = *q++;
+        uint32_t tl = get_u32(q); q += 4;
+        if ((size_t)(end - q) < (size_t)tl + 4) return false;
+        e.text.assign((const char*)q, tl); q += tl;
+        uint32_t al = get_u32(q); q += 4;
+        if ((size_t)(end - q) != al) return false;
+        e.attachment.assign((const char*)q, al);
+        return true;
+    }
+    static void append_id_record(std::string &b, JournalRecordType type, uint64_t id) {
+        size_t start = b.size();
+        put_u32(b, 0);
+        b.push_back((char)type);
+        put_u64(b, id);
+        seal_record(b, start);
+    }
+    static void append_meta(std::string &b, uint64_t next, uint64_t base) {
+        size_t start = b.size();
+        put_u32(b, 0);
+        b.push_back((char)JR_META);
+        put_u64(b, next);
+        put_u64(b, base);
+        seal_record(b, start);
+    }
+    void append_id(JournalRecordType type, uint64_t id) {
+        std::lock_guard<std::mutex> lock(mu);
+        append_id_record(pending, type, id);
+        ++appendedLsn;
+        if (type == JR_ACK) live.erase(id);
+        work.notify_one();
+    }
+
+    std::string segment_path(uint64_t n) const { return dir + "/wal-" + std::to_string(n) + ".log"; }
+    std::string snapshot_path() const { return dir + "/snapshot.log"; }
+
+    static std::string file_header() {
+        std::string h(JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC));
+        h.push_back((char)JOURNAL_VERSION);
+        h.append(3, '\0');
+        return h;
+    }
+
+    // Applies the records in one file, up to a torn or corrupt tail.
+    void replay_file(const std::string &path, uint64_t file) {
+        std::ifstream in(path, std::ios::binary);
+        if (!in.is_open()) return;
+        std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        if (data.size() < JOURNAL_FILE_HEADER_LEN || data.compare(0, JOURNAL_FILE_HEADER_LEN, file_header()) != 0) {
+            std::cerr << "Warning: ignoring journal file with a bad header: " << path << "\n";
+            return;
+        }
+        const unsigned char *p = (const unsigned char*)data.data();
+        size_t off = JOURNAL_FILE_HEADER_LEN, end = data.size();
+        while (off + 4 <= end) {
+            uint32_t len = get_u32(p + off);
+            if (len < 1 || len > JOURNAL_MAX_RECORD || off + 4 + len + JOURNAL_CHECKSUM_LEN > end) break;
+            unsigned char sum[JOURNAL_CHECKSUM_LEN];
+            crypto_generichash(sum, sizeof(sum), p + off, 4 + len, NULL, 0);
+            if (sodium_memcmp(sum, p + off + 4 + len, sizeof(sum)) != 0) break;
+            if (!apply(p + off + 4, len, LiveRef{file, off, (uint32_t)(4 + len + JOURNAL_CHECKSUM_LEN)})) break;
+            off += 4 + len + JOURNAL_CHECKSUM_LEN;
+        }
+        if (off != end) std::cerr << "Warning: journal " << path << " ends in a torn or corrupt record; ignored the last "
+                                  << (end - off) << " bytes\n";
+    }
+
+    bool apply(const unsigned char *r, uint32_t len, const LiveRef &at) {
+        uint8_t type = r[0];
+        const unsigned char *q = r + 1, *end = r + len;
+        if (type == JR_ENQUEUE) {
+            JournalEntry e;
+            if (!parse_enqueue(r, len, e)) return false;
+            nextId = std::max(nextId, e.id + 1);
+            live[e.id] = at;
+            return true;
+        }
+        if (type == JR_META) {
+            if (at.file != SNAPSHOT_FILE || end - q != 16) return false;
+            nextId = std::max(nextId, get_u64(q));
+            snapshotBase = get_u64(q + 8);
+            return true;
+        }
+        if ((type != JR_ACK && type != JR_DEQUEUE) || end - q != 8) return false;
+        uint64_t id = get_u64(q);
+        if (type == JR_ACK) live.erase(id);
+        nextId = std::max(nextId, id + 1);
+        return true;
+    }
+
+    // snapshot.log first, then wal-<n>.log in order from the snapshot's base. Segments below the
+    // base are left over from a compaction that stopped before deleting them.
+    void replay() {
+        std::map<uint64_t, std::string> segments;
+        for (const auto &de : std::filesystem::directory_iterator(dir)) {
+            std::string name = de.path().filename().string();
+            if (name.size() > 8 && name.compare(0, 4, "wal-") == 0 && name.compare(name.size() - 4, 4, ".log") == 0) {
+                try { segments[std::stoull(name.substr(4, name.size() - 8))] = de.path().string(); } catch (...) {}
+            }
+        }
+        replay_file(snapshot_path(), SNAPSHOT_FILE);
+        for (const auto &kv : segments) {
+            if (kv.first < snapshotBase) { std::filesystem::remove(kv.second); continue; }
+            replay_file(kv.second, kv.first);
+            lastSegment = kv.first;
+            ++replayedSegments;
+        }
+        if (snapshotBase > lastSegment + 1) lastSegment = snapshotBase - 1;
+    }
+
+    void open_segment(uint64_t n) {
+        if (fd >= 0) ::close(fd);
+        std::string path = segment_path(n);
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0600);
+        if (fd < 0) throw std::runtime_error("cannot create journal segment " + path);
+        currentSegment = n;
+        segmentLen = 0;
+        std::string h = file_header();
+        write_all(h);
+        sync_fd(fd);
+        sync_dir();
+    }
+
+    void write_all(const std::string &b) {
+        size_t off = 0;
+        while (off < b.size()) {
+            ssize_t w = ::write(fd, b.data() + off, b.size() - off);
+            if (w < 0) throw std::runtime_error("journal write failed");
+            off += (size_t)w;
+        }
+        segmentLen += b.size();
+    }
+
+    static void sync_fd(int f) {
+#if defined(_WIN32)
+        _commit(f);
+#elif defined(__APPLE__)
+        fsync(f);
+#else
+        fdatasync(f);
+#endif
+    }
+    void sync_dir() const {
+#if !defined(_WIN32)
+        int d = ::open(dir.c_str(), O_RDONLY);
+        if (d >= 0) { fsync(d); ::close(d); }
+#endif
+    }
+
+    // Copies the live records (all in files before `base`, or the old snapshot) into a new
+    // snapshot.log via a temp file and rename, repoints them, then drops the segments before
+    // `base`, all of whose effects the snapshot now holds. Runs on the committer thread (or in
+    // the constructor), the only writer of file locations.
+    void compact(uint64_t base) {
+        std::map<uint64_t, LiveRef> liveCopy;
+        uint64_t next;
+        {
+            std::lock_guard<std::mutex> lock(mu);
+            for (const auto &kv : live)
+                if (kv.second.file != PENDING_FILE) liveCopy.insert(kv); // pending ones land in `base` or later
+            next = nextId;
+        }
+        std::string b = file_header();
+        append_meta(b, next, base);
+        std::string tmp = snapshot_path() + ".tmp";
+        int t = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+        if (t < 0) throw std::runtime_error("cannot create journal snapshot");
+        auto flush = [&] {
+            size_t off = 0;
+            while (off < b.size()) {
+                ssize_t w = ::write(t, b.data() + off, b.size() - off);
+                if (w < 0) { ::close(t); throw std::runtime_error("journal snapshot write failed"); }
+                off += (size_t)w;
+            }
+            b.clear();
+        };
+        {
+            RecordReader reader(*this);
+            std::string rec;
+            uint64_t written = 0;
+            for (auto &kv : liveCopy) {
+                reader.read(kv.second, rec);
+                uint64_t at = written + b.size();
+                b += rec;
+                kv.second = LiveRef{SNAPSHOT_FILE, at, (uint32_t)rec.size()};
+                if (b.size() >= (1u << 20)) { written += b.size(); flush(); }
+            }
+            flush();
+        }
+        sync_fd(t);
+        ::close(t);
+        std::filesystem::rename(tmp, snapshot_path());
+        sync_dir();
+        {
+            std::lock_guard<std::mutex> lock(mu);
+            for (const auto &kv : liveCopy) {
+                auto it = live.find(kv.first);
+                if (it != live.end()) it->second = kv.second; // acked meanwhile: already gone
+            }
+        }
+        for (const auto &de : std::filesystem::directory_iterator(dir)) {
+            std::string name = de.path().filename().string();
+            if (name.size() > 8 && name.compare(0, 4, "wal-") == 0) {
+                try { if (std::stoull(name.substr(4, name.size() - 8)) < base) std::filesystem::remove(de.path()); } catch (...) {}
+            }
+        }
+    }
+
+    void commit_loop() {
+        std::unique_lock<std::mutex> lock(mu);
+        for (;;) {
+            work.wait(lock, [&] { return stopping || !pending.empty(); });
+            if (pending.empty() && stopping) return;
+            std::string batch;
+            std::vector<uint64_t> ids;
+            batch.swap(pending);
+            ids.swap(pendingIds);
+            uint64_t lsn = appendedLsn;
+            bool roll = segmentLen + batch.size() > segmentBytes && segmentLen > JOURNAL_FILE_HEADER_LEN;
+            bool doCompact = sinceSnapshot + batch.size() > compactBytes;
+            lock.unlock();
+            // writers keep appending to `pending` while this batch is written and synced
+            bool ok = true;
+            try {
+                uint64_t seg = currentSegment, at = segmentLen;
+                write_all(batch);
+                sync_fd(fd);
+                lock.lock();
+                for (uint64_t id : ids) {
+                    auto it = live.find(id);
+                    if (it != live.end() && it->second.file == PENDING_FILE) it->second = LiveRef{seg, at + it->second.offset, it->second.size};
+                }
+                lock.unlock();
+                if (doCompact) {
+                    open_segment(currentSegment + 1);
+                    compact(currentSegment);
+                } else if (roll) {
+                    open_segment(currentSegment + 1);
+                }
+            } catch (const std::exception &e) {
+                std::cerr << "Journal error: " << e.what() << "\n";
+                ok = false;
+            }
+            if (!lock.owns_lock()) lock.lock();
+            if (!ok) failed = true;
+            sinceSnapshot = doCompact ? 0 : sinceSnapshot + batch.size();
+            durableLsn = lsn;
+            durable.notify_all();
+        }
+    }
+
+    std::string dir;
+    size_t segmentBytes, compactBytes;
+
+    mutable std::mutex mu;
+    std::condition_variable work, durable;
+    std::map<uint64_t, LiveRef> live;
+    std::string pending;              // records appended but not yet written
+    std::vector<uint64_t> pendingIds; // ids enqueued into `pending`
+    uint64_t nextId = 1;
+    uint64_t appendedLsn = 0, durableLsn = 0;
+    bool stopping = false, failed = false;
+
+    // owned by the committer thread after construction
+    int fd = -1;
+    uint64_t snapshotBase = 0, lastSegment = 0, currentSegment = 0;
+    size_t replayedSegments = 0;
+    size_t segmentLen = 0, sinceSnapshot = 0;
+    std::thread committer;
+};
+
+#endif // JOURNAL_H
@@ -0,0 +1,250 @@
+// KeyAgent.h
+// Wire protocol, request handling and client for key_agent, the local daemon that derives the
+// master key once and serves wrap/unwrap/encrypt/decrypt requests over a permission-checked
+// Unix socket.
+#ifndef KEYAGENT_H
+#define KEYAGENT_H
+
+#include "Encryption.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Clients use the agent only when this variable names its socket (key_agent prints it on start).
+static const char *AGENT_SOCK_ENV = "LIFECORE_AGENT_SOCK";
+static const uint32_t AGENT_MAX_PAYLOAD = 16u * 1024u * 1024u;
+static const int AGENT_READ_TIMEOUT_MS = 5000; // a request must arrive whole within this
+
+// Request:  u8 op | u8 key | u32 length (LE) | payload
+// Response: u8 status | u32 length (LE) | payload (error text when status != AGENT_OK)
+// AGENT_DECRYPT_AD payload: u32 ad length (LE) | associated data | boxed
+enum AgentOp : uint8_t {
+    AGENT_PING = 1,
+    AGENT_ENCRYPT = 2, // seal payload under the selected key
+    AGENT_DECRYPT = 3, // open payload under the selected key
+    AGENT_WRAP = 4,    // seal key material under the master key
+    AGENT_UNWRAP = 5,  // open key material wrapped under the master key
+    AGENT_EXPORT = 6,  // return the selected key itself (only if the agent runs with --allow-export)
+    AGENT_LOCK = 7,    // wipe keys and shut the agent down
+    AGENT_DECRYPT_AD = 8 // AGENT_DECRYPT for a blob sealed with associated data
+};
+enum AgentKey : uint8_t { AGENT_KEY_MASTER = 0, AGENT_KEY_LOG = 1 };
+enum AgentStatus : uint8_t { AGENT_OK = 0, AGENT_ERR = 1 };
+
+// Default socket: $XDG_RUNTIME_DIR/lifecore/agent.sock, else /tmp/lifecore-<uid>/agent.sock.
+inline std::string agent_default_socket_path() {
+    const char *rt = std::getenv("XDG_RUNTIME_DIR");
+    std::string dir = (rt && *rt) ? std::string(rt) + "/lifecore" : "/tmp/lifecore-" + std::to_string(getuid());
+    return dir + "/agent.sock";
+}
+
+// The socket directory must be a real directory, ours, and closed to everyone else: otherwise
+// another local user could swap the socket for their own (clients would hand them plaintext and
+// take their keys) or bind it before the agent does.
+inline void agent_check_socket_dir(const std::string &dir) {
+    struct stat st;
+    if (::lstat(dir.c_str(), &st) != 0) throw std::runtime_error("agent: cannot stat " + dir);
+    if (!S_ISDIR(st.st_mode)) throw std::runtime_error("agent: " + dir + " is not a directory");
+    if (st.st_uid != geteuid()) throw std::runtime_error("agent: " + dir + " is owned by another user");
+    if (st.st_mode & 077) throw std::runtime_error("agent: " + dir + " is accessible to other users");
+}
+
+inline bool agent_write_all(int fd, const void *buf, size_t len) {
+    const unsigned char *p = (const unsigned char*)buf;
+    while (len) {
+        ssize_t w = ::send(fd, p, len, MSG_NOSIGNAL);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) return false;
+        p += w; len -= (size_t)w;
+    }
+    return true;
+}
+inline bool agent_read_all(int fd, void *buf, size_t len) {
+    unsigned char *p = (unsigned char*)buf;
+    while (len) {
+        ssize_t r = ::recv(fd, p, len, 0);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return false;
+        p += r; len -= (size_t)r;
+    }
+    return true;
+}
+inline void agent_put_u32(unsigned char *p, uint32_t v) {
+    p[0] = (unsigned char)v; p[1] = (unsigned char)(v >> 8); p[2] = (unsigned char)(v >> 16); p[3] = (unsigned char)(v >> 24);
+}
+inline uint32_t agent_get_u32(const unsigned char *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+class KeyAgentClient {
+public:
+    // True when LIFECORE_AGENT_SOCK is set, i.e. the tools should run in client mode.
+    static bool configured() {
+        const char *p = std::getenv(AGENT_SOCK_ENV);
+        return p && *p;
+    }
+
+    // Socket named by LIFECORE_AGENT_SOCK, falling back to the default location.
+    static std::string socketPath() {
+        return configured() ? std::string(std::getenv(AGENT_SOCK_ENV)) : agent_default_socket_path();
+    }
+
+    explicit KeyAgentClient(const std::string &path = socketPath()) {
+        fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) throw std::runtime_error("agent: socket() failed");
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(addr.sun_path)) { ::close(fd); throw std::runtime_error("agent: socket path too long"); }
+        size_t slash = path.find_last_of('/');
+        if (slash != std::string::npos) {
+            try { agent_check_socket_dir(slash ? path.substr(0, slash) : "/"); }
+            catch (...) { ::close(fd); throw; }
+        }
+        std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+        if (::connect(fd, (sockaddr*)&addr, sizeof(addr)) != 0) {
+            ::close(fd);
+            throw std::runtime_error("agent: cannot connect to " + path);
+        }
+        timeval tv{30, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    }
+    ~KeyAgentClient() { if (fd >= 0) ::close(fd); }
+    KeyAgentClient(const KeyAgentClient &) = delete;
+    KeyAgentClient &operator=(const KeyAgentClient &) = delete;
+
+    void ping() { call(AGENT_PING, AGENT_KEY_MASTER, ByteSpan()); }
+    std::string encrypt(AgentKey key, ByteSpan plaintext) { return public_copy(call(AGENT_ENCRYPT, key, plaintext)); }
+    SecureString decrypt(AgentKey key, ByteSpan boxed, ByteSpan ad = ByteSpan()) {
+        if (ad.empty()) return call(AGENT_DECRYPT, key, boxed);
+        std::string payload(4, '\0');
+        agent_put_u32((unsigned char*)&payload[0], (uint32_t)ad.size());
+        payload.append((const char*)ad.data(), ad.size()).append((const char*)boxed.data(), boxed.size());
+        return call(AGENT_DECRYPT_AD, key, ByteSpan(payload));
+    }
+    std::string wrap(ByteSpan secret) { return public_copy(call(AGENT_WRAP, AGENT_KEY_MASTER, secret)); }
+    SecureString unwrap(ByteSpan wrapped) { return call(AGENT_UNWRAP, AGENT_KEY_MASTER, wrapped); }
+    SecureString exportKey(AgentKey key) { return call(AGENT_EXPORT, key, ByteSpan()); }
+    void lock() { call(AGENT_LOCK, AGENT_KEY_MASTER, ByteSpan()); }
+
+private:
+    static std::string public_copy(const SecureString &s) { return std::string(s.data(), s.size()); }
+
+    // Responses may carry keys or plaintext, so they are read straight into secure memory.
+    SecureString call(AgentOp op, AgentKey key, ByteSpan payload) {
+        if (payload.size() > AGENT_MAX_PAYLOAD) throw std::runtime_error("agent: payload too large");
+        unsigned char hdr[6] = {op, key};
+        agent_put_u32(hdr + 2, (uint32_t)payload.size());
+        if (!agent_write_all(fd, hdr, sizeof(hdr)) || !agent_write_all(fd, payload.data(), payload.size()))
+            throw std::runtime_error("agent: write failed");
+        unsigned char rhdr[5];
+        if (!agent_read_all(fd, rhdr, sizeof(rhdr))) throw std::runtime_error("agent: no response");
+        uint32_t len = agent_get_u32(rhdr + 1);
+        if (len > AGENT_MAX_PAYLOAD) throw std::runtime_error("agent: response too large");
+        SecureString body(len, '\0');
+        if (len && !agent_read_all(fd, &body[0], len)) throw std::runtime_error("agent: truncated response");
+        if (rhdr[0] != AGENT_OK) throw std::runtime_error("agent: " + public_copy(body));
+        return body;
+    }
+
+    int fd = -1;
+};
+
+// Client-mode key loading shared by the tools: fetches masterKey and (when the agent holds one)
+// logKey. Returns false if the agent is not configured; throws if it is configured but fails,
+// including when it was started without --allow-export (the tools then ask for the passphrase).
+inline bool agent_load_keys(SecureString &masterKey, SecureString &logKey) {
+    if (!KeyAgentClient::configured()) return false;
+    KeyAgentClient agent;
+    masterKey = agent.exportKey(AGENT_KEY_MASTER);
+    try { logKey = agent.exportKey(AGENT_KEY_LOG); } catch (const std::exception &) { logKey.clear(); }
+    return true;
+}
+
+// Server side, shared by key_agent and the tests.
+
+// Carries out one request with `key` (the one the request selected) and `master`, into `out`;
+// throws with the text the client gets back. Only AGENT_EXPORT lets a key leave the agent.
+inline void agent_apply(AgentOp op, ByteSpan key, ByteSpan master, ByteSpan payload, bool allowExport, SecureString &out) {
+    switch (op) {
+    case AGENT_PING:
+        out.clear();
+        break;
+    case AGENT_ENCRYPT:
+    case AGENT_WRAP:
+        out.resize(aead_boxed_len(payload.size()));
+        out.resize(encrypt_aead(MutableByteSpan(out), payload, op == AGENT_WRAP ? master : key));
+        break;
+    case AGENT_DECRYPT:
+    case AGENT_UNWRAP:
+        out.resize(aead_plain_len(payload.size()));
+        out.resize(decrypt_aead(MutableByteSpan(out), payload, op == AGENT_UNWRAP ? master : key));
+        break;
+    case AGENT_DECRYPT_AD: {
+        uint32_t adLen = payload.size() < 4 ? 0 : agent_get_u32(payload.data());
+        if (payload.size() < 4 || payload.size() - 4 < adLen) throw std::runtime_error("malformed request");
+        ByteSpan boxed = payload.subspan(4 + adLen);
+        out.resize(aead_plain_len(boxed.size()));
+        out.resize(decrypt_aead(MutableByteSpan(out), boxed, key, payload.subspan(4, adLen)));
+        break;
+    }
+    case AGENT_EXPORT:
+        if (!allowExport) throw std::runtime_error("key export disabled (start key_agent with --allow-export)");
+        out.assign((const char*)key.data(), key.size());
+        break;
+    default:
+        throw std::runtime_error("unknown op");
+    }
+}
+
+inline bool agent_reply(int fd, AgentStatus status, ByteSpan body) {
+    unsigned char hdr[5] = {status};
+    agent_put_u32(hdr + 1, (uint32_t)body.size());
+    return agent_write_all(fd, hdr, sizeof(hdr)) && agent_write_all(fd, body.data(), body.size());
+}
+
+// Answers the requests on one connection with handle(op, key, payload, out) until the peer hangs
+// up, sends nothing for idleMs, or stalls for readTimeoutMs in the middle of a request. Returns
+// false once the peer asked for AGENT_LOCK.
+template <class Handle>
+inline bool agent_serve(int fd, int idleMs, int readTimeoutMs, Handle handle) {
+    timeval tv{readTimeoutMs / 1000, (readTimeoutMs % 1000) * 1000};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    SecureBuffer payload;
+    SecureString out;
+    for (;;) {
+        pollfd p{fd, POLLIN, 0};
+        if (poll(&p, 1, idleMs) <= 0) return true; // idle client: drop it
+        unsigned char hdr[6];
+        if (!agent_read_all(fd, hdr, sizeof(hdr))) return true;
+        uint32_t len = agent_get_u32(hdr + 2);
+        if (len > AGENT_MAX_PAYLOAD) { agent_reply(fd, AGENT_ERR, ByteSpan(std::string("payload too large"))); return true; }
+        payload.resize(len);
+        if (len && !agent_read_all(fd, payload.data(), len)) return true;
+
+        AgentOp op = (AgentOp)hdr[0];
+        if (op == AGENT_LOCK) {
+            agent_reply(fd, AGENT_OK, ByteSpan());
+            return false;
+        }
+        try {
+            handle(op, (AgentKey)hdr[1], ByteSpan(payload), out);
+            agent_reply(fd, AGENT_OK, ByteSpan(out));
+        } catch (const std::exception &e) {
+            agent_reply(fd, AGENT_ERR, ByteSpan(std::string(e.what())));
+        }
+        out.wipe();
+        if (!payload.empty()) sodium_memzero(payload.data(), payload.size());
+    }
+}
+
+#endif // KEYAGENT_H
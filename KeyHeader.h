@@ -0,0 +1,133 @@
+// KeyHeader.h
+// Versioned key header (user_key.hdr) recording the KDF algorithm, its cost parameters and the
+// salt, plus host calibration of those parameters. Replaces the bare 16-byte user_salt.bin.
+#ifndef KEYHEADER_H
+#define KEYHEADER_H
+
+#include "Encryption.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+static const char KEY_HEADER_MAGIC[4] = {'L', 'C', 'K', 'H'};
+static const uint8_t KEY_HEADER_VERSION = 1;
+static const size_t KEY_HEADER_CHECKSUM_LEN = 16;
+// magic(4) version(1) alg(1) reserved(2) opslimit(8) memlimit(8) salt(16) checksum(16)
+static const size_t KEY_HEADER_LEN = 4 + 1 + 1 + 2 + 8 + 8 + SALT_LEN + KEY_HEADER_CHECKSUM_LEN;
+
+struct KdfParams {
+    int alg = crypto_pwhash_ALG_ARGON2ID13;
+    unsigned long long opslimit = crypto_pwhash_OPSLIMIT_INTERACTIVE;
+    size_t memlimit = crypto_pwhash_MEMLIMIT_INTERACTIVE;
+    std::vector<unsigned char> salt;
+};
+
+inline void key_header_put_u64(unsigned char *p, uint64_t v) {
+    for (int i = 0; i < 8; ++i) p[i] = (unsigned char)(v >> (8 * i));
+}
+inline uint64_t key_header_get_u64(const unsigned char *p) {
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; --i) v = (v << 8) | p[i];
+    return v;
+}
+
+inline std::vector<unsigned char> encode_key_header(const KdfParams &kdf) {
+    if (kdf.salt.size() != SALT_LEN) throw std::runtime_error("salt size mismatch");
+    std::vector<unsigned char> buf(KEY_HEADER_LEN, 0);
+    std::memcpy(buf.data(), KEY_HEADER_MAGIC, 4);
+    buf[4] = KEY_HEADER_VERSION;
+    buf[5] = (unsigned char)kdf.alg;
+    key_header_put_u64(&buf[8], kdf.opslimit);
+    key_header_put_u64(&buf[16], kdf.memlimit);
+    std::memcpy(&buf[24], kdf.salt.data(), SALT_LEN);
+    size_t body = KEY_HEADER_LEN - KEY_HEADER_CHECKSUM_LEN;
+    crypto_generichash(&buf[body], KEY_HEADER_CHECKSUM_LEN, buf.data(), body, NULL, 0);
+    return buf;
+}
+
+inline KdfParams decode_key_header(const std::vector<unsigned char> &buf) {
+    if (buf.size() != KEY_HEADER_LEN || std::memcmp(buf.data(), KEY_HEADER_MAGIC, 4) != 0)
+        throw std::runtime_error("not a key header");
+    if (buf[4] != KEY_HEADER_VERSION) throw std::runtime_error("unsupported key header version");
+    size_t body = KEY_HEADER_LEN - KEY_HEADER_CHECKSUM_LEN;
+    unsigned char sum[KEY_HEADER_CHECKSUM_LEN];
+    crypto_generichash(sum, sizeof(sum), buf.data(), body, NULL, 0);
+    if (sodium_memcmp(sum, &buf[body], sizeof(sum)) != 0) throw std::runtime_error("key header checksum mismatch");
+    KdfParams kdf;
+    kdf.alg = buf[5];
+    kdf.opslimit = key_header_get_u64(&buf[8]);
+    kdf.memlimit = (size_t)key_header_get_u64(&buf[16]);
+    kdf.salt.assign(&buf[24], &buf[24] + SALT_LEN);
+    if (kdf.alg != crypto_pwhash_ALG_ARGON2ID13 && kdf.alg != crypto_pwhash_ALG_ARGON2I13)
+        throw std::runtime_error("unknown KDF algorithm in key header");
+    if (kdf.opslimit < crypto_pwhash_OPSLIMIT_MIN || kdf.memlimit < crypto_pwhash_MEMLIMIT_MIN)
+        throw std::runtime_error("KDF limits in key header below minimum");
+    return kdf;
+}
+
+inline void write_key_header(const std::string &path, const KdfParams &kdf) {
+    write_binary_file(path, encode_key_header(kdf));
+}
+inline KdfParams read_key_header(const std::string &path) {
+    return decode_key_header(read_binary_file(path));
+}
+
+// Resolves the KDF parameters for a key directory: user_key.hdr if present, otherwise the
+// legacy user_salt.bin with the interactive limits it was always used with.
+inline KdfParams load_kdf_params(const std::string &keydir) {
+    std::string hdr = keydir + "/user_key.hdr";
+    if (std::filesystem::exists(hdr)) return read_key_header(hdr);
+    std::string legacy = keydir + "/user_salt.bin";
+    if (!std::filesystem::exists(legacy)) throw std::runtime_error("no key header or salt in " + keydir);
+    KdfParams kdf;
+    kdf.salt = read_binary_file(legacy);
+    if (kdf.salt.size() != SALT_LEN) throw std::runtime_error("salt size mismatch in " + legacy);
+    return kdf;
+}
+
+inline SecureString derive_master_key(ByteSpan pass, const KdfParams &kdf) {
+    return derive_master_key(pass, kdf.salt, kdf.opslimit, kdf.memlimit, kdf.alg);
+}
+
+// Times one crypto_pwhash run in milliseconds.
+inline double time_pwhash_ms(unsigned long long opslimit, size_t memlimit, int alg) {
+    unsigned char out[MASTER_KEY_LEN];
+    unsigned char salt[SALT_LEN] = {0};
+    auto t0 = std::chrono::steady_clock::now();
+    if (crypto_pwhash(out, sizeof(out), "calibrate", 9, salt, opslimit, memlimit, alg) != 0)
+        throw std::runtime_error("crypto_pwhash failed - out of memory");
+    auto t1 = std::chrono::steady_clock::now();
+    sodium_memzero(out, sizeof(out));
+    return std::chrono::duration<double, std::milli>(t1 - t0).count();
+}
+
+// Picks Argon2id limits for this host: the largest memory (in whole MiB, at most mem_budget)
+// whose single pass fits target_ms, then as many passes as fit in target_ms.
+// Returns the params (with a fresh salt) and stores the measured unlock time in *measured_ms.
+inline KdfParams kdf_calibrate(double target_ms, size_t mem_budget, double *measured_ms = nullptr) {
+    const size_t MiB = 1024 * 1024;
+    KdfParams kdf;
+    kdf.alg = crypto_pwhash_ALG_ARGON2ID13;
+    size_t mem = std::max<size_t>(8 * MiB, mem_budget / MiB * MiB);
+    double one_pass = time_pwhash_ms(1, mem, kdf.alg);
+    while (one_pass > target_ms && mem > 8 * MiB) {
+        mem = std::max<size_t>(8 * MiB, mem / 2 / MiB * MiB);
+        one_pass = time_pwhash_ms(1, mem, kdf.alg);
+    }
+    // a run costs roughly setup + ops * per_pass; measure a second pass to split the two
+    double per_pass = std::max(time_pwhash_ms(2, mem, kdf.alg) - one_pass, 0.001);
+    double setup = std::max(one_pass - per_pass, 0.0);
+    unsigned long long ops = (unsigned long long)((target_ms - setup) / per_pass);
+    kdf.opslimit = std::max<unsigned long long>(crypto_pwhash_OPSLIMIT_MIN, ops);
+    kdf.memlimit = mem;
+    kdf.salt = generate_salt();
+    double t = time_pwhash_ms(kdf.opslimit, kdf.memlimit, kdf.alg);
+    if (measured_ms) *measured_ms = t;
+    return kdf;
+}
+
+#endif // KEYHEADER_H
@@ -0,0 +1,125 @@
+// LogFrame.h
+// Binary frames of the sent log: a batch of records sealed under one nonce and tag, written
+// with one write. Segments (SegmentedLog.h) whose header says "LCSEG 2" hold frames back to
+// back after the header; version 1 segments and the older single-file log hold one base64
+// line per record, each sealed on its own.
+//
+// Frame (16-byte header): magic "LCFR" | flags u8 (1: payload sealed) | reserved[3] |
+//                         count u32 | payload length u32 | payload
+// The payload is the batch, encrypt_aead()ed with the log key when flags say so, with the
+// 16-byte header as associated data (a changed count, length or flag fails the tag):
+//   batch = count x (length u32 | record bytes)
+// Integers are little-endian. A frame cut short by a crash fails the length check and is
+// ignored along with anything after it. Readers holding a key refuse unsealed frames.
+#ifndef LOGFRAME_H
+#define LOGFRAME_H
+
+#include "QueueStore.h" // store_get_* / store_put_*
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+static const char LOG_FRAME_MAGIC[4] = {'L', 'C', 'F', 'R'};
+static const size_t LOG_FRAME_HEADER_LEN = 16;
+static const uint8_t LOG_FRAME_SEALED = 1;
+static const size_t LOG_FRAME_MAX_RECORDS = 65535; // slot numbers are 16-bit in the index
+
+struct LogFrameHeader {
+    uint8_t flags = 0;
+    uint32_t count = 0;
+    uint32_t payloadLen = 0;
+
+    uint64_t frameLen() const { return LOG_FRAME_HEADER_LEN + (uint64_t)payloadLen; }
+};
+
+// The header of a complete frame at `offset` of `log`; false if there is none.
+inline bool log_frame_at(ByteSpan log, uint64_t offset, LogFrameHeader &h) {
+    if (offset + LOG_FRAME_HEADER_LEN > log.size()) return false;
+    const unsigned char *p = log.data() + offset;
+    if (std::memcmp(p, LOG_FRAME_MAGIC, sizeof(LOG_FRAME_MAGIC)) != 0) return false;
+    h.flags = p[4];
+    h.count = store_get_u32(p + 8);
+    h.payloadLen = store_get_u32(p + 12);
+    return h.count && h.count <= LOG_FRAME_MAX_RECORDS && offset + h.frameLen() <= log.size();
+}
+
+// Calls fn(offset, const LogFrameHeader&) for each frame of `log` from byte `from` on, up to
+// the first incomplete one.
+template <class F>
+inline void scan_log_frames(ByteSpan log, uint64_t from, F fn) {
+    LogFrameHeader h;
+    for (uint64_t off = from; log_frame_at(log, off, h); off += h.frameLen()) fn(off, (const LogFrameHeader&)h);
+}
+
+// Calls fn(slot, ByteSpan record) for each record of an opened batch; false if it is malformed.
+template <class F>
+inline bool for_each_batch_record(ByteSpan batch, F fn) {
+    size_t pos = 0;
+    for (uint32_t slot = 0; pos < batch.size(); ++slot) {
+        if (batch.size() - pos < 4) return false;
+        uint32_t len = store_get_u32(batch.data() + pos);
+        pos += 4;
+        if (batch.size() - pos < len) return false;
+        fn(slot, ByteSpan(batch.data() + pos, len));
+        pos += len;
+    }
+    return true;
+}
+
+// A frame of `count` records around `batch`, sealed under `key` with `suite` (an empty key
+// leaves the payload plain).
+inline void seal_log_frame(std::string &out, ByteSpan batch, uint32_t count, ByteSpan key, SuiteId suite) {
+    const bool sealed = key.size() != 0;
+    const size_t payloadLen = sealed ? aead_boxed_len(suite, batch.size()) : batch.size();
+    out.assign(LOG_FRAME_MAGIC, sizeof(LOG_FRAME_MAGIC));
+    out.push_back((char)(sealed ? LOG_FRAME_SEALED : 0));
+    out.append(3, '\0');
+    store_put_u32(out, count);
+    store_put_u32(out, (uint32_t)payloadLen);
+    if (!sealed) { out.append((const char*)batch.data(), batch.size()); return; }
+    out.resize(LOG_FRAME_HEADER_LEN + payloadLen);
+    MutableByteSpan payload((unsigned char*)&out[LOG_FRAME_HEADER_LEN], payloadLen);
+    if (encrypt_aead(payload, batch, key, suite, ByteSpan(out.data(), LOG_FRAME_HEADER_LEN)) != payloadLen)
+        throw std::runtime_error("log frame: unexpected sealed length");
+}
+
+// Collects records into one frame. Not synchronized.
+class LogFrameBuilder {
+public:
+    struct Record {
+        int priority;
+        uint64_t timeMs;
+    };
+
+    void add(const std::string &record, int priority, uint64_t timeMs) {
+        if (recs.size() >= LOG_FRAME_MAX_RECORDS) throw std::runtime_error("log frame is full");
+        store_put_u32(batch, (uint32_t)record.size());
+        batch.append(record);
+        recs.push_back(Record{priority, timeMs});
+    }
+
+    bool empty() const { return recs.empty(); }
+    size_t count() const { return recs.size(); }
+    const std::vector<Record> &records() const { return recs; }
+
+    // Seals the batch under `key` with `suite` (an empty key leaves it plain) into frame().
+    void seal(ByteSpan key, SuiteId suite) { seal_log_frame(out, ByteSpan(batch), (uint32_t)recs.size(), key, suite); }
+    const std::string &frame() const { return out; }
+
+    void clear() {
+        if (!batch.empty()) sodium_memzero(&batch[0], batch.size());
+        batch.clear();
+        recs.clear();
+        out.clear();
+    }
+    ~LogFrameBuilder() { clear(); }
+
+private:
+    std::string batch, out;
+    std::vector<Record> recs;
+};
+
+#endif // LOGFRAME_H
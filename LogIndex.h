@@ -0,0 +1,372 @@
+// LogIndex.h
+// Sidecar index for a sent-log file (<log>.idx) and the per-file reader SegmentedLog.h builds
+// on. The index holds one fixed-size entry per log record, so record N, the last record and a
+// binary search by time are O(1) / O(log n) instead of a scan of the whole log. A log file holds
+// either one line per record or binary frames of several (LogFrame.h); both are read here.
+//
+// Header (8 bytes): magic "LCLI" | version u8 | reserved[3]
+// Entry (24 bytes): offset u64 | length u32 | priority u8 | flags u8 (1: framed) | slot u16 |
+//                   time_ms u64 (wall clock at append; 0 when unknown)
+// A line entry spans the line without its newline; a framed entry spans the whole frame and
+// `slot` is the record's place in it. Older indexes have zero flags: every entry is a line.
+// Integers are little-endian. The messenger is the only writer: it appends an entry after each
+// record and, when it opens the log, rebuilds or extends an index that is missing or behind.
+// Readers never write; whatever tail the index does not cover yet they scan in memory.
+#ifndef LOGINDEX_H
+#define LOGINDEX_H
+
+#include "LogFrame.h"
+#include "LogRecord.h"
+#include "QueueStore.h" // MappedFile, store_get_* / store_put_*
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+static const char LOG_INDEX_MAGIC[4] = {'L', 'C', 'L', 'I'};
+static const uint8_t LOG_INDEX_VERSION = 1;
+static const size_t LOG_INDEX_HEADER_LEN = 8;
+static const size_t LOG_INDEX_ENTRY_LEN = 24;
+// Segment files (SegmentedLog.h) open with a fixed-width header line that is not a record.
+static const char SEGMENT_HEADER_TAG[] = "LCSEG ";
+static const size_t SEGMENT_HEADER_LEN = 82;
+static const char SEGMENT_HEADER_FRAMED[] = "LCSEG 2 ";
+static const uint8_t LOG_INDEX_FRAMED = 1;
+
+// Decrypts what the log key sealed (a base64-decoded line, or a frame payload with its header
+// as `ad`; lines have none) and returns the plaintext; it may throw. Readers call it only for
+// sealed records; an empty result marks records that could not be opened. Readers given one
+// treat the log as keyed: unsealed frames are refused, not returned.
+using LogOpener = std::function<std::string(ByteSpan sealed, ByteSpan ad)>;
+
+struct LogIndexEntry {
+    uint64_t offset = 0;
+    uint32_t length = 0;
+    int priority = 0;   // 0 when unknown
+    bool framed = false;
+    uint32_t slot = 0;  // record within the frame
+    uint64_t timeMs = 0;
+
+    uint64_t end() const { return offset + length + (framed ? 0 : 1); }
+};
+
+inline std::string log_index_path(const std::string &logPath) { return logPath + ".idx"; }
+
+inline LogIndexEntry log_index_entry_at(const unsigned char *p) {
+    LogIndexEntry e;
+    e.offset = store_get_u64(p);
+    e.length = store_get_u32(p + 8);
+    e.priority = p[12];
+    e.framed = p[13] & LOG_INDEX_FRAMED;
+    e.slot = (uint32_t)p[14] | (uint32_t)p[15] << 8;
+    e.timeMs = store_get_u64(p + 16);
+    return e;
+}
+
+inline void log_index_put(std::string &b, const LogIndexEntry &e) {
+    store_put_u64(b, e.offset);
+    store_put_u32(b, e.length);
+    b.push_back((char)e.priority);
+    b.push_back((char)(e.framed ? LOG_INDEX_FRAMED : 0));
+    b.push_back((char)(e.slot & 0xff));
+    b.push_back((char)(e.slot >> 8));
+    store_put_u64(b, e.timeMs);
+}
+
+// Calls fn(offset, length) for each non-empty line of `log` from byte `from` on; a trailing '\r'
+// is left out of the length, an unterminated last line (a write in progress) is skipped.
+template <class F>
+inline void scan_log_lines(ByteSpan log, uint64_t from, F fn) {
+    const unsigned char *p = log.data();
+    size_t pos = (size_t)from, n = log.size();
+    while (pos < n) {
+        const void *nl = std::memchr(p + pos, '\n', n - pos);
+        if (!nl) break;
+        size_t end = (const unsigned char*)nl - p, len = end - pos;
+        if (len && p[pos + len - 1] == '\r') --len;
+        if (len) fn((uint64_t)pos, (uint32_t)len);
+        pos = end + 1;
+    }
+}
+
+inline uint64_t log_data_start(ByteSpan log) {
+    bool segment = log.size() >= SEGMENT_HEADER_LEN && std::memcmp(log.data(), SEGMENT_HEADER_TAG, sizeof(SEGMENT_HEADER_TAG) - 1) == 0;
+    return segment ? SEGMENT_HEADER_LEN : 0;
+}
+
+inline bool log_is_framed(ByteSpan log) {
+    return log.size() >= SEGMENT_HEADER_LEN && std::memcmp(log.data(), SEGMENT_HEADER_FRAMED, sizeof(SEGMENT_HEADER_FRAMED) - 1) == 0;
+}
+
+// An index entry still describes `log` if the record it names ends in a newline there and starts
+// the log or follows one; a framed entry, if its frame is complete there and the entry is the
+// frame's last. Checked on the last entry before the index is trusted.
+inline bool log_index_entry_fits(ByteSpan log, const LogIndexEntry &e) {
+    if (e.end() > log.size()) return false;
+    if (e.framed) {
+        LogFrameHeader h;
+        return log_frame_at(log, e.offset, h) && h.frameLen() == e.length && e.slot + 1 == h.count;
+    }
+    const unsigned char *p = log.data();
+    if (e.offset && p[e.offset - 1] != '\n') return false;
+    size_t nl = (size_t)(e.offset + e.length);
+    return p[nl] == '\n' || (p[nl] == '\r' && nl + 1 < log.size() && p[nl + 1] == '\n');
+}
+
+// An opener for records sealed under `key`, which must outlive it; throws on a wrong key.
+inline LogOpener log_key_opener(ByteSpan key) {
+    return [key](ByteSpan sealed, ByteSpan ad) {
+        std::string plain(aead_plain_len(sealed.size()), '\0');
+        plain.resize(decrypt_aead(MutableByteSpan(plain), sealed, key, ad));
+        return plain;
+    };
+}
+
+// The plain record of a log line. Base64 lines are sealed records and go through `open` (no
+// opener: ""); anything else was written without a log key and is returned as is.
+inline std::string open_log_line(const std::string &line, const LogOpener &open) {
+    std::vector<unsigned char> sealed;
+    try { base64ToBin(sealed, line); } catch (const std::exception &) { return line; }
+    return open ? open(ByteSpan(sealed), ByteSpan()) : std::string();
+}
+
+// The opened batch of the frame at `offset`. With an opener (a keyed log) an unsealed frame is
+// refused like one that fails to open: it can only have been planted or had its flag cleared.
+inline std::string open_log_frame(ByteSpan log, uint64_t offset, const LogFrameHeader &h, const LogOpener &open) {
+    ByteSpan payload(log.data() + offset + LOG_FRAME_HEADER_LEN, h.payloadLen);
+    if (!(h.flags & LOG_FRAME_SEALED)) return open ? std::string() : std::string((const char*)payload.data(), payload.size());
+    return open ? open(payload, ByteSpan(log.data() + offset, LOG_FRAME_HEADER_LEN)) : std::string();
+}
+
+// Owned by the messenger's log appender. Entries recovered from the log get their time and
+// priority from the records `open` (it holds the log key) lets it read; otherwise they stay 0.
+class LogIndexWriter {
+public:
+    LogIndexWriter(const std::string &logPath, const LogOpener &open) : path(log_index_path(logPath)) {
+        std::vector<LogIndexEntry> missing;
+        bool rebuild = true;
+        uint64_t from = 0;
+        std::error_code ec;
+        if (std::filesystem::exists(logPath, ec) && std::filesystem::file_size(logPath, ec)) {
+            MappedFile log(logPath);
+            ByteSpan bytes(log.data(), log.size());
+            from = log_data_start(bytes);
+            LogIndexEntry last;
+            if (read_last_entry(last)) {
+                if (log_index_entry_fits(bytes, last)) { rebuild = false; from = last.end(); }
+            } else if (std::filesystem::exists(path, ec) && std::filesystem::file_size(path, ec) == LOG_INDEX_HEADER_LEN) {
+                rebuild = false;
+            }
+            if (log_is_framed(bytes)) {
+                scan_log_frames(bytes, from, [&](uint64_t off, const LogFrameHeader &h) {
+                    size_t first = missing.size();
+                    for (uint32_t slot = 0; slot < h.count; ++slot) {
+                        LogIndexEntry e;
+                        e.offset = off;
+                        e.length = (uint32_t)h.frameLen();
+                        e.framed = true;
+                        e.slot = slot;
+                        missing.push_back(e);
+                    }
+                    std::string batch = try_open([&] { return open_log_frame(bytes, off, h, open); });
+                    for_each_batch_record(ByteSpan(batch), [&](uint32_t slot, ByteSpan rec) {
+                        if (slot < h.count) describe(std::string((const char*)rec.data(), rec.size()), missing[first + slot]);
+                    });
+                    if (!batch.empty()) sodium_memzero(&batch[0], batch.size());
+                });
+            } else {
+                scan_log_lines(bytes, from, [&](uint64_t off, uint32_t len) {
+                    LogIndexEntry e;
+                    e.offset = off;
+                    e.length = len;
+                    describe(try_open([&] { return open_log_line(std::string((const char*)bytes.data() + off, len), open); }), e);
+                    missing.push_back(e);
+                });
+            }
+        }
+        out.open(path, std::ios::binary | (rebuild ? std::ios::trunc : std::ios::app));
+        if (!out.is_open()) throw std::runtime_error("cannot open " + path);
+        if (rebuild) out.write(LOG_INDEX_MAGIC, sizeof(LOG_INDEX_MAGIC)).put((char)LOG_INDEX_VERSION).write("\0\0\0", 3);
+        for (const LogIndexEntry &e : missing) append(e);
+        flush();
+        recovered = missing.size();
+    }
+
+    void append(const LogIndexEntry &e) {
+        buf.clear();
+        log_index_put(buf, e);
+        out.write(buf.data(), buf.size());
+    }
+    void flush() {
+        out.flush();
+        if (!out) throw std::runtime_error("failed writing " + path);
+    }
+    // entries added from the log when the index was opened
+    size_t recoveredEntries() const { return recovered; }
+
+private:
+    template <class F>
+    static std::string try_open(F f) {
+        try { return f(); } catch (const std::exception &) { return std::string(); } // another key, or damaged
+    }
+    static void describe(const std::string &plain, LogIndexEntry &e) {
+        LogRecord r;
+        if (decode_log_record(ByteSpan(plain), r)) {
+            e.timeMs = r.timeMs();
+            e.priority = r.priority;
+            return;
+        }
+        // a text record whose message is not base64: its tags still index it
+        LegacyLogFields f;
+        split_legacy_log_record(plain, f);
+        int64_t ns;
+        if (!f.time.empty() && parse_ctime_ns(f.time, ns)) e.timeMs = (uint64_t)ns / 1000000;
+        e.priority = f.priority;
+    }
+
+    bool read_last_entry(LogIndexEntry &e) const {
+        std::ifstream in(path, std::ios::binary | std::ios::ate);
+        if (!in.is_open()) return false;
+        std::streamoff size = in.tellg();
+        if (size < (std::streamoff)(LOG_INDEX_HEADER_LEN + LOG_INDEX_ENTRY_LEN) ||
+            (size - (std::streamoff)LOG_INDEX_HEADER_LEN) % (std::streamoff)LOG_INDEX_ENTRY_LEN) return false;
+        unsigned char h[LOG_INDEX_HEADER_LEN], b[LOG_INDEX_ENTRY_LEN];
+        in.seekg(0);
+        in.read((char*)h, sizeof(h));
+        if (!in || std::memcmp(h, LOG_INDEX_MAGIC, sizeof(LOG_INDEX_MAGIC)) != 0 || h[4] != LOG_INDEX_VERSION) return false;
+        in.seekg(size - (std::streamoff)LOG_INDEX_ENTRY_LEN);
+        in.read((char*)b, sizeof(b));
+        if (!in) return false;
+        e = log_index_entry_at(b);
+        return true;
+    }
+
+    std::string path, buf;
+    std::ofstream out;
+    size_t recovered = 0;
+};
+
+// Read-only access to the log by record number or time, through the index where it is current.
+// Both files are mapped, so opening is O(1) when the index is up to date.
+class LogReader {
+public:
+    explicit LogReader(const std::string &logPath) : log(std::make_shared<const MappedFile>(logPath)) {
+        ByteSpan bytes(log->data(), log->size());
+        uint64_t from = log_data_start(bytes);
+        const bool framed = log_is_framed(bytes);
+        try {
+            auto idx = std::make_shared<const MappedFile>(log_index_path(logPath));
+            size_t n = idx->size() < LOG_INDEX_HEADER_LEN ? 0 : (idx->size() - LOG_INDEX_HEADER_LEN) / LOG_INDEX_ENTRY_LEN;
+            if (n && std::memcmp(idx->data(), LOG_INDEX_MAGIC, sizeof(LOG_INDEX_MAGIC)) == 0 && idx->data()[4] == LOG_INDEX_VERSION) {
+                // trust the index up to its last entry that still fits the log
+                while (n && !log_index_entry_fits(bytes, log_index_entry_at(idx->data() + LOG_INDEX_HEADER_LEN + (n - 1) * LOG_INDEX_ENTRY_LEN))) --n;
+                if (n) { index = idx; indexed = n; from = entry(n - 1).end(); }
+            }
+        } catch (const std::exception &) {
+            // no index: scan below
+        }
+        if (framed) {
+            scan_log_frames(bytes, from, [&](uint64_t off, const LogFrameHeader &h) {
+                for (uint32_t slot = 0; slot < h.count; ++slot) {
+                    LogIndexEntry e;
+                    e.offset = off;
+                    e.length = (uint32_t)h.frameLen();
+                    e.framed = true;
+                    e.slot = slot;
+                    tail.push_back(e);
+                }
+            });
+        } else {
+            scan_log_lines(bytes, from, [&](uint64_t off, uint32_t len) {
+                LogIndexEntry e;
+                e.offset = off;
+                e.length = len;
+                tail.push_back(e);
+            });
+        }
+    }
+
+    size_t size() const { return indexed + tail.size(); }
+    // records [0, indexedSize()) come from the index, the rest from a scan of the tail
+    size_t indexedSize() const { return indexed; }
+
+    LogIndexEntry entry(size_t n) const {
+        if (n < indexed) return log_index_entry_at(index->data() + LOG_INDEX_HEADER_LEN + n * LOG_INDEX_ENTRY_LEN);
+        if (n - indexed < tail.size()) return tail[n - indexed];
+        throw std::out_of_range("log record " + std::to_string(n) + " out of range");
+    }
+
+    // Calls fn(n, const std::string &plain) for records [first, last), opening each frame once.
+    // Exceptions from `open` propagate.
+    template <class F>
+    void read(size_t first, size_t last, const LogOpener &open, F fn) const {
+        readIf(first, last, open, [](size_t) { return true; }, fn);
+    }
+
+    // read() for the records of [first, last) that want(n) picks; a frame is opened once, and
+    // only if it holds one of them.
+    template <class Want, class F>
+    void readIf(size_t first, size_t last, const LogOpener &open, Want want, F fn) const {
+        ByteSpan bytes(log->data(), log->size());
+        uint64_t frameAt = UINT64_MAX;
+        std::vector<std::string> slots; // records of the frame at frameAt
+        for (size_t n = first; n < last && n < size(); ++n) {
+            if (!want(n)) continue;
+            LogIndexEntry e = entry(n);
+            if (!e.framed) {
+                std::string line((const char*)bytes.data() + e.offset, e.length);
+                if (!line.empty() && line.back() == '\r') line.pop_back();
+                fn(n, open_log_line(line, open));
+                continue;
+            }
+            if (e.offset != frameAt) {
+                frameAt = e.offset;
+                slots.clear();
+                LogFrameHeader h;
+                std::string batch = log_frame_at(bytes, e.offset, h) ? open_log_frame(bytes, e.offset, h, open) : std::string();
+                for_each_batch_record(ByteSpan(batch), [&](uint32_t, ByteSpan rec) { slots.emplace_back((const char*)rec.data(), rec.size()); });
+                if (!batch.empty()) sodium_memzero(&batch[0], batch.size());
+            }
+            fn(n, e.slot < slots.size() ? slots[e.slot] : std::string());
+        }
+    }
+
+    bool last(const LogOpener &open, std::string &out) const {
+        if (!size()) return false;
+        read(size() - 1, size(), open, [&](size_t, const std::string &plain) { out = plain; });
+        return true;
+    }
+
+    // Records [first, second) appended between fromMs and toMs inclusive. Assumes append order is
+    // time order. Only indexed records have a time: unknown ones (0, from a rebuild that could
+    // not open them) sort first, and records past the index are never in range.
+    std::pair<size_t, size_t> timeRange(uint64_t fromMs, uint64_t toMs) const {
+        auto lower = [&](uint64_t t) {
+            size_t lo = 0, hi = indexed;
+            while (lo < hi) {
+                size_t mid = lo + (hi - lo) / 2;
+                if (entry(mid).timeMs < t) lo = mid + 1; else hi = mid;
+            }
+            return lo;
+        };
+        if (toMs < fromMs) return {0, 0};
+        size_t a = lower(std::max<uint64_t>(fromMs, 1));
+        size_t b = toMs == UINT64_MAX ? indexed : lower(toMs + 1);
+        return {a, std::max(a, b)};
+    }
+
+private:
+    std::shared_ptr<const MappedFile> log, index;
+    size_t indexed = 0;
+    std::vector<LogIndexEntry> tail; // records past the index (or all of them, without one)
+};
+
+#endif // LOGINDEX_H
@@ -0,0 +1,166 @@
+// LogKeyring.h
+// Log key epochs. The current log key is wrapped under the master key in
+// keys/wrapped_logkey.bin; rotate_log_epoch() keeps it as keys/logkeys/<key id>.bin and writes a
+// fresh one, so new segments go under the new key at once (SegmentedLogWriter::setKey) while
+// the old ones stay readable until they are resealed (SegmentedLogWriter::resealStep). Every
+// segment names its key by key_id(); LogKeyCache turns the id back into the key. Once no segment
+// names a retired epoch any more, prune_log_epochs() deletes its key file.
+#ifndef LOGKEYRING_H
+#define LOGKEYRING_H
+
+#include "SegmentedLog.h"
+
+#include <cinttypes>
+#include <cstdio>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+static const char LOG_KEY_FILE[] = "wrapped_logkey.bin";
+static const char LOG_EPOCH_DIR[] = "logkeys";
+
+inline std::string log_epoch_path(const std::string &keydir, uint64_t keyId) {
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016" PRIx64 ".bin", keyId);
+    return keydir + "/" + LOG_EPOCH_DIR + "/" + name;
+}
+
+// Starts a new epoch: the current log key (if any) is kept under logkeys/ by its id, then a
+// fresh key wrapped under `masterKey` replaces wrapped_logkey.bin. The retired copy is on disk
+// before the replacement is, so a crash never loses the only copy of a key. Returns the new key.
+inline SecureString rotate_log_epoch(const std::string &keydir, ByteSpan masterKey) {
+    const std::string current = keydir + "/" + LOG_KEY_FILE;
+    std::error_code ec;
+    if (std::filesystem::exists(current, ec)) {
+        std::vector<unsigned char> wrapped = read_binary_file(current);
+        SecureString old = decrypt_aead_secure(ByteSpan(wrapped), masterKey); // throws under another master key
+        std::filesystem::create_directories(keydir + "/" + LOG_EPOCH_DIR);
+        const std::string retired = log_epoch_path(keydir, key_id(ByteSpan(old)));
+        if (!std::filesystem::exists(retired, ec)) {
+            write_binary_file(retired + ".tmp", wrapped);
+            sync_file(retired + ".tmp");
+            std::filesystem::rename(retired + ".tmp", retired);
+        }
+        sync_file(retired);
+        sync_dir(keydir + "/" + LOG_EPOCH_DIR);
+        sync_dir(keydir);
+    }
+    SecureString key(crypto_aead_xchacha20poly1305_ietf_KEYBYTES, '\0');
+    randombytes_buf(&key[0], key.size());
+    std::vector<unsigned char> wrapped(aead_boxed_len(key.size()));
+    encrypt_aead(MutableByteSpan(wrapped), ByteSpan(key), masterKey);
+    write_binary_file(current + ".tmp", wrapped);
+    sync_file(current + ".tmp");
+    std::filesystem::rename(current + ".tmp", current);
+    sync_dir(keydir);
+    return key;
+}
+
+// Deletes the retired epochs under `keydir` (and their rotate_keys backups) that no segment of
+// the log in `logdir` names, archived ones included, and that are not `inUse`. A segment whose
+// file is gone needs no key. Nothing is deleted while the older single-file log is there: its
+// lines carry no key id. Returns the ids of the deleted epochs.
+inline std::vector<uint64_t> prune_log_epochs(const std::string &keydir, const std::string &logdir,
+                                              const std::vector<LogSegment> &segs, uint64_t inUse) {
+    std::vector<uint64_t> pruned;
+    std::set<uint64_t> named{inUse};
+    std::error_code ec;
+    for (const LogSegment &s : segs) {
+        if (!std::filesystem::exists(logdir + "/" + s.file, ec)) continue;
+        if (!s.keyId && !segment_unkeyed(s)) return pruned;
+        named.insert(s.keyId);
+    }
+    const std::string epochs = keydir + "/" + LOG_EPOCH_DIR;
+    for (std::filesystem::directory_iterator it(epochs, ec), end; !ec && it != end; it.increment(ec)) {
+        const std::filesystem::path &p = it->path();
+        uint64_t id = 0;
+        if (p.extension() != ".bin" || std::sscanf(p.stem().string().c_str(), "%16" SCNx64, &id) != 1) continue;
+        if (!id || named.count(id) || log_epoch_path(keydir, id) != p.string()) continue;
+        pruned.push_back(id);
+    }
+    for (uint64_t id : pruned) {
+        std::filesystem::remove(log_epoch_path(keydir, id) + ".bak", ec);
+        std::filesystem::remove(log_epoch_path(keydir, id));
+    }
+    if (!pruned.empty()) sync_dir(epochs);
+    return pruned;
+}
+
+// Every wrapped log key in `keydir`: the current one first, then the retired epochs.
+inline std::vector<std::string> log_key_files(const std::string &keydir) {
+    std::vector<std::string> files;
+    std::error_code ec;
+    if (std::filesystem::exists(keydir + "/" + LOG_KEY_FILE, ec)) files.push_back(keydir + "/" + LOG_KEY_FILE);
+    for (std::filesystem::directory_iterator it(keydir + "/" + LOG_EPOCH_DIR, ec), end; !ec && it != end; it.increment(ec))
+        if (it->path().extension() == ".bin") files.push_back(it->path().string());
+    return files;
+}
+
+// Log keys by id, unwrapped on first use from wrapped_logkey.bin or logkeys/<id>.bin and kept
+// for the cache's lifetime (one 32-byte key per epoch). Thread-safe. The openers it hands out
+// point at its keys, so they must not outlive it.
+class LogKeyCache {
+public:
+    using Unwrap = std::function<SecureString(ByteSpan wrapped)>;
+
+    LogKeyCache(std::string keydir, Unwrap unwrap) : keydir(std::move(keydir)), unwrap(std::move(unwrap)) {}
+
+    // Makes `key` known without reading the key files (e.g. the one in use).
+    void add(const SecureString &key) {
+        if (key.empty()) return;
+        std::lock_guard<std::mutex> lock(mu);
+        insert(key);
+    }
+
+    // The key with this id; null for 0 or an id no key file holds.
+    const SecureString *find(uint64_t keyId) {
+        if (!keyId) return nullptr;
+        std::lock_guard<std::mutex> lock(mu);
+        auto it = keys.find(keyId);
+        if (it == keys.end()) {
+            load(keydir + "/" + LOG_KEY_FILE);
+            load(log_epoch_path(keydir, keyId));
+            it = keys.find(keyId);
+        }
+        return it == keys.end() ? nullptr : it->second.get();
+    }
+
+    // An opener for records sealed under key `keyId`; null if it is unknown.
+    LogOpener opener(uint64_t keyId) {
+        const SecureString *key = find(keyId);
+        return key ? log_key_opener(ByteSpan(*key)) : nullptr;
+    }
+
+    // Picks each segment's opener by the key id it was written under.
+    SegmentOpener segmentOpener() {
+        return [this](const LogSegment &s) { return opener(s.keyId); };
+    }
+
+private:
+    void insert(const SecureString &key) {
+        std::unique_ptr<SecureString> &slot = keys[key_id(ByteSpan(key))];
+        if (!slot) slot.reset(new SecureString(key));
+    }
+    void load(const std::string &path) {
+        std::error_code ec;
+        if (!unwrap || !std::filesystem::exists(path, ec)) return;
+        try { insert(unwrap(ByteSpan(read_binary_file(path)))); } catch (const std::exception &) {} // another master key
+    }
+
+    std::string keydir;
+    Unwrap unwrap;
+    std::mutex mu;
+    std::map<uint64_t, std::unique_ptr<SecureString>> keys;
+};
+
+// Unwraps log keys with `masterKey`, which must outlive it.
+inline LogKeyCache::Unwrap log_key_unwrapper(ByteSpan masterKey) {
+    return [masterKey](ByteSpan wrapped) { return decrypt_aead_secure(wrapped, masterKey); };
+}
+
+#endif // LOGKEYRING_H
@@ -0,0 +1,190 @@
+// LogRecord.h
+// The plaintext of one sent-log record: what the log key seals, alone in a line or batched in
+// a frame (LogFrame.h). Version 1 is binary, with a fixed 32-byte header:
+//   version u8 (1) | priority u8 | reserved[2] | repeats u32 | time_ns i64 (unix, UTC) |
+//   key id u64 (key_id() of the key sealing the message; 0 unknown) | message length u32 |
+//   attachment length u32 | message (the raw ciphertext) | attachment path
+// Integers are little-endian. Older records are text,
+//   "<ctime> : <b64 message> [Priority: N][ [Attachment: path]][ [Repeats: N]]"
+// in local time to the second; decode_log_record reads both, without regexes.
+#ifndef LOGRECORD_H
+#define LOGRECORD_H
+
+#include "QueueStore.h" // store_get_* / store_put_*
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+
+static const uint8_t LOG_RECORD_VERSION = 1;
+static const size_t LOG_RECORD_HEADER_LEN = 32;
+
+struct LogRecord {
+    uint8_t version = 0;     // 0: a legacy text record
+    int64_t timeNs = 0;      // 0 when unknown
+    int priority = 0;
+    uint32_t repeats = 1;
+    uint64_t keyId = 0;
+    std::string attachment;
+    ByteSpan binaryMessage;                   // version 1: points into the decoded bytes
+    std::vector<unsigned char> legacyMessage; // legacy: the base64 message, decoded
+
+    ByteSpan message() const { return version ? binaryMessage : ByteSpan(legacyMessage); }
+    uint64_t timeMs() const { return timeNs > 0 ? (uint64_t)timeNs / 1000000 : 0; }
+};
+
+inline int64_t unix_ns_now() {
+    return (int64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+inline void encode_log_record(std::string &out, int64_t timeNs, int priority, uint32_t repeats, uint64_t keyId,
+                              ByteSpan message, const std::string &attachment) {
+    out.clear();
+    out.reserve(LOG_RECORD_HEADER_LEN + message.size() + attachment.size());
+    out.push_back((char)LOG_RECORD_VERSION);
+    out.push_back((char)priority);
+    out.append(2, '\0');
+    store_put_u32(out, repeats);
+    store_put_u64(out, (uint64_t)timeNs);
+    store_put_u64(out, keyId);
+    store_put_u32(out, (uint32_t)message.size());
+    store_put_u32(out, (uint32_t)attachment.size());
+    out.append((const char*)message.data(), message.size());
+    out.append(attachment);
+}
+
+// "Www Mmm dd hh:mm:ss yyyy" (ctime, local time) and nothing else, as unix ns.
+inline bool parse_ctime_ns(const std::string &ts, int64_t &ns) {
+    std::tm tm{};
+    std::istringstream in(ts);
+    in >> std::get_time(&tm, "%a %b %d %H:%M:%S %Y");
+    if (in.fail() || in.peek() != EOF) return false;
+    tm.tm_isdst = -1;
+    std::time_t t = std::mktime(&tm);
+    if (t < 0) return false;
+    ns = (int64_t)t * 1000000000;
+    return true;
+}
+
+// The parts of a legacy text record. The time and its " : " may be missing (hand-written logs),
+// and so may the space in "[Priority:N]".
+struct LegacyLogFields {
+    std::string time;   // as written; empty if the record starts with the body
+    std::string body;   // between the time and the priority tag (or the end)
+    int priority = 0;   // 0: no tag
+    uint32_t repeats = 1;
+    std::string attachment;
+};
+
+inline void split_legacy_log_record(const std::string &text, LegacyLogFields &f) {
+    f = LegacyLogFields();
+    size_t tag = text.find("[Priority:");
+    size_t bodyEnd = tag == std::string::npos ? text.size() : tag;
+    size_t start = 0, sep = text.find(" : ");
+    int64_t ns;
+    if (sep != std::string::npos && sep < bodyEnd && parse_ctime_ns(text.substr(0, sep), ns)) {
+        f.time = text.substr(0, sep);
+        start = sep + 3;
+    }
+    size_t a = text.find_first_not_of(" :\t", start), b = text.find_last_not_of(" \t", bodyEnd ? bodyEnd - 1 : 0);
+    if (a != std::string::npos && b != std::string::npos && bodyEnd && a <= b) f.body = text.substr(a, b - a + 1);
+    if (tag == std::string::npos) return;
+    f.priority = std::atoi(text.c_str() + tag + 10);
+    auto tagValue = [&](const char *name) {
+        size_t p = text.find(name, tag);
+        if (p == std::string::npos) return std::string();
+        p += std::strlen(name);
+        size_t end = text.find(']', p);
+        return end == std::string::npos ? std::string() : text.substr(p, end - p);
+    };
+    f.attachment = tagValue("[Attachment: ");
+    std::string repeats = tagValue("[Repeats: ");
+    if (!repeats.empty()) f.repeats = (uint32_t)std::strtoul(repeats.c_str(), nullptr, 10);
+}
+
+// A legacy line as a version 1 record, its message as a sent record holds it: the ciphertext
+// under `masterKey`. A body that is base64 of a message sealed under masterKey is kept as it
+// is; any other body is plain text from before messages were sealed, and is sealed now.
+// Authentication decides, not whether the body parses as base64, so "help" or "SOS1" stay text.
+inline void migrate_legacy_log_record(std::string &out, const LegacyLogFields &f, int64_t timeNs, ByteSpan masterKey) {
+    std::vector<unsigned char> message;
+    bool sealed = false;
+    try {
+        base64ToBin(message, f.body);
+        std::string plain(aead_plain_len(message.size()), '\0');
+        decrypt_aead(MutableByteSpan(plain), ByteSpan(message), masterKey);
+        sodium_memzero(&plain[0], plain.size());
+        sealed = true;
+    } catch (const std::exception &) {}
+    if (!sealed) {
+        message.assign(aead_boxed_len(f.body.size()), 0);
+        message.resize(encrypt_aead(MutableByteSpan(message), ByteSpan(f.body), masterKey));
+    }
+    encode_log_record(out, timeNs, f.priority ? f.priority : 2, f.repeats, key_id(masterKey), ByteSpan(message), f.attachment);
+}
+
+inline bool decode_legacy_log_record(const std::string &text, LogRecord &r) {
+    LegacyLogFields f;
+    split_legacy_log_record(text, f);
+    if (f.time.empty() || !f.priority) return false;
+    r = LogRecord();
+    try { base64ToBin(r.legacyMessage, f.body); } catch (const std::exception &) { return false; }
+    parse_ctime_ns(f.time, r.timeNs);
+    r.priority = f.priority;
+    r.repeats = f.repeats;
+    r.attachment = f.attachment;
+    return true;
+}
+
+// Either format; false if `bytes` is neither. A version 1 record's message points into `bytes`.
+inline bool decode_log_record(ByteSpan bytes, LogRecord &r) {
+    const unsigned char *p = bytes.data();
+    if (bytes.size() >= LOG_RECORD_HEADER_LEN && p[0] == LOG_RECORD_VERSION) {
+        uint32_t msgLen = store_get_u32(p + 24), attLen = store_get_u32(p + 28);
+        if ((uint64_t)LOG_RECORD_HEADER_LEN + msgLen + attLen != bytes.size()) return false;
+        r = LogRecord();
+        r.version = p[0];
+        r.priority = p[1];
+        r.repeats = store_get_u32(p + 4);
+        r.timeNs = (int64_t)store_get_u64(p + 8);
+        r.keyId = store_get_u64(p + 16);
+        r.binaryMessage = ByteSpan(p + LOG_RECORD_HEADER_LEN, msgLen);
+        r.attachment.assign((const char*)p + LOG_RECORD_HEADER_LEN + msgLen, attLen);
+        return true;
+    }
+    return decode_legacy_log_record(std::string((const char*)p, bytes.size()), r);
+}
+
+// ISO 8601 in UTC with milliseconds ("2024-01-31T12:00:00.250Z"); thread-safe, unlike gmtime.
+inline std::string format_log_time(int64_t timeNs) {
+    int64_t ms = timeNs / 1000000, secs = ms / 1000, days = secs / 86400, rem = secs % 86400;
+    if (rem < 0) { rem += 86400; --days; }
+    // civil date from days since 1970-01-01
+    int64_t z = days + 719468, era = (z >= 0 ? z : z - 146096) / 146097, doe = z - era * 146097;
+    int64_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365, doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    int64_t mp = (5 * doy + 2) / 153, d = doy - (153 * mp + 2) / 5 + 1, m = mp < 10 ? mp + 3 : mp - 9, y = yoe + era * 400 + (m <= 2);
+    char buf[40];
+    std::snprintf(buf, sizeof(buf), "%04lld-%02lld-%02lldT%02lld:%02lld:%02lld.%03lldZ", (long long)y, (long long)m, (long long)d,
+                  (long long)(rem / 3600), (long long)(rem / 60 % 60), (long long)(rem % 60), (long long)((ms % 1000 + 1000) % 1000));
+    return buf;
+}
+
+// One line for people: time, priority, repeats, attachment and message size.
+inline std::string log_record_summary(const LogRecord &r) {
+    std::string s = r.timeNs ? format_log_time(r.timeNs) : std::string("(no time)");
+    s += " [Priority: " + std::to_string(r.priority) + "]";
+    if (r.repeats > 1) s += " [Repeats: " + std::to_string(r.repeats) + "]";
+    if (!r.attachment.empty()) s += " [Attachment: " + r.attachment + "]";
+    s += " " + std::to_string(r.message().size()) + "-byte message";
+    if (r.version == 0) s += " (legacy text record)";
+    return s;
+}
+
+#endif // LOGRECORD_H
@@ -1,11 +1,14 @@
 // MessageQueue.cpp
 #include "MessageQueue.h"
 #include "Encryption.h"
+#include "SecretStream.h"
 
 #include <iostream>
 #include <fstream>
 #include <algorithm>
+#include <map>
 #include <ctime>
+#include <cstdio>
 #include <vector>
 #include <string>
 
@@ -29,6 +32,10 @@
   #define HAS_CURL 0
 #endif
 
+static const char *SENT_LOG_DIR = "modules/emergency_messenger/logs";
+static const char *LOG_KEY_DIR = "modules/emergency_messenger/keys";
+static const int RESEAL_TICKS_PER_SEC = 10; // the appender wakes this often when idle
+
 static void ensure_dir_exists(const std::string &path) {
 #if __has_include(<filesystem>)
     try { fs::create_directories(path); } catch (...) {}
@@ -41,168 +48,919 @@ static void ensure_dir_exists(const std::string &path) {
 #endif
 }
 
-MessageQueue::MessageQueue(const std::string &masterKey_, const std::string &logKey_)
-    : masterKey(masterKey_), logKey(logKey_) {}
+MessageQueue::MessageQueue(const SecureString &masterKey_, const SecureString &logKey_)
+    : ingest{MpmcRing<Pending>(INGEST_CAPACITY), MpmcRing<Pending>(INGEST_CAPACITY), MpmcRing<Pending>(INGEST_CAPACITY)},
+      masterKey(masterKey_), logKey(logKey_), masterKeyId(key_id(ByteSpan(masterKey_))),
+      logKeys(LOG_KEY_DIR, log_key_unwrapper(ByteSpan(masterKey))), dedup(ByteSpan(masterKey_), std::chrono::minutes(10))
+{
+    logKeys.add(logKey);
+    try {
+        ensure_dir_exists("modules");
+        ensure_dir_exists("modules/emergency_messenger");
+        journal.reset(new QueueJournal("modules/emergency_messenger/journal"));
+        std::vector<JournalEntry> pending = journal->recovered();
+        for (JournalEntry &e : pending) {
+            Message msg{std::move(e.text), e.priority, std::move(e.attachment), e.id};
+            msg.enqueuedMs = unix_ms_now();
+            account(msg, true);
+            queue.push(std::move(msg), e.priority);
+        }
+        if (!pending.empty()) std::cout << "Recovered " << pending.size() << " queued message(s) from the journal.\n";
+    } catch (const std::exception &e) {
+        std::cerr << "Warning: queue journal unavailable, queued messages will not survive a restart: " << e.what() << "\n";
+        journal.reset();
+    }
+    {
+        std::lock_guard<std::mutex> lock(senderMu);
+        spillOverBudget();
+    }
+    for (int i = 0; i < ENCODE_WORKERS; ++i) encoders.emplace_back(&MessageQueue::encodeStage, this);
+    appender = std::thread(&MessageQueue::appendStage, this);
+    posters.emplace_back(&MessageQueue::transportStage, this, true);
+    for (int i = 0; i < TRANSPORT_WORKERS; ++i) posters.emplace_back(&MessageQueue::transportStage, this, false);
+}
+
+// Lets every enqueued send finish, stage by stage; keys wipe themselves (SecureString).
+MessageQueue::~MessageQueue()
+{
+    encodeQ.close();
+    for (auto &t : encoders) t.join();
+    appendQ.close();
+    appender.join();
+    transportQ.close();
+    for (auto &t : posters) t.join();
+}
+
+// Lock-free fast path; a full ring is folded into the scheduler by the producer itself.
+void MessageQueue::enqueue(Message &&msg)
+{
+    account(msg, true);
+    int prio = std::min(std::max(msg.priority, 1), PriorityScheduler<Message>::LEVELS);
+    Pending p{std::move(msg), PriorityScheduler<Message>::Clock::now()};
+    while (!ingest[prio - 1].try_push(p)) absorbIngest();
+    if (prio == 1) { // a sender waiting on a full pipeline or on throttled posts yields to it
+        encodeQ.wake();
+        std::lock_guard<std::mutex> lock(postMu);
+        postCv.notify_all();
+    }
+}
+
+// A priority-1 message the sender has not taken up yet.
+bool MessageQueue::urgentWaiting() const
+{
+    return !ingest[0].empty() || queue.sizeOf(1) > 0;
+}
+
+void MessageQueue::journalEnqueue(Message &msg)
+{
+    if (!journal) return;
+    try {
+        msg.id = journal->enqueue(msg.priority, msg.text, msg.attachment);
+    } catch (const std::exception &e) {
+        std::cerr << "Warning: message not journaled: " << e.what() << "\n";
+    }
+}
+
+// Sent, or dropped for good; either way it must not come back on replay.
+void MessageQueue::journalAck(const Message &msg)
+{
+    if (journal && msg.id) journal->ack(msg.id);
+}
+
+// Moves everything in the ingest rings into the scheduler. Serialized so that two absorbers
+// cannot interleave and reorder messages of one priority.
+void MessageQueue::absorbIngest()
+{
+    std::lock_guard<std::mutex> lock(absorbMu);
+    Pending p;
+    for (int lane = 0; lane < PriorityScheduler<Message>::LEVELS; ++lane)
+        while (ingest[lane].try_pop(p)) queue.push(std::move(p.msg), lane + 1, p.arrived);
+}
+
+// Puts failed posts back at their lane heads, aging from their original enqueue time. Left to
+// the next send rather than retried within the same drain, so a dead endpoint is not hammered.
+void MessageQueue::requeueFailed()
+{
+    std::vector<Message> failed;
+    {
+        std::lock_guard<std::mutex> lock(failedMu);
+        failed.swap(failedPosts);
+    }
+    const uint64_t nowMs = unix_ms_now();
+    const auto steadyNow = PriorityScheduler<Message>::Clock::now();
+    for (size_t j = failed.size(); j-- > 0;) {
+        Message &msg = failed[j];
+        auto waited = std::chrono::milliseconds(nowMs > msg.enqueuedMs ? nowMs - msg.enqueuedMs : 0);
+        account(msg, true);
+        int prio = msg.priority;
+        queue.pushFront(std::move(msg), prio, steadyNow - waited);
+    }
+}
+
+void MessageQueue::setMemoryBudget(size_t residentBytes_, size_t spillBytes)
+{
+    std::lock_guard<std::mutex> lock(senderMu);
+    memoryBudget = residentBytes_;
+    spillLimit = spillBytes;
+    spillOverBudget();
+}
+
+void MessageQueue::memoryUsage(size_t &resident, size_t &spilled) const
+{
+    resident = residentBytes.load();
+    spilled = spilledBytes.load();
+}
+
+// Lower priorities are refused first, and priority 1 never: an SOS is worth more than the bound.
+Admission MessageQueue::admit(int priority, size_t bytes) const
+{
+    size_t resident = residentBytes.load(), total = resident + spilledBytes.load() + bytes;
+    size_t cap = memoryBudget + spillLimit;
+    if ((priority >= 3 && total > cap / 10 * 9) || (priority == 2 && total > cap)) return ADMIT_REJECTED;
+    return resident + bytes > memoryBudget ? ADMIT_THROTTLED : ADMIT_OK;
+}
+
+void MessageQueue::account(const Message &msg, bool adding)
+{
+    std::atomic<size_t> &counter = msg.spilled ? spilledBytes : residentBytes;
+    size_t n = msg.ciphertext().size();
+    if (msg.mapped && !msg.spilled) return; // lives in the user's store file
+    if (adding) counter += n; else counter -= n;
+}
 
-MessageQueue::~MessageQueue() {
-    if (!masterKey.empty()) sodium_memzero((void*)masterKey.data(), masterKey.size());
-    if (!logKey.empty()) sodium_memzero((void*)logKey.data(), logKey.size());
+// Writes the newest messages of the lowest priorities to a spill segment until the resident
+// ciphertext is back under 3/4 of the budget, then points them at a read-only mapping of it.
+// Priority 1 goes last, only if nothing else is left. The segment is unlinked once mapped, so
+// it disappears with its last message (the journal, not the spill, is what survives a crash);
+// the kernel pages it back in as the sender reaches those messages. Caller holds senderMu,
+// so nothing pops while the scheduler entries are rewritten.
+void MessageQueue::spillOverBudget()
+{
+    if (residentBytes.load() <= memoryBudget) return;
+    const size_t target = memoryBudget / 4 * 3;
+    std::vector<Message*> victims;
+    size_t freed = 0;
+    std::string path;
+    try {
+        ensure_dir_exists("modules/emergency_messenger/spill");
+        path = "modules/emergency_messenger/spill/spill-" + std::to_string(spillSeq++) + ".store";
+        QueueStoreWriter spill(path, false); // unlinked once mapped: nothing to make durable
+        queue.visitNewestFirst([&](Message &msg, int) {
+            if (msg.mapped || msg.text.empty()) return true;
+            StoreRecord rec;
+            rec.priority = msg.priority;
+            rec.enqueuedMs = msg.enqueuedMs;
+            rec.keyId = masterKeyId;
+            rec.text = ByteSpan(msg.text);
+            rec.attachment = ByteSpan(msg.attachment);
+            spill.add(rec);
+            victims.push_back(&msg);
+            freed += msg.text.size();
+            return freed + target < residentBytes.load();
+        });
+        if (victims.empty()) return;
+        spill.commit();
+        auto file = std::make_shared<const MappedFile>(path);
+        std::remove(path.c_str());
+        size_t i = 0;
+        scan_queue_store(ByteSpan(file->data(), file->size()), [&](const StoreRecord &rec) {
+            Message &msg = *victims[i++];
+            std::string().swap(msg.text);
+            msg.mapped = file;
+            msg.mappedText = rec.text;
+            msg.spilled = true;
+        });
+        residentBytes -= freed;
+        spilledBytes += freed;
+    } catch (const std::exception &e) {
+        std::cerr << "Warning: could not spill queued messages to disk: " << e.what() << "\n";
+        if (!path.empty()) std::remove(path.c_str());
+    }
 }
 
-void MessageQueue::addMessage(const std::string &content, int priority)
+Admission MessageQueue::addMessage(ByteSpan content, int priority)
 {
+    Admission adm = admit(priority, aead_boxed_len(content.size()));
+    if (adm == ADMIT_REJECTED) {
+        std::cerr << "Queue full: priority " << priority << " message refused (memory budget and spill limit reached).\n";
+        return adm;
+    }
+    uint64_t token = 0;
     try {
-        std::string boxed = encrypt_aead(content, masterKey);
-        Message msg{boxed, priority};
-        messages.push_back(std::move(msg));
+        // sealed before it is admitted, so a failed seal leaves no copy for repeats to fold into
+        Message msg{std::string(aead_boxed_len(content.size()), '\0'), priority};
+        encrypt_aead(MutableByteSpan(msg.text), content, ByteSpan(masterKey));
+        token = dedup.admit(content, priority);
+        if (!token) {
+            std::cout << "Same message already queued; counted as a repeat.\n";
+            return adm;
+        }
+        msg.enqueuedMs = unix_ms_now();
+        msg.dedupToken = token;
+        journalEnqueue(msg);
+        enqueue(std::move(msg));
         std::cout << "Message added to queue.\n";
     } catch (const std::exception &e) {
-        std::cerr << "Failed to encrypt message: " << e.what() << "\n";
+        dedup.release(token);
+        std::cerr << "Failed to queue message: " << e.what() << "\n";
+        return ADMIT_REJECTED;
+    }
+    relieveMemory(adm);
+    return adm;
+}
+
+// Over budget: spill now if no sender is busy (a busy sender spills between rounds).
+void MessageQueue::relieveMemory(Admission adm)
+{
+    if (adm != ADMIT_THROTTLED) return;
+    std::cout << "Queue is over its memory budget; spilling to disk.\n";
+    std::unique_lock<std::mutex> lock(senderMu, std::try_to_lock);
+    if (!lock.owns_lock()) return;
+    absorbIngest();
+    spillOverBudget();
+}
+
+Admission MessageQueue::addAttachment(const std::string &srcPath, int priority)
+{
+    Admission adm = admit(priority, 0);
+    if (adm == ADMIT_REJECTED) {
+        std::cerr << "Queue full: priority " << priority << " attachment refused (memory budget and spill limit reached).\n";
+        return adm;
+    }
+    try {
+        std::ifstream in(srcPath, std::ios::binary);
+        if (!in.is_open()) throw std::runtime_error("cannot open " + srcPath);
+        ensure_dir_exists("modules/emergency_messenger/attachments");
+        unsigned char id[16];
+        randombytes_buf(id, sizeof(id));
+        char hex[sizeof(id) * 2 + 1];
+        sodium_bin2hex(hex, sizeof(hex), id, sizeof(id));
+        std::string dst = std::string("modules/emergency_messenger/attachments/") + hex + ".lcs";
+        std::ofstream out(dst, std::ios::binary | std::ios::trunc);
+        if (!out.is_open()) throw std::runtime_error("cannot create " + dst);
+        uint64_t bytes = stream_encrypt(in, out, ByteSpan(masterKey));
+        out.close();
+
+        std::string name = srcPath.substr(srcPath.find_last_of("/\\") == std::string::npos ? 0 : srcPath.find_last_of("/\\") + 1);
+        std::string caption = "[attachment] " + name + " (" + std::to_string(bytes) + " bytes)";
+        Message msg{std::string(aead_boxed_len(caption.size()), '\0'), priority, dst};
+        msg.enqueuedMs = unix_ms_now();
+        encrypt_aead(MutableByteSpan(msg.text), ByteSpan(caption), ByteSpan(masterKey));
+        journalEnqueue(msg);
+        enqueue(std::move(msg));
+        std::cout << "Attachment encrypted to " << dst << " and queued.\n";
+    } catch (const std::exception &e) {
+        std::cerr << "Failed to encrypt attachment: " << e.what() << "\n";
+        return ADMIT_REJECTED;
     }
+    relieveMemory(adm);
+    return adm;
 }
 
-// Simple HTTP POST sender: sends JSON {"message": "<b64>", "priority": N}
-// Returns true if sent OK. Requires libcurl.
-static bool post_ciphertext(const std::string &url, const std::string &b64msg, int priority) {
+// Simple HTTP POST sender: sends JSON {"message": "<b64>", "priority": N[, "repeats": R]
+// [, "attachment_id": "<hex>"]}, the id naming the upload that carries the message's attachment.
+// Returns true if sent OK. Requires libcurl. `body` is caller-owned scratch space.
+static bool post_ciphertext(const std::string &url, const std::string &b64msg, int priority, uint32_t repeats,
+                            const std::string &attachmentId, std::string &body) {
 #if HAS_CURL
     CURL *curl = curl_easy_init();
     if (!curl) return false;
-    std::string body = "{\"message\":\"" + b64msg + "\",\"priority\":" + std::to_string(priority) + "}";
+    char prio[16];
+    std::snprintf(prio, sizeof(prio), "%d", priority);
+    body.assign("{\"message\":\"").append(b64msg).append("\",\"priority\":").append(prio);
+    if (repeats > 1) body.append(",\"repeats\":").append(std::to_string(repeats));
+    if (!attachmentId.empty()) body.append(",\"attachment_id\":\"").append(attachmentId).append("\"");
+    body.append("}");
     struct curl_slist *headers = NULL;
     headers = curl_slist_append(headers, "Content-Type: application/json");
     curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
     curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body.c_str());
     curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
     curl_easy_setopt(curl, CURLOPT_TIMEOUT, 10L);
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L); // several workers: no SIGALRM-based resolver timeouts
+    CURLcode res = curl_easy_perform(curl);
+    curl_slist_free_all(headers);
+    curl_easy_cleanup(curl);
+    return res == CURLE_OK;
+#else
+    (void)url; (void)b64msg; (void)priority; (void)repeats; (void)attachmentId; (void)body;
+    return false;
+#endif
+}
+
+#if HAS_CURL
+static size_t read_stream_cb(char *buf, size_t size, size_t nitems, void *userdata) {
+    std::ifstream *in = static_cast<std::ifstream*>(userdata);
+    in->read(buf, (std::streamsize)(size * nitems));
+    return (size_t)in->gcount();
+}
+#endif
+
+// Streams an already-encrypted attachment file as the POST body, a chunk at a time, tagged with
+// the id its message carries (X-Attachment-Id).
+static bool post_encrypted_stream(const std::string &url, const std::string &path, const std::string &attachmentId) {
+#if HAS_CURL
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    if (!in.is_open()) return false;
+    curl_off_t size = (curl_off_t)in.tellg();
+    in.seekg(0, std::ios::beg);
+    CURL *curl = curl_easy_init();
+    if (!curl) return false;
+    struct curl_slist *headers = NULL;
+    headers = curl_slist_append(headers, "Content-Type: application/octet-stream");
+    headers = curl_slist_append(headers, ("X-Attachment-Id: " + attachmentId).c_str());
+    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(curl, CURLOPT_POST, 1L);
+    curl_easy_setopt(curl, CURLOPT_READFUNCTION, read_stream_cb);
+    curl_easy_setopt(curl, CURLOPT_READDATA, &in);
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE, size);
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+    // large uploads: give up on a stalled link rather than after a fixed total time
+    curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, 1024L);
+    curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, 30L);
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
     CURLcode res = curl_easy_perform(curl);
     curl_slist_free_all(headers);
     curl_easy_cleanup(curl);
     return res == CURLE_OK;
 #else
-    (void)url; (void)b64msg; (void)priority;
+    (void)url; (void)path; (void)attachmentId;
     return false;
 #endif
 }
 
+void MessageQueue::setAgingInterval(std::chrono::milliseconds interval)
+{
+    queue.setAgingInterval(interval);
+}
+
+void MessageQueue::setDedupWindow(std::chrono::milliseconds window)
+{
+    dedup.setWindow(window);
+}
+
+void MessageQueue::setLogRotation(uint64_t segmentBytes, std::chrono::milliseconds segmentAge, size_t keepSegments)
+{
+    logSegmentBytes = segmentBytes;
+    logSegmentAgeMs = (uint64_t)std::max<long long>(0, segmentAge.count());
+    logKeepSegments = keepSegments;
+}
+
+void MessageQueue::setLogBatching(size_t records, std::chrono::milliseconds linger)
+{
+    logBatchRecords = records;
+    logBatchLingerMs = (uint64_t)std::max<long long>(0, linger.count());
+}
+
+void MessageQueue::setLogKey(const SecureString &key)
+{
+    logKeys.add(key);
+    std::lock_guard<std::mutex> lock(logKeyMu);
+    nextLogKey = key;
+    logKeyChanged = true; // the appender switches at its next wake-up
+}
+
+void MessageQueue::setLogReseal(uint64_t bytesPerSecond)
+{
+    logResealBytesPerSec = bytesPerSecond;
+}
+
+void MessageQueue::setTransport(const Transport &t)
+{
+    transport = t;
+}
+
+void MessageQueue::setRateLimit(double perSecond, double burst, double priorityOneReserve)
+{
+    limiter.setEndpointLimit(RateLimiter::Limit{perSecond, burst}, priorityOneReserve);
+}
+
+// transport URL: set to a test endpoint or keep empty to disable network send
+static const char *TRANSPORT_URL = "https://httpbin.org/post"; // e.g., "https://httpbin.org/post"
+
 void MessageQueue::sendMessages()
 {
-    if (messages.empty()) { std::cout << "No messages to send.\n"; return; }
+    std::lock_guard<std::mutex> lock(senderMu);
+    absorbIngest();
+    requeueFailed();
+    if (queue.empty()) { std::cout << "No messages to send.\n"; return; }
+    sendStart = RateLimiter::Clock::now();
+
+    // Drain in rounds of DRAIN_ROUND messages, re-asking the scheduler between rounds: a
+    // priority-1 message queued while a low-priority backlog is going out is sent in the next
+    // round rather than after the backlog. One queued while this thread waits on a full pipeline
+    // cuts the round short (the rest go back to the lane heads) and overtakes the jobs already
+    // in the pipeline, which serves priority-1 jobs ahead of the others at every stage.
+    // While the limiter is making routine posts wait, take one message at a time so each wait
+    // ends with a fresh look at the scheduler, and only once the posts ahead of it have spent
+    // their tokens, so the limiter's answer for it is not stale; a priority-1 message does not
+    // wait for them.
+    for (;;) {
+        absorbIngest();
+        spillOverBudget();
+        size_t round = DRAIN_ROUND;
+        if (*TRANSPORT_URL && limiter.saturated(TRANSPORT_URL)) {
+            round = 1;
+            std::unique_lock<std::mutex> lock(postMu);
+            postCv.wait(lock, [this] { return unposted == 0 || urgentWaiting(); });
+        }
+        if (!queue.popBatch(inflight, round)) break;
+        for (const Message &msg : inflight) account(msg, false);
+        RoundEnd end = sendRound();
+        inflight.clear();
+        if (end == ROUND_HELD) {
+            std::cout << "Rate limit reached; " << queue.size() << " message(s) left queued for a later send.\n";
+            break;
+        }
+    }
+}
+
+void MessageQueue::showRateLimits()
+{
+    if (!*TRANSPORT_URL) { std::cout << "Transport disabled; nothing is rate limited.\n"; return; }
+    RateLimiter::Counters c = limiter.counters(TRANSPORT_URL);
+    char line[160];
+    std::snprintf(line, sizeof(line), "Endpoint tokens: %.1f (%.0f reserved for priority 1)\n", c.tokens, c.reserve);
+    std::cout << line;
+    for (int i = 0; i < RateLimiter::CLASSES; ++i) {
+        const RateLimiter::ClassCounters &k = c.classes[i];
+        std::snprintf(line, sizeof(line), "Priority %d: tokens %.1f, sent %llu, throttled %llu, dropped %llu\n", i + 1,
+                      k.tokens, (unsigned long long)k.granted, (unsigned long long)k.throttled, (unsigned long long)k.dropped);
+        std::cout << line;
+    }
+}
+
+// Opens the round's messages (the plaintext is shown, never stored), builds their log records
+// and feeds them to the pipeline in order, each once the rate limiter says its posts (message
+// and attachment) would go out in time; the transport workers spend the tokens. Ends early,
+// handing the rest back to the scheduler, when a class would have waited too long (HELD) or
+// when a priority-1 message is queued while the pipeline is full (PREEMPTED).
+MessageQueue::RoundEnd MessageQueue::sendRound()
+{
+    const size_t n = inflight.size();
+    openBatch.resize(n);
+    for (size_t i = 0; i < n; ++i) openBatch[i].input = inflight[i].ciphertext();
+    crypto.open(openBatch, ByteSpan(masterKey));
+
+    // back to the lane heads, in their original order
+    auto handBack = [&](size_t from) {
+        const uint64_t nowMs = unix_ms_now();
+        const auto steadyNow = PriorityScheduler<Message>::Clock::now();
+        for (size_t j = n; j-- > from;) {
+            if (!openBatch[j].output.empty()) sodium_memzero(&openBatch[j].output[0], openBatch[j].output.size());
+            Message &msg = inflight[j];
+            auto waited = std::chrono::milliseconds(nowMs > msg.enqueuedMs ? nowMs - msg.enqueuedMs : 0);
+            account(msg, true);
+            int prio = msg.priority;
+            queue.pushFront(std::move(msg), prio, steadyNow - waited);
+        }
+    };
+
+    for (size_t i = 0; i < n; ++i) {
+        AeadRecord &opened = openBatch[i];
+        const bool sos = inflight[i].priority == 1;
+        if (!sos && !encodeQ.waitForRoom([this] { return urgentWaiting(); })) {
+            handBack(i);
+            return ROUND_PREEMPTED;
+        }
+        const double posts = inflight[i].attachment.empty() ? 1 : 2;
+        if (*TRANSPORT_URL && !limiter.admits(TRANSPORT_URL, inflight[i].priority, posts, sendStart)) {
+            handBack(i);
+            return ROUND_HELD;
+        }
+        // 0: a repeat at higher priority was queued (and likely already sent) in its place
+        uint32_t repeats = inflight[i].dedupToken ? dedup.claim(inflight[i].dedupToken) : inflight[i].repeats;
+        if (!repeats) {
+            if (!opened.output.empty()) sodium_memzero(&opened.output[0], opened.output.size());
+            journalAck(inflight[i]);
+            continue;
+        }
+        if (!opened.ok) {
+            std::cerr << "Failed to decrypt/send message: " << opened.error << "\n";
+            journalAck(inflight[i]);
+            continue;
+        }
+        if (journal && inflight[i].id) journal->dequeue(inflight[i].id);
+        std::cout << "Sending (plaintext): " << opened.output << " [Priority: " << inflight[i].priority << "]";
+        if (repeats > 1) std::cout << " x" << repeats;
+        std::cout << "\n";
+        sodium_memzero(&opened.output[0], opened.output.size());
 
-    ensure_dir_exists("modules");
-    ensure_dir_exists("modules/emergency_messenger");
-    ensure_dir_exists("modules/emergency_messenger/logs");
-    ensure_dir_exists("modules/emergency_messenger/keys");
+        SendJob job;
+        if (!sos) job.seq = nextSeq++;
+        job.msg = std::move(inflight[i]);
+        job.repeats = repeats;
+        job.sentNs = unix_ns_now();
+        {
+            std::lock_guard<std::mutex> lock(postMu);
+            ++unposted;
+        }
+        if (sos) encodeQ.pushUrgent(std::move(job));
+        else encodeQ.push(std::move(job)); // there is room: waitForRoom above
+    }
+    return ROUND_SENT;
+}
+
+// Stage 1: base64 of the message ciphertext (the transport payload) and the binary log record
+// (LogRecord.h), which keeps the ciphertext raw.
+void MessageQueue::encodeStage()
+{
+    SendJob job;
+    while (encodeQ.pop(job)) {
+        const Message &msg = job.msg;
+        binToBase64(job.msgB64, msg.ciphertext());
+        encode_log_record(job.record, job.sentNs, msg.priority, job.repeats, masterKeyId, msg.ciphertext(), msg.attachment);
+        if (msg.priority == 1) appendQ.pushUrgent(std::move(job));
+        else appendQ.push(std::move(job));
+    }
+}
 
-    std::ofstream logFile("modules/emergency_messenger/logs/sent_messages.log", std::ios::app | std::ios::binary);
-    if (!logFile.is_open()) std::cerr << "Warning: unable to open log file for writing metadata.\n";
+// Opens what logKey sealed; "" (unreadable) for records sealed under another key or damaged.
+static std::string open_log_sealed(const SecureString &logKey, ByteSpan sealed, ByteSpan ad)
+{
+    try { return log_key_opener(ByteSpan(logKey))(sealed, ad); }
+    catch (const std::exception &) { return std::string(); }
+}
 
-    std::sort(messages.begin(), messages.end(), [](const Message &a, const Message &b){ return a.priority < b.priority; });
+// Each segment's key from `keys`, opening records the same way.
+static SegmentOpener open_log_segment(LogKeyCache &keys)
+{
+    return [&keys](const LogSegment &s) -> LogOpener {
+        const SecureString *key = keys.find(s.keyId);
+        if (!key) return nullptr;
+        return [key](ByteSpan sealed, ByteSpan ad) { return open_log_sealed(*key, sealed, ad); };
+    };
+}
 
-    // transport URL: set to a test endpoint or keep empty to disable network send
-    const std::string TRANSPORT_URL = "https://httpbin.org/post"; // e.g., "https://httpbin.org/post"
+// Stage 2: append records in enqueue order (encoders may finish out of order), batched into
+// binary frames (LogFrame.h): one seal with logKey, one write and one flush per frame instead
+// of per record. A frame goes out once it holds logBatchRecords records, once its first record
+// has lingered logBatchLingerMs, or straight away if it holds a priority-1 record; those are
+// appended as they arrive, ahead of routine records still waiting for their turn. Jobs move on
+// to transport only after their frame is written. Frames are sealed with the fastest suite on
+// this host (readers handle mixed-suite logs); without a logKey they are written plain (the
+// records still only hold message ciphertext). The log is segmented (SegmentedLog.h); each
+// segment's sidecar index is brought up to date when the segment is first opened. When idle
+// the stage wakes RESEAL_TICKS_PER_SEC times a second to take up a new log key (setLogKey)
+// and reseal a rate-limited slice of the segments still under an older epoch's key.
+void MessageQueue::appendStage()
+{
+    const SuiteId suite = best_suite();
+    const size_t batch = std::min(std::max<size_t>(logBatchRecords.load(), 1), LOG_FRAME_MAX_RECORDS);
+    const auto linger = std::chrono::milliseconds(logBatchLingerMs.load());
+    std::unique_ptr<SegmentedLogWriter> log;
+    std::map<uint64_t, SendJob> early;
+    uint64_t expected = 0;
+    LogFrameBuilder frame;
+    std::vector<SendJob> framed; // the jobs whose records are in `frame`
+    std::chrono::steady_clock::time_point deadline;
+    const LogOpener openCurrent = [this](ByteSpan sealed, ByteSpan ad) { return open_log_sealed(logKey, sealed, ad); };
+    auto currentKeyId = [this] { return logKey.empty() ? 0 : key_id(ByteSpan(logKey)); };
 
-    for (const auto &msg : messages) {
+    auto openLog = [&] {
+        if (log) return true;
+        ensure_dir_exists("modules");
+        ensure_dir_exists("modules/emergency_messenger");
+        ensure_dir_exists(LOG_KEY_DIR);
         try {
-            // decrypt for sending (in-memory only)
-            std::string plaintext = decrypt_aead(msg.text, masterKey);
-            std::cout << "Sending (plaintext): " << plaintext << " [Priority: " << msg.priority << "]\n";
-
-            // Prepare record: timestamp + b64(message_ciphertext) + priority
-            std::time_t now = std::time(nullptr);
-            std::string ts = std::ctime(&now);
-            if (!ts.empty() && ts.back()=='\n') ts.pop_back();
-
-            std::string b64_msg = binToBase64(reinterpret_cast<const unsigned char*>(msg.text.data()), msg.text.size());
-            std::string record_plain = ts + " : " + b64_msg + " [Priority: " + std::to_string(msg.priority) + "]";
-
-            // Encrypt record_plain with logKey (if provided) to keep logs encrypted at rest.
-            // If logKey is empty, write base64(message) plainly (still ciphertext-of-message).
-            if (!logKey.empty()) {
-                std::string wrapped = encrypt_aead(record_plain, logKey); // wrapped = nonce||ct
-                std::string wrapped_b64 = binToBase64(reinterpret_cast<const unsigned char*>(wrapped.data()), wrapped.size());
-                if (logFile.is_open()) logFile << wrapped_b64 << "\n";
-            } else {
-                if (logFile.is_open()) logFile << record_plain << "\n";
-            }
-            if (logFile.is_open()) logFile.flush();
+            log.reset(new SegmentedLogWriter(SENT_LOG_DIR, currentKeyId(), logSegmentBytes.load(),
+                                             std::chrono::milliseconds(logSegmentAgeMs.load()), logKeepSegments.load(), openCurrent));
+            if (log->recoveredEntries()) std::cout << "Indexed " << log->recoveredEntries() << " log record(s).\n";
+        } catch (const std::exception &e) {
+            std::cerr << "Warning: unable to open log file for writing metadata: " << e.what() << "\n";
+        }
+        return (bool)log;
+    };
 
-            // Optionally POST ciphertext-only to server (disable by leaving TRANSPORT_URL empty)
-            if (!TRANSPORT_URL.empty()) {
-                bool ok = post_ciphertext(TRANSPORT_URL, b64_msg, msg.priority);
-                if (!ok) std::cerr << "Warning: transport post failed (network or libcurl missing)\n";
+    // sealed segments under an older epoch's key are resealed to the current one when idle
+    auto olderEpochs = [&] {
+        try {
+            for (const LogSegment &s : read_log_manifest(SENT_LOG_DIR))
+                if (s.state == SEGMENT_SEALED && s.keyId && s.keyId != currentKeyId()) return true;
+        } catch (const std::exception &) {}
+        return false;
+    };
+    // retired epoch keys go once no segment needs them
+    auto pruneEpochs = [&] {
+        try {
+            size_t n = prune_log_epochs(LOG_KEY_DIR, SENT_LOG_DIR, read_log_manifest(SENT_LOG_DIR), currentKeyId()).size();
+            if (n) std::cout << "Deleted " << n << " retired log key(s) no segment uses any more.\n";
+        } catch (const std::exception &e) {
+            std::cerr << "Warning: retired log keys not pruned: " << e.what() << "\n";
+        }
+    };
+    bool resealing = !logKey.empty() && olderEpochs();
+    if (!resealing) pruneEpochs();
+    auto resealStep = [&] {
+        const uint64_t rate = logResealBytesPerSec.load();
+        if (!rate || !openLog()) return;
+        try {
+            resealing = log->resealStep(rate / RESEAL_TICKS_PER_SEC + 1, logKeys.segmentOpener(), ByteSpan(logKey), suite);
+        } catch (const std::exception &e) {
+            std::cerr << "Warning: log reseal stopped: " << e.what() << "\n";
+            resealing = false;
+        }
+        if (!resealing) pruneEpochs();
+    };
+
+    auto adoptLogKey = [&] {
+        if (!logKeyChanged.exchange(false)) return;
+        {
+            std::lock_guard<std::mutex> lock(logKeyMu);
+            logKey = nextLogKey;
+        }
+        if (log) {
+            try { log->setKey(currentKeyId(), openCurrent); }
+            catch (const std::exception &e) { std::cerr << "Warning: log key switch failed: " << e.what() << "\n"; log.reset(); }
+        }
+        resealing = !logKey.empty();
+    };
+
+    auto writeFrame = [&] {
+        openLog();
+        if (log) {
+            try {
+                frame.seal(ByteSpan(logKey), suite);
+                log->append(frame);
+                log->flush();
+            } catch (const std::exception &e) {
+                std::cerr << "Warning: log append failed: " << e.what() << "\n";
+                log.reset();
             }
+        }
+        frame.clear();
+        for (SendJob &j : framed) {
+            if (j.msg.priority == 1) transportQ.pushUrgent(std::move(j));
+            else transportQ.push(std::move(j));
+        }
+        framed.clear();
+    };
 
-            sentMessages.push_back(msg);
-        } catch (const std::exception &e) {
-            std::cerr << "Failed to decrypt/send message: " << e.what() << "\n";
+    // the index assumes append order is time order: a routine record stamped before a priority-1
+    // record that overtook it is indexed at the latter's time (the record keeps its own)
+    uint64_t lastMs = 0;
+    auto addToFrame = [&](SendJob &j) {
+        if (framed.empty()) deadline = std::chrono::steady_clock::now() + linger;
+        lastMs = std::max(lastMs, (uint64_t)j.sentNs / 1000000);
+        frame.add(j.record, j.msg.priority, lastMs);
+        framed.push_back(std::move(j));
+    };
+
+    const auto tick = std::chrono::milliseconds(1000 / RESEAL_TICKS_PER_SEC);
+    SendJob job;
+    for (;;) {
+        adoptLogKey();
+        if (!appendQ.popUntil(job, framed.empty() ? std::chrono::steady_clock::now() + tick : deadline)) {
+            if (!framed.empty()) { writeFrame(); continue; } // lingered long enough (or closing)
+            if (appendQ.drained()) break;                     // closed and drained
+            if (resealing) resealStep();                      // idle
+            continue;
         }
+        if (job.msg.priority == 1) {
+            addToFrame(job);
+            writeFrame();
+            continue;
+        }
+        early.emplace(job.seq, std::move(job));
+        for (auto it = early.begin(); it != early.end() && it->first == expected; it = early.erase(it), ++expected) {
+            addToFrame(it->second);
+            if (framed.size() >= batch) writeFrame();
+        }
+        if (!framed.empty() && std::chrono::steady_clock::now() >= deadline) writeFrame();
     }
+}
 
-    messages.clear();
-    if (logFile.is_open()) logFile.close();
+// Stage 3: POST ciphertext-only to the server (disable by leaving TRANSPORT_URL empty). Several
+// workers, so one slow or dead endpoint does not hold up the messages behind it, plus one that
+// serves priority 1 only: the others may all be sleeping in the limiter on throttled routine
+// posts. Only compact metadata outlives a delivered job; the ciphertext is released here. A failed
+// one keeps its message for the next send.
+void MessageQueue::transportStage(bool sosLane)
+{
+    SendJob job;
+    std::string postBody;
+    while (sosLane ? transportQ.popUrgent(job) : transportQ.pop(job)) {
+        SentRecord rec;
+        ciphertext_hash(rec.hash, job.msg.ciphertext());
+        rec.priority = (uint8_t)job.msg.priority;
+        rec.repeats = job.repeats;
+        rec.status = SEND_LOCAL;
+        if (*TRANSPORT_URL) {
+            // every POST spends its tokens right before it goes out, the attachment's too
+            limiter.take(TRANSPORT_URL, job.msg.priority);
+            auto t0 = std::chrono::steady_clock::now();
+            // the message hash pairs the message with its attachment upload on the server
+            const std::string attachmentId = job.msg.attachment.empty() ? std::string() : hash_hex(rec.hash);
+            bool ok = transport.post ? transport.post(job.msgB64, job.msg.priority, job.repeats, attachmentId)
+                                     : post_ciphertext(TRANSPORT_URL, job.msgB64, job.msg.priority, job.repeats, attachmentId, postBody);
+            if (!ok) std::cerr << "Warning: transport post failed (network or libcurl missing)\n";
+            if (!job.msg.attachment.empty()) {
+                limiter.take(TRANSPORT_URL, job.msg.priority);
+                if (!(transport.upload ? transport.upload(job.msg.attachment, attachmentId)
+                                       : post_encrypted_stream(TRANSPORT_URL, job.msg.attachment, attachmentId))) {
+                    std::cerr << "Warning: attachment upload failed; kept " << job.msg.attachment << "\n";
+                    ok = false;
+                } else if (ok) {
+                    std::remove(job.msg.attachment.c_str()); // delivered; the log keeps only its path
+                }
+            }
+            rec.status = ok ? SEND_OK : SEND_FAILED;
+            rec.latencyMs = (uint32_t)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t0).count();
+        }
+        rec.sentMs = unix_ms_now();
+        if (rec.status == SEND_FAILED) {
+            // not acked: queued again by the next send, or replayed from the journal after a restart
+            job.msg.dedupToken = 0;
+            job.msg.repeats = job.repeats;
+            std::lock_guard<std::mutex> lock(failedMu);
+            failedPosts.push_back(std::move(job.msg));
+        } else {
+            journalAck(job.msg);
+        }
+        job.msg = Message();
+        {
+            std::lock_guard<std::mutex> lock(sentMu);
+            sentHistory.push(rec);
+        }
+        std::lock_guard<std::mutex> lock(postMu);
+        if (--unposted == 0) postCv.notify_all();
+    }
 }
 
 void MessageQueue::showQueue()
 {
-    if (messages.empty()) { std::cout << "Queue is empty.\n"; return; }
+    std::lock_guard<std::mutex> lock(senderMu);
+    absorbIngest();
+    requeueFailed();
+    std::vector<Message> queued;
+    queue.snapshot(queued);
+    if (queued.empty()) { std::cout << "Queue is empty.\n"; return; }
     std::cout << "--- Current Queue ---\n";
-    for (const auto &msg : messages) {
-        try {
-            std::string plaintext = decrypt_aead(msg.text, masterKey);
-            std::cout << plaintext << " (Priority: " << msg.priority << ")\n";
-        } catch (const std::exception &e) {
-            std::cerr << "Error decrypting message: " << e.what() << "\n";
-        }
+    openBatch.resize(queued.size());
+    for (size_t i = 0; i < queued.size(); ++i) openBatch[i].input = queued[i].ciphertext();
+    crypto.open(openBatch, ByteSpan(masterKey));
+    for (size_t i = 0; i < queued.size(); ++i) {
+        AeadRecord &opened = openBatch[i];
+        if (!opened.ok) { std::cerr << "Error decrypting message: " << opened.error << "\n"; continue; }
+        std::cout << opened.output << " (Priority: " << queued[i].priority << ")";
+        if (!queued[i].attachment.empty()) std::cout << " -> " << queued[i].attachment;
+        std::cout << "\n";
+        sodium_memzero(&opened.output[0], opened.output.size());
     }
 }
 
 void MessageQueue::loadMessagesFromFile(const std::string &filepath)
+{
+    std::lock_guard<std::mutex> lock(senderMu);
+    absorbIngest();
+    std::shared_ptr<const MappedFile> file;
+    try {
+        file = std::make_shared<const MappedFile>(filepath);
+    } catch (const std::exception &) {
+        std::cerr << "Warning: messages file not found: " << filepath << "\n";
+        return;
+    }
+    if (!is_queue_store(ByteSpan(file->data(), file->size()))) { file.reset(); loadTextStore(filepath); return; }
+
+    // Records stay in the mapping; each is authenticated when it is sent or shown, like any
+    // queued message. Only the key id is checked here, so a store sealed under another key
+    // is refused up front instead of failing message by message.
+    const uint64_t nowMs = unix_ms_now();
+    const auto steadyNow = PriorityScheduler<Message>::Clock::now();
+    size_t queued = 0, foreign = 0;
+    try {
+        scan_queue_store(ByteSpan(file->data(), file->size()), [&](const StoreRecord &rec) {
+            if (rec.keyId != masterKeyId) { ++foreign; return; }
+            int prio = std::min(std::max(rec.priority, 1), 3);
+            Message msg{std::string(), prio, std::string((const char*)rec.attachment.data(), rec.attachment.size())};
+            msg.enqueuedMs = rec.enqueuedMs;
+            msg.mapped = file;
+            msg.mappedText = rec.text;
+            // aging resumes from the original enqueue time
+            auto waited = std::chrono::milliseconds(nowMs > rec.enqueuedMs ? nowMs - rec.enqueuedMs : 0);
+            queue.push(std::move(msg), prio, steadyNow - waited);
+            ++queued;
+        });
+    } catch (const std::exception &e) {
+        std::cerr << "Stored queue is damaged, loaded the first " << queued << " message(s): " << e.what() << "\n";
+    }
+    if (foreign) std::cerr << "Skipped " << foreign << " stored message(s) sealed under a different key.\n";
+    std::cout << "Loaded " << queued << " message(s).\n";
+}
+
+// Older format: one base64 ciphertext per line (optional "\t<attachment path>"), no priority.
+void MessageQueue::loadTextStore(const std::string &filepath)
 {
     std::ifstream file(filepath, std::ios::binary);
     if (!file.is_open()) { std::cerr << "Warning: messages file not found: " << filepath << "\n"; return; }
+    std::vector<Message> loaded;
+    std::vector<unsigned char> bin;
     std::string line;
     while (std::getline(file, line)) {
         if (!line.empty() && line.back() == '\r') line.pop_back();
         if (line.empty()) continue;
+        // optional "\t<attachment path>" suffix
+        std::string attachment;
+        size_t tab = line.find('\t');
+        if (tab != std::string::npos) { attachment = line.substr(tab + 1); line.resize(tab); }
         try {
-            std::vector<unsigned char> bin = base64ToBin(line);
-            std::string ciphertext(reinterpret_cast<char*>(bin.data()), bin.size());
-            messages.push_back(Message{ciphertext, 2});
+            base64ToBin(bin, line);
+            loaded.push_back(Message{std::string(reinterpret_cast<char*>(bin.data()), bin.size()), 2, attachment});
         } catch (const std::exception &e) {
             std::cerr << "Failed to parse stored message line: " << e.what() << "\n";
         }
     }
     file.close();
+
+    // authenticate every stored ciphertext under masterKey before queueing it
+    openBatch.resize(loaded.size());
+    for (size_t i = 0; i < loaded.size(); ++i) openBatch[i].input = ByteSpan(loaded[i].text);
+    crypto.open(openBatch, ByteSpan(masterKey));
+    for (size_t i = 0; i < loaded.size(); ++i) {
+        AeadRecord &opened = openBatch[i];
+        if (!opened.output.empty()) sodium_memzero(&opened.output[0], opened.output.size());
+        if (!opened.ok) { std::cerr << "Skipping stored message that failed authentication: " << opened.error << "\n"; continue; }
+        loaded[i].enqueuedMs = unix_ms_now();
+        account(loaded[i], true);
+        queue.push(std::move(loaded[i]), 2);
+    }
+    spillOverBudget();
 }
 
 void MessageQueue::saveMessagesToFile(const std::string &filepath)
 {
-    std::ofstream file(filepath, std::ios::binary | std::ios::trunc);
-    if (!file.is_open()) { std::cerr << "Failed to open messages file for saving: " << filepath << "\n"; return; }
-    for (const auto &msg : messages) {
-        try {
-            std::string b64 = binToBase64(reinterpret_cast<const unsigned char*>(msg.text.data()), msg.text.size());
-            file << b64 << "\n";
-        } catch (const std::exception &e) {
-            std::cerr << "Failed to encode message for saving: " << e.what() << "\n";
+    std::lock_guard<std::mutex> lock(senderMu);
+    absorbIngest();
+    requeueFailed();
+    std::vector<Message> queued;
+    queue.snapshot(queued);
+    try {
+        QueueStoreWriter store(filepath);
+        for (const auto &msg : queued) {
+            StoreRecord rec;
+            rec.priority = msg.priority;
+            rec.suite = SUITE_LEGACY; // queued messages are sealed in the untagged layout
+            rec.enqueuedMs = msg.enqueuedMs;
+            rec.keyId = masterKeyId;
+            rec.text = msg.ciphertext();
+            rec.attachment = ByteSpan(msg.attachment);
+            store.add(rec);
         }
+        store.commit();
+    } catch (const std::exception &e) {
+        std::cerr << "Failed to save messages file: " << filepath << ": " << e.what() << "\n";
     }
-    file.close();
+}
+
+static std::string format_ms(uint64_t ms) {
+    std::time_t t = (std::time_t)(ms / 1000);
+    char buf[32];
+    std::strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", std::localtime(&t));
+    return buf;
 }
 
 void MessageQueue::viewSentHistory()
 {
-    if (sentMessages.empty()) { std::cout << "No messages have been sent yet.\n"; return; }
+    std::lock_guard<std::mutex> lock(sentMu);
+    if (!sentHistory.size()) { std::cout << "No messages have been sent yet.\n"; return; }
+    static const char *const status[] = {"sent", "FAILED", "logged only"};
     std::cout << "--- Sent Messages (metadata only) ---\n";
-    for (const auto &msg : sentMessages) {
+    sentHistory.visit([&](const SentRecord &rec) {
+        std::cout << format_ms(rec.sentMs) << "  " << hash_hex(rec.hash) << "  (Priority: " << (int)rec.priority << ") "
+                  << status[rec.status];
+        if (rec.status != SEND_LOCAL) std::cout << " in " << rec.latencyMs << " ms";
+        if (rec.repeats > 1) std::cout << " x" << rec.repeats;
+        std::cout << "\n";
+    });
+    if (sentHistory.evicted())
+        std::cout << sentHistory.evicted() << " earlier send(s) this session are only in the log (menu 10).\n";
+}
+
+void MessageQueue::viewLoggedHistory(size_t count)
+{
+    std::unique_ptr<SegmentedLogReader> log;
+    try { log.reset(new SegmentedLogReader(SENT_LOG_DIR, open_log_segment(logKeys))); } catch (const std::exception &e) { std::cerr << "Cannot read the log: " << e.what() << "\n"; return; }
+    if (log->segments().empty()) { std::cout << "No log yet.\n"; return; }
+    std::cout << "--- Last " << count << " logged send(s) ---\n";
+    SecureString current; // for segments without a key id, e.g. the older single-file log
+    {
+        std::lock_guard<std::mutex> lock(logKeyMu);
+        current = logKey;
+    }
+    LogOpener open = [&current](ByteSpan sealed, ByteSpan ad) { return open_log_sealed(current, sealed, ad); };
+    log->forEachRecent(count, open, [&](const LogSegment &, const std::string &plain) {
         try {
-            std::string b64 = binToBase64(reinterpret_cast<const unsigned char*>(msg.text.data()), msg.text.size());
-            if (b64.size() > 24)
-                std::cout << "Sent message (ciphertext b64 prefix): " << b64.substr(0,24) << "... (Priority: " << msg.priority << ")\n";
-            else
-                std::cout << "Sent message (ciphertext b64): " << b64 << " (Priority: " << msg.priority << ")\n";
+            if (plain.empty()) throw std::runtime_error("sealed under another key");
+            LogRecord rec;
+            if (!decode_log_record(ByteSpan(plain), rec)) throw std::runtime_error("unexpected record format");
+            unsigned char hash[8];
+            ciphertext_hash(hash, rec.message());
+            std::cout << format_ms(rec.timeMs()) << "  " << hash_hex(hash) << "  (Priority: " << rec.priority << ")";
+            if (!rec.attachment.empty()) std::cout << " [Attachment: " << rec.attachment << "]";
+            if (rec.repeats > 1) std::cout << " x" << rec.repeats;
+            std::cout << "\n";
         } catch (const std::exception &e) {
-            std::cerr << "Error handling sent message: " << e.what() << "\n";
+            std::cerr << "Unreadable log record: " << e.what() << "\n";
         }
-    }
+    });
 }
@@ -2,31 +2,202 @@
 #ifndef MESSAGEQUEUE_H
 #define MESSAGEQUEUE_H
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 
+#include "BatchCrypto.h"
+#include "BoundedQueue.h"
+#include "DedupIndex.h"
+#include "Journal.h"
+#include "LogKeyring.h"
+#include "QueueStore.h"
+#include "MpmcRing.h"
+#include "PriorityScheduler.h"
+#include "RateLimiter.h"
+#include "SentHistory.h"
+
 struct Message {
-    std::string text; // ciphertext (nonce||ciphertext)
+    std::string text; // ciphertext (nonce||ciphertext); empty when it is a view into `mapped`
     int priority;
+    std::string attachment; // path of an on-disk encrypted stream (SecretStream.h), or empty
+    uint64_t id = 0;        // journal id; 0 when not journaled
+    uint64_t enqueuedMs = 0; // wall clock, ms since the epoch
+    // set for messages loaded from a binary store or spilled: the ciphertext stays in the mapped file
+    std::shared_ptr<const MappedFile> mapped;
+    ByteSpan mappedText;
+    bool spilled = false;    // mapped from a spill segment (counts against the spill limit)
+    uint64_t dedupToken = 0; // DedupIndex token; 0 when not deduplicated (attachments, reloads)
+    uint32_t repeats = 1;    // submissions it stands for once its token is claimed (a failed post)
+
+    ByteSpan ciphertext() const { return mapped ? mappedText : ByteSpan(text); }
+};
+
+// What the transport stage posts through: the message (base64 ciphertext) and, for an
+// attachment, its encrypted stream file, both tagged with the id that pairs them. Empty members
+// mean libcurl to the built-in endpoint; tests put stubs in their place.
+struct Transport {
+    std::function<bool(const std::string &b64msg, int priority, uint32_t repeats, const std::string &attachmentId)> post;
+    std::function<bool(const std::string &path, const std::string &attachmentId)> upload;
 };
 
+// What addMessage tells a producer: queued within budget; queued but the queue is over its
+// memory budget and spilling (slow down); or refused because the spill limit is reached too.
+enum Admission { ADMIT_OK, ADMIT_THROTTLED, ADMIT_REJECTED };
+
 class MessageQueue {
 public:
-    MessageQueue(const std::string &masterKey, const std::string &logKey);
+    // Replays the pending-queue journal, so messages queued before a crash are queued again.
+    MessageQueue(const SecureString &masterKey, const SecureString &logKey);
     ~MessageQueue();
 
-    void addMessage(const std::string &content, int priority);
+    // addMessage/addAttachment may be called from any number of threads: the sealed message goes
+    // into a lock-free per-priority ingest ring, which senders fold into the scheduler.
+    // Each is journaled (fsync shared with concurrent adds) before it returns.
+    Admission addMessage(ByteSpan content, int priority);
+    // Streams a file into an encrypted attachment on disk and queues a message referencing it.
+    Admission addAttachment(const std::string &srcPath, int priority);
+    // Hands the queue to the send pipeline in scheduler order: priority 1 first, FIFO within a
+    // priority, aged low-priority messages ahead of fresh priority-2 ones. Returns once every
+    // message is enqueued; sealing, log append and transport finish on the stage workers
+    // (blocking here only while the pipeline is full). The destructor waits for them.
+    // Posts are paced by RateLimiter.h: once a priority class has been held back longer than its
+    // max wait in this call, its next message and everything behind it stay queued for later.
     void sendMessages();
+    // How long a queued message waits before it is served one priority level higher; 0 disables aging.
+    void setAgingInterval(std::chrono::milliseconds interval);
+    // Queued ciphertext kept in RAM (beyond it the newest lowest-priority messages spill to disk)
+    // and on disk in spill segments (beyond it priority 3, then 2, is refused; priority 1 never is).
+    void setMemoryBudget(size_t residentBytes, size_t spillBytes);
+    // Queued ciphertext bytes held in RAM and in spill segments.
+    void memoryUsage(size_t &resident, size_t &spilled) const;
+    // Identical messages submitted within this window while the first is still queued are sent
+    // once, with a repeat count and the highest priority seen; 0 disables coalescing.
+    void setDedupWindow(std::chrono::milliseconds window);
+    // Upstream limit for the transport endpoint, in posts per second, plus burst credits that
+    // only priority 1 may spend.
+    void setRateLimit(double perSecond, double burst, double priorityOneReserve);
+    // Replaces the libcurl posts; call it before sending.
+    void setTransport(const Transport &t);
+    // When the active log segment is closed and a new one started (0 disables a limit), and how
+    // many closed segments stay next to it before older ones move to logs/archive (0: all stay).
+    // Takes effect when the log is first opened, so call it before sending.
+    void setLogRotation(uint64_t segmentBytes, std::chrono::milliseconds segmentAge, size_t keepSegments);
+    // Log records are sealed and written in frames of up to `records`; a frame waits at most
+    // `linger` for more records (priority 1 never waits). Call it before sending.
+    void setLogBatching(size_t records, std::chrono::milliseconds linger);
+    // Moves the log to a new epoch key (LogKeyring.h rotate_log_epoch): the next frame starts a
+    // segment under it. Sealed segments under older keys are then resealed to it in the
+    // appender's spare time, writing at most `bytesPerSecond` (0 stops it; default 1 MiB/s).
+    void setLogKey(const SecureString &key);
+    void setLogReseal(uint64_t bytesPerSecond);
+    // Live token levels and grant/throttle/drop counts per priority class.
+    void showRateLimits();
     void showQueue();
+    // Binary store (QueueStore.h) keeping priority and enqueue time; load also reads the older
+    // base64 text format. Loaded messages are not journaled: the store file is their durable copy.
     void saveMessagesToFile(const std::string &filepath);
     void loadMessagesFromFile(const std::string &filepath);
+    // This session's most recent sends (SENT_HISTORY_CAPACITY), metadata only.
     void viewSentHistory();
+    // The last `count` records of the encrypted log, for history older than the ring.
+    void viewLoggedHistory(size_t count);
 
 private:
-    std::vector<Message> messages;
-    std::vector<Message> sentMessages;
-    std::string masterKey;
-    std::string logKey;
+    static const size_t DRAIN_ROUND = 16;
+    static const size_t INGEST_CAPACITY = 1024; // per priority
+    static const size_t SENT_HISTORY_CAPACITY = 1024;
+    void enqueue(Message &&msg);
+    void journalEnqueue(Message &msg);
+    void journalAck(const Message &msg);
+    void absorbIngest();
+    void requeueFailed();
+    void loadTextStore(const std::string &filepath);
+    Admission admit(int priority, size_t bytes) const;
+    void account(const Message &msg, bool adding);
+    void spillOverBudget();
+    void relieveMemory(Admission adm);
+    enum RoundEnd { ROUND_SENT, ROUND_PREEMPTED, ROUND_HELD };
+    RoundEnd sendRound();
+    bool urgentWaiting() const;
+
+    // One message moving through the send pipeline: encode -> append (framed, sealed) -> transport.
+    struct SendJob {
+        uint64_t seq = 0;      // enqueue order of routine jobs; the log appends them in this order
+        Message msg;
+        std::string msgB64;    // b64(message ciphertext), the transport payload
+        std::string record;    // binary log record; sealed with others into a frame when appended
+        int64_t sentNs = 0;    // unix ns, stamped in enqueue order
+        uint32_t repeats = 1;  // submissions this message stands for
+    };
+    static const size_t PIPELINE_DEPTH = 64; // per stage queue; priority-1 jobs skip the line
+    static const int ENCODE_WORKERS = 2;
+    static const int TRANSPORT_WORKERS = 4; // plus one for priority 1 only
+    void encodeStage();
+    void appendStage();
+    void transportStage(bool sosLane);
+
+    // a message on its way into the scheduler; keeps its arrival time for aging
+    struct Pending {
+        Message msg;
+        PriorityScheduler<Message>::Clock::time_point arrived;
+    };
+    MpmcRing<Pending> ingest[PriorityScheduler<Message>::LEVELS];
+    std::mutex absorbMu; // keeps ring -> scheduler moves in ring order
+    PriorityScheduler<Message> queue;
+    std::mutex senderMu; // the scratch buffers below belong to one sender at a time
+    std::vector<Message> inflight; // the round being sent
+    uint64_t nextSeq = 0;
+    RateLimiter::Clock::time_point sendStart; // the current sendMessages call, for the limiter
+    std::mutex postMu;
+    std::condition_variable postCv;
+    size_t unposted = 0; // handed to the pipeline, not yet through transport
+    std::mutex failedMu;
+    std::vector<Message> failedPosts; // not acked; queued again by the next send
+
+    size_t memoryBudget = 64u << 20;
+    size_t spillLimit = (size_t)1 << 30;
+    std::atomic<size_t> residentBytes{0}, spilledBytes{0};
+    uint64_t spillSeq = 0;
+    SentHistory sentHistory{SENT_HISTORY_CAPACITY};
+    std::mutex sentMu;
+    SecureString masterKey;
+    SecureString logKey;   // written by the appender only, under logKeyMu
+    uint64_t masterKeyId;
+    LogKeyCache logKeys;   // every epoch's key, by id, for readers and the reseal
+    std::mutex logKeyMu;
+    SecureString nextLogKey;
+    std::atomic<bool> logKeyChanged{false};
+    std::atomic<uint64_t> logResealBytesPerSec{1u << 20};
+    DedupIndex dedup;
+    RateLimiter limiter;
+    Transport transport;
+    std::atomic<uint64_t> logSegmentBytes{64u << 20}, logSegmentAgeMs{24 * 3600 * 1000};
+    std::atomic<size_t> logKeepSegments{0};
+    std::atomic<size_t> logBatchRecords{64};
+    std::atomic<uint64_t> logBatchLingerMs{5};
+    std::unique_ptr<QueueJournal> journal; // null if the journal could not be opened
+
+    // Worker pool for bulk seal/open of queued messages and log records.
+    AeadBatchEngine crypto;
+
+    // Scratch reused across sends.
+    std::vector<AeadRecord> openBatch;
+
+    // Send pipeline; declared last so the workers start after, and stop before, everything above.
+    BoundedQueue<SendJob> encodeQ{PIPELINE_DEPTH};
+    BoundedQueue<SendJob> appendQ{PIPELINE_DEPTH};
+    BoundedQueue<SendJob> transportQ{PIPELINE_DEPTH};
+    std::vector<std::thread> encoders, posters;
+    std::thread appender;
 };
 
 #endif // MESSAGEQUEUE_H
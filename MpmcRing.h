@@ -0,0 +1,95 @@
+// MpmcRing.h
+// Bounded lock-free multi-producer/multi-consumer ring (Vyukov's sequenced-slot design).
+// Each slot carries a sequence number that tells producers and consumers whose turn it is,
+// so a push or pop is one CAS on the shared position plus a release store on the slot;
+// there is no lock and no allocation after construction. Full/empty are reported, not waited on.
+#ifndef MPMCRING_H
+#define MPMCRING_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+
+template <class T>
+class MpmcRing {
+public:
+    // capacity is rounded up to a power of two
+    explicit MpmcRing(size_t capacity) {
+        if (capacity < 2) capacity = 2;
+        size_t cap = 1;
+        while (cap < capacity) {
+            if (cap > SIZE_MAX / 2) throw std::runtime_error("MpmcRing capacity too large");
+            cap <<= 1;
+        }
+        mask = cap - 1;
+        slots.reset(new Slot[cap]);
+        for (size_t i = 0; i < cap; ++i) slots[i].seq.store(i, std::memory_order_relaxed);
+    }
+    MpmcRing(const MpmcRing &) = delete;
+    MpmcRing &operator=(const MpmcRing &) = delete;
+
+    size_t capacity() const { return mask + 1; }
+
+    // False when the ring is full; `item` is left untouched in that case.
+    bool try_push(T &item) {
+        size_t pos = tail.load(std::memory_order_relaxed);
+        for (;;) {
+            Slot &s = slots[pos & mask];
+            size_t seq = s.seq.load(std::memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+            if (dif == 0) {
+                if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    s.value = std::move(item);
+                    s.seq.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (dif < 0) {
+                return false;
+            } else {
+                pos = tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // False when the ring is empty.
+    bool try_pop(T &out) {
+        size_t pos = head.load(std::memory_order_relaxed);
+        for (;;) {
+            Slot &s = slots[pos & mask];
+            size_t seq = s.seq.load(std::memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (dif == 0) {
+                if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    out = std::move(s.value);
+                    s.seq.store(pos + mask + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (dif < 0) {
+                return false;
+            } else {
+                pos = head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Approximate under concurrency.
+    bool empty() const {
+        return head.load(std::memory_order_acquire) >= tail.load(std::memory_order_acquire);
+    }
+
+private:
+    struct alignas(64) Slot {
+        std::atomic<size_t> seq;
+        T value;
+    };
+
+    std::unique_ptr<Slot[]> slots;
+    size_t mask = 0;
+    // producers and consumers hammer different lines
+    alignas(64) std::atomic<size_t> tail{0};
+    alignas(64) std::atomic<size_t> head{0};
+};
+
+#endif // MPMCRING_H
@@ -0,0 +1,139 @@
+// PriorityScheduler.h
+// Per-priority FIFO lanes (1 = SOS .. 3 = low) with optional aging. push/pop are O(1): a pop
+// only compares the heads of the three lanes. Within a priority, order is strictly FIFO.
+// Aging: a waiting entry gains one level per aging interval, but never reaches priority 1, so
+// old low-priority traffic eventually beats fresh priority-2 traffic while SOS always goes first.
+// All members lock internally, so producers may push while a sender is draining.
+#ifndef PRIORITYSCHEDULER_H
+#define PRIORITYSCHEDULER_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+template <class T>
+class PriorityScheduler {
+public:
+    using Clock = std::chrono::steady_clock;
+    static const int LEVELS = 3;
+
+    explicit PriorityScheduler(std::chrono::milliseconds agingInterval = std::chrono::milliseconds(30000))
+        : aging(agingInterval) {}
+
+    // 0 disables aging.
+    void setAgingInterval(std::chrono::milliseconds interval) {
+        std::lock_guard<std::mutex> lock(mu);
+        aging = interval;
+    }
+
+    // Priorities outside 1..3 are clamped. `enqueued` is where aging starts counting, for callers
+    // that held the item elsewhere first; it should not go backwards within a priority.
+    void push(T item, int priority, Clock::time_point enqueued = Clock::now()) {
+        std::lock_guard<std::mutex> lock(mu);
+        lanes[lane_of(priority)].push_back(Entry{std::move(item), enqueued});
+    }
+
+    // Returns an entry taken by pop to the head of its lane, ahead of everything pushed since.
+    void pushFront(T item, int priority, Clock::time_point enqueued) {
+        std::lock_guard<std::mutex> lock(mu);
+        lanes[lane_of(priority)].push_front(Entry{std::move(item), enqueued});
+    }
+
+    bool pop(T &out, int *priority = nullptr) {
+        std::lock_guard<std::mutex> lock(mu);
+        return pop_locked(out, priority, Clock::now());
+    }
+
+    // Appends up to `max` entries in service order; returns how many were taken.
+    size_t popBatch(std::vector<T> &out, size_t max) {
+        std::lock_guard<std::mutex> lock(mu);
+        Clock::time_point now = Clock::now();
+        size_t taken = 0;
+        T item;
+        while (taken < max && pop_locked(item, nullptr, now)) {
+            out.push_back(std::move(item));
+            ++taken;
+        }
+        return taken;
+    }
+
+    // Copies the queued entries in lane order (priority 1 first, FIFO within a lane).
+    void snapshot(std::vector<T> &out) const {
+        std::lock_guard<std::mutex> lock(mu);
+        for (const auto &lane : lanes)
+            for (const Entry &e : lane) out.push_back(e.item);
+    }
+
+    // Calls fn(T&, priority) from the lowest priority up, newest first within a priority, until
+    // it returns false. References stay valid after this returns only as long as nothing pops
+    // (pushes never move existing entries).
+    template <class F>
+    void visitNewestFirst(F fn) {
+        std::lock_guard<std::mutex> lock(mu);
+        for (int lane = LEVELS - 1; lane >= 0; --lane)
+            for (auto it = lanes[lane].rbegin(); it != lanes[lane].rend(); ++it)
+                if (!fn(it->item, lane + 1)) return;
+    }
+
+    size_t size() const {
+        std::lock_guard<std::mutex> lock(mu);
+        size_t n = 0;
+        for (const auto &lane : lanes) n += lane.size();
+        return n;
+    }
+    bool empty() const { return size() == 0; }
+    size_t sizeOf(int priority) const {
+        std::lock_guard<std::mutex> lock(mu);
+        return lanes[lane_of(priority)].size();
+    }
+
+    void clear() {
+        std::lock_guard<std::mutex> lock(mu);
+        for (auto &lane : lanes) lane.clear();
+    }
+
+private:
+    struct Entry {
+        T item;
+        Clock::time_point enqueued;
+    };
+
+    static int lane_of(int priority) { return std::min(std::max(priority, 1), LEVELS) - 1; }
+
+    // Level the lane head competes at: its lane, minus one per aging interval waited,
+    // never better than level 1 (priority 2) unless it started at level 0.
+    int effective_level(int lane, Clock::time_point now) const {
+        if (lane == 0 || aging.count() <= 0) return lane;
+        auto waited = std::chrono::duration_cast<std::chrono::milliseconds>(now - lanes[lane].front().enqueued);
+        long steps = (long)(waited.count() / aging.count());
+        return (int)std::max<long>(1, lane - steps);
+    }
+
+    bool pop_locked(T &out, int *priority, Clock::time_point now) {
+        int best = -1, best_level = 0;
+        for (int lane = 0; lane < LEVELS; ++lane) {
+            if (lanes[lane].empty()) continue;
+            int level = effective_level(lane, now);
+            // equal levels: the older head wins, so aged entries go before fresh ones
+            if (best < 0 || level < best_level ||
+                (level == best_level && lanes[lane].front().enqueued < lanes[best].front().enqueued)) {
+                best = lane;
+                best_level = level;
+            }
+        }
+        if (best < 0) return false;
+        out = std::move(lanes[best].front().item);
+        lanes[best].pop_front();
+        if (priority) *priority = best + 1;
+        return true;
+    }
+
+    mutable std::mutex mu;
+    std::deque<Entry> lanes[LEVELS];
+    std::chrono::milliseconds aging;
+};
+
+#endif // PRIORITYSCHEDULER_H
@@ -0,0 +1,227 @@
+// QueueStore.h
+// Binary queue store (messages.store). A fixed header, then one length-prefixed record per
+// message carrying its priority, enqueue time, cipher suite and the id of the key that sealed
+// it. Loading maps the file and hands out views into the mapping, so nothing is copied per
+// record; a record's bytes are only touched when its message is sent or shown.
+//
+// Header (32 bytes): magic "LCQS" | version u8 | reserved[3] | count u64 | created_ms u64 | reserved u64
+// Record: len u32 (bytes after this field) | priority u8 | suite u8 | reserved u16 |
+//         enqueued_ms u64 | key_id u64 | text_len u32 | text | attachment_len u32 | attachment
+// Integers are little-endian. Files without the magic are the older base64-per-line text format.
+#ifndef QUEUESTORE_H
+#define QUEUESTORE_H
+
+#include "Encryption.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+  #include <fcntl.h>
+  #include <io.h>
+  #include <iterator>
+#else
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+#endif
+
+static const char QUEUE_STORE_MAGIC[4] = {'L', 'C', 'Q', 'S'};
+static const uint8_t QUEUE_STORE_VERSION = 1;
+static const size_t QUEUE_STORE_HEADER_LEN = 32;
+static const size_t QUEUE_STORE_RECORD_FIXED = 1 + 1 + 2 + 8 + 8 + 4; // after len, before text
+
+// Forces a written (and closed) file's data to disk, so a rename that publishes it cannot reach
+// the disk before the data does. Throws if the file cannot be synced.
+inline void sync_file(const std::string &path) {
+#if defined(_WIN32)
+    int fd = ::_open(path.c_str(), _O_RDWR | _O_BINARY);
+    if (fd < 0) throw std::runtime_error("cannot open " + path + " to sync");
+    int rc = ::_commit(fd);
+    ::_close(fd);
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) throw std::runtime_error("cannot open " + path + " to sync");
+    int rc = ::fsync(fd);
+    ::close(fd);
+#endif
+    if (rc != 0) throw std::runtime_error("cannot sync " + path);
+}
+
+// Makes renames and new files in `dir` durable (a no-op where directories cannot be synced).
+inline void sync_dir(const std::string &dir) {
+#if !defined(_WIN32)
+    int fd = ::open(dir.empty() ? "." : dir.c_str(), O_RDONLY);
+    if (fd >= 0) { ::fsync(fd); ::close(fd); }
+#else
+    (void)dir;
+#endif
+}
+
+// Read-only view of a whole file: mmap where available, a single read otherwise.
+class MappedFile {
+public:
+    explicit MappedFile(const std::string &path) {
+#if defined(_WIN32)
+        std::ifstream in(path, std::ios::binary);
+        if (!in.is_open()) throw std::runtime_error("cannot open " + path);
+        copy.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        base = (const unsigned char*)copy.data();
+        len = copy.size();
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) throw std::runtime_error("cannot open " + path);
+        struct stat st;
+        if (fstat(fd, &st) != 0) { ::close(fd); throw std::runtime_error("cannot stat " + path); }
+        len = (size_t)st.st_size;
+        if (len) {
+            void *p = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p == MAP_FAILED) { ::close(fd); throw std::runtime_error("cannot map " + path); }
+            base = (const unsigned char*)p;
+        }
+        ::close(fd);
+#endif
+    }
+    ~MappedFile() {
+#if !defined(_WIN32)
+        if (base) munmap((void*)base, len);
+#endif
+    }
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    const unsigned char *data() const { return base; }
+    size_t size() const { return len; }
+
+private:
+    const unsigned char *base = nullptr;
+    size_t len = 0;
+#if defined(_WIN32)
+    std::string copy;
+#endif
+};
+
+struct StoreRecord {
+    int priority = 2;
+    SuiteId suite = SUITE_LEGACY;
+    uint64_t enqueuedMs = 0; // wall clock, ms since the epoch
+    uint64_t keyId = 0;
+    ByteSpan text;           // ciphertext
+    ByteSpan attachment;     // path, or empty
+};
+
+inline uint64_t unix_ms_now() {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+inline uint32_t store_get_u32(const unsigned char *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+inline uint64_t store_get_u64(const unsigned char *p) {
+    return (uint64_t)store_get_u32(p) | (uint64_t)store_get_u32(p + 4) << 32;
+}
+inline void store_put_u32(std::string &b, uint32_t v) { for (int i = 0; i < 4; ++i) b.push_back((char)(v >> (8 * i))); }
+inline void store_put_u64(std::string &b, uint64_t v) { for (int i = 0; i < 8; ++i) b.push_back((char)(v >> (8 * i))); }
+
+inline bool is_queue_store(ByteSpan file) {
+    return file.size() >= sizeof(QUEUE_STORE_MAGIC) && std::memcmp(file.data(), QUEUE_STORE_MAGIC, sizeof(QUEUE_STORE_MAGIC)) == 0;
+}
+
+// Calls fn(const StoreRecord&) for every record, in file order; the spans point into `file`.
+// Throws std::runtime_error on a bad header or a malformed/truncated record.
+template <class F>
+inline uint64_t scan_queue_store(ByteSpan file, F fn) {
+    if (file.size() < QUEUE_STORE_HEADER_LEN || !is_queue_store(file)) throw std::runtime_error("not a queue store");
+    const unsigned char *p = file.data();
+    if (p[4] != QUEUE_STORE_VERSION) throw std::runtime_error("unsupported queue store version " + std::to_string(p[4]));
+    uint64_t count = store_get_u64(p + 8);
+    size_t off = QUEUE_STORE_HEADER_LEN, end = file.size();
+    for (uint64_t i = 0; i < count; ++i) {
+        if (end - off < 4) throw std::runtime_error("queue store truncated");
+        uint32_t len = store_get_u32(p + off);
+        if (len < QUEUE_STORE_RECORD_FIXED + 4 || end - off - 4 < len) throw std::runtime_error("queue store record out of bounds");
+        const unsigned char *r = p + off + 4;
+        StoreRecord rec;
+        rec.priority = r[0];
+        rec.suite = (SuiteId)r[1];
+        rec.enqueuedMs = store_get_u64(r + 4);
+        rec.keyId = store_get_u64(r + 12);
+        uint32_t tl = store_get_u32(r + 20);
+        if ((size_t)tl > len - QUEUE_STORE_RECORD_FIXED - 4) throw std::runtime_error("queue store record out of bounds");
+        rec.text = ByteSpan(r + QUEUE_STORE_RECORD_FIXED, tl);
+        const unsigned char *a = r + QUEUE_STORE_RECORD_FIXED + tl;
+        uint32_t al = store_get_u32(a);
+        if ((size_t)al != len - QUEUE_STORE_RECORD_FIXED - 4 - tl) throw std::runtime_error("queue store record out of bounds");
+        rec.attachment = ByteSpan(a + 4, al);
+        fn((const StoreRecord&)rec);
+        off += 4 + len;
+    }
+    return count;
+}
+
+// Streams records into a temp file next to `path`, syncs it and renames it into place (then syncs
+// the directory), so neither a crash nor a power loss leaves a half-written store, and a mapping
+// of the old file stays valid. Files that need not outlive the process (spill segments, unlinked
+// once mapped) pass durable = false and skip the syncs.
+class QueueStoreWriter {
+public:
+    explicit QueueStoreWriter(const std::string &path, bool durable = true) : path(path), tmp(path + ".tmp"), durable(durable) {
+        out.open(tmp, std::ios::binary | std::ios::trunc);
+        if (!out.is_open()) throw std::runtime_error("cannot create " + tmp);
+        std::string h(QUEUE_STORE_MAGIC, sizeof(QUEUE_STORE_MAGIC));
+        h.push_back((char)QUEUE_STORE_VERSION);
+        h.append(3, '\0');
+        store_put_u64(h, 0); // count, patched in commit()
+        store_put_u64(h, unix_ms_now());
+        store_put_u64(h, 0);
+        out.write(h.data(), h.size());
+    }
+    ~QueueStoreWriter() {
+        if (out.is_open()) { out.close(); std::remove(tmp.c_str()); }
+    }
+
+    void add(const StoreRecord &rec) {
+        buf.clear();
+        store_put_u32(buf, (uint32_t)(QUEUE_STORE_RECORD_FIXED + rec.text.size() + 4 + rec.attachment.size()));
+        buf.push_back((char)rec.priority);
+        buf.push_back((char)rec.suite);
+        buf.append(2, '\0');
+        store_put_u64(buf, rec.enqueuedMs);
+        store_put_u64(buf, rec.keyId);
+        store_put_u32(buf, (uint32_t)rec.text.size());
+        buf.append((const char*)rec.text.data(), rec.text.size());
+        store_put_u32(buf, (uint32_t)rec.attachment.size());
+        buf.append((const char*)rec.attachment.data(), rec.attachment.size());
+        out.write(buf.data(), buf.size());
+        ++count;
+    }
+
+    void commit() {
+        std::string c;
+        store_put_u64(c, count);
+        out.seekp(8);
+        out.write(c.data(), c.size());
+        out.close();
+        if (!out) throw std::runtime_error("failed writing " + tmp);
+        if (durable) sync_file(tmp);
+        std::filesystem::rename(tmp, path);
+        if (durable) sync_dir(std::filesystem::path(path).parent_path().string());
+    }
+
+private:
+    std::string path, tmp, buf;
+    bool durable;
+    std::ofstream out;
+    uint64_t count = 0;
+};
+
+#endif // QUEUESTORE_H
@@ -0,0 +1,229 @@
+// RateLimiter.h
+// Hierarchical token buckets pacing outgoing posts. Every endpoint has one bucket (the upstream
+// limit) and, under it, one bucket per priority class; a post spends a token from both. The
+// endpoint bucket holds `reserve` credits above its burst that only priority 1 may spend, so a
+// backlog of routine traffic can drain the shared budget but never the credits an SOS needs.
+//
+// acquire() sleeps until both buckets have a token, then spends them. A class may be paced for
+// at most its max wait per burst: once that is used up the call fails without spending
+// anything, so the caller can leave the message queued rather than hold the sender hostage.
+// Tokens are only taken when granted, never promised ahead, so waiting routine posts cannot
+// eat into the priority-1 reserve. A sender that hands posts to worker threads asks admits()
+// whether a post would go out in time, and the worker take()s its tokens right before the POST.
+#ifndef RATELIMITER_H
+#define RATELIMITER_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+class RateLimiter {
+public:
+    using Clock = std::chrono::steady_clock;
+    static const int CLASSES = 3;
+
+    // rate in tokens per second; rate 0 means the bucket never limits
+    struct Limit {
+        double rate;
+        double burst;
+    };
+
+    struct ClassCounters {
+        double tokens = 0;      // available now
+        uint64_t granted = 0;
+        uint64_t throttled = 0; // granted after a wait
+        uint64_t dropped = 0;   // refused: the class used up its max wait
+    };
+    struct Counters {
+        double tokens = 0;      // endpoint bucket, reserve included
+        double reserve = 0;
+        ClassCounters classes[CLASSES];
+    };
+
+    RateLimiter() {
+        endpointLimit = Limit{50, 100};
+        reserve = 20;
+        classLimit[0] = Limit{0, 0};
+        classLimit[1] = Limit{20, 40};
+        classLimit[2] = Limit{5, 10};
+        maxWait[0] = std::chrono::milliseconds::max();
+        maxWait[1] = std::chrono::seconds(30);
+        maxWait[2] = std::chrono::seconds(10);
+    }
+
+    // Applies to endpoints first seen afterwards, and resets the ones already known.
+    void setEndpointLimit(Limit limit, double priorityOneReserve) {
+        std::lock_guard<std::mutex> lock(mu);
+        endpointLimit = limit;
+        reserve = std::max(0.0, priorityOneReserve);
+        endpoints.clear();
+    }
+    void setClassLimit(int priority, Limit limit, std::chrono::milliseconds wait) {
+        std::lock_guard<std::mutex> lock(mu);
+        int c = class_of(priority);
+        classLimit[c] = limit;
+        maxWait[c] = wait;
+        endpoints.clear();
+    }
+
+    // For tests: the clock buckets refill by and how a wait is slept. Call it before first use.
+    void setClock(std::function<Clock::time_point()> now, std::function<void(Clock::duration)> sleep) {
+        std::lock_guard<std::mutex> lock(mu);
+        clockNow = std::move(now);
+        sleepFor = std::move(sleep);
+        endpoints.clear();
+    }
+
+    // Blocks until a post of `priority` to `endpoint` is within every limit above it; false
+    // (nothing spent) if that would end later than the class's max wait after `burstStart`,
+    // when the caller started the burst this post belongs to (default: now).
+    bool acquire(const std::string &endpoint, int priority, Clock::time_point burstStart) {
+        return spend(endpoint, class_of(priority), &burstStart);
+    }
+    bool acquire(const std::string &endpoint, int priority) {
+        Clock::time_point now = clockNow();
+        return spend(endpoint, class_of(priority), &now);
+    }
+    // Like acquire(), but waits however long it takes: for a post already committed to.
+    void take(const std::string &endpoint, int priority) { spend(endpoint, class_of(priority), nullptr); }
+
+    // Whether `need` tokens for posts of `priority` to `endpoint` would come within the class's
+    // max wait after `burstStart`. Spends nothing; a refusal counts as a drop.
+    bool admits(const std::string &endpoint, int priority, double need, Clock::time_point burstStart) {
+        const int c = class_of(priority);
+        std::lock_guard<std::mutex> lock(mu);
+        Clock::time_point now = clockNow();
+        Endpoint &ep = endpoint_of(endpoint, now);
+        Bucket &cls = ep.classes[c];
+        Clock::duration wait = wait_locked(ep, c, need, now);
+        if (wait == Clock::duration::zero() ||
+            std::chrono::duration_cast<std::chrono::milliseconds>(now - burstStart + wait) <= maxWait[c])
+            return true;
+        ++cls.dropped;
+        return false;
+    }
+
+    // True while posts to `endpoint` below priority 1 have to wait for tokens.
+    bool saturated(const std::string &endpoint) {
+        std::lock_guard<std::mutex> lock(mu);
+        Clock::time_point now = clockNow();
+        Endpoint &ep = endpoint_of(endpoint, now);
+        ep.total.refill(now);
+        return ep.total.wait_for(1, reserve) > Clock::duration::zero();
+    }
+
+    Counters counters(const std::string &endpoint) {
+        std::lock_guard<std::mutex> lock(mu);
+        Clock::time_point now = clockNow();
+        Endpoint &ep = endpoint_of(endpoint, now);
+        Counters out;
+        ep.total.refill(now);
+        out.tokens = ep.total.tokens;
+        out.reserve = reserve;
+        for (int c = 0; c < CLASSES; ++c) {
+            Bucket &b = ep.classes[c];
+            b.refill(now);
+            out.classes[c].tokens = b.tokens;
+            out.classes[c].granted = b.granted;
+            out.classes[c].throttled = b.throttled;
+            out.classes[c].dropped = b.dropped;
+        }
+        return out;
+    }
+
+private:
+    struct Bucket {
+        Limit limit{0, 0};
+        double tokens = 0;
+        Clock::time_point last;
+        uint64_t granted = 0, throttled = 0, dropped = 0;
+
+        void refill(Clock::time_point now) {
+            if (limit.rate <= 0) return;
+            double dt = std::chrono::duration<double>(now - last).count();
+            tokens = std::min(limit.burst, tokens + dt * limit.rate);
+            last = now;
+        }
+        void take(double n) { if (limit.rate > 0) tokens -= n; }
+        // time until `need` tokens are available above `floor`
+        Clock::duration wait_for(double need, double floor) const {
+            if (limit.rate <= 0) return Clock::duration::zero();
+            double missing = floor + need - tokens;
+            if (missing <= 0) return Clock::duration::zero();
+            return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(missing / limit.rate));
+        }
+    };
+    struct Endpoint {
+        Bucket total;
+        Bucket classes[CLASSES];
+    };
+
+    static int class_of(int priority) { return std::min(std::max(priority, 1), CLASSES) - 1; }
+
+    // Refills class `c` and the endpoint bucket; how long until both hold `need` tokens.
+    Clock::duration wait_locked(Endpoint &ep, int c, double need, Clock::time_point now) {
+        ep.classes[c].refill(now);
+        ep.total.refill(now);
+        // lower classes must leave the reserve untouched
+        return std::max(ep.classes[c].wait_for(need, 0), ep.total.wait_for(need, c == 0 ? 0 : reserve));
+    }
+
+    // acquire() with a burst start, take() without one (never refuses).
+    bool spend(const std::string &endpoint, int c, const Clock::time_point *burstStart) {
+        for (bool waited = false;; waited = true) {
+            Clock::duration wait;
+            std::function<void(Clock::duration)> sleep;
+            {
+                std::lock_guard<std::mutex> lock(mu);
+                Clock::time_point now = clockNow();
+                Endpoint &ep = endpoint_of(endpoint, now);
+                Bucket &cls = ep.classes[c];
+                wait = wait_locked(ep, c, 1, now);
+                if (wait == Clock::duration::zero()) {
+                    cls.take(1);
+                    ep.total.take(1);
+                    ++cls.granted;
+                    if (waited) ++cls.throttled;
+                    return true;
+                }
+                if (burstStart && std::chrono::duration_cast<std::chrono::milliseconds>(now - *burstStart + wait) > maxWait[c]) {
+                    ++cls.dropped;
+                    return false;
+                }
+                sleep = sleepFor;
+            }
+            sleep(wait);
+        }
+    }
+
+    Endpoint &endpoint_of(const std::string &name, Clock::time_point now) {
+        auto it = endpoints.find(name);
+        if (it != endpoints.end()) return it->second;
+        Endpoint &ep = endpoints[name];
+        ep.total.limit = Limit{endpointLimit.rate, endpointLimit.burst + reserve};
+        ep.total.tokens = ep.total.limit.burst;
+        ep.total.last = now;
+        for (int c = 0; c < CLASSES; ++c) {
+            ep.classes[c].limit = classLimit[c];
+            ep.classes[c].tokens = classLimit[c].burst;
+            ep.classes[c].last = now;
+        }
+        return ep;
+    }
+
+    std::mutex mu;
+    Limit endpointLimit;
+    double reserve;
+    Limit classLimit[CLASSES];
+    std::chrono::milliseconds maxWait[CLASSES];
+    std::map<std::string, Endpoint> endpoints;
+    std::function<Clock::time_point()> clockNow = [] { return Clock::now(); };
+    std::function<void(Clock::duration)> sleepFor = [](Clock::duration d) { std::this_thread::sleep_for(d); };
+};
+
+#endif // RATELIMITER_H
@@ -0,0 +1,132 @@
+// SecretStream.h
+// Chunked streaming encryption (crypto_secretstream_xchacha20poly1305) for payloads too large
+// to hold in memory: attachments, audio, telemetry dumps. Works on any std::istream/ostream,
+// so files and pipes alike, with a fixed footprint of two chunk-sized buffers.
+//
+// Layout: "LCSS" | version u8 | reserved[3] | chunk_size u32 LE | secretstream header (24)
+//         then per chunk: ciphertext length u32 LE | ciphertext (plaintext <= chunk_size + 17)
+// The final chunk carries TAG_FINAL, so truncation is detected on decrypt.
+// The caller passes the master key. Streams are sealed under a subkey derived from it
+// (stream_subkey), so the master key itself never keys a secretstream. Version 1 (keyed by the
+// master key directly) was never released and is not read.
+#ifndef SECRETSTREAM_H
+#define SECRETSTREAM_H
+
+#include "Encryption.h"
+
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include <vector>
+
+static const char STREAM_MAGIC[4] = {'L', 'C', 'S', 'S'};
+static const uint8_t STREAM_VERSION = 2;
+static const uint64_t STREAM_SUBKEY_ID = 1;
+static const char STREAM_SUBKEY_CONTEXT[crypto_kdf_CONTEXTBYTES] = {'L', 'C', 'S', 'T', 'R', 'E', 'A', 'M'};
+static const size_t STREAM_PREFIX_LEN = 12;
+static const size_t STREAM_DEFAULT_CHUNK = 64 * 1024;
+static const size_t STREAM_MAX_CHUNK = 16 * 1024 * 1024;
+
+inline void stream_put_u32(unsigned char *p, uint32_t v) {
+    p[0] = (unsigned char)v; p[1] = (unsigned char)(v >> 8); p[2] = (unsigned char)(v >> 16); p[3] = (unsigned char)(v >> 24);
+}
+inline uint32_t stream_get_u32(const unsigned char *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+inline SecureString stream_subkey(ByteSpan masterKey) {
+    if (masterKey.size() != crypto_kdf_KEYBYTES) throw std::runtime_error("Invalid key size");
+    SecureString sub(crypto_secretstream_xchacha20poly1305_KEYBYTES, '\0');
+    crypto_kdf_derive_from_key((unsigned char*)&sub[0], sub.size(), STREAM_SUBKEY_ID, STREAM_SUBKEY_CONTEXT, masterKey.data());
+    return sub;
+}
+
+// Reads up to n bytes, looping so short reads from pipes still fill the chunk.
+inline size_t stream_read_full(std::istream &in, unsigned char *buf, size_t n) {
+    size_t got = 0;
+    while (got < n && in) {
+        in.read((char*)buf + got, (std::streamsize)(n - got));
+        got += (size_t)in.gcount();
+    }
+    return got;
+}
+
+// Encrypts everything from `in` to `out`; returns the number of plaintext bytes.
+inline uint64_t stream_encrypt(std::istream &in, std::ostream &out, ByteSpan key,
+                               size_t chunk_size = STREAM_DEFAULT_CHUNK) {
+    if (key.size() != crypto_secretstream_xchacha20poly1305_KEYBYTES) throw std::runtime_error("Invalid key size");
+    if (chunk_size == 0 || chunk_size > STREAM_MAX_CHUNK) throw std::runtime_error("Invalid chunk size");
+
+    unsigned char prefix[STREAM_PREFIX_LEN + crypto_secretstream_xchacha20poly1305_HEADERBYTES] = {0};
+    std::memcpy(prefix, STREAM_MAGIC, 4);
+    prefix[4] = STREAM_VERSION;
+    stream_put_u32(prefix + 8, (uint32_t)chunk_size);
+    crypto_secretstream_xchacha20poly1305_state st;
+    SecureString sub = stream_subkey(key);
+    crypto_secretstream_xchacha20poly1305_init_push(&st, prefix + STREAM_PREFIX_LEN, (const unsigned char*)sub.data());
+    out.write((const char*)prefix, sizeof(prefix));
+
+    std::vector<unsigned char> plain(chunk_size);
+    std::vector<unsigned char> framed(4 + chunk_size + crypto_secretstream_xchacha20poly1305_ABYTES);
+    uint64_t total = 0;
+    for (;;) {
+        size_t n = stream_read_full(in, plain.data(), chunk_size);
+        total += n;
+        // a short read means EOF; a full chunk is final only if nothing follows it
+        bool last = n < chunk_size || in.peek() == std::char_traits<char>::eof();
+        unsigned char tag = last ? crypto_secretstream_xchacha20poly1305_TAG_FINAL
+                                 : crypto_secretstream_xchacha20poly1305_TAG_MESSAGE;
+        unsigned long long clen = 0;
+        crypto_secretstream_xchacha20poly1305_push(&st, framed.data() + 4, &clen, plain.data(), n, NULL, 0, tag);
+        stream_put_u32(framed.data(), (uint32_t)clen);
+        out.write((const char*)framed.data(), (std::streamsize)(4 + clen));
+        if (!out) throw std::runtime_error("stream write failed");
+        if (last) break;
+    }
+    sodium_memzero(plain.data(), plain.size());
+    sodium_memzero(&st, sizeof(st));
+    return total;
+}
+
+// Decrypts a stream written by stream_encrypt; returns the number of plaintext bytes.
+// Throws on a bad header, a forged or reordered chunk, or a stream cut before TAG_FINAL.
+inline uint64_t stream_decrypt(std::istream &in, std::ostream &out, ByteSpan key) {
+    if (key.size() != crypto_secretstream_xchacha20poly1305_KEYBYTES) throw std::runtime_error("Invalid key size");
+    unsigned char prefix[STREAM_PREFIX_LEN + crypto_secretstream_xchacha20poly1305_HEADERBYTES];
+    if (stream_read_full(in, prefix, sizeof(prefix)) != sizeof(prefix) || std::memcmp(prefix, STREAM_MAGIC, 4) != 0)
+        throw std::runtime_error("not an encrypted stream");
+    if (prefix[4] != STREAM_VERSION) throw std::runtime_error("unsupported stream version");
+    size_t chunk_size = stream_get_u32(prefix + 8);
+    if (chunk_size == 0 || chunk_size > STREAM_MAX_CHUNK) throw std::runtime_error("invalid stream chunk size");
+
+    crypto_secretstream_xchacha20poly1305_state st;
+    SecureString sub = stream_subkey(key);
+    if (crypto_secretstream_xchacha20poly1305_init_pull(&st, prefix + STREAM_PREFIX_LEN, (const unsigned char*)sub.data()) != 0)
+        throw std::runtime_error("invalid stream header");
+
+    std::vector<unsigned char> cipher(chunk_size + crypto_secretstream_xchacha20poly1305_ABYTES);
+    std::vector<unsigned char> plain(chunk_size);
+    uint64_t total = 0;
+    for (;;) {
+        unsigned char lenbuf[4];
+        if (stream_read_full(in, lenbuf, 4) != 4) throw std::runtime_error("stream truncated");
+        size_t clen = stream_get_u32(lenbuf);
+        if (clen < crypto_secretstream_xchacha20poly1305_ABYTES || clen > cipher.size())
+            throw std::runtime_error("invalid stream chunk length");
+        if (stream_read_full(in, cipher.data(), clen) != clen) throw std::runtime_error("stream truncated");
+        unsigned long long mlen = 0;
+        unsigned char tag = 0;
+        if (crypto_secretstream_xchacha20poly1305_pull(&st, plain.data(), &mlen, &tag, cipher.data(), clen, NULL, 0) != 0)
+            throw std::runtime_error("Decryption failed (auth)");
+        out.write((const char*)plain.data(), (std::streamsize)mlen);
+        if (!out) throw std::runtime_error("stream write failed");
+        total += mlen;
+        if (tag == crypto_secretstream_xchacha20poly1305_TAG_FINAL) break;
+    }
+    sodium_memzero(plain.data(), plain.size());
+    sodium_memzero(&st, sizeof(st));
+    return total;
+}
+
+#endif // SECRETSTREAM_H
@@ -0,0 +1,146 @@
+// SecureMemory.h
+// Pooled secure memory for keys and transient plaintext. Chunks are carved from large
+// sodium_malloc'd slabs (mlock'd, with guard pages around each slab) in power-of-two size
+// classes, and zeroed when freed. A free/alloc pair is a mutex and a freelist pop, not the
+// mmap/mprotect round trip of sodium_malloc itself; requests above the largest class still
+// go straight to sodium_malloc.
+#ifndef SECUREMEMORY_H
+#define SECUREMEMORY_H
+
+#include <sodium.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <string>
+#include <vector>
+
+class SecurePool {
+public:
+    static const size_t MIN_CLASS = 16;
+    static const size_t NUM_CLASSES = 12; // 16 B .. 32 KiB
+    static const size_t MAX_CLASS = MIN_CLASS << (NUM_CLASSES - 1);
+    static const size_t SLAB_BYTES = 256 * 1024;
+
+    // Never destroyed, so SecureStrings in static storage can still free into it at exit.
+    static SecurePool &instance() {
+        static SecurePool *pool = new SecurePool();
+        return *pool;
+    }
+
+    void *allocate(size_t n) {
+        if (n == 0) n = 1;
+        if (n > MAX_CLASS) {
+            void *p = sodium_malloc((n + 15) & ~(size_t)15);
+            if (!p) throw std::bad_alloc();
+            return p;
+        }
+        size_t c = class_of(n), sz = MIN_CLASS << c;
+        std::lock_guard<std::mutex> lock(mu);
+        if (FreeNode *node = freelist[c]) {
+            freelist[c] = node->next;
+            node->next = nullptr;
+            return node;
+        }
+        if (bump_left < sz) {
+            // the rest of the current slab is abandoned; slabs are small next to their use
+            unsigned char *slab = (unsigned char*)sodium_malloc(SLAB_BYTES);
+            if (!slab) throw std::bad_alloc();
+            slabs.push_back(slab);
+            bump = slab;
+            bump_left = SLAB_BYTES;
+        }
+        void *p = bump;
+        bump += sz;
+        bump_left -= sz;
+        return p;
+    }
+
+    void deallocate(void *p, size_t n) noexcept {
+        if (!p) return;
+        if (n == 0) n = 1;
+        if (n > MAX_CLASS) { sodium_free(p); return; } // sodium_free zeroes
+        size_t c = class_of(n);
+        sodium_memzero(p, MIN_CLASS << c);
+        std::lock_guard<std::mutex> lock(mu);
+        FreeNode *node = (FreeNode*)p;
+        node->next = freelist[c];
+        freelist[c] = node;
+    }
+
+    size_t slabCount() {
+        std::lock_guard<std::mutex> lock(mu);
+        return slabs.size();
+    }
+
+private:
+    struct FreeNode { FreeNode *next; };
+
+    SecurePool() = default;
+    static size_t class_of(size_t n) {
+        size_t c = 0;
+        while ((MIN_CLASS << c) < n) ++c;
+        return c;
+    }
+
+    std::mutex mu;
+    FreeNode *freelist[NUM_CLASSES] = {};
+    unsigned char *bump = nullptr;
+    size_t bump_left = 0;
+    std::vector<void*> slabs;
+};
+
+// STL allocator over SecurePool.
+template <class T>
+struct SecureAllocator {
+    using value_type = T;
+    SecureAllocator() noexcept = default;
+    template <class U> SecureAllocator(const SecureAllocator<U> &) noexcept {}
+    T *allocate(size_t n) {
+        if (n > SIZE_MAX / sizeof(T)) throw std::bad_alloc();
+        return (T*)SecurePool::instance().allocate(n * sizeof(T));
+    }
+    void deallocate(T *p, size_t n) noexcept { SecurePool::instance().deallocate(p, n * sizeof(T)); }
+};
+template <class T, class U> bool operator==(const SecureAllocator<T> &, const SecureAllocator<U> &) { return true; }
+template <class T, class U> bool operator!=(const SecureAllocator<T> &, const SecureAllocator<U> &) { return false; }
+
+using SecureStringBase = std::basic_string<char, std::char_traits<char>, SecureAllocator<char>>;
+
+// Heap storage comes from SecurePool (wiped on every reallocation and free); the destructor
+// also wipes the small-string buffer, which lives inside the object and never reaches the pool.
+// Copy and move assignment wipe it first too: a longer value moves to the heap and would leave
+// the old short one behind in it.
+class SecureString : public SecureStringBase {
+public:
+    using SecureStringBase::SecureStringBase;
+    SecureString() = default;
+    SecureString(const SecureString &) = default;
+    SecureString(SecureString &&other) noexcept : SecureStringBase(std::move(other)) { other.wipe(); }
+    SecureString(const SecureStringBase &s) : SecureStringBase(s) {}
+    SecureString(SecureStringBase &&s) : SecureStringBase(std::move(s)) {}
+    using SecureStringBase::operator=;
+    SecureString &operator=(const SecureString &other) {
+        if (this != &other) {
+            wipe();
+            SecureStringBase::operator=(other);
+        }
+        return *this;
+    }
+    SecureString &operator=(SecureString &&other) noexcept {
+        if (this != &other) {
+            wipe();
+            SecureStringBase::operator=(std::move(other));
+            other.wipe();
+        }
+        return *this;
+    }
+    ~SecureString() { wipe(); }
+
+    void wipe() noexcept { sodium_memzero(&(*this)[0], capacity()); }
+};
+
+using SecureBuffer = std::vector<unsigned char, SecureAllocator<unsigned char>>;
+
+#endif // SECUREMEMORY_H
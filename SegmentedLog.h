@@ -0,0 +1,522 @@
+// SegmentedLog.h
+// The sent log as a series of segment files under one directory, listed in a manifest. The
+// appender writes to one active segment and starts a new one when it reaches a size or age
+// limit, or when the log key changes, so every segment is sealed under a single key. Appended
+// segments are never rewritten in place: retention moves them to archive/ (delete it at will),
+// and once the log key moves to a new epoch (LogKeyring.h) resealStep() rebuilds sealed
+// segments under it beside the old file and renames them over it. Readers open only the
+// segments a query touches, each with the key its id names.
+//
+// Segment file: one header line, then the records, with a LogIndex.h sidecar (<segment>.idx).
+//   LCSEG <v> key=<16 hex> first=<20 digits> last=<20 digits>\n   (fixed width, rewritten on seal)
+// Version 2 segments hold binary frames of records (LogFrame.h), which is all the writer
+// starts; version 1 ones, one line per record as in the single-file log, are still read.
+// key is key_id() of the log key (0: records are not sealed); first/last are wall-clock ms,
+// last is 0 while the segment is active.
+//
+// MANIFEST: "LCMANIFEST 1" line, then one line per segment, oldest first:
+//   <seq> <file> <key hex> <first ms> <last ms> <records> active|sealed|archived
+// It is replaced atomically (temp file + rename) whenever a segment opens, seals or moves.
+// A sealed segment's key is taken from its file header when the two disagree: a reseal renames
+// the new file into place before it rewrites the manifest, and a crash may come in between.
+// A directory with only the older sent_messages.log reads as one sealed segment (seq 0).
+#ifndef SEGMENTEDLOG_H
+#define SEGMENTEDLOG_H
+
+#include "LogIndex.h"
+
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+static const char LOG_MANIFEST[] = "MANIFEST";
+static const char LEGACY_LOG_FILE[] = "sent_messages.log";
+
+enum SegmentState { SEGMENT_ACTIVE, SEGMENT_SEALED, SEGMENT_ARCHIVED };
+
+struct LogSegment {
+    uint64_t seq = 0;
+    std::string file;     // name within the log directory (archive/ prefix once archived)
+    uint64_t keyId = 0;
+    uint64_t firstMs = 0, lastMs = 0;
+    uint64_t records = 0; // known once sealed
+    SegmentState state = SEGMENT_ACTIVE;
+};
+
+// Written without a log key, so its frames are plain and it is read without an opener (one
+// would refuse them). The older single-file log has no key id either but holds sealed lines.
+inline bool segment_unkeyed(const LogSegment &s) {
+    return !s.keyId && std::filesystem::path(s.file).filename() != LEGACY_LOG_FILE;
+}
+
+// The opener for one segment's records, chosen by its key id (LogKeyring.h); null: use the
+// caller's default opener.
+using SegmentOpener = std::function<LogOpener(const LogSegment &)>;
+
+inline std::string segment_header(const LogSegment &s, bool framed = true) {
+    char h[SEGMENT_HEADER_LEN + 1];
+    std::snprintf(h, sizeof(h), "LCSEG %d key=%016" PRIx64 " first=%020" PRIu64 " last=%020" PRIu64 "\n", framed ? 2 : 1, s.keyId, s.firstMs, s.lastMs);
+    return std::string(h, SEGMENT_HEADER_LEN);
+}
+
+inline bool segment_file_is_framed(const std::string &path) {
+    char h[sizeof(SEGMENT_HEADER_FRAMED) - 1] = {};
+    std::ifstream in(path, std::ios::binary);
+    return in.read(h, sizeof(h)) && std::memcmp(h, SEGMENT_HEADER_FRAMED, sizeof(h)) == 0;
+}
+
+// The key id in a segment file's header; false if the file has no segment header.
+inline bool segment_file_key(const std::string &path, uint64_t &keyId) {
+    char h[SEGMENT_HEADER_LEN + 1] = {};
+    std::ifstream in(path, std::ios::binary);
+    if (!in.read(h, SEGMENT_HEADER_LEN) || std::memcmp(h, SEGMENT_HEADER_TAG, sizeof(SEGMENT_HEADER_TAG) - 1) != 0) return false;
+    const char *k = std::strstr(h, " key=");
+    if (!k) return false;
+    char *end = nullptr;
+    uint64_t id = std::strtoull(k + 5, &end, 16);
+    if (end != k + 5 + 16) return false;
+    keyId = id;
+    return true;
+}
+
+inline std::string segment_file_name(uint64_t seq) {
+    char name[32];
+    std::snprintf(name, sizeof(name), "segment-%06" PRIu64 ".log", seq);
+    return name;
+}
+
+inline std::vector<LogSegment> read_log_manifest(const std::string &dir) {
+    std::vector<LogSegment> segs;
+    std::ifstream in(dir + "/" + LOG_MANIFEST);
+    if (!in.is_open()) {
+        // older layout: the single file is segment 0
+        std::error_code ec;
+        if (std::filesystem::exists(dir + "/" + LEGACY_LOG_FILE, ec)) {
+            LogSegment s;
+            s.file = LEGACY_LOG_FILE;
+            s.state = SEGMENT_SEALED;
+            LogReader r(dir + "/" + LEGACY_LOG_FILE);
+            s.records = r.size();
+            if (r.size()) { s.firstMs = r.entry(0).timeMs; s.lastMs = r.entry(r.size() - 1).timeMs; }
+            segs.push_back(s);
+        }
+        return segs;
+    }
+    std::string line, state;
+    if (!std::getline(in, line) || line != "LCMANIFEST 1") throw std::runtime_error("bad log manifest in " + dir);
+    while (std::getline(in, line)) {
+        if (line.empty()) continue;
+        std::istringstream f(line);
+        LogSegment s;
+        f >> s.seq >> s.file >> std::hex >> s.keyId >> std::dec >> s.firstMs >> s.lastMs >> s.records >> state;
+        if (f.fail()) throw std::runtime_error("bad log manifest line: " + line);
+        s.state = state == "active" ? SEGMENT_ACTIVE : state == "archived" ? SEGMENT_ARCHIVED : SEGMENT_SEALED;
+        if (s.state == SEGMENT_SEALED) segment_file_key(dir + "/" + s.file, s.keyId);
+        segs.push_back(s);
+    }
+    return segs;
+}
+
+inline void write_log_manifest(const std::string &dir, const std::vector<LogSegment> &segs) {
+    static const char *const states[] = {"active", "sealed", "archived"};
+    const std::string path = dir + "/" + LOG_MANIFEST, tmp = path + ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        if (!out.is_open()) throw std::runtime_error("cannot create " + tmp);
+        out << "LCMANIFEST 1\n";
+        char key[17];
+        for (const LogSegment &s : segs) {
+            std::snprintf(key, sizeof(key), "%016" PRIx64, s.keyId);
+            out << s.seq << ' ' << s.file << ' ' << key << ' ' << s.firstMs << ' ' << s.lastMs << ' ' << s.records << ' '
+                << states[s.state] << '\n';
+        }
+        out.close();
+        if (!out) throw std::runtime_error("failed writing " + tmp);
+    }
+    sync_file(tmp);
+    std::filesystem::rename(tmp, path);
+    sync_dir(dir);
+}
+
+// The messenger's log appender. Not synchronized; one appender thread owns it.
+class SegmentedLogWriter {
+public:
+    SegmentedLogWriter(const std::string &dir, uint64_t keyId, uint64_t maxBytes, std::chrono::milliseconds maxAge,
+                       size_t keepSealed, LogOpener open)
+        : dir(dir), keyId(keyId), maxBytes(maxBytes), maxAgeMs((uint64_t)std::max<long long>(0, maxAge.count())),
+          keepSealed(keepSealed), open(keyId ? std::move(open) : LogOpener()) {
+        std::filesystem::create_directories(dir);
+        segs = read_log_manifest(dir);
+        if (!segs.empty() && segs.back().state == SEGMENT_ACTIVE) {
+            LogSegment &active = segs.back();
+            if (active.keyId == keyId && segment_file_is_framed(path_of(active))) { resume(); return; }
+            seal_active(); // the log key or the format changed (or the file is gone): start a new segment
+        }
+        start(unix_ms_now());
+    }
+    ~SegmentedLogWriter() {
+        try { flush(); } catch (const std::exception &) {}
+    }
+
+    // Appends a sealed frame (one write), rotating first if the active segment is full or too
+    // old. Frames never straddle segments, so a segment may exceed maxBytes by under one frame.
+    void append(const LogFrameBuilder &frame) {
+        if (frame.empty()) return;
+        const std::string &bytes = frame.frame();
+        const uint64_t nowMs = frame.records().front().timeMs;
+        bool full = maxBytes && offset + bytes.size() > maxBytes;
+        bool old = maxAgeMs && nowMs >= segs.back().firstMs + maxAgeMs;
+        if (records && (full || old)) {
+            seal_active();
+            start(nowMs);
+        }
+        out.write(bytes.data(), (std::streamsize)bytes.size());
+        LogIndexEntry e;
+        e.offset = offset;
+        e.length = (uint32_t)bytes.size();
+        e.framed = true;
+        for (const LogFrameBuilder::Record &r : frame.records()) {
+            e.priority = r.priority;
+            e.timeMs = r.timeMs;
+            index->append(e);
+            ++e.slot;
+        }
+        offset += bytes.size();
+        records += frame.count();
+        lastMs = frame.records().back().timeMs;
+    }
+
+    // The segment first, then its index: an index entry never points past the segment.
+    void flush() {
+        out.flush();
+        if (!out) throw std::runtime_error("failed writing " + path_of(segs.back()));
+        index->flush();
+    }
+
+    size_t recoveredEntries() const { return recovered; }
+
+    // Moves to another log key (a new epoch): the active segment is sealed and the next frame
+    // starts a segment under `newKeyId`, so rotating costs one segment switch.
+    void setKey(uint64_t newKeyId, LogOpener newOpen) {
+        if (newKeyId == keyId) return;
+        seal_active();
+        keyId = newKeyId;
+        open = newKeyId ? std::move(newOpen) : LogOpener();
+        start(unix_ms_now());
+    }
+
+    // Re-seals the oldest sealed segment under another key with `key` (the writer's), frame by
+    // frame, stopping once about `budget` bytes are written; call it again to go on. `old`
+    // opens the segment's frames. The new file and its index are built beside the segment and
+    // renamed over it when complete, then the manifest takes the new key id. Segments `old`
+    // cannot open, line-format ones and archived ones are left as they are. False once there
+    // is nothing left to do.
+    bool resealStep(uint64_t budget, const SegmentOpener &old, ByteSpan key, SuiteId suite) {
+        uint64_t written = 0;
+        while (written < budget) {
+            if (!reseal && !reseal_next(old)) return false;
+            LogSegment *s = segment_by_seq(reseal->seq);
+            if (!s || s->state != SEGMENT_SEALED || s->file != reseal->file) { reseal_abandon(false); continue; }
+            try {
+                written += reseal_frame(key, suite);
+                if (reseal->next == reseal->src->size()) reseal_finish(*s);
+            } catch (const std::exception &) {
+                reseal_abandon(true); // unreadable under the key its id names
+            }
+        }
+        return true;
+    }
+
+private:
+    std::string path_of(const LogSegment &s) const { return dir + "/" + s.file; }
+
+    LogSegment *segment_by_seq(uint64_t seq) {
+        for (LogSegment &s : segs)
+            if (s.seq == seq) return &s;
+        return nullptr;
+    }
+
+    // A segment being rebuilt under the writer's key.
+    struct Reseal {
+        uint64_t seq;
+        std::string file, tmp;
+        LogOpener open;
+        std::unique_ptr<MappedFile> bytes;
+        std::unique_ptr<LogReader> src;
+        size_t next = 0; // the first record not yet rewritten
+        std::ofstream out;
+        std::unique_ptr<LogIndexWriter> index;
+        uint64_t offset = SEGMENT_HEADER_LEN;
+    };
+
+    bool reseal_next(const SegmentOpener &old) {
+        for (const LogSegment &s : segs) {
+            if (s.state != SEGMENT_SEALED || !s.keyId || s.keyId == keyId || resealSkipped.count(s.seq)) continue;
+            LogOpener o = old ? old(s) : nullptr;
+            if (!o || !segment_file_is_framed(path_of(s))) { resealSkipped.insert(s.seq); continue; }
+            std::unique_ptr<Reseal> r(new Reseal);
+            r->seq = s.seq;
+            r->file = s.file;
+            r->tmp = path_of(s) + ".reseal";
+            r->open = std::move(o);
+            try {
+                r->bytes.reset(new MappedFile(path_of(s)));
+                r->src.reset(new LogReader(path_of(s)));
+                LogSegment h = s;
+                h.keyId = keyId;
+                r->out.open(r->tmp, std::ios::binary | std::ios::trunc);
+                if (!r->out.is_open()) throw std::runtime_error("cannot create " + r->tmp);
+                r->out << segment_header(h);
+                r->out.flush();
+                std::remove(log_index_path(r->tmp).c_str());
+                r->index.reset(new LogIndexWriter(r->tmp, r->open));
+            } catch (const std::exception &) {
+                resealSkipped.insert(s.seq);
+                r->out.close();
+                std::remove(r->tmp.c_str());
+                continue;
+            }
+            reseal = std::move(r);
+            return true;
+        }
+        return false;
+    }
+
+    // Rewrites the frame holding record `next`; returns the bytes written.
+    uint64_t reseal_frame(ByteSpan key, SuiteId suite) {
+        Reseal &r = *reseal;
+        if (r.next == r.src->size()) return 0;
+        ByteSpan log(r.bytes->data(), r.bytes->size());
+        LogIndexEntry e = r.src->entry(r.next);
+        LogFrameHeader h;
+        if (!e.framed || e.slot || !log_frame_at(log, e.offset, h) || r.next + h.count > r.src->size())
+            throw std::runtime_error("unexpected frame");
+        std::string batch = open_log_frame(log, e.offset, h, r.open), frame;
+        seal_log_frame(frame, ByteSpan(batch), h.count, key, suite);
+        if (!batch.empty()) sodium_memzero(&batch[0], batch.size());
+        r.out.write(frame.data(), (std::streamsize)frame.size());
+        for (uint32_t slot = 0; slot < h.count; ++slot) {
+            LogIndexEntry n = r.src->entry(r.next + slot);
+            n.offset = r.offset;
+            n.length = (uint32_t)frame.size();
+            r.index->append(n);
+        }
+        r.next += h.count;
+        r.offset += frame.size();
+        return frame.size();
+    }
+
+    void reseal_finish(LogSegment &s) {
+        Reseal &r = *reseal;
+        r.out.flush();
+        if (!r.out) throw std::runtime_error("failed writing " + r.tmp);
+        r.out.close();
+        r.index->flush();
+        r.index.reset();
+        r.src.reset();
+        r.bytes.reset();
+        // on disk before either rename can be: the renamed file's header names the new key
+        sync_file(r.tmp);
+        sync_file(log_index_path(r.tmp));
+        sync_dir(dir);
+        const std::string path = path_of(s);
+        std::filesystem::rename(r.tmp, path);
+        std::filesystem::rename(log_index_path(r.tmp), log_index_path(path));
+        sync_dir(dir);
+        s.keyId = keyId;
+        reseal.reset();
+        write_log_manifest(dir, segs);
+    }
+
+    void reseal_abandon(bool skip) {
+        if (skip) resealSkipped.insert(reseal->seq);
+        reseal->out.close();
+        reseal->index.reset();
+        std::remove(reseal->tmp.c_str());
+        std::remove(log_index_path(reseal->tmp).c_str());
+        reseal.reset();
+    }
+
+    void resume() {
+        const std::string path = path_of(segs.back());
+        index.reset(new LogIndexWriter(path, open));
+        recovered = index->recoveredEntries();
+        LogReader r(path);
+        records = r.size();
+        lastMs = records ? r.entry(records - 1).timeMs : 0;
+        // drop a frame torn by a crash, or the next ones would sit behind it unreachable
+        offset = records ? r.entry(records - 1).end() : SEGMENT_HEADER_LEN;
+        if (std::filesystem::file_size(path) > offset) std::filesystem::resize_file(path, offset);
+        out.open(path, std::ios::binary | std::ios::app);
+        if (!out.is_open()) throw std::runtime_error("cannot open " + path);
+    }
+
+    void start(uint64_t nowMs) {
+        LogSegment s;
+        s.seq = segs.empty() ? 1 : segs.back().seq + 1;
+        s.file = segment_file_name(s.seq);
+        s.keyId = keyId;
+        s.firstMs = nowMs;
+        const std::string path = path_of(s);
+        out.open(path, std::ios::binary | std::ios::trunc);
+        if (!out.is_open()) throw std::runtime_error("cannot create " + path);
+        out << segment_header(s);
+        out.flush();
+        offset = SEGMENT_HEADER_LEN;
+        records = 0;
+        lastMs = 0;
+        std::remove(log_index_path(path).c_str());
+        index.reset(new LogIndexWriter(path, open));
+        segs.push_back(s);
+        write_log_manifest(dir, segs);
+    }
+
+    // Closes the active segment, stamps its header with the last record time, and applies retention.
+    void seal_active() {
+        LogSegment &s = segs.back();
+        const std::string path = path_of(s);
+        if (out.is_open()) { flush(); out.close(); }
+        index.reset();
+        if (!records && std::filesystem::exists(path)) {
+            LogReader r(path);
+            records = r.size();
+            lastMs = records ? r.entry(records - 1).timeMs : 0;
+        }
+        s.lastMs = lastMs ? lastMs : s.firstMs;
+        s.records = records;
+        s.state = SEGMENT_SEALED;
+        {
+            bool framed = segment_file_is_framed(path);
+            std::fstream f(path, std::ios::binary | std::ios::in | std::ios::out);
+            if (f.is_open()) f.seekp(0).write(segment_header(s, framed).data(), SEGMENT_HEADER_LEN);
+        }
+        retain();
+        write_log_manifest(dir, segs);
+    }
+
+    // Keeps the newest `keepSealed` sealed segments in place and moves older ones to archive/.
+    void retain() {
+        if (!keepSealed) return;
+        size_t sealed = 0;
+        for (auto it = segs.rbegin(); it != segs.rend(); ++it) {
+            if (it->state != SEGMENT_SEALED || ++sealed <= keepSealed) continue;
+            std::filesystem::create_directories(dir + "/archive");
+            std::string name = std::filesystem::path(it->file).filename().string();
+            std::error_code ec;
+            std::filesystem::rename(path_of(*it), dir + "/archive/" + name, ec);
+            if (ec) continue;
+            std::filesystem::rename(log_index_path(path_of(*it)), log_index_path(dir + "/archive/" + name), ec);
+            it->file = "archive/" + name;
+            it->state = SEGMENT_ARCHIVED;
+        }
+    }
+
+    std::string dir;
+    uint64_t keyId, maxBytes, maxAgeMs;
+    size_t keepSealed;
+    LogOpener open;
+    std::vector<LogSegment> segs; // manifest order; the last one is active
+    std::ofstream out;
+    std::unique_ptr<LogIndexWriter> index;
+    uint64_t offset = 0, records = 0, lastMs = 0;
+    size_t recovered = 0;
+    std::unique_ptr<Reseal> reseal;
+    std::set<uint64_t> resealSkipped; // segment seqs
+};
+
+// Read-only view of a segmented (or older single-file) log directory. Segments are opened on
+// demand: `last` opens the newest non-empty one, a time query only those whose span overlaps it.
+// With `keys`, each segment is opened with the opener it picks, else with the caller's.
+class SegmentedLogReader {
+public:
+    explicit SegmentedLogReader(const std::string &dir, SegmentOpener keys = nullptr)
+        : dir(dir), segs(read_log_manifest(dir)), keys(std::move(keys)) {}
+
+    const std::vector<LogSegment> &segments() const { return segs; }
+
+    // The plain last record (see LogIndex.h for `open`).
+    bool last(const LogOpener &open, std::string &out) const {
+        for (auto it = segs.rbegin(); it != segs.rend(); ++it) {
+            std::unique_ptr<LogReader> r = reader(*it);
+            if (r && r->last(opener_for(*it, open), out)) return true;
+        }
+        return false;
+    }
+
+    // Calls fn(const LogSegment&, const std::string &plain) for the newest `count` records,
+    // oldest first.
+    template <class F>
+    void forEachRecent(size_t count, const LogOpener &open, F fn) const {
+        struct Pick {
+            size_t segment, first;
+            std::unique_ptr<LogReader> reader;
+        };
+        std::vector<Pick> picked; // newest segment first
+        size_t need = count;
+        for (size_t i = segs.size(); i-- > 0 && need;) {
+            std::unique_ptr<LogReader> r = reader(segs[i]);
+            if (!r || !r->size()) continue;
+            size_t take = std::min(need, r->size());
+            need -= take;
+            picked.push_back(Pick{i, r->size() - take, std::move(r)});
+        }
+        for (auto it = picked.rbegin(); it != picked.rend(); ++it) {
+            const LogSegment &s = segs[it->segment];
+            it->reader->read(it->first, it->reader->size(), opener_for(s, open), [&](size_t, const std::string &plain) { fn(s, plain); });
+        }
+    }
+
+    // Calls fn(const LogSegment&, const std::string &plain) for records appended in
+    // [fromMs, toMs], oldest first, skipping segments whose header span lies outside it.
+    template <class F>
+    void forEachInRange(uint64_t fromMs, uint64_t toMs, const LogOpener &open, F fn) const {
+        for (const LogSegment &s : segs) {
+            if (s.state == SEGMENT_ARCHIVED) continue;
+            bool open_ended = s.state == SEGMENT_ACTIVE || !s.lastMs;
+            if ((s.firstMs && s.firstMs > toMs) || (!open_ended && s.lastMs < fromMs)) continue;
+            std::unique_ptr<LogReader> r = reader(s);
+            if (!r) continue;
+            std::pair<size_t, size_t> range = r->timeRange(fromMs, toMs);
+            r->read(range.first, range.second, opener_for(s, open), [&](size_t, const std::string &plain) { fn(s, plain); });
+        }
+    }
+
+    // A reader for one segment; null if it cannot be opened, or is archived and `archived` is false.
+    std::unique_ptr<LogReader> reader(const LogSegment &s, bool archived = false) const {
+        if (s.state == SEGMENT_ARCHIVED && !archived) return nullptr;
+        try { return std::unique_ptr<LogReader>(new LogReader(dir + "/" + s.file)); }
+        catch (const std::exception &) { return nullptr; }
+    }
+
+    LogOpener opener_for(const LogSegment &s, const LogOpener &open) const {
+        if (segment_unkeyed(s)) return nullptr;
+        LogOpener o = keys ? keys(s) : nullptr;
+        return o ? o : open;
+    }
+
+private:
+    std::string dir;
+    std::vector<LogSegment> segs;
+    SegmentOpener keys;
+};
+
+// Last record of the log in `dir`, opened with `open` (or what `keys` picks); false if there is
+// none or the log cannot be read. Exceptions from the opener propagate.
+inline bool read_last_log_record(const std::string &dir, const LogOpener &open, std::string &out, SegmentOpener keys = nullptr) {
+    std::unique_ptr<SegmentedLogReader> r;
+    try { r.reset(new SegmentedLogReader(dir, std::move(keys))); } catch (const std::exception &) { return false; }
+    return r->last(open, out);
+}
+
+#endif // SEGMENTEDLOG_H
@@ -0,0 +1,60 @@
+// SentHistory.h
+// Fixed-capacity ring of what was sent this session: a hash prefix of the ciphertext (enough to
+// match an entry against the log), priority, send time, transport outcome and latency. About 32
+// bytes an entry; once full, the oldest entry is overwritten. The encrypted log keeps the rest.
+#ifndef SENTHISTORY_H
+#define SENTHISTORY_H
+
+#include "Encryption.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+enum SendStatus : uint8_t { SEND_OK, SEND_FAILED, SEND_LOCAL }; // SEND_LOCAL: logged, transport disabled
+
+struct SentRecord {
+    unsigned char hash[8];  // BLAKE2b-64 of the message ciphertext
+    uint64_t sentMs = 0;    // wall clock, ms since the epoch
+    uint32_t latencyMs = 0; // transport time (post plus attachment upload)
+    uint32_t repeats = 1;
+    uint8_t priority = 2;
+    SendStatus status = SEND_OK;
+};
+
+inline void ciphertext_hash(unsigned char out[8], ByteSpan ciphertext) {
+    crypto_generichash(out, 8, ciphertext.data(), ciphertext.size(), nullptr, 0);
+}
+
+inline std::string hash_hex(const unsigned char hash[8]) {
+    char hex[17];
+    sodium_bin2hex(hex, sizeof(hex), hash, 8);
+    return hex;
+}
+
+// Not synchronized; the owner locks around it.
+class SentHistory {
+public:
+    explicit SentHistory(size_t capacity) : ring(capacity ? capacity : 1) {}
+
+    void push(const SentRecord &rec) {
+        ring[total % ring.size()] = rec;
+        ++total;
+    }
+
+    size_t size() const { return total < ring.size() ? (size_t)total : ring.size(); }
+    // entries pushed but no longer held
+    uint64_t evicted() const { return total - size(); }
+
+    // Calls fn(const SentRecord&) oldest first.
+    template <class F>
+    void visit(F fn) const {
+        for (uint64_t i = total - size(); i < total; ++i) fn((const SentRecord&)ring[i % ring.size()]);
+    }
+
+private:
+    std::vector<SentRecord> ring;
+    uint64_t total = 0;
+};
+
+#endif // SENTHISTORY_H
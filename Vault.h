@@ -6,15 +6,19 @@
 #include <string>
 #include <fstream>
 
-inline void save_vault(const std::string &path, const std::string &jsondata, const std::string &masterKey) {
-    std::string boxed = encrypt_aead(jsondata, masterKey);
-    std::string b64 = binToBase64((const unsigned char*)boxed.data(), boxed.size());
+// Sealed with the fastest suite on this host; load_vault opens any suite or the untagged layout.
+inline void save_vault(const std::string &path, const std::string &jsondata, ByteSpan masterKey) {
+    SuiteId suite = best_suite();
+    std::vector<unsigned char> boxed(aead_boxed_len(suite, jsondata.size()));
+    boxed.resize(encrypt_aead(MutableByteSpan(boxed), ByteSpan(jsondata), masterKey, suite));
+    std::string b64;
+    binToBase64(b64, ByteSpan(boxed));
     std::ofstream f(path, std::ios::binary | std::ios::trunc);
     f << b64;
     f.close();
 }
 
-inline std::string load_vault(const std::string &path, const std::string &masterKey) {
+inline SecureString load_vault(const std::string &path, ByteSpan masterKey) {
     std::ifstream f(path, std::ios::binary);
     if (!f.is_open()) return "{}";
     std::string b64;
@@ -22,8 +26,7 @@ inline std::string load_vault(const std::string &path, const std::string &master
     f.close();
     if (b64.empty()) return "{}";
     auto bin = base64ToBin(b64);
-    std::string boxed((char*)bin.data(), bin.size());
-    return decrypt_aead(boxed, masterKey);
+    return decrypt_aead_secure(ByteSpan(bin), masterKey);
 }
 
 #endif // VAULT_H
@@ -0,0 +1,62 @@
+// bench_base64.cpp
+// Usage: ./bench_base64 [record_bytes] [MiB]
+// Compares libsodium's base64 with the Base64.h kernels (scalar / SSSE3 / AVX2) on records of
+// record_bytes (default 256, about one log record) until MiB of input has been processed.
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdlib>
+#include "Encryption.h"
+
+template <class F>
+static double mib_per_s(size_t bytes_per_call, size_t calls, F fn) {
+    auto t0 = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < calls; ++i) fn();
+    double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    return (double)bytes_per_call * calls / (1024.0 * 1024.0) / s;
+}
+
+int main(int argc, char **argv) {
+    try { init_crypto(); } catch (const std::exception &e) { std::cerr<<"libsodium init failed: "<<e.what()<<"\n"; return 1; }
+    size_t rec = argc > 1 ? (size_t)std::strtoul(argv[1], nullptr, 10) : 256;
+    size_t mib = argc > 2 ? (size_t)std::strtoul(argv[2], nullptr, 10) : 512;
+    if (rec == 0 || mib == 0) { std::cerr << "Usage: " << argv[0] << " [record_bytes] [MiB]\n"; return 2; }
+    size_t calls = mib * 1024 * 1024 / rec + 1;
+
+    std::vector<unsigned char> bin(rec), back(rec + 3);
+    randombytes_buf(bin.data(), bin.size());
+    size_t b64_len = sodium_base64_encoded_len(rec, sodium_base64_VARIANT_ORIGINAL);
+    std::string b64(b64_len, '\0');
+    sodium_bin2base64(&b64[0], b64_len, bin.data(), rec, sodium_base64_VARIANT_ORIGINAL);
+    b64.resize(b64_len - 1);
+    std::vector<char> enc(b64_len);
+    volatile size_t sink = 0;
+
+    std::cout << "record " << rec << " bytes, " << mib << " MiB per run, best kernel: "
+              << b64_impl_name(b64_best_impl()) << "\n";
+    double ref_enc = mib_per_s(rec, calls, [&] {
+        sodium_bin2base64(enc.data(), b64_len, bin.data(), rec, sodium_base64_VARIANT_ORIGINAL);
+        sink += (size_t)enc[0];
+    });
+    double ref_dec = mib_per_s(rec, calls, [&] {
+        size_t n = 0;
+        sodium_base642bin(back.data(), back.size(), b64.data(), b64.size(), NULL, &n, NULL, sodium_base64_VARIANT_ORIGINAL);
+        sink += n;
+    });
+    std::cout << "  libsodium  encode " << (long)ref_enc << " MiB/s  decode " << (long)ref_dec << " MiB/s\n";
+
+    for (B64Impl impl : {B64_SCALAR, B64_SSSE3, B64_AVX2}) {
+        if (impl > b64_best_impl()) break;
+        double e = mib_per_s(rec, calls, [&] { sink += b64_encode(enc.data(), bin.data(), rec, impl); });
+        double d = mib_per_s(rec, calls, [&] {
+            size_t n = 0;
+            b64_decode(back.data(), &n, b64.data(), b64.size(), impl);
+            sink += n;
+        });
+        std::cout << "  " << b64_impl_name(impl) << std::string(10 - std::strlen(b64_impl_name(impl)), ' ')
+                  << " encode " << (long)e << " MiB/s (x" << e / ref_enc << ")  decode " << (long)d
+                  << " MiB/s (x" << d / ref_dec << ")\n";
+    }
+    return 0;
+}
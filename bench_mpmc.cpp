@@ -0,0 +1,108 @@
+// bench_mpmc.cpp
+// Usage: ./bench_mpmc [items_per_producer] [consumers]
+// Contention benchmark for the ingest ring (MpmcRing.h) against a mutex-guarded deque of the
+// same capacity, with 1..64 producer threads and a fixed number of consumer threads. Every run
+// also checks that each pushed item was popped exactly once (by sum).
+#include <iostream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include "MpmcRing.h"
+
+static const size_t CAPACITY = 1024;
+
+// the baseline: what a vector/deque behind one lock gives you
+class LockedQueue {
+public:
+    bool try_push(uint64_t &v) {
+        std::lock_guard<std::mutex> lock(mu);
+        if (q.size() >= CAPACITY) return false;
+        q.push_back(v);
+        return true;
+    }
+    bool try_pop(uint64_t &out) {
+        std::lock_guard<std::mutex> lock(mu);
+        if (q.empty()) return false;
+        out = q.front();
+        q.pop_front();
+        return true;
+    }
+private:
+    std::mutex mu;
+    std::deque<uint64_t> q;
+};
+
+// Returns million items per second; sets ok to whether every item arrived exactly once.
+template <class Q>
+static double run(Q &q, size_t producers, size_t consumers, size_t per_producer, bool &ok) {
+    const uint64_t total = (uint64_t)producers * per_producer;
+    std::atomic<uint64_t> popped{0}, sum{0};
+    std::atomic<bool> go{false};
+    std::vector<std::thread> threads;
+    for (size_t p = 0; p < producers; ++p) {
+        threads.emplace_back([&, p] {
+            while (!go.load(std::memory_order_acquire)) std::this_thread::yield();
+            for (uint64_t i = 0; i < per_producer; ++i) {
+                uint64_t v = p * per_producer + i + 1;
+                while (!q.try_push(v)) std::this_thread::yield();
+            }
+        });
+    }
+    for (size_t c = 0; c < consumers; ++c) {
+        threads.emplace_back([&] {
+            while (!go.load(std::memory_order_acquire)) std::this_thread::yield();
+            uint64_t v, local_sum = 0, local_n = 0;
+            while (popped.load(std::memory_order_relaxed) + local_n < total) {
+                if (q.try_pop(v)) {
+                    local_sum += v;
+                    if (++local_n == 256) { // publish in chunks to keep the counter off the hot path
+                        popped.fetch_add(local_n);
+                        local_n = 0;
+                    }
+                } else {
+                    if (local_n) { popped.fetch_add(local_n); local_n = 0; }
+                    std::this_thread::yield();
+                }
+            }
+            popped.fetch_add(local_n);
+            sum.fetch_add(local_sum);
+        });
+    }
+    auto t0 = std::chrono::steady_clock::now();
+    go.store(true, std::memory_order_release);
+    for (auto &t : threads) t.join();
+    double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    ok = popped.load() == total && sum.load() == total * (total + 1) / 2;
+    return (double)total / 1e6 / s;
+}
+
+int main(int argc, char **argv) {
+    size_t per_producer = argc > 1 ? (size_t)std::strtoul(argv[1], nullptr, 10) : 200000;
+    size_t consumers = argc > 2 ? (size_t)std::strtoul(argv[2], nullptr, 10) : 2;
+    if (per_producer == 0 || consumers == 0) {
+        std::cerr << "Usage: " << argv[0] << " [items_per_producer] [consumers]\n";
+        return 2;
+    }
+    std::cout << "capacity " << CAPACITY << ", " << per_producer << " items per producer, " << consumers
+              << " consumers, " << std::thread::hardware_concurrency() << " hardware threads\n";
+    std::cout << "producers   mpmc ring Mitems/s   mutex deque Mitems/s\n";
+    bool all_ok = true;
+    for (size_t producers : {1, 2, 4, 8, 16, 32, 64}) {
+        bool ok1 = false, ok2 = false;
+        MpmcRing<uint64_t> ring(CAPACITY);
+        double a = run(ring, producers, consumers, per_producer, ok1);
+        LockedQueue locked;
+        double b = run(locked, producers, consumers, per_producer, ok2);
+        std::string pad = std::to_string(producers);
+        std::cout << std::string(9 - pad.size(), ' ') << pad << "   " << a << "   " << b
+                  << (ok1 && ok2 ? "" : "   LOST/DUPLICATED ITEMS") << "\n";
+        all_ok = all_ok && ok1 && ok2;
+    }
+    return all_ok ? 0 : 1;
+}
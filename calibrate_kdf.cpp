@@ -0,0 +1,131 @@
+// calibrate_kdf.cpp
+// Usage: ./calibrate_kdf [--target-ms N] [--mem-mib N] [--apply]
+// Benchmarks crypto_pwhash on this host and picks Argon2id limits for the target unlock
+// latency (default 500 ms) within the memory budget (default 64 MiB). With --apply the result
+// is written to user_key.hdr and every log key (current and older epochs) is rewrapped under the
+// new masterKey; the replaced files are kept as <file>.<yyyymmdd-hhmmss>.bak. --apply refuses
+// to run while messages are queued or journaled: they are sealed under the old masterKey.
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <filesystem>
+#include <cstdlib>
+#include <ctime>
+
+#include "Encryption.h"
+#include "Journal.h"
+#include "KeyHeader.h"
+#include "LogKeyring.h"
+
+namespace fs = std::filesystem;
+
+// Queued messages are sealed under the current masterKey and would be stranded by a new one.
+static std::vector<std::string> pending_messages() {
+    std::vector<std::string> found;
+    const std::string journal_dir = "modules/emergency_messenger/journal";
+    if (fs::exists(journal_dir)) {
+        try {
+            size_t n = QueueJournal(journal_dir).recovered().size();
+            if (n) found.push_back(std::to_string(n) + " journaled message(s) in " + journal_dir);
+        } catch (const std::exception &e) {
+            found.push_back(journal_dir + " (unreadable: " + e.what() + ")");
+        }
+    }
+    std::error_code ec;
+    if (fs::file_size("messages.store", ec) > 0 && !ec) found.push_back("the saved queue in messages.store");
+    return found;
+}
+
+// Keeps every earlier copy: <path>.<yyyymmdd-hhmmss>.bak.
+static std::string backup_file(const std::string &path, const std::string &stamp) {
+    std::string backup = path + "." + stamp + ".bak";
+    fs::copy_file(path, backup, fs::copy_options::overwrite_existing);
+    return backup;
+}
+
+static void replace_file(const std::string &path, const std::vector<unsigned char> &bytes) {
+    write_binary_file(path + ".tmp", bytes);
+    fs::rename(path + ".tmp", path);
+}
+
+int main(int argc, char **argv) {
+    double target_ms = 500;
+    size_t mem_mib = 64;
+    bool apply = false;
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        if (a == "--target-ms" && i + 1 < argc) target_ms = std::atof(argv[++i]);
+        else if (a == "--mem-mib" && i + 1 < argc) mem_mib = (size_t)std::atol(argv[++i]);
+        else if (a == "--apply") apply = true;
+        else { std::cerr << "Usage: " << argv[0] << " [--target-ms N] [--mem-mib N] [--apply]\n"; return 2; }
+    }
+    if (target_ms <= 0 || mem_mib < 8) { std::cerr << "Need --target-ms > 0 and --mem-mib >= 8\n"; return 2; }
+
+    try { init_crypto(); } catch (const std::exception &e) { std::cerr<<"libsodium init failed: "<<e.what()<<"\n"; return 1; }
+
+    std::cout << "Calibrating Argon2id for " << target_ms << " ms within " << mem_mib << " MiB...\n";
+    KdfParams kdf;
+    double measured = 0;
+    try { kdf = kdf_calibrate(target_ms, mem_mib * 1024 * 1024, &measured); }
+    catch (const std::exception &e) { std::cerr << "Calibration failed: " << e.what() << "\n"; return 3; }
+    std::cout << "Chosen: opslimit=" << kdf.opslimit << " memlimit=" << kdf.memlimit / (1024 * 1024)
+              << " MiB, measured unlock " << (long)measured << " ms\n";
+    if (!apply) { std::cout << "Re-run with --apply to write the key header.\n"; return 0; }
+
+    std::string keydir = "modules/emergency_messenger/keys";
+    std::string header_path = keydir + "/user_key.hdr";
+    fs::create_directories(keydir);
+    std::vector<std::string> log_keys = log_key_files(keydir);
+    char stamp[32];
+    std::time_t now = std::time(nullptr);
+    std::strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", std::localtime(&now));
+
+    // fresh install: nothing is bound to the old parameters yet
+    if (log_keys.empty()) {
+        if (fs::exists(header_path)) std::cout << "Old header kept as " << backup_file(header_path, stamp) << "\n";
+        replace_file(header_path, encode_key_header(kdf));
+        std::cout << "Wrote " << header_path << "\n";
+        return 0;
+    }
+
+    std::vector<std::string> pending = pending_messages();
+    if (!pending.empty()) {
+        std::cerr << "Messages are still queued under the current masterKey:\n";
+        for (const std::string &p : pending) std::cerr << " - " << p << "\n";
+        std::cerr << "Send them (or discard them) with the messenger first, then re-run with --apply.\n";
+        return 6;
+    }
+
+    // existing keys: rewrap every log key under the masterKey derived with the new parameters
+    KdfParams old_kdf;
+    try { old_kdf = load_kdf_params(keydir); }
+    catch (const std::exception &e) { std::cerr << "Cannot load current KDF parameters: " << e.what() << "\n"; return 4; }
+
+    SecureString pass;
+    std::cout << "Passphrase: ";
+    std::getline(std::cin, pass);
+    try {
+        // unwrap and rewrap everything before anything is written
+        SecureString old_master = derive_master_key(pass, old_kdf);
+        SecureString new_master = derive_master_key(pass, kdf);
+        std::vector<std::vector<unsigned char>> rewrapped;
+        for (const std::string &f : log_keys) {
+            SecureString logKey = decrypt_aead_secure(ByteSpan(read_binary_file(f)), ByteSpan(old_master));
+            rewrapped.emplace_back(aead_boxed_len(logKey.size()));
+            encrypt_aead(MutableByteSpan(rewrapped.back()), ByteSpan(logKey), ByteSpan(new_master));
+        }
+
+        for (const std::string &f : log_keys) backup_file(f, stamp);
+        if (fs::exists(header_path)) std::cout << "Old header kept as " << backup_file(header_path, stamp) << "\n";
+        for (size_t i = 0; i < log_keys.size(); ++i) replace_file(log_keys[i], rewrapped[i]);
+        replace_file(header_path, encode_key_header(kdf));
+    } catch (const std::exception &e) {
+        std::cerr << "Failed to apply new parameters: " << e.what() << "\n";
+        return 5;
+    }
+    std::cout << "Wrote " << header_path << " and rewrapped " << log_keys.size() << " log key(s) (backups: *." << stamp << ".bak).\n"
+              << "Inner log ciphertexts made under the old masterKey still need the old parameters: keep\n"
+              << header_path << "." << stamp << ".bak to read them (try_all_salts_and_decrypt finds it).\n";
+    return 0;
+}
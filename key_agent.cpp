@@ -0,0 +1,225 @@
+// key_agent.cpp
+// Usage: ./key_agent [--ttl seconds] [--socket path] [--allow-export]
+// Derives the master key once, unwraps wrapped_logkey.bin and keeps both in sodium_malloc'd
+// (guard-paged, mlock'd) memory. Serves requests on a 0600 Unix socket, in a private directory,
+// to peers with our uid, each connection on its own thread; wipes the keys and exits after
+// --ttl seconds without a request (default 900).
+// Keys never leave the agent unless --allow-export is given; without it the tools that need raw
+// keys (the messenger, reencrypt_log, ...) ask for the passphrase instead.
+// Start it, then export LIFECORE_AGENT_SOCK as printed so the tools run in client mode.
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <filesystem>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include <poll.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "Encryption.h"
+#include "KeyAgent.h"
+#include "KeyHeader.h"
+
+namespace fs = std::filesystem;
+
+struct HeldKeys {
+    unsigned char master[MASTER_KEY_LEN];
+    unsigned char log[MASTER_KEY_LEN];
+    bool haveLog;
+};
+
+static volatile std::sig_atomic_t stop_requested = 0;
+static void on_signal(int) { stop_requested = 1; }
+
+static bool peer_is_owner(int fd) {
+#if defined(SO_PEERCRED)
+    struct ucred cred{};
+    socklen_t len = sizeof(cred);
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0) return false;
+    return cred.uid == geteuid();
+#else
+    uid_t uid; gid_t gid;
+    if (getpeereid(fd, &uid, &gid) != 0) return false;
+    return uid == geteuid();
+#endif
+}
+
+static const size_t MAX_CLIENTS = 16;
+
+static bool reply_error(int fd, const std::string &msg) { return agent_reply(fd, AGENT_ERR, ByteSpan(msg)); }
+
+static int64_t steady_ms() {
+    return (int64_t)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// One client connection and the thread serving it.
+struct Client {
+    int fd = -1;
+    std::thread worker;
+    std::atomic<bool> done{false};
+};
+
+int main(int argc, char **argv) {
+    int ttl = 900;
+    bool allow_export = false;
+    std::string sock_path = KeyAgentClient::socketPath();
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        if (a == "--ttl" && i + 1 < argc) ttl = std::atoi(argv[++i]);
+        else if (a == "--socket" && i + 1 < argc) sock_path = argv[++i];
+        else if (a == "--allow-export") allow_export = true;
+        else { std::cerr << "Usage: " << argv[0] << " [--ttl seconds] [--socket path] [--allow-export]\n"; return 2; }
+    }
+    if (ttl <= 0) { std::cerr << "TTL must be positive\n"; return 2; }
+
+    try { init_crypto(); } catch (const std::exception &e) { std::cerr<<"libsodium init failed: "<<e.what()<<"\n"; return 1; }
+
+    KdfParams kdf;
+    try { kdf = load_kdf_params("modules/emergency_messenger/keys"); }
+    catch (const std::exception &e) { std::cerr << "Cannot load KDF parameters: " << e.what() << "\n"; return 3; }
+
+    SecureString pass;
+    std::cout << "Enter passphrase to unlock the key agent: ";
+    std::getline(std::cin, pass);
+
+    // sodium_malloc gives guard pages and mlock()s the region; it stays PROT_NONE between requests
+    HeldKeys *keys = (HeldKeys*)sodium_malloc(sizeof(HeldKeys));
+    if (!keys) { std::cerr << "sodium_malloc failed\n"; return 4; }
+    keys->haveLog = false;
+    try {
+        SecureString mk = derive_master_key(pass, kdf);
+        std::memcpy(keys->master, mk.data(), MASTER_KEY_LEN);
+    } catch (const std::exception &e) {
+        std::cerr << "Key derivation failed: " << e.what() << "\n";
+        sodium_free(keys);
+        return 5;
+    }
+    pass.wipe();
+
+    std::string wrapped_log_path = "modules/emergency_messenger/keys/wrapped_logkey.bin";
+    if (fs::exists(wrapped_log_path)) {
+        try {
+            auto wrapped = read_binary_file(wrapped_log_path);
+            decrypt_aead(MutableByteSpan(keys->log, MASTER_KEY_LEN), ByteSpan(wrapped), ByteSpan(keys->master, MASTER_KEY_LEN));
+            keys->haveLog = true;
+        } catch (const std::exception &e) {
+            std::cerr << "Failed to unwrap log key (wrong passphrase?): " << e.what() << "\n";
+            sodium_free(keys);
+            return 6;
+        }
+    }
+    sodium_mprotect_noaccess(keys);
+
+    // socket directory is private to us; the socket itself is 0600. A directory that is already
+    // there must be ours (it is tightened to 0700 if it is looser, never taken over).
+    fs::path dir = fs::path(sock_path).parent_path();
+    if (!dir.empty()) {
+        try {
+            if (dir.has_parent_path()) fs::create_directories(dir.parent_path());
+            if (::mkdir(dir.c_str(), 0700) != 0 && errno != EEXIST) throw std::runtime_error("cannot create " + dir.string());
+            struct stat st;
+            if (::lstat(dir.c_str(), &st) == 0 && S_ISDIR(st.st_mode) && st.st_uid == geteuid()) ::chmod(dir.c_str(), 0700);
+            agent_check_socket_dir(dir.string());
+        } catch (const std::exception &e) {
+            std::cerr << "Unsafe socket directory: " << e.what() << "\n";
+            sodium_free(keys);
+            return 7;
+        }
+    }
+    ::unlink(sock_path.c_str());
+    int lfd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    if (lfd < 0 || sock_path.size() >= sizeof(addr.sun_path)) { std::cerr << "Cannot create socket\n"; sodium_free(keys); return 7; }
+    std::memcpy(addr.sun_path, sock_path.c_str(), sock_path.size() + 1);
+    mode_t old_mask = umask(0177);
+    int rc = ::bind(lfd, (sockaddr*)&addr, sizeof(addr));
+    umask(old_mask);
+    if (rc != 0 || ::listen(lfd, 16) != 0) {
+        std::cerr << "Cannot bind " << sock_path << ": " << std::strerror(errno) << "\n";
+        sodium_free(keys);
+        return 7;
+    }
+    chmod(sock_path.c_str(), 0600);
+
+    std::signal(SIGINT, on_signal);
+    std::signal(SIGTERM, on_signal);
+    std::signal(SIGPIPE, SIG_IGN);
+
+    std::cout << "\nKey agent ready (idle TTL " << ttl << "s). Run:\n"
+              << "export " << AGENT_SOCK_ENV << "=" << sock_path << "\n" << std::flush;
+
+    // connections are served concurrently (one idle client cannot block the others); the keys
+    // are touched by one request at a time, which also keeps the mprotect toggling consistent
+    const int ttl_ms = ttl * 1000;
+    std::mutex key_mu;
+    std::atomic<bool> lock_requested{false};
+    std::atomic<int64_t> last_request{steady_ms()};
+    auto handle = [&](AgentOp op, AgentKey which, ByteSpan payload, SecureString &out) {
+        std::lock_guard<std::mutex> lock(key_mu);
+        last_request = steady_ms();
+        sodium_mprotect_readonly(keys);
+        try {
+            if (which == AGENT_KEY_LOG && !keys->haveLog) throw std::runtime_error("no logKey loaded");
+            ByteSpan key(which == AGENT_KEY_LOG ? keys->log : keys->master, MASTER_KEY_LEN);
+            agent_apply(op, key, ByteSpan(keys->master, MASTER_KEY_LEN), payload, allow_export, out);
+        } catch (...) {
+            sodium_mprotect_noaccess(keys);
+            throw;
+        }
+        sodium_mprotect_noaccess(keys);
+    };
+
+    std::list<std::unique_ptr<Client>> clients;
+    auto reap = [&](bool all) {
+        for (auto it = clients.begin(); it != clients.end();) {
+            Client &c = **it;
+            if (all) ::shutdown(c.fd, SHUT_RDWR); // wakes its worker
+            if (!all && !c.done) { ++it; continue; }
+            c.worker.join();
+            ::close(c.fd);
+            it = clients.erase(it);
+        }
+    };
+    while (!stop_requested && !lock_requested) {
+        reap(false);
+        if (steady_ms() - last_request >= ttl_ms) { std::cout << "Idle TTL expired; wiping keys.\n"; break; }
+        pollfd p{lfd, POLLIN, 0};
+        if (poll(&p, 1, 1000) <= 0) continue; // timeout or EINTR: re-check the flags
+        int cfd = ::accept(lfd, nullptr, nullptr);
+        if (cfd < 0) continue;
+        if (!peer_is_owner(cfd)) {
+            reply_error(cfd, "permission denied");
+            ::close(cfd);
+            continue;
+        }
+        if (clients.size() >= MAX_CLIENTS) {
+            reply_error(cfd, "too many clients");
+            ::close(cfd);
+            continue;
+        }
+        std::unique_ptr<Client> c(new Client);
+        c->fd = cfd;
+        Client *cp = c.get();
+        clients.push_back(std::move(c));
+        cp->worker = std::thread([&, cp] {
+            if (!agent_serve(cp->fd, ttl_ms, AGENT_READ_TIMEOUT_MS, handle)) lock_requested = true;
+            cp->done = true;
+        });
+    }
+    reap(true);
+
+    ::close(lfd);
+    ::unlink(sock_path.c_str());
+    sodium_free(keys); // zeroes before releasing
+    return 0;
+}
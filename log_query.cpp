@@ -0,0 +1,293 @@
+// log_query.cpp
+// Usage: ./log_query [--from T] [--to T] [--priority N[,N...]] [--threads N] [--archive]
+// Decrypts the whole sent log (both layers: logKey around the record, masterKey around the
+// message) across all cores and prints the matching records as NDJSON, oldest first, one
+// object per line:
+//   {"segment":1,"record":0,"time":"2024-01-31T12:00:00.250Z","time_ms":...,"priority":1,"repeats":1,"message":"..."}
+// with "time" in UTC, plus "attachment" when there is one; a record that cannot be opened
+// prints "error" instead.
+// T is unix seconds, YYYY-MM-DD or YYYY-MM-DDTHH:MM[:SS] (local time); --to is inclusive and
+// covers all of what T names: the whole day, minute or second.
+// Segments outside the range are never opened, and the index skips records by time and
+// priority before anything is decrypted. --archive also reads segments moved to logs/archive.
+// Keys come from key_agent when LIFECORE_AGENT_SOCK is set, else from the passphrase.
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <set>
+#include <chrono>
+#include <ctime>
+#include <iomanip>
+#include <sstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <filesystem>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include "Encryption.h"
+#include "KeyAgent.h"
+#include "KeyHeader.h"
+#include "LogKeyring.h"
+
+namespace fs = std::filesystem;
+
+static const size_t CHUNK_RECORDS = 512;
+
+// unix seconds, YYYY-MM-DD or YYYY-MM-DDTHH:MM[:SS] (local time), as unix ms: the first ms of
+// the second, minute or day it names, or with `last` its last ms
+static bool parse_time_ms(const std::string &s, uint64_t &ms, bool last = false) {
+    if (!s.empty() && s.find_first_not_of("0123456789") == std::string::npos) {
+        ms = std::strtoull(s.c_str(), nullptr, 10) * 1000 + (last ? 999 : 0);
+        return true;
+    }
+    // shortest first: get_time does not fail when the input ends before the format does
+    static const char *const formats[] = {"%Y-%m-%d", "%Y-%m-%dT%H:%M", "%Y-%m-%dT%H:%M:%S"};
+    for (const char *f : formats) {
+        std::tm tm{};
+        std::istringstream in(s);
+        in >> std::get_time(&tm, f);
+        if (in.fail() || in.peek() != EOF) continue;
+        if (last) { // the start of the next second, minute or day (mktime normalizes; days may not be 24 h)
+            if (f == formats[0]) ++tm.tm_mday;
+            else if (f == formats[1]) ++tm.tm_min;
+            else ++tm.tm_sec;
+        }
+        tm.tm_isdst = -1;
+        std::time_t t = std::mktime(&tm);
+        if (t < 0) return false;
+        ms = (uint64_t)t * 1000 - (last ? 1 : 0);
+        return true;
+    }
+    return false;
+}
+
+static void json_string(std::string &out, const char *p, size_t n) {
+    static const char hex[] = "0123456789abcdef";
+    out.push_back('"');
+    for (size_t i = 0; i < n; ++i) {
+        unsigned char c = (unsigned char)p[i];
+        switch (c) {
+        case '"': out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        case '\n': out += "\\n"; break;
+        case '\r': out += "\\r"; break;
+        case '\t': out += "\\t"; break;
+        default:
+            if (c < 0x20) { out += "\\u00"; out.push_back(hex[c >> 4]); out.push_back(hex[c & 15]); }
+            else out.push_back((char)c);
+        }
+    }
+    out.push_back('"');
+}
+
+struct Query {
+    uint64_t fromMs = 0, toMs = UINT64_MAX;
+    std::set<int> priorities; // empty: all
+    bool timed() const { return fromMs || toMs != UINT64_MAX; }
+    bool wants(int priority) const { return priorities.empty() || priorities.count(priority); }
+    bool inRange(uint64_t ms) const { return ms >= fromMs && ms <= toMs; }
+};
+
+struct Chunk {
+    const LogSegment *segment;
+    std::shared_ptr<LogReader> reader;
+    size_t first, last;
+    LogOpener open; // the segment's key
+};
+
+struct Counts {
+    uint64_t matched = 0, unreadable = 0;
+};
+
+// Appends one NDJSON line per matching record of the chunk.
+static void run_chunk(const Chunk &c, const Query &q, ByteSpan masterKey, std::string &out, Counts &counts) {
+    const uint64_t masterId = key_id(masterKey);
+    auto emit = [&](size_t n, const std::string &plain) {
+        std::string head = "{\"segment\":" + std::to_string(c.segment->seq) + ",\"record\":" + std::to_string(n);
+        LogRecord rec;
+        if (plain.empty() || !decode_log_record(ByteSpan(plain), rec)) {
+            ++counts.unreadable;
+            out += head + ",\"error\":\"" + (plain.empty() ? "cannot open record" : "unexpected record format") + "\"}\n";
+            return;
+        }
+        // the record's own time: the index may place it later (a priority-1 send overtook it)
+        uint64_t timeMs = rec.timeMs();
+        if (!timeMs) timeMs = c.reader->entry(n).timeMs;
+        if (!q.wants(rec.priority) || (q.timed() && !q.inRange(timeMs))) return;
+        ++counts.matched;
+        out += head + ",\"time\":";
+        std::string time = format_log_time(rec.version ? rec.timeNs : (int64_t)timeMs * 1000000); // legacy records hold whole seconds
+        json_string(out, time.data(), time.size());
+        out += ",\"time_ms\":" + std::to_string(timeMs) + ",\"priority\":" + std::to_string(rec.priority);
+        out += ",\"repeats\":" + std::to_string(rec.repeats);
+        if (!rec.attachment.empty()) { out += ",\"attachment\":"; json_string(out, rec.attachment.data(), rec.attachment.size()); }
+        try {
+            if (rec.keyId && rec.keyId != masterId) throw std::runtime_error("message sealed under another master key");
+            SecureString message(aead_plain_len(rec.message().size()), '\0');
+            message.resize(decrypt_aead(MutableByteSpan(message), rec.message(), masterKey));
+            out += ",\"message\":";
+            json_string(out, message.data(), message.size());
+        } catch (const std::exception &e) {
+            out += ",\"error\":";
+            json_string(out, e.what(), std::strlen(e.what()));
+        }
+        out += "}\n";
+    };
+    // decrypt only the frames holding records the index cannot rule out, each once
+    auto candidate = [&](size_t i) {
+        LogIndexEntry e = c.reader->entry(i);
+        return (!e.priority || q.wants(e.priority)) && (!e.timeMs || !q.timed() || q.inRange(e.timeMs));
+    };
+    c.reader->readIf(c.first, c.last, c.open, candidate, emit);
+}
+
+static bool load_keys(SecureString &masterKey, SecureString &logKey) {
+    try {
+        if (agent_load_keys(masterKey, logKey)) return true;
+    } catch (const std::exception &e) {
+        std::cerr << "Key agent unavailable (" << e.what() << "); falling back to passphrase.\n";
+    }
+    KdfParams kdf;
+    try { kdf = load_kdf_params("modules/emergency_messenger/keys"); }
+    catch (const std::exception &e) { std::cerr << "Cannot load KDF parameters: " << e.what() << "\n"; return false; }
+    SecureString pass;
+    std::cerr << "Enter passphrase to derive master key: ";
+    std::getline(std::cin, pass);
+    if (pass.empty()) { std::cerr << "Empty passphrase\n"; return false; }
+    try { masterKey = derive_master_key(pass, kdf); } catch (const std::exception &e) { std::cerr << "KDF failed: " << e.what() << "\n"; return false; }
+    std::string wrapped_log_path = "modules/emergency_messenger/keys/wrapped_logkey.bin";
+    if (fs::exists(wrapped_log_path)) {
+        try { logKey = decrypt_aead_secure(ByteSpan(read_binary_file(wrapped_log_path)), ByteSpan(masterKey)); }
+        catch (const std::exception &e) { std::cerr << "Failed to unwrap logKey (" << e.what() << "); trying masterKey on records.\n"; }
+    }
+    return true;
+}
+
+int main(int argc, char **argv) {
+    try { init_crypto(); } catch (const std::exception &e) { std::cerr<<"libsodium init failed: "<<e.what()<<"\n"; return 1; }
+
+    Query q;
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    bool archive = false;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--from" && has_value && parse_time_ms(argv[i + 1], q.fromMs)) ++i;
+        else if (arg == "--to" && has_value && parse_time_ms(argv[i + 1], q.toMs, true)) ++i;
+        else if (arg == "--priority" && has_value) {
+            std::istringstream list(argv[++i]);
+            for (std::string p; std::getline(list, p, ',');) q.priorities.insert(std::atoi(p.c_str()));
+        }
+        else if (arg == "--threads" && has_value) threads = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--archive") archive = true;
+        else {
+            std::cerr << "Usage: " << argv[0] << " [--from T] [--to T] [--priority N[,N...]] [--threads N] [--archive]\n"
+                      << "  T: unix seconds, YYYY-MM-DD or YYYY-MM-DDTHH:MM[:SS] (local time)\n";
+            return 2;
+        }
+    }
+    if (q.toMs < q.fromMs) { std::cerr << "--to is before --from\n"; return 2; }
+
+    const std::string logdir = "modules/emergency_messenger/logs";
+    if (!fs::exists(logdir)) { std::cerr << "Log not found: " << logdir << "\n"; return 3; }
+    std::unique_ptr<SegmentedLogReader> log;
+    try { log.reset(new SegmentedLogReader(logdir)); } catch (const std::exception &e) { std::cerr << "Cannot read the log: " << e.what() << "\n"; return 3; }
+
+    SecureString masterKey, logKey;
+    if (!load_keys(masterKey, logKey)) return 4;
+    // each segment opens with the key epoch its id names, else with the current log key
+    LogKeyCache keys("modules/emergency_messenger/keys", log_key_unwrapper(ByteSpan(masterKey)));
+    keys.add(logKey);
+    auto opener = [](ByteSpan key) -> LogOpener {
+        return [key](ByteSpan sealed, ByteSpan ad) {
+            try { return log_key_opener(key)(sealed, ad); } catch (const std::exception &) { return std::string(); }
+        };
+    };
+    const LogOpener open = opener(ByteSpan(logKey.empty() ? masterKey : logKey));
+
+    // plan: chunks of candidate records, in log order
+    std::vector<Chunk> chunks;
+    for (const LogSegment &s : log->segments()) {
+        if (s.state == SEGMENT_ARCHIVED && !archive) continue;
+        bool open_ended = s.state == SEGMENT_ACTIVE || !s.lastMs;
+        if ((s.firstMs && s.firstMs > q.toMs) || (!open_ended && s.lastMs < q.fromMs)) continue;
+        std::shared_ptr<LogReader> r(log->reader(s, true).release());
+        if (!r) { std::cerr << "Skipping unreadable segment " << s.file << "\n"; continue; }
+        std::vector<std::pair<size_t, size_t>> ranges;
+        if (q.timed()) {
+            // records without an index time (a rebuild that could not open them sorts first, the
+            // unindexed tail comes last) are checked against the record's own timestamp
+            size_t unknown = 0;
+            while (unknown < r->indexedSize() && !r->entry(unknown).timeMs) ++unknown;
+            std::pair<size_t, size_t> range = r->timeRange(q.fromMs, q.toMs);
+            ranges = {{0, unknown}, {std::max(range.first, unknown), range.second}, {r->indexedSize(), r->size()}};
+        } else {
+            ranges = {{0, r->size()}};
+        }
+        const SecureString *key = keys.find(s.keyId);
+        LogOpener segmentOpen = segment_unkeyed(s) ? LogOpener() : key ? opener(ByteSpan(*key)) : open;
+        for (const auto &range : ranges)
+            for (size_t a = range.first; a < range.second; a += CHUNK_RECORDS)
+                chunks.push_back(Chunk{&s, r, a, std::min(range.second, a + CHUNK_RECORDS), segmentOpen});
+    }
+
+    // workers decrypt ahead of the printer, at most `window` chunks
+    const size_t window = (size_t)threads * 4;
+    std::vector<std::string> outs(chunks.size());
+    std::vector<Counts> counts(chunks.size());
+    std::vector<char> done(chunks.size(), 0);
+    std::mutex mu;
+    std::condition_variable cv;
+    size_t next = 0, printed = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < threads; ++t) {
+        workers.emplace_back([&] {
+            for (;;) {
+                size_t i;
+                {
+                    std::unique_lock<std::mutex> lock(mu);
+                    cv.wait(lock, [&] { return next >= chunks.size() || next < printed + window; });
+                    if (next >= chunks.size()) return;
+                    i = next++;
+                }
+                std::string out;
+                Counts c;
+                run_chunk(chunks[i], q, ByteSpan(masterKey), out, c);
+                {
+                    std::lock_guard<std::mutex> lock(mu);
+                    outs[i].swap(out);
+                    counts[i] = c;
+                    done[i] = 1;
+                }
+                cv.notify_all();
+            }
+        });
+    }
+    Counts total;
+    for (size_t i = 0; i < chunks.size(); ++i) {
+        std::string out;
+        {
+            std::unique_lock<std::mutex> lock(mu);
+            cv.wait(lock, [&] { return done[i] != 0; });
+            out.swap(outs[i]);
+            printed = i + 1;
+        }
+        cv.notify_all();
+        std::cout.write(out.data(), (std::streamsize)out.size());
+        if (!out.empty()) sodium_memzero(&out[0], out.size());
+        total.matched += counts[i].matched;
+        total.unreadable += counts[i].unreadable;
+    }
+    for (auto &w : workers) w.join();
+    std::cout.flush();
+
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    std::cerr << total.matched << " record(s) matched, " << total.unreadable << " unreadable, in " << secs << " s on "
+              << threads << " thread(s)\n";
+    return total.unreadable ? 5 : 0;
+}
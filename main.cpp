@@ -5,7 +5,24 @@
 #include <string>
 #include "Encryption.h"
 #include "MessageQueue.h"
+#include "KeyAgent.h"
+#include "KeyHeader.h"
+#include "LogKeyring.h"
 #include <limits>
+#include <cstdlib>
+
+#if __has_include(<curl/curl.h>)
+  #include <curl/curl.h>
+  // libcurl's global state: set up before the queue starts its transport workers (curl_global_init
+  // is not thread-safe, so it must not be left to the first curl_easy_init) and torn down after
+  // they have stopped
+  struct CurlGlobal {
+      CurlGlobal() { curl_global_init(CURL_GLOBAL_DEFAULT); }
+      ~CurlGlobal() { curl_global_cleanup(); }
+  };
+#else
+  struct CurlGlobal {};
+#endif
 
 namespace fs = std::filesystem;
 
@@ -25,34 +42,58 @@ int main() {
     fs::create_directories("modules/emergency_messenger/keys");
     fs::create_directories("modules/emergency_messenger/logs");
 
-    std::string salt_path = "modules/emergency_messenger/keys/user_salt.bin";
-    std::vector<unsigned char> salt;
-    if (!fs::exists(salt_path)) {
-        salt = generate_salt();
-        write_binary_file(salt_path, salt);
-        std::cout << "Generated new user salt.\n";
-    } else {
-        salt = read_binary_file(salt_path);
-    }
-
-    std::string pass;
-    std::cout << "Enter passphrase (used to derive master key): ";
-    std::getline(std::cin, pass);
-    std::string masterKey;
+    // client mode: take both keys from a running key_agent instead of re-deriving them
+    SecureString masterKey;
+    SecureString logKey;
+    bool via_agent = false;
     try {
-        masterKey = derive_master_key(pass, salt);
+        via_agent = agent_load_keys(masterKey, logKey);
+        if (via_agent) std::cout << "Using keys held by key agent.\n";
     } catch (const std::exception &e) {
-        std::cerr << "Key derivation failed: " << e.what() << "\n";
-        return 2;
+        std::cerr << "Key agent unavailable (" << e.what() << "); falling back to passphrase.\n";
+    }
+
+    if (!via_agent) {
+        // KDF parameters and salt live in the versioned key header; a legacy user_salt.bin
+        // is migrated into one (same salt, same interactive limits, so the same masterKey)
+        std::string keydir = "modules/emergency_messenger/keys";
+        std::string header_path = keydir + "/user_key.hdr";
+        KdfParams kdf;
+        try {
+            if (fs::exists(header_path)) {
+                kdf = read_key_header(header_path);
+            } else if (fs::exists(keydir + "/user_salt.bin")) {
+                kdf = load_kdf_params(keydir);
+                write_key_header(header_path, kdf);
+                std::cout << "Migrated user_salt.bin into key header.\n";
+            } else {
+                kdf.salt = generate_salt();
+                write_key_header(header_path, kdf);
+                std::cout << "Generated new key header (run ./calibrate_kdf to tune KDF cost).\n";
+            }
+        } catch (const std::exception &e) {
+            std::cerr << "Failed to load key header: " << e.what() << "\n";
+            return 2;
+        }
+
+        SecureString pass;
+        std::cout << "Enter passphrase (used to derive master key): ";
+        std::getline(std::cin, pass);
+        try {
+            masterKey = derive_master_key(pass, kdf);
+        } catch (const std::exception &e) {
+            std::cerr << "Key derivation failed: " << e.what() << "\n";
+            return 2;
+        }
     }
 
     std::string wrapped_log_path = "modules/emergency_messenger/keys/wrapped_logkey.bin";
-    std::string logKey;
-    if (fs::exists(wrapped_log_path)) {
+    if (!logKey.empty()) {
+        // already unwrapped by the agent
+    } else if (fs::exists(wrapped_log_path)) {
         try {
             auto wrapped = read_binary_file(wrapped_log_path);
-            std::string wrapped_str((char*)wrapped.data(), wrapped.size());
-            logKey = decrypt_aead(wrapped_str, masterKey); // unwrap
+            logKey = decrypt_aead_secure(ByteSpan(wrapped), ByteSpan(masterKey)); // unwrap
             std::cout << "Loaded and unwrapped log key.\n";
         } catch (const std::exception &e) {
             std::cerr << "Failed to unwrap existing log key: " << e.what() << "\n";
@@ -60,33 +101,70 @@ int main() {
         }
     } else {
         // generate random logKey and wrap it
-        std::string new_logKey(crypto_aead_xchacha20poly1305_ietf_KEYBYTES, '\0');
-        randombytes_buf(&new_logKey[0], new_logKey.size());
-        std::string wrapped = encrypt_aead(new_logKey, masterKey);
-        std::vector<unsigned char> wrapped_bin(wrapped.begin(), wrapped.end());
+        logKey.assign(crypto_aead_xchacha20poly1305_ietf_KEYBYTES, '\0');
+        randombytes_buf(&logKey[0], logKey.size());
+        std::vector<unsigned char> wrapped_bin(aead_boxed_len(logKey.size()));
+        encrypt_aead(MutableByteSpan(wrapped_bin), ByteSpan(logKey), ByteSpan(masterKey));
         write_binary_file(wrapped_log_path, wrapped_bin);
-        logKey = new_logKey;
         std::cout << "Generated and wrapped new log key.\n";
     }
 
     // create message queue with both keys
+    CurlGlobal curl;
     MessageQueue mq(masterKey, logKey);
+    // LIFECORE_AGING_MS: wait before a queued message is served one priority higher (0 = never)
+    if (const char *aging = std::getenv("LIFECORE_AGING_MS"))
+        mq.setAgingInterval(std::chrono::milliseconds(std::strtol(aging, nullptr, 10)));
+    // LIFECORE_QUEUE_BUDGET_MB / LIFECORE_SPILL_LIMIT_MB: queued ciphertext kept in RAM / spilled to disk
+    {
+        const char *ram = std::getenv("LIFECORE_QUEUE_BUDGET_MB"), *disk = std::getenv("LIFECORE_SPILL_LIMIT_MB");
+        if (ram || disk)
+            mq.setMemoryBudget((ram ? std::strtoull(ram, nullptr, 10) : 64) << 20, (disk ? std::strtoull(disk, nullptr, 10) : 1024) << 20);
+    }
+    // LIFECORE_RATE_PER_S / LIFECORE_RATE_BURST / LIFECORE_RATE_RESERVE: transport endpoint limit
+    {
+        const char *rate = std::getenv("LIFECORE_RATE_PER_S"), *burst = std::getenv("LIFECORE_RATE_BURST"),
+                   *reserve = std::getenv("LIFECORE_RATE_RESERVE");
+        if (rate || burst || reserve)
+            mq.setRateLimit(rate ? std::strtod(rate, nullptr) : 50, burst ? std::strtod(burst, nullptr) : 100,
+                            reserve ? std::strtod(reserve, nullptr) : 20);
+    }
+    // LIFECORE_LOG_SEGMENT_MB / LIFECORE_LOG_SEGMENT_HOURS / LIFECORE_LOG_KEEP_SEGMENTS: log rotation and retention
+    {
+        const char *mb = std::getenv("LIFECORE_LOG_SEGMENT_MB"), *hours = std::getenv("LIFECORE_LOG_SEGMENT_HOURS"),
+                   *keep = std::getenv("LIFECORE_LOG_KEEP_SEGMENTS");
+        if (mb || hours || keep)
+            mq.setLogRotation((mb ? std::strtoull(mb, nullptr, 10) : 64) << 20, std::chrono::hours(hours ? std::strtol(hours, nullptr, 10) : 24),
+                              keep ? std::strtoul(keep, nullptr, 10) : 0);
+    }
+    // LIFECORE_LOG_BATCH / LIFECORE_LOG_LINGER_MS: records per sealed log frame and how long one waits to fill
+    {
+        const char *batch = std::getenv("LIFECORE_LOG_BATCH"), *linger = std::getenv("LIFECORE_LOG_LINGER_MS");
+        if (batch || linger)
+            mq.setLogBatching(batch ? std::strtoul(batch, nullptr, 10) : 64, std::chrono::milliseconds(linger ? std::strtol(linger, nullptr, 10) : 5));
+    }
+    // LIFECORE_LOG_RESEAL_KBPS: how fast older log key epochs are resealed in the background (0 = never)
+    if (const char *kbps = std::getenv("LIFECORE_LOG_RESEAL_KBPS"))
+        mq.setLogReseal(std::strtoull(kbps, nullptr, 10) << 10);
+    // LIFECORE_DEDUP_WINDOW_S: identical queued messages within this window are sent once (0 = off)
+    if (const char *window = std::getenv("LIFECORE_DEDUP_WINDOW_S"))
+        mq.setDedupWindow(std::chrono::seconds(std::strtol(window, nullptr, 10)));
 
     // menu loop
     while (true) {
-        std::cout << "\nMenu:\n1) Add message\n2) Show queue\n3) Send messages\n4) Save queue\n5) Load queue\n6) View sent history\n7) Exit\nChoose: ";
+        std::cout << "\nMenu:\n1) Add message\n2) Show queue\n3) Send messages\n4) Save queue\n5) Load queue\n6) View sent history\n7) Exit\n8) Add attachment\n9) Rate limits\n10) Sent history from log\n11) New log key epoch\nChoose: ";
         int c;
         if (!(std::cin >> c)) break;
         std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
 
         if (c == 1) {
-            std::string msg;
+            SecureString msg;
             int pr;
             std::cout << "Enter message: ";
             std::getline(std::cin, msg);
             std::cout << "Priority (1 high, 2 med, 3 low): ";
             std::cin >> pr; std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
-            mq.addMessage(msg, pr);
+            mq.addMessage(ByteSpan(msg), pr);
         } else if (c == 2) {
             mq.showQueue();
         } else if (c == 3) {
@@ -97,10 +175,27 @@ int main() {
             mq.loadMessagesFromFile("messages.store");
         } else if (c == 6) {
             mq.viewSentHistory();
+        } else if (c == 8) {
+            std::string path;
+            int pr;
+            std::cout << "File to attach: ";
+            std::getline(std::cin, path);
+            std::cout << "Priority (1 high, 2 med, 3 low): ";
+            std::cin >> pr; std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+            mq.addAttachment(path, pr);
+        } else if (c == 9) {
+            mq.showRateLimits();
+        } else if (c == 10) {
+            mq.viewLoggedHistory(20);
+        } else if (c == 11) {
+            try {
+                mq.setLogKey(rotate_log_epoch("modules/emergency_messenger/keys", ByteSpan(masterKey)));
+                std::cout << "New log key in use; older segments are resealed to it in the background.\n";
+            } catch (const std::exception &e) {
+                std::cerr << "Log key rotation failed: " << e.what() << "\n";
+            }
         } else break;
     }
 
-    sodium_memzero((void*)masterKey.data(), masterKey.size());
-    sodium_memzero((void*)logKey.data(), logKey.size());
     return 0;
 }
@@ -1,73 +1,247 @@
 // reencrypt_log.cpp
-// Usage: ./reencrypt_log modules/emergency_messenger/logs/sent_messages.log
+// Usage: ./reencrypt_log [--threads N] [--restart] modules/emergency_messenger/logs/sent_messages.log
+//        (or one segment-NNNNNN.log)
+// Seals a plaintext log record by record with logKey (masterKey if there is none), as binary
+// records (LogRecord.h) in base64 lines. Message bodies that are still plain text are sealed
+// under masterKey first, as the messenger seals a message (migrate_legacy_log_record). The log is streamed: a reader thread parses chunks of
+// CHUNK_RECORDS lines, the chunk is sealed across the worker pool and written in order, then
+// <log>.reencrypt is checkpointed (input offset, output length) once the output is on disk.
+// An interrupted run resumes from the checkpoint unless --restart is given; the log is
+// replaced only once all is sealed. A segment's header and MANIFEST entry then name the key
+// its records are sealed under, and its stale .idx sidecar is dropped.
 // Requires Encryption.h (Argon2 + AEAD helpers)
 
 #include <iostream>
 #include <fstream>
 #include <string>
 #include <vector>
-#include <regex>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
 #include <ctime>
 #include <filesystem>
 #include <sstream>
+#include <thread>
 
 #include "Encryption.h"
+#include "BatchCrypto.h"
+#include "BoundedQueue.h"
+#include "KeyAgent.h"
+#include "KeyHeader.h"
+#include "SegmentedLog.h"
 
 namespace fs = std::filesystem;
 
+static const size_t CHUNK_RECORDS = 4096;
+static const size_t CHUNKS_AHEAD = 2; // parsed chunks waiting to be sealed
+
 static bool is_timestamp_line(const std::string &line) {
-    static std::regex re(R"(^[A-Za-z]{3}\s+[A-Za-z]{3}\s+\d{1,2}\s+\d{2}:\d{2}:\d{2}\s+\d{4}$)");
-    return std::regex_match(line, re);
+    int64_t ns;
+    return parse_ctime_ns(line, ns);
+}
+
+// Where a run stopped: `inputOffset` bytes of the log are sealed into the first `outputBytes`
+// of the temp file. Only trusted for the same log size and sealing key.
+struct Checkpoint {
+    uint64_t inputSize = 0, inputOffset = 0, outputBytes = 0, records = 0, keyId = 0;
+    std::string backup;
+};
+
+static bool read_checkpoint(const std::string &path, Checkpoint &c) {
+    std::ifstream in(path, std::ios::binary);
+    std::string magic, word;
+    if (!in.is_open() || !std::getline(in, magic) || magic != "LCREENC 1") return false;
+    in >> word >> c.inputSize >> c.inputOffset;
+    if (word != "input") return false;
+    in >> word >> c.outputBytes >> c.records;
+    if (word != "output") return false;
+    std::string key;
+    in >> word >> key;
+    if (word != "key") return false;
+    c.keyId = std::strtoull(key.c_str(), nullptr, 16);
+    in >> word;
+    if (word != "backup") return false;
+    in.get();
+    std::getline(in, c.backup);
+    return !in.fail();
+}
+
+// Replaced atomically (temp file + rename), after the sealed output it describes is synced.
+static void write_checkpoint(const std::string &path, const Checkpoint &c) {
+    const std::string tmp = path + ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        if (!out.is_open()) throw std::runtime_error("cannot create " + tmp);
+        char key[17];
+        std::snprintf(key, sizeof(key), "%016" PRIx64, c.keyId);
+        out << "LCREENC 1\n"
+            << "input " << c.inputSize << ' ' << c.inputOffset << '\n'
+            << "output " << c.outputBytes << ' ' << c.records << '\n'
+            << "key " << key << '\n'
+            << "backup " << c.backup << '\n';
+        out.close();
+        if (!out) throw std::runtime_error("failed writing " + tmp);
+    }
+    sync_file(tmp);
+    fs::rename(tmp, path);
+    sync_dir(fs::path(path).parent_path().string());
+}
+
+// A segment header ("LCSEG <v> key=<16 hex> ...") naming `keyId`; other lines as they are.
+static std::string header_with_key(std::string header, uint64_t keyId) {
+    size_t k = header.find(" key=");
+    if (k == std::string::npos || k + 5 + 16 > header.size()) return header;
+    char key[17];
+    std::snprintf(key, sizeof(key), "%016" PRIx64, keyId);
+    return header.replace(k + 5, 16, key);
+}
+
+// Points the MANIFEST entry for the segment at `path` (archive/ included) at `keyId`.
+static void update_manifest_key(const std::string &path, uint64_t keyId) {
+    fs::path p(path), dir = p.parent_path();
+    std::string name = p.filename().string();
+    if (dir.filename() == "archive") {
+        name = "archive/" + name;
+        dir = dir.parent_path();
+    }
+    std::error_code ec;
+    if (!fs::exists(dir / LOG_MANIFEST, ec)) return; // the single-file log has none
+    std::vector<LogSegment> segs = read_log_manifest(dir.string());
+    for (LogSegment &s : segs) {
+        if (s.file != name) continue;
+        s.keyId = keyId;
+        write_log_manifest(dir.string(), segs);
+        return;
+    }
+}
+
+// Plain lines parsed from the log, and the input offset just past their last line.
+struct LegacyLine {
+    LegacyLogFields fields;
+    int64_t timeNs;
+};
+struct Chunk {
+    std::vector<LegacyLine> lines;
+    uint64_t endOffset = 0;
+};
+
+// Parses lines from `in` (positioned at `offset`) into chunks of record fields.
+static void parse_log(std::ifstream &in, uint64_t offset, BoundedQueue<Chunk> &out) {
+    const int64_t nowNs = unix_ns_now();
+    Chunk chunk;
+    std::string line, pending_ts;
+    while (std::getline(in, line)) {
+        offset += line.size() + (in.eof() ? 0 : 1);
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (line.empty()) continue;
+        if (is_timestamp_line(line)) {
+            pending_ts = line;
+            continue;
+        }
+        // "ctime : message [Priority: N]", " : message [Priority:N]" after a timestamp line,
+        // or a bare content line
+        chunk.lines.push_back(LegacyLine{LegacyLogFields(), nowNs});
+        LegacyLine &l = chunk.lines.back();
+        split_legacy_log_record(line, l.fields);
+        sodium_memzero(&line[0], line.size());
+        if (!pending_ts.empty()) parse_ctime_ns(pending_ts, l.timeNs);
+        else if (!l.fields.time.empty()) parse_ctime_ns(l.fields.time, l.timeNs);
+        pending_ts.clear();
+        if (chunk.lines.size() == CHUNK_RECORDS) {
+            chunk.endOffset = offset;
+            if (!out.push(std::move(chunk))) return;
+            chunk = Chunk();
+        }
+    }
+    if (!chunk.lines.empty()) {
+        chunk.endOffset = offset;
+        out.push(std::move(chunk));
+    }
+}
+
+static void report_progress(const Checkpoint &c, uint64_t recordsNow, uint64_t bytesNow, double secs) {
+    const double mib = 1024.0 * 1024.0;
+    std::fprintf(stderr, "\r%llu record(s), %.1f of %.1f MiB (%.0f%%), %.0f records/s, %.1f MiB/s   ", (unsigned long long)c.records,
+                 c.inputOffset / mib, c.inputSize / mib, c.inputSize ? 100.0 * c.inputOffset / c.inputSize : 100.0,
+                 secs > 0 ? recordsNow / secs : 0.0, secs > 0 ? bytesNow / mib / secs : 0.0);
 }
 
 int main(int argc, char **argv) {
-    if (argc < 2) {
-        std::cerr << "Usage: " << argv[0] << " <path-to-sent_messages.log>\n";
+    std::string path;
+    unsigned threads = 0;
+    bool restart = false;
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        if (a == "--threads" && i + 1 < argc) threads = (unsigned)std::strtoul(argv[++i], nullptr, 10);
+        else if (a == "--restart") restart = true;
+        else if (path.empty() && a.compare(0, 2, "--") != 0) path = a;
+        else { path.clear(); break; }
+    }
+    if (path.empty()) {
+        std::cerr << "Usage: " << argv[0] << " [--threads N] [--restart] <path-to-sent_messages.log>\n";
         return 2;
     }
-    std::string path = argv[1];
+    if (segment_file_is_framed(path)) {
+        // binary segments (LogFrame.h) are sealed frame by frame as the messenger writes them
+        std::cout << path << " is a framed segment; its records are already sealed.\n";
+        return 0;
+    }
 
     try { init_crypto(); } catch (const std::exception &e) {
         std::cerr << "libsodium init failed: " << e.what() << "\n";
         return 3;
     }
 
-    // find salt file
-    std::string salt_path = "modules/emergency_messenger/keys/user_salt.bin";
-    if (!fs::exists(salt_path)) {
-        std::cerr << "Salt file not found: " << salt_path << "\n";
-        std::cerr << "Run ./messenger once to generate the salt file, or place the salt at that path.\n";
-        return 4;
+    // client mode: take masterKey/logKey from a running key_agent instead of re-deriving
+    SecureString masterKey;
+    SecureString logKey;
+    bool have_logkey = false;
+    bool via_agent = false;
+    try {
+        via_agent = agent_load_keys(masterKey, logKey);
+        have_logkey = via_agent && !logKey.empty();
+        if (via_agent) std::cout << "Using keys held by key agent.\n";
+    } catch (const std::exception &e) {
+        std::cerr << "Key agent unavailable (" << e.what() << "); falling back to passphrase.\n";
     }
 
-    // read salt
-    std::vector<unsigned char> salt;
-    try { salt = read_binary_file(salt_path); } catch (const std::exception &e) {
-        std::cerr << "Failed to read salt: " << e.what() << "\n"; return 5;
-    }
+    if (!via_agent) {
+        // find KDF parameters (key header, or legacy salt file)
+        std::string keydir = "modules/emergency_messenger/keys";
+        if (!fs::exists(keydir + "/user_key.hdr") && !fs::exists(keydir + "/user_salt.bin")) {
+            std::cerr << "Key header not found: " << keydir << "/user_key.hdr\n";
+            std::cerr << "Run ./messenger once to generate it, or place the key header at that path.\n";
+            return 4;
+        }
+
+        // read KDF parameters
+        KdfParams kdf;
+        try { kdf = load_kdf_params(keydir); } catch (const std::exception &e) {
+            std::cerr << "Failed to read key header: " << e.what() << "\n"; return 5;
+        }
 
-    // ask passphrase
-    std::string pass;
-    std::cout << "Enter passphrase to derive master key for re-encrypting log: ";
-    std::getline(std::cin, pass);
-    if (pass.empty()) { std::cerr << "Empty passphrase; abort.\n"; return 6; }
+        // ask passphrase
+        SecureString pass;
+        std::cout << "Enter passphrase to derive master key for re-encrypting log: ";
+        std::getline(std::cin, pass);
+        if (pass.empty()) { std::cerr << "Empty passphrase; abort.\n"; return 6; }
 
-    // derive masterKey
-    std::string masterKey;
-    try { masterKey = derive_master_key(pass, salt); } catch (const std::exception &e) {
-        std::cerr << "Key derivation failed: " << e.what() << "\n"; return 7;
+        // derive masterKey
+        try { masterKey = derive_master_key(pass, kdf); } catch (const std::exception &e) {
+            std::cerr << "Key derivation failed: " << e.what() << "\n"; return 7;
+        }
     }
 
     // attempt to load wrapped_logkey (optional)
     std::string wrapped_log_path = "modules/emergency_messenger/keys/wrapped_logkey.bin";
-    bool have_logkey = false;
-    std::string logKey;
-    if (fs::exists(wrapped_log_path)) {
+    if (have_logkey) {
+        std::cout << "Agent supplied logKey; will encrypt records with logKey.\n";
+    } else if (fs::exists(wrapped_log_path)) {
         try {
             auto wrapped = read_binary_file(wrapped_log_path);
-            std::string wrapped_str((char*)wrapped.data(), wrapped.size());
             // unwrap using masterKey
-            logKey = decrypt_aead(wrapped_str, masterKey);
+            logKey = decrypt_aead_secure(ByteSpan(wrapped), ByteSpan(masterKey));
             have_logkey = true;
             std::cout << "Unwrapped logKey successfully; will encrypt records with logKey.\n";
         } catch (const std::exception &e) {
@@ -79,126 +253,146 @@ int main(int argc, char **argv) {
         std::cout << "No wrapped_logkey.bin found — will use masterKey to encrypt log records.\n";
     }
 
-    // backup original log
-    fs::create_directories("backups");
-    std::string backup = "backups/sent_messages_plain_" + std::to_string(std::time(nullptr)) + ".log";
-    try {
-        fs::copy_file(path, backup, fs::copy_options::overwrite_existing);
-        std::cout << "Backed up plaintext log to: " << backup << "\n";
-    } catch (const std::exception &e) {
-        std::cerr << "Warning: could not backup original log: " << e.what() << "\n";
-    }
-
-    // open original log and parse
-    std::ifstream infile(path, std::ios::binary);
-    if (!infile.is_open()) {
+    const std::string tmp = path + ".tmp", checkpointPath = path + ".reencrypt";
+    ByteSpan sealKey(have_logkey ? logKey : masterKey);
+    std::error_code ec;
+    const uint64_t inputSize = fs::file_size(path, ec);
+    if (ec) {
         std::cerr << "Unable to open log file for reading: " << path << "\n";
-        sodium_memzero((void*)masterKey.data(), masterKey.size());
         return 8;
     }
 
-    std::vector<std::pair<std::string,std::string>> records; // (ts, content-with-priority)
-    std::string line;
-    std::string pending_ts;
-    while (std::getline(infile, line)) {
-        if (!line.empty() && line.back() == '\r') line.pop_back();
-        if (line.empty()) continue;
-
-        if (is_timestamp_line(line)) {
-            pending_ts = line;
-            continue;
-        }
-
-        // line may already be "ctime : message [Priority: N]" or just " : message [Priority:N]"
-        // Try to detect presence of "[Priority:"
-        if (line.find("[Priority:") != std::string::npos) {
-            std::string ts = pending_ts;
-            if (ts.empty()) {
-                // maybe the line itself has a timestamp prefix before " : "
-                size_t sep = line.find(" : ");
-                if (sep != std::string::npos) {
-                    std::string possible_ts = line.substr(0, sep);
-                    if (is_timestamp_line(possible_ts)) {
-                        ts = possible_ts;
-                        line = line.substr(sep + 3); // keep remainder as content
-                    }
-                }
-            }
-            records.emplace_back(ts, line);
-            pending_ts.clear();
-        } else {
-            // fallback: treat the line as a content line
-            std::string ts = pending_ts;
-            records.emplace_back(ts, line);
-            pending_ts.clear();
+    Checkpoint cp;
+    bool resume = !restart && read_checkpoint(checkpointPath, cp) && cp.inputSize == inputSize && cp.keyId == key_id(sealKey) &&
+                  cp.inputOffset <= inputSize && fs::file_size(tmp, ec) >= cp.outputBytes && !ec;
+    if (resume) {
+        fs::resize_file(tmp, cp.outputBytes); // whatever a crash left past the checkpoint
+        std::cout << "Resuming after " << cp.records << " record(s), at byte " << cp.inputOffset << " of " << inputSize << ".\n";
+    } else {
+        cp = Checkpoint();
+        cp.inputSize = inputSize;
+        cp.keyId = key_id(sealKey);
+        // backup original log
+        fs::create_directories("backups");
+        cp.backup = "backups/sent_messages_plain_" + std::to_string(std::time(nullptr)) + ".log";
+        try {
+            fs::copy_file(path, cp.backup, fs::copy_options::overwrite_existing);
+            std::cout << "Backed up plaintext log to: " << cp.backup << "\n";
+        } catch (const std::exception &e) {
+            std::cerr << "Warning: could not backup original log: " << e.what() << "\n";
         }
     }
-    infile.close();
 
-    // open tmp output
-    std::string tmp = path + ".tmp";
-    std::ofstream outfile(tmp, std::ios::binary | std::ios::trunc);
+    std::ifstream infile(path, std::ios::binary);
+    if (!infile.is_open()) {
+        std::cerr << "Unable to open log file for reading: " << path << "\n";
+        return 8;
+    }
+    std::ofstream outfile(tmp, std::ios::binary | (resume ? std::ios::app : std::ios::trunc));
     if (!outfile.is_open()) {
         std::cerr << "Unable to open temporary output file: " << tmp << "\n";
-        sodium_memzero((void*)masterKey.data(), masterKey.size());
         return 9;
     }
+    if (!resume) {
+        // a segment's header line (SegmentedLog.h) is kept as is
+        std::string first;
+        if (std::getline(infile, first) && first.compare(0, 6, "LCSEG ") == 0) {
+            cp.inputOffset = first.size() + (infile.eof() ? 0 : 1);
+            if (first.back() == '\r') first.pop_back();
+            first = header_with_key(first, key_id(sealKey));
+            outfile << first << '\n';
+            cp.outputBytes = first.size() + 1;
+        }
+        infile.clear();
+    }
+    infile.seekg((std::streamoff)cp.inputOffset);
 
-    // regex for priority
-    std::regex prio_re(R"(\[Priority:\s*(\d+)\])");
-
-    for (auto &p : records) {
-        std::string ts = p.first;
-        std::string content = p.second;
+    BoundedQueue<Chunk> chunks(CHUNKS_AHEAD);
+    std::thread reader([&] {
+        parse_log(infile, cp.inputOffset, chunks);
+        chunks.close();
+    });
 
-        if (ts.empty()) {
-            std::time_t now = std::time(nullptr);
-            ts = std::string(std::ctime(&now));
-            if (!ts.empty() && ts.back() == '\n') ts.pop_back();
+    AeadBatchEngine engine(threads);
+    const SuiteId suite = best_suite();
+    const auto start = std::chrono::steady_clock::now();
+    auto lastReport = start;
+    const uint64_t startOffset = cp.inputOffset;
+    uint64_t recordsNow = 0, failed = 0;
+    int rc = 0;
+    std::vector<std::string> lines;
+    Chunk chunk;
+    while (chunks.pop(chunk)) {
+        // migrate, seal and encode across the pool; lines[i] keeps the order of the log
+        lines.assign(chunk.lines.size(), std::string());
+        engine.parallelFor(chunk.lines.size(), [&](size_t i) {
+            LegacyLogFields &f = chunk.lines[i].fields;
+            std::string rec;
+            try {
+                migrate_legacy_log_record(rec, f, chunk.lines[i].timeNs, ByteSpan(masterKey));
+                std::string sealed(aead_boxed_len(suite, rec.size()), '\0');
+                sealed.resize(encrypt_aead(MutableByteSpan(sealed), ByteSpan(rec), sealKey, suite));
+                binToBase64(lines[i], ByteSpan(sealed));
+            } catch (const std::exception &) {
+                lines[i].clear(); // write nothing for this record
+            }
+            sodium_memzero(&f.body[0], f.body.size());
+            sodium_memzero(&rec[0], rec.size());
+        });
+        for (const std::string &l : lines) {
+            if (l.empty()) { ++failed; continue; }
+            outfile << l << '\n';
+            cp.outputBytes += l.size() + 1;
+            ++cp.records;
+            ++recordsNow;
         }
-
-        // extract priority
-        std::smatch m;
-        int priority = 2;
-        if (std::regex_search(content, m, prio_re) && m.size() >= 2) {
-            priority = std::stoi(m[1].str());
-            content = std::regex_replace(content, prio_re, "");
+        outfile.flush();
+        if (!outfile) {
+            std::cerr << "\nFailed writing " << tmp << "; run again to resume.\n";
+            rc = 9;
+            break;
         }
-        // remove leading " : " or similar
-        size_t pos = content.find_first_not_of(" :\t");
-        if (pos != std::string::npos) content = content.substr(pos);
-        else content.clear();
-
-        // now content is the plaintext message
-        std::string record_plain = ts + " : " + content + " [Priority: " + std::to_string(priority) + "]";
-
+        cp.inputOffset = chunk.endOffset;
         try {
-            std::string boxed;
-            if (have_logkey) boxed = encrypt_aead(record_plain, logKey);
-            else boxed = encrypt_aead(record_plain, masterKey);
-
-            std::string b64 = binToBase64(reinterpret_cast<const unsigned char*>(boxed.data()), boxed.size());
-            outfile << b64 << "\n";
+            sync_file(tmp); // the checkpoint may only vouch for output that is on disk
+            write_checkpoint(checkpointPath, cp);
         } catch (const std::exception &e) {
-            std::cerr << "Encryption failed for record: " << e.what() << "\n";
-            // write nothing for this record; continue
+            std::cerr << "\nCheckpoint failed: " << e.what() << "\n";
+            rc = 9;
+            break;
+        }
+        auto now = std::chrono::steady_clock::now();
+        if (now - lastReport >= std::chrono::seconds(1)) {
+            lastReport = now;
+            report_progress(cp, recordsNow, cp.inputOffset - startOffset, std::chrono::duration<double>(now - start).count());
         }
     }
-
+    chunks.close(); // unblocks the reader if we stopped early
+    reader.join();
+    if (rc) return rc;
     outfile.close();
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    report_progress(cp, recordsNow, cp.inputOffset - startOffset, secs);
+    std::cerr << "\n";
+    std::cout << "Sealed " << recordsNow << " record(s) this run (" << cp.records << " in all) with " << suite_name(suite) << " on "
+              << engine.threadCount() << " thread(s) in " << secs << " s.\n";
+    if (failed) std::cerr << failed << " record(s) failed to seal and were left out.\n";
 
-    // atomically replace
+    // atomically replace; the old index points into the plaintext layout
     try {
+        sync_file(tmp);
         fs::rename(tmp, path);
+        sync_dir(fs::path(path).parent_path().string());
     } catch (const std::exception &e) {
         std::cerr << "Failed to overwrite original log with sanitized log: " << e.what() << "\n";
-        sodium_memzero((void*)masterKey.data(), masterKey.size());
         return 10;
     }
+    fs::remove(log_index_path(path), ec);
+    try { update_manifest_key(path, key_id(sealKey)); } catch (const std::exception &e) {
+        std::cerr << "Warning: could not update the log manifest: " << e.what() << "\n";
+    }
+    fs::remove(checkpointPath, ec);
 
-    sodium_memzero((void*)masterKey.data(), masterKey.size());
-    if (have_logkey) sodium_memzero((void*)logKey.data(), logKey.size());
-
-    std::cout << "Re-encryption complete. Log sanitized and original backed up at: " << backup << "\n";
+    std::cout << "Re-encryption complete. Log sanitized and original backed up at: " << cp.backup << "\n";
     return 0;
 }
@@ -1,46 +1,104 @@
 // rotate_keys.cpp
+// Usage: ./rotate_keys                  rewrap every log key (current and older epochs) under a new passphrase
+//        ./rotate_keys --new-log-epoch  start a new log key epoch (LogKeyring.h); a running messenger
+//                                       keeps its key until restarted (its menu 11 does this in place)
 #include <iostream>
 #include <string>
 #include <vector>
 #include <filesystem>
 #include "Encryption.h"
+#include "KeyAgent.h"
+#include "KeyHeader.h"
+#include "LogKeyring.h"
 
 namespace fs = std::filesystem;
 
-int main() {
+int main(int argc, char **argv) {
     try { init_crypto(); } catch (const std::exception &e) { std::cerr<<e.what()<<"\n"; return 1; }
     std::string keydir = "modules/emergency_messenger/keys";
     fs::create_directories(keydir);
-    std::string salt_path = keydir + "/user_salt.bin";
-    if (!fs::exists(salt_path)) { std::cerr << "Salt not found: " << salt_path << "\n"; return 2; }
-    auto salt = read_binary_file(salt_path);
+    KdfParams kdf;
+    try { kdf = load_kdf_params(keydir); }
+    catch (const std::exception &e) { std::cerr << "Cannot load KDF parameters: " << e.what() << "\n"; return 2; }
 
-    std::string oldp, newp;
-    std::cout << "Old passphrase: "; std::getline(std::cin, oldp);
-    std::cout << "New passphrase: "; std::getline(std::cin, newp);
-
-    std::string old_master = derive_master_key(oldp, salt);
-    std::string new_master = derive_master_key(newp, salt);
+    if (argc > 1 && std::string(argv[1]) == "--new-log-epoch") {
+        SecureString master, current;
+        try { agent_load_keys(master, current); }
+        catch (const std::exception &e) { std::cerr << "Key agent unavailable (" << e.what() << "); falling back to passphrase.\n"; }
+        if (master.empty()) {
+            SecureString pass;
+            std::cout << "Passphrase: "; std::getline(std::cin, pass);
+            try { master = derive_master_key(pass, kdf); }
+            catch (const std::exception &e) { std::cerr << "Key derivation failed: " << e.what() << "\n"; return 4; }
+        }
+        try {
+            SecureString next = rotate_log_epoch(keydir, ByteSpan(master));
+            std::cout << "New log key epoch " << std::hex << key_id(ByteSpan(next)) << std::dec << " in " << keydir << "/" << LOG_KEY_FILE
+                      << "; older keys are kept under " << keydir << "/" << LOG_EPOCH_DIR << ".\n";
+        } catch (const std::exception &e) {
+            std::cerr << "Failed to start a new epoch: " << e.what() << "\n";
+            return 4;
+        }
+        return 0;
+    }
 
-    std::string wrapped_path = keydir + "/wrapped_logkey.bin";
+    std::string wrapped_path = keydir + "/" + LOG_KEY_FILE;
     if (!fs::exists(wrapped_path)) { std::cerr << "Wrapped log key not found: " << wrapped_path << "\n"; return 3; }
-    auto wrapped = read_binary_file(wrapped_path);
-    std::string wrapped_str((char*)wrapped.data(), wrapped.size());
+    std::vector<std::string> files = log_key_files(keydir);
+
+    // client mode: the agent unwraps with the current masterKey, so only the new passphrase
+    // needs an Argon2 run here
+    std::vector<SecureString> logKeys;
+    bool via_agent = false;
+    if (KeyAgentClient::configured()) {
+        try {
+            KeyAgentClient agent;
+            for (const std::string &f : files) logKeys.push_back(agent.unwrap(ByteSpan(read_binary_file(f))));
+            via_agent = true;
+            std::cout << "Unwrapped " << logKeys.size() << " log key(s) via key agent.\n";
+        } catch (const std::exception &e) {
+            std::cerr << "Key agent unwrap failed (" << e.what() << "); falling back to passphrase.\n";
+            logKeys.clear();
+        }
+    }
+
+    SecureString oldp, newp;
+    if (!via_agent) { std::cout << "Old passphrase: "; std::getline(std::cin, oldp); }
+    std::cout << "New passphrase: "; std::getline(std::cin, newp);
 
     try {
-        std::string logKey = decrypt_aead(wrapped_str, old_master);
-        std::string new_wrapped = encrypt_aead(logKey, new_master);
-        std::string backup = wrapped_path + ".bak";
-        fs::rename(wrapped_path, backup);
-        std::vector<unsigned char> nb(new_wrapped.begin(), new_wrapped.end());
-        write_binary_file(wrapped_path, nb);
-        sodium_memzero((void*)old_master.data(), old_master.size());
-        sodium_memzero((void*)new_master.data(), new_master.size());
-        sodium_memzero((void*)logKey.data(), logKey.size());
-        std::cout << "Rewrapped logKey. Backup created: " << backup << "\n";
+        // unwrap everything before anything is rewritten
+        if (!via_agent) {
+            SecureString old_master = derive_master_key(oldp, kdf);
+            for (const std::string &f : files) logKeys.push_back(decrypt_aead_secure(ByteSpan(read_binary_file(f)), ByteSpan(old_master)));
+        }
+        SecureString new_master = derive_master_key(newp, kdf);
+        for (size_t i = 0; i < files.size(); ++i) {
+            std::vector<unsigned char> nb(aead_boxed_len(logKeys[i].size()));
+            encrypt_aead(MutableByteSpan(nb), ByteSpan(logKeys[i]), ByteSpan(new_master));
+            if (files[i] == wrapped_path) {
+                std::string backup = wrapped_path + ".bak";
+                fs::rename(wrapped_path, backup);
+                write_binary_file(wrapped_path, nb);
+                std::cout << "Rewrapped logKey. Backup created: " << backup << "\n";
+            } else {
+                // older epochs keep a backup too: a bad rewrap must not lose the only copy
+                fs::copy_file(files[i], files[i] + ".bak", fs::copy_options::overwrite_existing);
+                write_binary_file(files[i] + ".tmp", nb);
+                sync_file(files[i] + ".tmp");
+                fs::rename(files[i] + ".tmp", files[i]);
+            }
+        }
+        if (files.size() > 1) std::cout << "Rewrapped " << files.size() - 1 << " older log key epoch(s) (backups: <epoch>.bin.bak).\n";
     } catch (const std::exception &e) {
         std::cerr << "Failed rewrap: " << e.what() << "\n";
         return 4;
     }
+
+    // the agent still holds the old masterKey: lock it so it is re-unlocked with the new passphrase
+    if (via_agent) {
+        try { KeyAgentClient().lock(); std::cout << "Key agent locked; restart it with the new passphrase.\n"; }
+        catch (const std::exception &e) { std::cerr << "Warning: could not lock key agent: " << e.what() << "\n"; }
+    }
     return 0;
 }
@@ -0,0 +1,149 @@
+// stream_tool.cpp
+// Usage: ./stream_tool encrypt|decrypt <in|-> <out|->
+//        ./stream_tool bench [MiB]
+// Streams a file of any size through SecretStream.h under a subkey of the masterKey (from
+// key_agent when LIFECORE_AGENT_SOCK is set, else the passphrase). "-" means stdin/stdout. bench measures
+// encrypt and decrypt throughput with a random key, entirely in memory (default 2048 MiB).
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdlib>
+#include "Encryption.h"
+#include "KeyAgent.h"
+#include "KeyHeader.h"
+#include "SecretStream.h"
+
+// Feeds `total` bytes of a repeating pattern without materialising them.
+class PatternBuf : public std::streambuf {
+public:
+    explicit PatternBuf(uint64_t total) : left(total), block(1 << 20) {
+        randombytes_buf(block.data(), block.size());
+    }
+protected:
+    int_type underflow() override {
+        if (left == 0) return traits_type::eof();
+        size_t n = (size_t)std::min<uint64_t>(left, block.size());
+        left -= n;
+        setg(block.data(), block.data(), block.data() + n);
+        return traits_type::to_int_type(block[0]);
+    }
+private:
+    uint64_t left;
+    std::vector<char> block;
+};
+
+// Reads an in-memory blob without copying it (istringstream would copy per iteration).
+class MemBuf : public std::streambuf {
+public:
+    explicit MemBuf(std::string &s) { setg(&s[0], &s[0], &s[0] + s.size()); }
+};
+
+// Counts and discards everything written to it.
+class SinkBuf : public std::streambuf {
+public:
+    uint64_t count = 0;
+protected:
+    std::streamsize xsputn(const char *, std::streamsize n) override { count += (uint64_t)n; return n; }
+    int_type overflow(int_type c) override { if (c != traits_type::eof()) ++count; return c; }
+};
+
+static int bench(uint64_t mib) {
+    SecureString key(MASTER_KEY_LEN, '\0');
+    randombytes_buf(&key[0], key.size());
+    uint64_t bytes = mib * 1024 * 1024;
+
+    // encrypt throughput: pattern source -> counting sink
+    PatternBuf src(bytes);
+    SinkBuf sink;
+    std::istream in(&src);
+    std::ostream out(&sink);
+    auto t0 = std::chrono::steady_clock::now();
+    stream_encrypt(in, out, ByteSpan(key));
+    double enc_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+    // decrypt throughput: a 256 MiB sample is encrypted to memory, then opened repeatedly
+    uint64_t sample = std::min<uint64_t>(bytes, 256ull * 1024 * 1024);
+    PatternBuf sample_src(sample);
+    std::istream sample_in(&sample_src);
+    std::stringstream sealed;
+    stream_encrypt(sample_in, sealed, ByteSpan(key));
+    std::string blob = sealed.str();
+    uint64_t reps = (bytes + sample - 1) / sample;
+    SinkBuf plain_sink;
+    std::ostream plain_out(&plain_sink);
+    auto t1 = std::chrono::steady_clock::now();
+    for (uint64_t r = 0; r < reps; ++r) {
+        MemBuf mem(blob);
+        std::istream blob_in(&mem);
+        stream_decrypt(blob_in, plain_out, ByteSpan(key));
+    }
+    double dec_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - t1).count();
+
+    double mb = (double)bytes / (1024.0 * 1024.0);
+    std::cout << "encrypt: " << (uint64_t)mb << " MiB in " << enc_s << " s = " << (uint64_t)(mb / enc_s) << " MiB/s\n"
+              << "decrypt: " << (uint64_t)((double)plain_sink.count / (1024.0 * 1024.0)) << " MiB in " << dec_s
+              << " s = " << (uint64_t)((double)plain_sink.count / (1024.0 * 1024.0) / dec_s) << " MiB/s\n";
+    return 0;
+}
+
+static SecureString load_master_key() {
+    SecureString masterKey, logKey;
+    if (agent_load_keys(masterKey, logKey)) return masterKey;
+    KdfParams kdf = load_kdf_params("modules/emergency_messenger/keys");
+    SecureString pass;
+    std::cerr << "Enter passphrase to derive master key: ";
+    std::getline(std::cin, pass);
+    if (pass.empty()) throw std::runtime_error("empty passphrase");
+    return derive_master_key(pass, kdf);
+}
+
+int main(int argc, char **argv) {
+    try { init_crypto(); } catch (const std::exception &e) { std::cerr<<"libsodium init failed: "<<e.what()<<"\n"; return 1; }
+
+    std::string mode = argc > 1 ? argv[1] : "";
+    if (mode == "bench") {
+        uint64_t mib = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 2048;
+        if (mib == 0) { std::cerr << "MiB must be positive\n"; return 2; }
+        try { return bench(mib); } catch (const std::exception &e) { std::cerr << "Bench failed: " << e.what() << "\n"; return 3; }
+    }
+    if ((mode != "encrypt" && mode != "decrypt") || argc != 4) {
+        std::cerr << "Usage: " << argv[0] << " encrypt|decrypt <in|-> <out|->\n       " << argv[0] << " bench [MiB]\n";
+        return 2;
+    }
+    std::string in_path = argv[2], out_path = argv[3];
+    if (in_path == "-" && !KeyAgentClient::configured()) {
+        std::cerr << "Reading the " << (mode == "encrypt" ? "payload" : "stream") << " from stdin needs key_agent (the passphrase prompt also uses stdin)\n";
+        return 2;
+    }
+
+    SecureString masterKey;
+    try { masterKey = load_master_key(); } catch (const std::exception &e) { std::cerr << "Cannot load master key: " << e.what() << "\n"; return 4; }
+
+    std::ifstream fin;
+    std::ofstream fout;
+    if (in_path != "-") {
+        fin.open(in_path, std::ios::binary);
+        if (!fin.is_open()) { std::cerr << "Cannot open " << in_path << "\n"; return 5; }
+    }
+    if (out_path != "-") {
+        fout.open(out_path, std::ios::binary | std::ios::trunc);
+        if (!fout.is_open()) { std::cerr << "Cannot create " << out_path << "\n"; return 5; }
+    }
+    std::istream &in = in_path == "-" ? std::cin : fin;
+    std::ostream &out = out_path == "-" ? std::cout : fout;
+
+    try {
+        uint64_t n = mode == "encrypt" ? stream_encrypt(in, out, ByteSpan(masterKey))
+                                       : stream_decrypt(in, out, ByteSpan(masterKey));
+        out.flush();
+        std::cerr << (mode == "encrypt" ? "Encrypted " : "Decrypted ") << n << " bytes\n";
+    } catch (const std::exception &e) {
+        std::cerr << (mode == "encrypt" ? "Encryption" : "Decryption") << " failed: " << e.what() << "\n";
+        if (out_path != "-") { fout.close(); std::remove(out_path.c_str()); }
+        return 6;
+    }
+    return 0;
+}
@@ -1,16 +1,1074 @@
 // test_roundtrip.cpp
 #include <iostream>
 #include "Encryption.h"
+#include "BatchCrypto.h"
+#include "KeyHeader.h"
+#include "SecretStream.h"
+#include "Vault.h"
+#include "PriorityScheduler.h"
+#include "MpmcRing.h"
+#include "BoundedQueue.h"
+#include "Journal.h"
+#include "QueueStore.h"
+#include "DedupIndex.h"
+#include "RateLimiter.h"
+#include "SentHistory.h"
+#include "LogKeyring.h"
+#include "MessageQueue.h"
+#if !defined(_WIN32)
+#include "KeyAgent.h"
+#endif
+#include <algorithm>
+#include <atomic>
+#include <ctime>
+#include <mutex>
+#include <thread>
+#include <sstream>
+
+static int failures = 0;
+static void check(bool ok, const char *what) {
+    if (!ok) { std::cerr << "FAIL: " << what << "\n"; ++failures; }
+}
 
 int main() {
     try { init_crypto(); } catch (...) { std::cerr<<"libsodium init failed\n"; return 2; }
 
     // test salt + argon2
     auto salt = generate_salt();
-    std::string key = derive_master_key("testpass", salt);
+    SecureString key = derive_master_key(std::string("testpass"), salt);
     std::string pt = "This is a test message";
     std::string boxed = encrypt_aead(pt, key);
     std::string recovered = decrypt_aead(boxed, key);
     std::cout << "Original: " << pt << "\nRecovered: " << recovered << "\n";
-    return (pt == recovered) ? 0 : 3;
+    if (pt != recovered) return 3;
+
+    // span API: caller buffers, combined and in-place
+    {
+        unsigned char out[256];
+        size_t n = encrypt_aead(MutableByteSpan(out, sizeof(out)), ByteSpan(pt), ByteSpan(key));
+        check(n == aead_boxed_len(pt.size()), "span encrypt size");
+        std::string plain(aead_plain_len(n), '\0');
+        plain.resize(decrypt_aead(MutableByteSpan(plain), ByteSpan(out, n), ByteSpan(key)));
+        check(plain == pt, "span roundtrip");
+
+        std::vector<unsigned char> buf(aead_boxed_len(pt.size()));
+        std::memcpy(buf.data() + AEAD_NONCE_LEN, pt.data(), pt.size());
+        encrypt_aead(MutableByteSpan(buf), ByteSpan(buf.data() + AEAD_NONCE_LEN, pt.size()), ByteSpan(key));
+        check(decrypt_aead(std::string(buf.begin(), buf.end()), key) == pt, "in-place encrypt interop");
+        ByteSpan view = decrypt_aead_inplace(MutableByteSpan(buf), ByteSpan(key));
+        check(std::string((const char*)view.data(), view.size()) == pt, "in-place decrypt");
+
+        std::string detached = pt;
+        unsigned char nonce[AEAD_NONCE_LEN], tag[AEAD_TAG_LEN];
+        encrypt_aead_detached(MutableByteSpan(detached), nonce, tag, ByteSpan(key));
+        decrypt_aead_detached(MutableByteSpan(detached), nonce, tag, ByteSpan(key));
+        check(detached == pt, "detached roundtrip");
+
+        bool threw = false;
+        try { encrypt_aead(MutableByteSpan(out, pt.size()), ByteSpan(pt), ByteSpan(key)); } catch (const std::exception &) { threw = true; }
+        check(threw, "short output buffer rejected");
+    }
+
+    // failure cases: wrong key, corrupted ciphertext
+    {
+        SecureString other = derive_master_key(std::string("otherpass"), salt);
+        bool threw = false;
+        try { decrypt_aead(boxed, other); } catch (const std::exception &) { threw = true; }
+        check(threw, "wrong key rejected");
+        std::string corrupt = boxed;
+        corrupt[corrupt.size() / 2] ^= 0x01;
+        threw = false;
+        try { decrypt_aead(corrupt, key); } catch (const std::exception &) { threw = true; }
+        check(threw, "corrupted ciphertext rejected");
+        std::vector<unsigned char> cbuf(corrupt.begin(), corrupt.end());
+        threw = false;
+        try { decrypt_aead_inplace(MutableByteSpan(cbuf), ByteSpan(key)); } catch (const std::exception &) { threw = true; }
+        check(threw, "corrupted in-place decrypt rejected");
+    }
+
+    // base64 into reused buffers
+    {
+        std::string b64;
+        binToBase64(b64, ByteSpan(boxed));
+        check(b64 == binToBase64((const unsigned char*)boxed.data(), boxed.size()), "base64 reuse encode");
+        std::vector<unsigned char> bin;
+        base64ToBin(bin, b64);
+        check(std::string(bin.begin(), bin.end()) == boxed, "base64 reuse decode");
+    }
+
+    // batch engine: seal/open across a pool with per-record errors
+    {
+        AeadBatchEngine engine(4);
+        std::vector<std::string> plains;
+        for (int i = 0; i < 1000; ++i) plains.push_back("record #" + std::to_string(i));
+        std::vector<AeadRecord> sealed(plains.size());
+        for (size_t i = 0; i < plains.size(); ++i) sealed[i].input = ByteSpan(plains[i]);
+        check(engine.seal(sealed, ByteSpan(key)) == 0, "batch seal");
+
+        sealed[7].output[30] ^= 0x01; // corrupt one record
+        std::vector<AeadRecord> opened(sealed.size());
+        for (size_t i = 0; i < sealed.size(); ++i) opened[i].input = ByteSpan(sealed[i].output);
+        check(engine.open(opened, ByteSpan(key)) == 1, "batch open reports one failure");
+        check(!opened[7].ok && !opened[7].error.empty(), "batch per-record error");
+        bool all = true;
+        for (size_t i = 0; i < plains.size(); ++i) if (i != 7 && (!opened[i].ok || opened[i].output.compare(plains[i].c_str()) != 0)) all = false;
+        check(all, "batch roundtrip preserves order");
+    }
+
+    // key header: roundtrip, tamper detection, legacy-compatible derivation
+    {
+        KdfParams kdf;
+        kdf.salt = salt;
+        KdfParams back = decode_key_header(encode_key_header(kdf));
+        check(back.salt == salt && back.opslimit == kdf.opslimit && back.memlimit == kdf.memlimit && back.alg == kdf.alg,
+              "key header roundtrip");
+        check(derive_master_key(std::string("testpass"), back) == key, "header params match legacy derivation");
+        auto hdr = encode_key_header(kdf);
+        hdr[10] ^= 0x01;
+        bool threw = false;
+        try { decode_key_header(hdr); } catch (const std::exception &) { threw = true; }
+        check(threw, "tampered key header rejected");
+
+        double ms = 0;
+        KdfParams cal = kdf_calibrate(20, 8 * 1024 * 1024, &ms);
+        check(cal.memlimit == 8 * 1024 * 1024 && cal.opslimit >= 1 && cal.salt.size() == SALT_LEN, "calibration within budget");
+    }
+
+    // secretstream: multi-chunk roundtrip, exact-multiple boundary, truncation and tamper, and
+    // the key is a subkey (the same stream marked with the unreleased version 1 is refused)
+    {
+        for (size_t len : {0, 1000, 4096, 10000}) {
+            std::string data(len, '\0');
+            randombytes_buf(&data[0], data.size());
+            std::istringstream in(data);
+            std::stringstream sealed, opened;
+            check(stream_encrypt(in, sealed, ByteSpan(key), 1024) == len, "stream encrypt length");
+            check(stream_decrypt(sealed, opened, ByteSpan(key)) == len && opened.str() == data, "stream roundtrip");
+        }
+        std::string data(5000, 'x');
+        std::istringstream in(data);
+        std::stringstream sealed;
+        stream_encrypt(in, sealed, ByteSpan(key), 1024);
+        std::string blob = sealed.str();
+
+        auto rejects = [&](const std::string &b) {
+            std::istringstream bin(b);
+            std::ostringstream sink;
+            try { stream_decrypt(bin, sink, ByteSpan(key)); } catch (const std::exception &) { return true; }
+            return false;
+        };
+        check(rejects(blob.substr(0, blob.size() - 1044)), "truncated stream rejected");
+        std::string flipped = blob;
+        flipped[100] ^= 0x01;
+        check(rejects(flipped), "tampered stream rejected");
+        std::string other(MASTER_KEY_LEN, 'k');
+        std::istringstream bin(blob);
+        std::ostringstream sink;
+        bool threw = false;
+        try { stream_decrypt(bin, sink, ByteSpan(other)); } catch (const std::exception &) { threw = true; }
+        check(threw, "stream wrong key rejected");
+        std::string v1 = blob;
+        v1[4] = 1;
+        check(blob[4] == (char)STREAM_VERSION && rejects(v1), "stream sealed under a subkey");
+    }
+
+    // base64: every kernel matches libsodium byte for byte and rejects what libsodium rejects
+    {
+        std::vector<unsigned char> data(300);
+        randombytes_buf(data.data(), data.size());
+        bool same = true, strict = true;
+        for (size_t len = 0; len <= data.size(); ++len) {
+            size_t ref_len = sodium_base64_encoded_len(len, sodium_base64_VARIANT_ORIGINAL);
+            std::string ref(ref_len, '\0');
+            sodium_bin2base64(&ref[0], ref_len, data.data(), len, sodium_base64_VARIANT_ORIGINAL);
+            ref.resize(ref_len - 1);
+            for (B64Impl impl : {B64_SCALAR, B64_SSSE3, B64_AVX2}) {
+                if (impl > b64_best_impl()) break;
+                std::string enc(b64_encoded_len(len), '\0');
+                b64_encode(&enc[0], data.data(), len, impl);
+                std::vector<unsigned char> dec(b64_decoded_maxlen(enc.size()));
+                size_t n = 0;
+                if (enc != ref || !b64_decode(dec.data(), &n, enc.data(), enc.size(), impl) || n != len ||
+                    std::memcmp(dec.data(), data.data(), len) != 0) same = false;
+                // a bad character anywhere, or a changed final character, must agree with libsodium
+                for (size_t pos = 0; pos < ref.size(); pos += (pos + 1 < ref.size() - 4 ? 7 : 1)) {
+                    for (char bad : {'!', '=', '-', '\n', 'B'}) {
+                        std::string mut = ref;
+                        mut[pos] = bad;
+                        std::vector<unsigned char> a(mut.size() + 1), b(mut.size() + 1);
+                        size_t an = 0, bn = 0;
+                        bool ours = b64_decode(a.data(), &an, mut.data(), mut.size(), impl);
+                        bool theirs = sodium_base642bin(b.data(), b.size(), mut.data(), mut.size(), NULL, &bn, NULL,
+                                                        sodium_base64_VARIANT_ORIGINAL) == 0;
+                        if (ours != theirs || (ours && (an != bn || std::memcmp(a.data(), b.data(), an) != 0))) strict = false;
+                    }
+                }
+            }
+        }
+        check(same, "base64 kernels match libsodium");
+        check(strict, "base64 rejects malformed input like libsodium");
+        // libsodium 1.0.18 lets some bytes >= 0x80 through; we reject all non-alphabet bytes
+        std::string high(64, 'A');
+        high[40] = '\xc1';
+        std::vector<unsigned char> out(64);
+        size_t n = 0;
+        check(!b64_decode(out.data(), &n, high.data(), high.size()), "base64 rejects non-ASCII");
+        bool threw = false;
+        try { base64ToBin(out, std::string("QUJ")); } catch (const std::exception &) { threw = true; }
+        check(threw, "base64 rejects missing padding");
+    }
+
+    // secure pool: freed chunks are zeroed and reused, large blocks bypass the slabs
+    {
+        SecurePool &pool = SecurePool::instance();
+        unsigned char *p = (unsigned char*)pool.allocate(100);
+        std::memset(p, 0xAB, 100);
+        pool.deallocate(p, 100);
+        unsigned char *q = (unsigned char*)pool.allocate(120); // same 128-byte class
+        bool zeroed = true;
+        for (size_t i = 0; i < 120; ++i) if (q[i]) zeroed = false;
+        check(q == p && zeroed, "secure pool reuses and zeroes chunks");
+        pool.deallocate(q, 120);
+        void *big = pool.allocate(SecurePool::MAX_CLASS + 1);
+        std::memset(big, 1, SecurePool::MAX_CLASS + 1);
+        pool.deallocate(big, SecurePool::MAX_CLASS + 1);
+
+        SecureString a(40, 'k');
+        SecureString b(std::move(a));
+        check(b == SecureString(40, 'k') && a.empty(), "SecureString move");
+        const char secret[] = "shortpassword12"; // fills the small-string buffer
+        SecureString shortPw(secret), longer(40, 'x');
+        const char *inlineBuf = shortPw.data(); // inside the object
+        shortPw = longer;
+        bool wiped = shortPw.data() != inlineBuf;
+        for (size_t i = 0; i + 1 < sizeof(secret) && wiped; ++i) wiped = inlineBuf[i] != secret[i];
+        check(shortPw == longer && wiped, "SecureString copy-assign wipes the inline buffer");
+        SecureString grown;
+        for (int i = 0; i < 1000; ++i) grown += "0123456789";
+        SecureBuffer buf(5000, 7);
+        check(grown.size() == 10000 && buf[4999] == 7, "secure containers grow through the pool");
+    }
+
+    // cipher suites: tagged roundtrips, in-place sealing, mixed-suite batches, legacy look-alikes
+    {
+        std::vector<SuiteId> suites = {SUITE_LEGACY, SUITE_XCHACHA20POLY1305};
+        if (Aes256GcmSuite::available()) suites.push_back(SUITE_AES256GCM);
+        std::vector<std::string> blobs;
+        for (SuiteId suite : suites) {
+            std::string blob(aead_boxed_len(suite, pt.size()), '\0');
+            blob.resize(encrypt_aead(MutableByteSpan(blob), ByteSpan(pt), ByteSpan(key), suite));
+            check(blob.size() == aead_boxed_len(suite, pt.size()), "suite boxed length");
+            check(decrypt_aead(blob, key) == pt, "suite roundtrip");
+            std::string flipped = blob;
+            flipped[0] = (char)(suite == SUITE_AES256GCM ? SUITE_XCHACHA20POLY1305 : SUITE_AES256GCM);
+            bool threw = false;
+            try { decrypt_aead(flipped, key); } catch (const std::exception &) { threw = true; }
+            check(suite == SUITE_LEGACY || threw, "suite id is authenticated");
+            blobs.push_back(blob);
+        }
+        std::vector<unsigned char> inplace(suite_boxed_len<XChaCha20Poly1305Suite>(pt.size()));
+        size_t off = 1 + XChaCha20Poly1305Suite::NONCE_LEN;
+        std::memcpy(inplace.data() + off, pt.data(), pt.size());
+        seal_suite<XChaCha20Poly1305Suite>(MutableByteSpan(inplace), ByteSpan(inplace.data() + off, pt.size()), ByteSpan(key));
+        ByteSpan view = decrypt_aead_inplace(MutableByteSpan(inplace), ByteSpan(key));
+        check(std::string((const char*)view.data(), view.size()) == pt, "suite in-place seal/open");
+
+        // an untagged blob whose nonce starts with a suite id must still open, in place too
+        std::string lookalike;
+        do { lookalike = encrypt_aead(pt, ByteSpan(key)); } while ((unsigned char)lookalike[0] != SUITE_AES256GCM);
+        blobs.push_back(lookalike);
+        std::vector<unsigned char> la(lookalike.begin(), lookalike.end());
+        view = decrypt_aead_inplace(MutableByteSpan(la), ByteSpan(key));
+        check(std::string((const char*)view.data(), view.size()) == pt, "legacy blob with id-like first byte");
+        // only a failed tag falls back to the legacy layout; other errors are reported as they are
+        std::string shortTagged(AEAD_OVERHEAD, '\0');
+        shortTagged[0] = (char)SUITE_XCHACHA20POLY1305;
+        std::string what;
+        try { decrypt_aead(shortTagged, key); } catch (const std::exception &e) { what = e.what(); }
+        check(what == "Ciphertext too short", "suite errors are not masked");
+
+        AeadBatchEngine engine(2);
+        std::vector<AeadRecord> mixed(blobs.size());
+        for (size_t i = 0; i < blobs.size(); ++i) mixed[i].input = ByteSpan(blobs[i]);
+        bool all = engine.open(mixed, ByteSpan(key)) == 0;
+        for (auto &r : mixed) if (r.output.compare(pt.c_str()) != 0) all = false;
+        check(all, "mixed-suite batch open");
+
+        save_vault("test_vault.tmp", "{\"k\":1}", ByteSpan(key));
+        check(load_vault("test_vault.tmp", ByteSpan(key)) == "{\"k\":1}", "vault roundtrip");
+        std::remove("test_vault.tmp");
+    }
+
+    // scheduler: priority order, FIFO within a priority, mid-drain preemption, aging
+    {
+        PriorityScheduler<int> sched(std::chrono::milliseconds(0));
+        for (int i = 0; i < 40; ++i) sched.push(300 + i, 3);
+        sched.push(200, 2);
+        sched.push(100, 1);
+        sched.push(201, 2);
+        std::vector<int> got;
+        sched.popBatch(got, 16);
+        check(got.size() == 16 && got[0] == 100 && got[1] == 200 && got[2] == 201 && got[3] == 300 && got[15] == 312,
+              "scheduler priority order + FIFO");
+        sched.push(101, 1); // SOS arrives mid-drain
+        got.clear();
+        sched.popBatch(got, 2);
+        check(got.size() == 2 && got[0] == 101 && got[1] == 313, "scheduler preemption by priority 1");
+        std::vector<int> visited;
+        sched.visitNewestFirst([&](int &v, int) { visited.push_back(v); return visited.size() < 3; });
+        check(visited == std::vector<int>{339, 338, 337}, "scheduler spill order: newest lowest-priority first");
+
+        PriorityScheduler<int> aged(std::chrono::milliseconds(5));
+        aged.push(3, 3);
+        std::this_thread::sleep_for(std::chrono::milliseconds(12));
+        aged.push(2, 2);
+        aged.push(1, 1);
+        int v = 0, prio = 0;
+        check(aged.pop(v, &prio) && v == 1, "aging never outranks priority 1");
+        check(aged.pop(v, &prio) && v == 3 && prio == 3, "aged priority 3 beats fresh priority 2");
+        check(aged.pop(v) && v == 2 && !aged.pop(v), "scheduler drained");
+    }
+
+    // mpmc ring: full/empty edges, then 4 producers x 2 consumers deliver each item exactly once
+    {
+        MpmcRing<int> small(3);
+        int v = 1, out = 0;
+        check(small.capacity() == 4, "ring capacity rounds up");
+        for (int i = 0; i < 4; ++i) small.try_push(v);
+        check(!small.try_push(v), "ring reports full");
+        for (int i = 0; i < 4; ++i) small.try_pop(out);
+        check(!small.try_pop(out) && small.empty(), "ring reports empty");
+
+        MpmcRing<long> ring(64);
+        const long per = 20000, producers = 4;
+        std::atomic<long> sum{0}, count{0};
+        std::vector<std::thread> ts;
+        for (long p = 0; p < producers; ++p)
+            ts.emplace_back([&, p] {
+                for (long i = 1; i <= per; ++i) { long x = p * per + i; while (!ring.try_push(x)) std::this_thread::yield(); }
+            });
+        for (int c = 0; c < 2; ++c)
+            ts.emplace_back([&] {
+                long x;
+                while (count.load() < producers * per) {
+                    if (ring.try_pop(x)) { sum += x; ++count; } else std::this_thread::yield();
+                }
+            });
+        for (auto &t : ts) t.join();
+        long n = producers * per;
+        check(count.load() == n && sum.load() == n * (n + 1) / 2, "ring concurrent exactly-once");
+    }
+
+    // bounded queue: a full queue holds the producer back; close() drains, then ends consumers
+    {
+        BoundedQueue<int> bq(2);
+        std::atomic<int> pushed{0};
+        std::thread producer([&] { for (int i = 0; i < 5; ++i) if (bq.push(i)) ++pushed; bq.close(); });
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        check(pushed.load() == 2, "bounded queue backpressure");
+        int v, expect = 0;
+        bool order = true;
+        while (bq.pop(v)) order = order && v == expect++;
+        producer.join();
+        check(order && expect == 5 && !bq.push(9), "bounded queue FIFO + close");
+    }
+
+    // journal: replay keeps un-acked messages in order, survives a torn tail, and compaction
+    // (tiny thresholds) leaves a snapshot plus only the newest segments
+    {
+        const std::string jdir = "test_journal.tmp";
+        std::filesystem::remove_all(jdir);
+        uint64_t a, b, c;
+        {
+            QueueJournal j(jdir);
+            a = j.enqueue(1, "alpha", "");
+            b = j.enqueue(3, "bravo", "att/b.lcs");
+            c = j.enqueue(2, "charlie", "");
+            j.dequeue(a);
+            j.ack(b);
+        }
+        {
+            std::ofstream torn(jdir + "/wal-1.log", std::ios::binary | std::ios::app);
+            torn << std::string("\x30\x00\x00\x00\x01" "garbage", 12); // length says 48, 7 follow
+        }
+        {
+            QueueJournal j(jdir);
+            auto rec = j.recovered();
+            check(rec.size() == 2 && rec[0].id == a && rec[0].text == "alpha" && rec[0].priority == 1 &&
+                  rec[1].id == c && rec[1].text == "charlie", "journal replay");
+            check(j.enqueue(2, "delta", "") > c, "journal ids keep increasing");
+        }
+        size_t kept = 0;
+        {
+            QueueJournal j(jdir, 256, 1024);
+            std::vector<uint64_t> ids;
+            for (int i = 0; i < 200; ++i) ids.push_back(j.enqueue(2, std::string(40, 'x') + std::to_string(i), ""));
+            for (int i = 0; i < 190; ++i) j.ack(ids[i]);
+            kept = j.liveCount();
+        }
+        size_t segs = 0;
+        for (const auto &de : std::filesystem::directory_iterator(jdir))
+            if (de.path().filename().string().compare(0, 4, "wal-") == 0) ++segs;
+        {
+            QueueJournal j(jdir);
+            check(j.liveCount() == kept && kept == 2 + 1 + 10, "journal replay after compaction");
+        }
+        check(std::filesystem::exists(jdir + "/snapshot.log") && segs < 20, "journal compaction drops old segments");
+        std::filesystem::remove_all(jdir);
+    }
+
+    // queue store: fields survive a save/map/scan, spans point into the mapping, damage is caught
+    {
+        const std::string path = "test_store.tmp";
+        std::string ct = encrypt_aead(pt, ByteSpan(key));
+        const std::string att = "att/x.lcs";
+        {
+            QueueStoreWriter w(path);
+            for (int i = 0; i < 3; ++i) {
+                StoreRecord r;
+                r.priority = i + 1;
+                r.enqueuedMs = 1000 + i;
+                r.keyId = key_id(ByteSpan(key));
+                r.text = ByteSpan(ct);
+                r.attachment = i == 2 ? ByteSpan(att) : ByteSpan();
+                w.add(r);
+            }
+            w.commit();
+        }
+        MappedFile mf(path);
+        ByteSpan file(mf.data(), mf.size());
+        int seen = 0;
+        bool fields = is_queue_store(file);
+        scan_queue_store(file, [&](const StoreRecord &r) {
+            fields = fields && r.priority == seen + 1 && r.enqueuedMs == (uint64_t)(1000 + seen) &&
+                     r.keyId == key_id(ByteSpan(key)) && r.text.data() > mf.data() && r.text.data() < mf.data() + mf.size() &&
+                     decrypt_aead(std::string((const char*)r.text.data(), r.text.size()), key) == pt &&
+                     (seen != 2 || std::string((const char*)r.attachment.data(), r.attachment.size()) == att);
+            ++seen;
+        });
+        check(fields && seen == 3, "queue store roundtrip");
+        bool threw = false;
+        try { scan_queue_store(file.subspan(0, mf.size() - 5), [](const StoreRecord &) {}); } catch (const std::runtime_error &) { threw = true; }
+        check(threw, "queue store truncation detected");
+        check(key_id(ByteSpan(key)) != key_id(ByteSpan(std::string(32, 'k'))), "key ids differ per key");
+        std::remove(path.c_str());
+    }
+
+    // dedup: repeats fold into the queued copy; a higher-priority repeat replaces it and carries
+    // the count; once sent, the same text starts a new message; a copy that was never queued
+    // releases its token, so repeats are not swallowed and a copy it replaced goes out again
+    {
+        DedupIndex d(ByteSpan(key), std::chrono::minutes(1), 8, 1024);
+        const std::string sos = "SOS trapped", other = "SOS elsewhere";
+        uint64_t first = d.admit(ByteSpan(sos), 3);
+        bool folded = first && d.admit(ByteSpan(sos), 3) == 0 && d.admit(ByteSpan(other), 3) != 0;
+        uint64_t raised = d.admit(ByteSpan(sos), 1);
+        check(folded && raised && raised != first, "dedup coalesces repeats");
+        check(d.claim(raised) == 3 && d.claim(first) == 0, "dedup raised copy carries the count");
+        uint64_t again = d.admit(ByteSpan(sos), 2);
+        check(again && d.claim(again) == 1 && d.counters().coalesced == 1 && d.counters().raised == 1 &&
+              d.counters().lateRepeats == 1, "dedup after send");
+        DedupIndex off(ByteSpan(key), std::chrono::milliseconds(0));
+        uint64_t x = off.admit(ByteSpan(sos), 1), y = off.admit(ByteSpan(sos), 1);
+        check(x && y && off.claim(x) == 1 && off.claim(y) == 1, "dedup disabled");
+        DedupIndex r(ByteSpan(key), std::chrono::minutes(1), 8, 1024);
+        uint64_t lost = r.admit(ByteSpan(sos), 2);
+        r.release(lost);
+        uint64_t retry = r.admit(ByteSpan(sos), 2), held = r.admit(ByteSpan(other), 3);
+        bool folds = r.admit(ByteSpan(other), 3) == 0;
+        r.release(r.admit(ByteSpan(other), 1));
+        check(lost && retry && retry != lost && folds && r.claim(retry) == 1 && r.claim(held) == 2 && r.counters().raised == 0,
+              "dedup release");
+    }
+
+    // rate limiter: routine posts stop at the priority-1 reserve, priority 1 spends it, then waits;
+    // admits() only asks, take() waits out the refill (on a fake clock)
+    {
+        RateLimiter rl;
+        RateLimiter::Clock::time_point now;
+        RateLimiter::Clock::duration slept{0};
+        rl.setClock([&] { return now; }, [&](RateLimiter::Clock::duration d) { now += d; slept += d; });
+        rl.setEndpointLimit(RateLimiter::Limit{100, 2}, 1);
+        rl.setClassLimit(3, RateLimiter::Limit{0, 0}, std::chrono::milliseconds(0));
+        bool routine = rl.acquire("ep", 3) && rl.acquire("ep", 3) && !rl.acquire("ep", 3);
+        bool sos = rl.acquire("ep", 1) && rl.acquire("ep", 1);
+        auto sosWait = slept;
+        RateLimiter::Counters c = rl.counters("ep");
+        check(routine && c.classes[2].granted == 2 && c.classes[2].dropped == 1, "rate limiter keeps the reserve");
+        check(sos && sosWait >= std::chrono::microseconds(9900) && sosWait <= std::chrono::microseconds(10100) &&
+              c.classes[0].granted == 2 && c.classes[0].throttled == 1, "rate limiter paces priority 1");
+        bool asked = !rl.admits("ep", 3, 1, now) && rl.admits("ep", 1, 1, now - std::chrono::seconds(1));
+        rl.take("ep", 3); // two tokens short of reserve + 1: 20 ms
+        c = rl.counters("ep");
+        check(asked && slept - sosWait >= std::chrono::microseconds(19900) && slept - sosWait <= std::chrono::microseconds(20100) &&
+              c.classes[2].granted == 3 && c.classes[2].dropped == 2 && c.classes[0].granted == 2, "rate limiter takes at post time");
+    }
+
+    // sent history: the ring keeps the newest entries, oldest first, and counts what it dropped
+    {
+        SentHistory h(4);
+        for (int i = 0; i < 6; ++i) {
+            SentRecord r;
+            r.sentMs = (uint64_t)i;
+            ciphertext_hash(r.hash, ByteSpan(std::to_string(i)));
+            h.push(r);
+        }
+        std::vector<uint64_t> seen;
+        h.visit([&](const SentRecord &r) { seen.push_back(r.sentMs); });
+        check(h.size() == 4 && h.evicted() == 2 && seen == std::vector<uint64_t>{2, 3, 4, 5}, "sent history ring");
+    }
+
+    // log index: a missing index is rebuilt (time and priority read from the records), records
+    // past it are still readable, time ranges come from the index
+    {
+        const std::string log = "test_log.tmp";
+        auto rec = [](int i) {
+            std::time_t t = 1700000000 + i;
+            std::string ts = std::ctime(&t);
+            ts.pop_back();
+            std::string body = "rec-" + std::to_string(i);
+            return ts + " : " + binToBase64((const unsigned char*)body.data(), body.size()) + " [Priority: 2]";
+        };
+        {
+            std::ofstream f(log, std::ios::binary | std::ios::trunc);
+            for (int i = 0; i < 5; ++i) f << rec(i) << "\n";
+        }
+        std::remove(log_index_path(log).c_str());
+        {
+            LogIndexWriter w(log, nullptr);
+            check(w.recoveredEntries() == 5, "log index rebuilt");
+        }
+        { std::ofstream f(log, std::ios::binary | std::ios::app); f << rec(5) << "\r\n" << rec(6) << "\n"; }
+        LogReader r(log);
+        std::string last;
+        std::vector<std::string> read;
+        r.read(2, 6, nullptr, [&](size_t, const std::string &plain) { read.push_back(plain); });
+        std::pair<size_t, size_t> range = r.timeRange(1700000001000ull, 1700000003000ull);
+        check(r.size() == 7 && read == std::vector<std::string>{rec(2), rec(3), rec(4), rec(5)} && r.last(nullptr, last) &&
+              last == rec(6) && r.entry(1).priority == 2 && range.first == 1 && range.second == 4, "log reader");
+        {
+            LogIndexWriter w(log, nullptr);
+            check(w.recoveredEntries() == 2, "log index catches up");
+        }
+        { std::ofstream f(log, std::ios::binary | std::ios::trunc); f << "other-log\n"; }
+        {
+            LogIndexWriter w(log, nullptr);
+            std::string other;
+            check(w.recoveredEntries() == 1 && LogReader(log).last(nullptr, other) && other == "other-log", "stale log index rebuilt");
+        }
+        std::remove(log.c_str());
+        std::remove(log_index_path(log).c_str());
+    }
+
+    // segmented log: rotation by size, headers and manifest, reads across segments, retention
+    {
+        const std::string dir = "test_segments.tmp";
+        std::filesystem::remove_all(dir);
+        auto append = [](SegmentedLogWriter &w, const std::string &rec, int prio, uint64_t ms) {
+            LogFrameBuilder f; // one plain record per frame: 16 + 4 + 5 bytes
+            f.add(rec, prio, ms);
+            f.seal(ByteSpan(), SUITE_XCHACHA20POLY1305);
+            w.append(f);
+        };
+        auto lastOf = [](const std::string &d) {
+            std::string last;
+            read_last_log_record(d, nullptr, last);
+            return last;
+        };
+        {
+            SegmentedLogWriter w(dir, 0xabc, 82 + 3 * 25, std::chrono::milliseconds(0), 2, nullptr);
+            for (int i = 0; i < 10; ++i) append(w, "rec-" + std::to_string(i), 2, 1000 + (uint64_t)i);
+        }
+        std::vector<LogSegment> segs = read_log_manifest(dir);
+        size_t archived = 0;
+        for (const LogSegment &s : segs) archived += s.state == SEGMENT_ARCHIVED;
+        MappedFile first(dir + "/" + segs[2].file);
+        check(segs.size() == 4 && segs.back().state == SEGMENT_ACTIVE && archived == 1 && segs[1].records == 3 &&
+              segs[1].firstMs == 1003 && segs[1].lastMs == 1005 && segs[0].keyId == 0xabc &&
+              std::string((const char*)first.data(), 12) == "LCSEG 2 key=", "segmented log rotates");
+        SegmentedLogReader r(dir);
+        std::string last;
+        std::vector<std::string> recent, ranged;
+        r.forEachRecent(4, nullptr, [&](const LogSegment &, const std::string &rec) { recent.push_back(rec); });
+        r.forEachInRange(1004, 1007, nullptr, [&](const LogSegment &, const std::string &rec) { ranged.push_back(rec); });
+        check(r.last(nullptr, last) && last == "rec-9" && recent == std::vector<std::string>{"rec-6", "rec-7", "rec-8", "rec-9"} &&
+              ranged == std::vector<std::string>{"rec-4", "rec-5", "rec-6", "rec-7"} && lastOf(dir) == "rec-9",
+              "segmented log reader");
+        {
+            SegmentedLogWriter w(dir, 0xdef, 0, std::chrono::milliseconds(0), 0, nullptr); // key change: new segment
+            append(w, "rec-10", 1, 2000);
+        }
+        segs = read_log_manifest(dir);
+        check(segs.size() == 5 && segs[3].state == SEGMENT_SEALED && segs[4].keyId == 0xdef && lastOf(dir) == "rec-10",
+              "segmented log starts a segment per key");
+        std::filesystem::remove_all(dir);
+    }
+
+    // log frames: batches sealed under one nonce, records read back one at a time, an index
+    // rebuilt from sealed frames, a torn frame ignored
+    {
+        const std::string dir = "test_frames.tmp";
+        std::filesystem::remove_all(dir);
+        LogOpener open = log_key_opener(ByteSpan(key));
+        auto rec = [](int i) { return "rec-" + std::to_string(i) + " [Priority: " + std::to_string(1 + i % 3) + "]"; };
+        std::string path;
+        {
+            SegmentedLogWriter w(dir, key_id(ByteSpan(key)), 0, std::chrono::milliseconds(0), 0, open);
+            LogFrameBuilder f;
+            for (int i = 0; i < 10; ++i) {
+                f.add(rec(i), 1 + i % 3, 1000 + (uint64_t)i);
+                if (f.count() == 4 || i == 9) { f.seal(ByteSpan(key), best_suite()); w.append(f); f.clear(); }
+            }
+            path = dir + "/" + read_log_manifest(dir).back().file;
+        }
+        size_t frames = 0;
+        {
+            MappedFile seg(path);
+            scan_log_frames(ByteSpan(seg.data(), seg.size()), SEGMENT_HEADER_LEN, [&](uint64_t, const LogFrameHeader &h) {
+                frames += h.flags == LOG_FRAME_SEALED;
+            });
+        }
+        std::remove(log_index_path(path).c_str());
+        { std::ofstream f(path, std::ios::binary | std::ios::app); f.write("LCFR\1\0\0\0\4\0\0\0\xff\0\0\0torn", 20); }
+        size_t recovered;
+        {
+            SegmentedLogWriter w(dir, key_id(ByteSpan(key)), 0, std::chrono::milliseconds(0), 0, open);
+            recovered = w.recoveredEntries();
+        }
+        LogReader lr(path);
+        std::vector<std::string> all;
+        std::string last, blind;
+        SegmentedLogReader r(dir);
+        r.forEachRecent(100, open, [&](const LogSegment &, const std::string &plain) { all.push_back(plain); });
+        size_t opens = 0;
+        std::vector<std::string> picked;
+        LogOpener counting = [&](ByteSpan sealed, ByteSpan ad) { ++opens; return open(sealed, ad); };
+        lr.readIf(0, lr.size(), counting, [](size_t n) { return n == 1 || n == 2 || n == 9; },
+                  [&](size_t, const std::string &plain) { picked.push_back(plain); });
+        check(opens == 2 && picked == std::vector<std::string>{rec(1), rec(2), rec(9)}, "log reader opens picked frames once");
+        check(frames == 3 && recovered == 10 && lr.size() == 10 && lr.entry(5).priority == 3 && lr.entry(5).slot == 1 &&
+              all.size() == 10 && all[0] == rec(0) && all[9] == rec(9) && r.last(open, last) && last == rec(9) &&
+              r.last(nullptr, blind) && blind.empty(), "log frames");
+        std::filesystem::remove_all(dir);
+    }
+
+    // log frames bind their header: a changed byte fails the tag, and a reader holding a key
+    // refuses unsealed frames (planted, or with the sealed flag cleared)
+    {
+        LogOpener open = log_key_opener(ByteSpan(key));
+        const std::string batch = "\x05\0\0\0hello";
+        auto opened = [&](const std::string &frame, const LogOpener &o) {
+            LogFrameHeader h;
+            if (!log_frame_at(ByteSpan(frame), 0, h)) return std::string("no frame");
+            try { return open_log_frame(ByteSpan(frame), 0, h, o); } catch (const std::exception &) { return std::string("refused"); }
+        };
+        std::string sealed, plain;
+        seal_log_frame(sealed, ByteSpan(batch), 1, ByteSpan(key), best_suite());
+        seal_log_frame(plain, ByteSpan(batch), 1, ByteSpan(), best_suite());
+        std::string reserved = sealed, cleared = sealed;
+        reserved[5] = 1;
+        cleared[4] = 0;
+        check(opened(sealed, open) == batch && opened(reserved, open) == "refused" && opened(cleared, open).empty() &&
+              opened(plain, open).empty() && opened(plain, nullptr) == batch, "log frames bind their header");
+    }
+
+    // log records: binary roundtrip (the message stays raw), legacy text read without regexes,
+    // truncated or unknown bytes rejected
+    {
+        const unsigned char ct[] = {0, 1, 2, 0xff, '\n', 0};
+        std::string bin;
+        encode_log_record(bin, 1700000000250000000ll, 3, 2, 0xabc, ByteSpan(ct, sizeof(ct)), "a.jpg");
+        LogRecord r;
+        bool binOk = decode_log_record(ByteSpan(bin), r) && r.version == LOG_RECORD_VERSION && r.timeMs() == 1700000000250ull &&
+                     r.priority == 3 && r.repeats == 2 && r.keyId == 0xabc && r.attachment == "a.jpg" &&
+                     r.message().size() == sizeof(ct) && std::memcmp(r.message().data(), ct, sizeof(ct)) == 0 &&
+                     format_log_time(r.timeNs) == "2023-11-14T22:13:20.250Z";
+        std::time_t t = 1700000000;
+        std::string ts = std::ctime(&t);
+        ts.pop_back();
+        LogRecord legacy;
+        bool legacyOk = decode_log_record(ByteSpan(ts + " : AAEC/woA [Priority:1] [Repeats: 4]"), legacy) && legacy.version == 0 &&
+                        legacy.timeMs() == 1700000000000ull && legacy.priority == 1 && legacy.repeats == 4 &&
+                        legacy.message().size() == sizeof(ct) && std::memcmp(legacy.message().data(), ct, sizeof(ct)) == 0;
+        LogRecord bad;
+        check(binOk && legacyOk && !decode_log_record(ByteSpan(bin.data(), bin.size() - 1), bad) &&
+              !decode_log_record(ByteSpan(std::string("rec-1 [Priority: 2]")), bad), "log records");
+    }
+
+    // legacy log migration: plain-text bodies (base64-looking or not) are sealed under the master
+    // key as a sent message is; bodies already sealed under it are kept byte for byte
+    {
+        std::time_t t = 1700000000;
+        std::string ts = std::ctime(&t);
+        ts.pop_back();
+        std::string b64;
+        const std::string ct = encrypt_aead(std::string("already sealed"), ByteSpan(key));
+        binToBase64(b64, ByteSpan(ct));
+        const std::string plainLog[] = {ts + " : help [Priority: 1]", ts + " : SOS1 [Priority: 2] [Repeats: 3]",
+                                        "need water at the bridge", ts + " : " + b64 + " [Priority: 3] [Attachment: a.jpg]"};
+        const char *want[] = {"help", "SOS1", "need water at the bridge", "already sealed"};
+        bool ok = true;
+        for (size_t i = 0; i < 4; ++i) {
+            LegacyLogFields f;
+            split_legacy_log_record(plainLog[i], f);
+            std::string rec;
+            migrate_legacy_log_record(rec, f, 1700000000000000000ll, ByteSpan(key));
+            LogRecord r;
+            ok = ok && decode_log_record(ByteSpan(rec), r) && r.keyId == key_id(ByteSpan(key)) &&
+                 decrypt_aead(std::string((const char*)r.message().data(), r.message().size()), ByteSpan(key)) == want[i];
+            if (i == 1) ok = ok && r.priority == 2 && r.repeats == 3;
+            if (i == 2) ok = ok && r.priority == 2;
+            if (i == 3) ok = ok && r.attachment == "a.jpg" && std::string((const char*)r.message().data(), r.message().size()) == ct;
+        }
+        check(ok, "legacy log migration");
+    }
+
+    // log key epochs: a new epoch starts a segment, readers find each segment's key by id, and
+    // the reseal rewrites the older segment a frame per step until only the new key is needed
+    {
+        const std::string keydir = "test_keys.tmp", dir = "test_epochs.tmp";
+        std::filesystem::remove_all(keydir);
+        std::filesystem::remove_all(dir);
+        std::filesystem::create_directories(keydir);
+        SecureString k1 = rotate_log_epoch(keydir, ByteSpan(key)), k2 = rotate_log_epoch(keydir, ByteSpan(key));
+        const uint64_t id1 = key_id(ByteSpan(k1)), id2 = key_id(ByteSpan(k2));
+        {
+            SegmentedLogWriter w(dir, id1, 0, std::chrono::milliseconds(0), 0, log_key_opener(ByteSpan(k1)));
+            LogFrameBuilder f;
+            for (int i = 0; i < 8; ++i) {
+                if (i == 6) w.setKey(id2, log_key_opener(ByteSpan(k2)));
+                f.add("rec-" + std::to_string(i), 1 + i % 3, 1000 + (uint64_t)i);
+                if (i % 2) { f.seal(ByteSpan(i < 6 ? k1 : k2), best_suite()); w.append(f); f.clear(); }
+            }
+        }
+        LogKeyCache keys(keydir, log_key_unwrapper(ByteSpan(key)));
+        std::vector<std::string> before, after;
+        SegmentedLogReader(dir, keys.segmentOpener()).forEachRecent(100, nullptr, [&](const LogSegment &, const std::string &p) { before.push_back(p); });
+        size_t steps = 0;
+        {
+            SegmentedLogWriter w(dir, id2, 0, std::chrono::milliseconds(0), 0, log_key_opener(ByteSpan(k2)));
+            while (w.resealStep(1, keys.segmentOpener(), ByteSpan(k2), best_suite())) ++steps;
+        }
+        std::vector<LogSegment> segs = read_log_manifest(dir);
+        SegmentedLogReader(dir).forEachRecent(100, log_key_opener(ByteSpan(k2)), [&](const LogSegment &, const std::string &p) { after.push_back(p); });
+        LogReader resealed(dir + "/" + segs[0].file);
+        check(before.size() == 8 && before[0] == "rec-0" && steps == 3 && segs.size() == 2 && segs[0].keyId == id2 &&
+              after == before && resealed.size() == 6 && resealed.entry(4).priority == 2 && resealed.entry(4).slot == 0 &&
+              std::filesystem::exists(log_epoch_path(keydir, id1)), "log key epochs");
+        // a crash after the reseal's rename, before the manifest names the new key: the header wins
+        segs[0].keyId = id1;
+        write_log_manifest(dir, segs);
+        std::vector<std::string> recovered;
+        SegmentedLogReader(dir, keys.segmentOpener()).forEachRecent(100, nullptr, [&](const LogSegment &, const std::string &p) { recovered.push_back(p); });
+        check(read_log_manifest(dir)[0].keyId == id2 && recovered == before, "log reseal crash before the manifest");
+        // a retired epoch stays while any segment, archived or not, names it
+        std::vector<LogSegment> named = read_log_manifest(dir);
+        named[0].state = SEGMENT_ARCHIVED;
+        named[0].keyId = id1;
+        bool kept = prune_log_epochs(keydir, dir, named, id2).empty() && std::filesystem::exists(log_epoch_path(keydir, id1));
+        check(kept && prune_log_epochs(keydir, dir, read_log_manifest(dir), id2) == std::vector<uint64_t>{id1} &&
+              !std::filesystem::exists(log_epoch_path(keydir, id1)) && log_key_files(keydir).size() == 1, "retired log keys pruned");
+        std::filesystem::remove_all(keydir);
+        std::filesystem::remove_all(dir);
+    }
+
+    // send pipeline: each message passes encode -> append -> transport once; the stub poster sees
+    // every payload and the log holds every record, in send order (priority 1 first)
+    {
+        const std::filesystem::path home = std::filesystem::current_path(), dir = "test_pipeline.tmp";
+        std::filesystem::remove_all(dir);
+        std::filesystem::create_directories(dir);
+        std::filesystem::current_path(dir); // the queue keeps its files under ./modules
+        SecureString logKey(crypto_aead_xchacha20poly1305_ietf_KEYBYTES, '\0');
+        randombytes_buf(&logKey[0], logKey.size());
+        std::mutex mu;
+        std::vector<std::string> posted;
+        std::vector<int> postedPrio;
+        {
+            MessageQueue mq(key, logKey);
+            mq.setRateLimit(1e6, 1e6, 0);
+            mq.setTransport(Transport{[&](const std::string &b64, int priority, uint32_t, const std::string &) {
+                std::lock_guard<std::mutex> lock(mu);
+                posted.push_back(b64);
+                postedPrio.push_back(priority);
+                return true;
+            }, nullptr});
+            for (int i = 0; i < 12; ++i) mq.addMessage(ByteSpan("pipeline-" + std::to_string(i)), 1 + i % 3);
+            mq.sendMessages();
+        } // the destructor lets every stage finish
+        std::vector<std::string> texts, logged;
+        std::vector<int> loggedPrio;
+        for (const std::string &b64 : posted) {
+            std::vector<unsigned char> bin;
+            base64ToBin(bin, b64);
+            texts.push_back(decrypt_aead(std::string(bin.begin(), bin.end()), key));
+        }
+        SegmentedLogReader("modules/emergency_messenger/logs").forEachRecent(100, log_key_opener(ByteSpan(logKey)),
+            [&](const LogSegment &, const std::string &p) {
+                LogRecord r;
+                if (!decode_log_record(ByteSpan(p), r)) return;
+                std::string b64;
+                binToBase64(b64, r.message());
+                logged.push_back(b64);
+                loggedPrio.push_back(r.priority);
+            });
+        std::sort(texts.begin(), texts.end());
+        std::vector<std::string> sortedPosted = posted, sortedLogged = logged;
+        std::sort(sortedPosted.begin(), sortedPosted.end());
+        std::sort(sortedLogged.begin(), sortedLogged.end());
+        std::filesystem::current_path(home);
+        std::filesystem::remove_all(dir);
+        check(posted.size() == 12 && texts.front() == "pipeline-0" && std::adjacent_find(texts.begin(), texts.end()) == texts.end() &&
+              sortedLogged == sortedPosted && std::is_sorted(loggedPrio.begin(), loggedPrio.end()), "send pipeline");
+    }
+
+    // an SOS queued while a backlog drains through a slow poster overtakes the jobs already in the
+    // pipeline: it goes out once a transport worker frees up, not after the backlog
+    {
+        const std::filesystem::path home = std::filesystem::current_path(), dir = "test_sos_overtake.tmp";
+        std::filesystem::remove_all(dir);
+        std::filesystem::create_directories(dir);
+        std::filesystem::current_path(dir);
+        SecureString logKey(crypto_aead_xchacha20poly1305_ietf_KEYBYTES, '\0');
+        randombytes_buf(&logKey[0], logKey.size());
+        std::mutex mu;
+        std::vector<int> postedPrio;
+        std::atomic<size_t> posts{0};
+        size_t postsAtSos = 0;
+        {
+            MessageQueue mq(key, logKey);
+            mq.setRateLimit(1e6, 1e6, 0);
+            mq.setTransport(Transport{[&](const std::string &, int priority, uint32_t, const std::string &) {
+                if (priority != 1) std::this_thread::sleep_for(std::chrono::milliseconds(20));
+                std::lock_guard<std::mutex> lock(mu);
+                postedPrio.push_back(priority);
+                ++posts;
+                return true;
+            }, nullptr});
+            for (int i = 0; i < 30; ++i) mq.addMessage(ByteSpan("backlog-" + std::to_string(i)), 2);
+            mq.sendMessages();
+            while (posts < 2) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            postsAtSos = posts;
+            mq.addMessage(ByteSpan(std::string("sos")), 1);
+            mq.sendMessages();
+        }
+        std::filesystem::current_path(home);
+        std::filesystem::remove_all(dir);
+        size_t sosAt = std::find(postedPrio.begin(), postedPrio.end(), 1) - postedPrio.begin();
+        check(postedPrio.size() == 31 && sosAt <= postsAtSos + 4, "SOS overtakes the pipeline backlog");
+    }
+
+    // a failed post is not acked: the next send posts it again (as many submissions as before),
+    // and one still failing at shutdown is replayed from the journal at the next start
+    {
+        const std::filesystem::path home = std::filesystem::current_path(), dir = "test_failed_post.tmp";
+        std::filesystem::remove_all(dir);
+        std::filesystem::create_directories(dir);
+        std::filesystem::current_path(dir);
+        SecureString logKey(crypto_aead_xchacha20poly1305_ietf_KEYBYTES, '\0');
+        randombytes_buf(&logKey[0], logKey.size());
+        std::mutex mu;
+        std::vector<std::string> delivered;
+        std::atomic<size_t> posts{0};
+        bool down = true;
+        std::vector<uint32_t> flakyRepeats;
+        auto text = [&](const std::string &b64) {
+            std::vector<unsigned char> bin;
+            base64ToBin(bin, b64);
+            return decrypt_aead(std::string(bin.begin(), bin.end()), key);
+        };
+        Transport t{[&](const std::string &b64, int, uint32_t repeats, const std::string &) {
+            std::lock_guard<std::mutex> lock(mu);
+            ++posts;
+            std::string plain = text(b64);
+            if (plain == "flaky") flakyRepeats.push_back(repeats);
+            if (plain == "flaky" && down) return false;
+            delivered.push_back(plain);
+            return true;
+        }, nullptr};
+        auto waitPosts = [&](size_t n) {
+            for (int i = 0; i < 5000 && posts < n; ++i) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        };
+        {
+            MessageQueue mq(key, logKey);
+            mq.setRateLimit(1e6, 1e6, 0);
+            mq.setTransport(t);
+            mq.addMessage(ByteSpan(std::string("steady")), 2);
+            mq.addMessage(ByteSpan(std::string("flaky")), 2);
+            mq.addMessage(ByteSpan(std::string("flaky")), 2);
+            mq.sendMessages();
+            waitPosts(2);
+            mq.sendMessages(); // fails again
+            waitPosts(3);
+        }
+        const size_t failedPosts = posts;
+        down = false;
+        {
+            MessageQueue mq(key, logKey);
+            mq.setRateLimit(1e6, 1e6, 0);
+            mq.setTransport(t);
+            mq.sendMessages();
+        }
+        std::filesystem::current_path(home);
+        std::filesystem::remove_all(dir);
+        check(failedPosts == 3 && delivered.size() == 2 && delivered[0] == "steady" && delivered[1] == "flaky",
+              "failed posts retried and replayed");
+        check(flakyRepeats.size() == 3 && flakyRepeats[0] == 2 && flakyRepeats[1] == 2, "failed posts keep their repeats");
+    }
+
+    // an SOS queued while priority-3 posts are throttled (past their burst of 10, 5/s, with the
+    // endpoint down to its priority-1 reserve) is neither held by the sender waiting on them nor
+    // stuck behind them in the transport workers: it is the very next post
+    {
+        const std::filesystem::path home = std::filesystem::current_path(), dir = "test_sos_throttled.tmp";
+        std::filesystem::remove_all(dir);
+        std::filesystem::create_directories(dir);
+        std::filesystem::current_path(dir);
+        SecureString logKey(crypto_aead_xchacha20poly1305_ietf_KEYBYTES, '\0');
+        randombytes_buf(&logKey[0], logKey.size());
+        std::mutex mu;
+        std::vector<int> postedPrio;
+        std::atomic<size_t> posts{0};
+        size_t postsAtSos = 0;
+        {
+            MessageQueue mq(key, logKey);
+            mq.setRateLimit(5, 10, 1);
+            mq.setTransport(Transport{[&](const std::string &, int priority, uint32_t, const std::string &) {
+                std::lock_guard<std::mutex> lock(mu);
+                postedPrio.push_back(priority);
+                ++posts;
+                return true;
+            }, nullptr});
+            for (int i = 0; i < 16; ++i) mq.addMessage(ByteSpan("bulk-" + std::to_string(i)), 3);
+            mq.sendMessages();
+            while (posts < 10) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            postsAtSos = posts;
+            mq.addMessage(ByteSpan(std::string("sos")), 1);
+            mq.sendMessages();
+        }
+        std::filesystem::current_path(home);
+        std::filesystem::remove_all(dir);
+        size_t sosAt = std::find(postedPrio.begin(), postedPrio.end(), 1) - postedPrio.begin();
+        check(postedPrio.size() == 17 && sosAt == postsAtSos, "SOS not held by throttled posts");
+    }
+
+    // queue memory budget: over the resident budget adds are throttled and the newest low-priority
+    // messages spill to disk; near the spill limit priority 3, then 2, is refused, never 1; spilled
+    // messages come back from the mapping and go out in scheduler order
+    {
+        const std::filesystem::path home = std::filesystem::current_path(), dir = "test_budget.tmp";
+        std::filesystem::remove_all(dir);
+        std::filesystem::create_directories(dir);
+        std::filesystem::current_path(dir);
+        SecureString logKey(crypto_aead_xchacha20poly1305_ietf_KEYBYTES, '\0');
+        randombytes_buf(&logKey[0], logKey.size());
+        std::vector<std::string> admitted[3], sent;
+        std::atomic<size_t> posts{0};
+        size_t throttled = 0, resident = 0, spilled = 0, residentAfter = 1, spilledAfter = 1;
+        Admission p3 = ADMIT_OK, p2 = ADMIT_OK, p1 = ADMIT_REJECTED;
+        {
+            MessageQueue mq(key, logKey);
+            mq.setRateLimit(1e6, 1e6, 0);
+            mq.setMemoryBudget(8192, 8192); // priority 2 keeps the top tenth, room for one more
+            mq.setTransport(Transport{[&](const std::string &, int, uint32_t, const std::string &) { ++posts; return true; }, nullptr});
+            int n = 0;
+            auto add = [&](int priority) {
+                std::string text = "budget-" + std::to_string(n++);
+                text.resize(1000, '.');
+                Admission a = mq.addMessage(ByteSpan(text), priority);
+                if (a != ADMIT_REJECTED) admitted[priority - 1].push_back(text);
+                if (a == ADMIT_THROTTLED) ++throttled;
+                return a;
+            };
+            for (int i = 0; i < 20 && p3 != ADMIT_REJECTED; ++i) p3 = add(3);
+            mq.memoryUsage(resident, spilled);
+            for (int i = 0; i < 20 && p2 != ADMIT_REJECTED; ++i) p2 = add(2);
+            p1 = add(1);
+            mq.sendMessages();
+            mq.memoryUsage(residentAfter, spilledAfter);
+        }
+        SegmentedLogReader("modules/emergency_messenger/logs").forEachRecent(100, log_key_opener(ByteSpan(logKey)),
+            [&](const LogSegment &, const std::string &p) {
+                LogRecord r;
+                if (decode_log_record(ByteSpan(p), r))
+                    sent.push_back(decrypt_aead(std::string((const char*)r.message().data(), r.message().size()), key));
+            });
+        std::vector<std::string> inOrder = admitted[0];
+        inOrder.insert(inOrder.end(), admitted[1].begin(), admitted[1].end());
+        inOrder.insert(inOrder.end(), admitted[2].begin(), admitted[2].end());
+        std::filesystem::current_path(home);
+        std::filesystem::remove_all(dir);
+        check(p3 == ADMIT_REJECTED && p2 == ADMIT_REJECTED && p1 != ADMIT_REJECTED && !admitted[1].empty() && throttled >= 3,
+              "queue budget admission");
+        check(spilled > 0 && resident <= 8192 && residentAfter == 0 && spilledAfter == 0, "queue budget spill");
+        check(posts == inOrder.size() && sent == inOrder, "queue budget: spilled messages sent once, in order");
+    }
+
+#if !defined(_WIN32)
+    // key agent: requests over a real socket, export refused unless allowed, a request stalled
+    // halfway dropped after the read timeout, lock ends the session, shared directories refused
+    {
+        const std::string dir = "test_agent.tmp", path = dir + "/agent.sock";
+        std::filesystem::remove_all(dir);
+        std::filesystem::create_directory(dir);
+        ::chmod(dir.c_str(), 0755);
+        bool sharedRefused = false;
+        try { KeyAgentClient shared(path); } catch (const std::exception &e) { sharedRefused = std::string(e.what()).find("other users") != std::string::npos; }
+        ::chmod(dir.c_str(), 0700);
+        int lfd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+        bool listening = ::bind(lfd, (sockaddr*)&addr, sizeof(addr)) == 0 && ::listen(lfd, 4) == 0;
+        check(listening, "agent: listen");
+        SecureString logKey(crypto_aead_xchacha20poly1305_ietf_KEYBYTES, '\0');
+        randombytes_buf(&logKey[0], logKey.size());
+        bool allowExport = false;
+        auto handle = [&](AgentOp op, AgentKey which, ByteSpan payload, SecureString &out) {
+            agent_apply(op, ByteSpan(which == AGENT_KEY_LOG ? logKey : key), ByteSpan(key), payload, allowExport, out);
+        };
+        std::vector<bool> sessions;
+        std::thread server([&] {
+            for (int i = 0; listening && i < 3; ++i) {
+                int c = ::accept(lfd, nullptr, nullptr);
+                sessions.push_back(agent_serve(c, 2000, 100, handle));
+                ::close(c);
+            }
+        });
+        bool calls = false, exportRefused = false;
+        if (listening) {
+            KeyAgentClient agent(path);
+            agent.ping();
+            std::string boxed = agent.encrypt(AGENT_KEY_LOG, ByteSpan(pt));
+            SecureString opened = agent.decrypt(AGENT_KEY_LOG, ByteSpan(boxed));
+            SecureString unwrapped = agent.unwrap(ByteSpan(agent.wrap(ByteSpan(logKey))));
+            std::string frame;
+            seal_log_frame(frame, ByteSpan(pt), 1, ByteSpan(logKey), best_suite());
+            SecureString framed = agent.decrypt(AGENT_KEY_LOG, ByteSpan(frame).subspan(LOG_FRAME_HEADER_LEN), ByteSpan(frame).subspan(0, LOG_FRAME_HEADER_LEN));
+            calls = decrypt_aead(boxed, logKey) == pt && std::string(opened.data(), opened.size()) == pt && unwrapped == logKey &&
+                    std::string(framed.data(), framed.size()) == pt;
+            try { agent.exportKey(AGENT_KEY_MASTER); } catch (const std::exception &e) { exportRefused = std::string(e.what()).find("disabled") != std::string::npos; }
+            allowExport = true;
+            calls = calls && agent.exportKey(AGENT_KEY_MASTER) == key;
+        }
+        bool stalledDropped = false;
+        if (listening) {
+            int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+            unsigned char partial[3] = {AGENT_PING, 0, 0};
+            timeval tv{5, 0};
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+            char c;
+            stalledDropped = ::connect(fd, (sockaddr*)&addr, sizeof(addr)) == 0 && agent_write_all(fd, partial, sizeof(partial)) &&
+                             ::recv(fd, &c, 1, 0) == 0;
+            ::close(fd);
+            KeyAgentClient(path).lock();
+        }
+        server.join();
+        ::close(lfd);
+        check(sharedRefused && calls && exportRefused && stalledDropped && sessions == std::vector<bool>{true, true, false}, "key agent protocol");
+        std::filesystem::remove_all(dir);
+    }
+#endif
+
+    return failures ? 4 : 0;
 }
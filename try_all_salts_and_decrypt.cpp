@@ -1,7 +1,10 @@
 // try_all_salts_and_decrypt.cpp
+// Usage: ./try_all_salts_and_decrypt [--threads N] [--mem-mb N]
 // Searches for candidate salt files under repo, derives masterKey for each using the passphrase,
 // tries to unwrap wrapped_logkey.bin in same directory (if present) and attempts to decrypt
 // the last log record inner message. Prints any successful decrypts.
+// Candidates are deduplicated by content, and the Argon2 runs go in parallel as long as their
+// memlimits fit in --mem-mb (default 1024); the search stops at the first working key.
 
 #include <iostream>
 #include <fstream>
@@ -9,23 +12,21 @@
 #include <vector>
 #include <filesystem>
 #include <sstream>
-#include <regex>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <thread>
+#include "BoundedQueue.h"
 #include "Encryption.h"
+#include "KeyAgent.h"
+#include "KeyHeader.h"
+#include "SegmentedLog.h"
 
 namespace fs = std::filesystem;
 
-static std::string read_last_line(const std::string &path) {
-    std::ifstream f(path, std::ios::binary);
-    if (!f.is_open()) return "";
-    std::string line, last;
-    while (std::getline(f, line)) {
-        if (!line.empty() && line.back() == '\r') line.pop_back();
-        if (!line.empty()) last = line;
-    }
-    f.close();
-    return last;
-}
-
 static std::vector<fs::path> find_files(const fs::path &root, const std::vector<std::string> &patterns) {
     std::vector<fs::path> found;
     for (auto &p : fs::recursive_directory_iterator(root)) {
@@ -34,61 +35,123 @@ static std::vector<fs::path> find_files(const fs::path &root, const std::vector<
         for (auto &pat : patterns) {
             if (name.find(pat) != std::string::npos) {
                 found.push_back(p.path());
+                break;
             }
         }
     }
     return found;
 }
 
-int main() {
-    try { init_crypto(); } catch (const std::exception &e) { std::cerr<<"libsodium init failed: "<<e.what()<<"\n"; return 1; }
+static std::string content_hash(const std::vector<unsigned char> &bytes) {
+    unsigned char h[16];
+    crypto_generichash(h, sizeof(h), bytes.data(), bytes.size(), NULL, 0);
+    return std::string((const char*)h, sizeof(h));
+}
+
+// One set of KDF parameters and every file that holds it (copies and backups of one salt).
+struct SaltCandidate {
+    KdfParams kdf;
+    std::vector<fs::path> paths;
+};
 
-    const std::string logpath = "modules/emergency_messenger/logs/sent_messages.log";
-    if (!fs::exists(logpath)) { std::cerr << "Log not found: " << logpath << "\n"; return 2; }
-    std::string lastline = read_last_line(logpath);
-    if (lastline.empty()) { std::cerr << "No lines found in log\n"; return 3; }
+// One wrapped log key and every file that holds it.
+struct WrappedCandidate {
+    std::string hash;
+    std::vector<fs::path> paths;
+};
+
+struct Derived {
+    size_t candidate = 0;
+    SecureString key;   // empty on failure
+    std::string error;
+};
+
+int main(int argc, char **argv) {
+    unsigned threads = 0;
+    size_t budget = 1024ull << 20;
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        if (a == "--threads" && i + 1 < argc) threads = (unsigned)std::strtoul(argv[++i], nullptr, 10);
+        else if (a == "--mem-mb" && i + 1 < argc) budget = (size_t)std::strtoull(argv[++i], nullptr, 10) << 20;
+        else {
+            std::cerr << "Usage: " << argv[0] << " [--threads N] [--mem-mb N]\n";
+            return 2;
+        }
+    }
+
+    try { init_crypto(); } catch (const std::exception &e) { std::cerr<<"libsodium init failed: "<<e.what()<<"\n"; return 1; }
 
-    std::vector<unsigned char> wrapped_bin;
-    try { wrapped_bin = base64ToBin(lastline); } catch (const std::exception &e) { std::cerr << "Last line not base64: " << e.what() << "\n"; return 4; }
-    std::string wrapped_str((char*)wrapped_bin.data(), wrapped_bin.size());
+    const std::string logdir = "modules/emergency_messenger/logs";
+    if (!fs::exists(logdir)) { std::cerr << "Log not found: " << logdir << "\n"; return 2; }
+    std::string unopened;
+    if (!read_last_log_record(logdir, nullptr, unopened)) { std::cerr << "No lines found in log\n"; return 3; }
 
-    std::cout << "Found last log line (len=" << wrapped_str.size() << " bytes). Searching for candidate salts...\n";
+    std::cout << "Found last log record. Searching for candidate salts...\n";
 
-    // search patterns for salt files (common names)
-    std::vector<std::string> patterns = {"salt", "user_salt", "user_salt.bin"};
+    // search patterns for salt files and key headers (common names)
+    std::vector<std::string> patterns = {"salt", "user_salt", "user_salt.bin", "user_key.hdr"};
     auto salt_files = find_files(".", patterns);
 
-    if (salt_files.empty()) {
+    // key headers carry their own KDF limits; bare salts used the interactive defaults. Files
+    // giving the same parameters need only one Argon2 run.
+    std::vector<SaltCandidate> salts;
+    std::map<std::string, size_t> salt_index;
+    for (auto &saltp : salt_files) {
+        KdfParams kdf;
+        try {
+            auto bytes = read_binary_file(saltp.string());
+            if (bytes.size() == KEY_HEADER_LEN) kdf = decode_key_header(bytes);
+            else kdf.salt = bytes;
+        } catch (...) { continue; }
+        if (kdf.salt.size() != SALT_LEN) continue;
+        std::vector<unsigned char> id(kdf.salt);
+        for (uint64_t v : {(uint64_t)kdf.alg, (uint64_t)kdf.opslimit, (uint64_t)kdf.memlimit})
+            for (int i = 0; i < 8; ++i) id.push_back((unsigned char)(v >> (8 * i)));
+        auto ins = salt_index.emplace(content_hash(id), salts.size());
+        if (ins.second) salts.push_back(SaltCandidate{kdf, {}});
+        salts[ins.first->second].paths.push_back(saltp);
+    }
+
+    if (salts.empty()) {
         std::cerr << "No candidate salt files found under repo.\n";
     } else {
-        std::cout << "Candidate salts found:\n";
-        for (auto &s : salt_files) std::cout << " - " << s.string() << "\n";
+        std::cout << "Candidate salts found (" << salts.size() << " unique of " << salt_files.size() << " files):\n";
+        for (auto &c : salts) {
+            std::cout << " - " << c.paths[0].string();
+            if (c.paths.size() > 1) std::cout << " (+" << c.paths.size() - 1 << " identical)";
+            std::cout << "\n";
+        }
     }
 
     // also look for wrapped_logkey backups
     std::vector<std::string> wrap_patterns = {"wrapped_logkey", "wrapped_logkey.bin"};
-    auto wrapped_candidates = find_files(".", wrap_patterns);
-    if (!wrapped_candidates.empty()) {
-        std::cout << "Found wrapped_logkey candidates:\n";
-        for (auto &w : wrapped_candidates) std::cout << " - " << w.string() << "\n";
+    std::vector<WrappedCandidate> wrapped;
+    for (auto &w : find_files(".", wrap_patterns)) {
+        std::string h;
+        try { h = content_hash(read_binary_file(w.string())); } catch (...) { continue; }
+        auto it = std::find_if(wrapped.begin(), wrapped.end(), [&](const WrappedCandidate &c) { return c.hash == h; });
+        if (it == wrapped.end()) wrapped.push_back(WrappedCandidate{h, {w}});
+        else it->paths.push_back(w);
+    }
+    if (!wrapped.empty()) {
+        std::cout << "Found wrapped_logkey candidates (" << wrapped.size() << " unique):\n";
+        for (auto &w : wrapped) {
+            std::cout << " - " << w.paths[0].string();
+            if (w.paths.size() > 1) std::cout << " (+" << w.paths.size() - 1 << " identical)";
+            std::cout << "\n";
+        }
     }
-
-    std::string pass;
-    std::cout << "Enter the passphrase you always use: ";
-    std::getline(std::cin, pass);
-    if (pass.empty()) { std::cerr << "Empty passphrase\n"; return 5; }
 
     bool any_success = false;
 
     // function to attempt decrypt given masterKey and optional wrapped_logpath
-    auto attempt_with = [&](const std::string &label, const std::string &masterKey, const fs::path *wrapped_path) -> bool {
-        std::string logKey;
+    auto attempt_with = [&](const std::string &label, ByteSpan masterKey, const fs::path *wrapped_path) -> bool {
+        SecureString logKey;
         bool have_logkey = false;
         if (wrapped_path && fs::exists(*wrapped_path)) {
             try {
                 auto w = read_binary_file(wrapped_path->string());
-                std::string wstr((char*)w.data(), w.size());
-                logKey = decrypt_aead(wstr, masterKey);
+                logKey = decrypt_aead_secure(ByteSpan(w), masterKey);
                 have_logkey = true;
                 std::cout << "[" << label << "] Unwrapped logKey successfully.\n";
             } catch (const std::exception &e) {
@@ -97,80 +160,142 @@ int main() {
             }
         }
 
-        // decrypt outer wrapper
-        std::string record_plain;
+        // decrypt the outer wrapper (of the line, or of the frame holding it)
+        SecureString record_plain;
         try {
-            if (have_logkey) record_plain = decrypt_aead(wrapped_str, logKey);
-            else record_plain = decrypt_aead(wrapped_str, masterKey);
+            std::string plain;
+            read_last_log_record(logdir, log_key_opener(have_logkey ? ByteSpan(logKey) : masterKey), plain);
+            record_plain.assign(plain.begin(), plain.end());
+            if (!plain.empty()) sodium_memzero(&plain[0], plain.size());
         } catch (const std::exception &e) {
             std::cerr << "[" << label << "] Failed to decrypt outer record: " << e.what() << "\n";
             return false;
         }
 
-        std::cout << "[" << label << "] Decrypted outer record:\n" << record_plain << "\n";
-
-        // extract inner b64 message
-        std::smatch m;
-        std::regex re(R"(\s:\s([A-Za-z0-9+/=]+)\s*\[Priority:\s*(\d+)\])");
-        if (!std::regex_search(record_plain, m, re) || m.size() < 2) {
-            std::cerr << "[" << label << "] Could not find inner base64 message in record (unexpected format)\n";
+        LogRecord rec;
+        if (!decode_log_record(ByteSpan(record_plain), rec)) {
+            std::cerr << "[" << label << "] Could not decode the log record (unexpected format)\n";
             return false;
         }
-        std::string b64msg = m[1].str();
+        std::cout << "[" << label << "] Decrypted outer record:\n" << log_record_summary(rec) << "\n";
+        ByteSpan bin = rec.message();
+        SecureString plaintext(aead_plain_len(bin.size()), '\0');
+        // try decrypt inner with masterKey
         try {
-            auto bin = base64ToBin(b64msg);
-            std::string inner_box((char*)bin.data(), bin.size());
-            // try decrypt inner with masterKey
-            try {
-                std::string plaintext = decrypt_aead(inner_box, masterKey);
-                std::cout << "[" << label << "] SUCCESS: inner message decrypted with masterKey. Plaintext:\n" << plaintext << "\n";
-                return true;
-            } catch (...) {
-                // try with logKey as backup (unlikely)
-                if (have_logkey) {
-                    try {
-                        std::string plaintext2 = decrypt_aead(inner_box, logKey);
-                        std::cout << "[" << label << "] SUCCESS: inner message decrypted with logKey. Plaintext:\n" << plaintext2 << "\n";
-                        return true;
-                    } catch (...) {}
-                }
-                std::cerr << "[" << label << "] Inner message decryption failed with both masterKey/logKey.\n";
-                return false;
+            plaintext.resize(decrypt_aead(MutableByteSpan(plaintext), bin, ByteSpan(masterKey)));
+            std::cout << "[" << label << "] SUCCESS: inner message decrypted with masterKey. Plaintext:\n" << plaintext << "\n";
+            return true;
+        } catch (...) {
+            // try with logKey as backup (unlikely)
+            if (have_logkey) {
+                try {
+                    plaintext.resize(decrypt_aead(MutableByteSpan(plaintext), bin, ByteSpan(logKey)));
+                    std::cout << "[" << label << "] SUCCESS: inner message decrypted with logKey. Plaintext:\n" << plaintext << "\n";
+                    return true;
+                } catch (...) {}
             }
-        } catch (const std::exception &e) {
-            std::cerr << "[" << label << "] Failed to base64-decode inner message: " << e.what() << "\n";
+            std::cerr << "[" << label << "] Inner message decryption failed with both masterKey/logKey.\n";
             return false;
         }
     };
 
-    // try each salt file and, for each, try any wrapped_logkey in the same directory or repo-wide
-    for (auto &saltp : salt_files) {
-        std::vector<unsigned char> salt;
-        try { salt = read_binary_file(saltp.string()); } catch (...) { continue; }
-        std::string mk;
-        try { mk = derive_master_key(pass, salt); } catch (const std::exception &e) { std::cerr << "Argon2 failed for salt " << saltp << ": " << e.what() << "\n"; continue; }
-
-        // try using wrapped_logkey in same parent dir
-        fs::path parent = saltp.parent_path();
-        fs::path local_wrapped = parent / "wrapped_logkey.bin";
-        if (fs::exists(local_wrapped)) {
-            std::string label = "salt=" + saltp.string() + " wrapped(local)";
-            if (attempt_with(label, mk, &local_wrapped)) { any_success = true; break; }
+    // client mode: try the agent's masterKey against the canonical wrapped key before any Argon2 run
+    if (KeyAgentClient::configured()) {
+        try {
+            SecureString mk, lk;
+            agent_load_keys(mk, lk);
+            fs::path canonical = "modules/emergency_messenger/keys/wrapped_logkey.bin";
+            bool ok = attempt_with("key agent", mk, &canonical);
+            if (ok) return 0;
+        } catch (const std::exception &e) {
+            std::cerr << "Key agent unavailable: " << e.what() << "\n";
         }
+    }
+
+    if (salts.empty()) {
+        std::cerr << "Place salt files or key headers from backups under the repo and re-run this tool.\n";
+        return 9;
+    }
 
-        // try repo-wide wrapped candidates
-        for (auto &w : wrapped_candidates) {
-            std::string label = "salt=" + saltp.string() + " wrapped=" + w.string();
-            if (attempt_with(label, mk, &w)) { any_success = true; break; }
+    SecureString pass;
+    std::cout << "Enter the passphrase you always use: ";
+    std::getline(std::cin, pass);
+    if (pass.empty()) { std::cerr << "Empty passphrase\n"; return 5; }
+
+    // each Argon2 run holds its memlimit (64 MiB interactive) for its whole duration, so runs
+    // start only while the sum fits in the budget; a candidate larger than the budget runs alone
+    if (!threads) threads = std::max(1u, std::thread::hardware_concurrency());
+    size_t by_memory = std::max<size_t>(1, budget / crypto_pwhash_MEMLIMIT_INTERACTIVE);
+    threads = (unsigned)std::min<size_t>({(size_t)threads, by_memory, salts.size()});
+    std::cout << "Deriving " << salts.size() << " key(s) on " << threads << " thread(s) within " << (budget >> 20) << " MiB.\n";
+
+    std::mutex mem_mu;
+    std::condition_variable mem_cv;
+    size_t mem_in_use = 0;
+    std::atomic<size_t> next{0};
+    std::atomic<bool> found{false};
+    BoundedQueue<Derived> results(threads);
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < threads; ++t) {
+        workers.emplace_back([&] {
+            for (size_t i; !found && (i = next++) < salts.size();) {
+                const KdfParams &kdf = salts[i].kdf;
+                {
+                    std::unique_lock<std::mutex> lock(mem_mu);
+                    mem_cv.wait(lock, [&] { return found || mem_in_use == 0 || mem_in_use + kdf.memlimit <= budget; });
+                    if (found) break;
+                    mem_in_use += kdf.memlimit;
+                }
+                Derived d;
+                d.candidate = i;
+                try { d.key = derive_master_key(pass, kdf); } catch (const std::exception &e) { d.error = e.what(); }
+                {
+                    std::lock_guard<std::mutex> lock(mem_mu);
+                    mem_in_use -= kdf.memlimit;
+                }
+                mem_cv.notify_all();
+                if (!results.push(std::move(d))) break;
+            }
+        });
+    }
+    std::thread closer([&] {
+        for (auto &w : workers) w.join();
+        results.close();
+    });
+
+    // unwrap attempts are cheap next to Argon2, so they stay on this thread, in completion order:
+    // the local wrapped key first, then each other unique one, then the masterKey alone
+    Derived d;
+    while (!any_success && results.pop(d)) {
+        const SaltCandidate &c = salts[d.candidate];
+        const fs::path &saltp = c.paths[0];
+        if (d.key.empty()) { std::cerr << "Argon2 failed for salt " << saltp << ": " << d.error << "\n"; continue; }
+
+        std::vector<const WrappedCandidate *> order;
+        for (auto &p : c.paths) {
+            fs::path local_wrapped = p.parent_path() / "wrapped_logkey.bin";
+            for (auto &w : wrapped)
+                if (std::find(w.paths.begin(), w.paths.end(), local_wrapped) != w.paths.end() &&
+                    std::find(order.begin(), order.end(), &w) == order.end()) order.push_back(&w);
         }
-        if (any_success) break;
+        size_t local_count = order.size();
+        for (auto &w : wrapped)
+            if (std::find(order.begin(), order.end(), &w) == order.end()) order.push_back(&w);
 
-        // try with no wrapped key (use masterKey directly)
-        {
-            std::string label = "salt=" + saltp.string() + " (no wrapped key)";
-            if (attempt_with(label, mk, nullptr)) { any_success = true; break; }
+        for (size_t k = 0; k < order.size() && !any_success; ++k) {
+            std::string label = "salt=" + saltp.string() + (k < local_count ? " wrapped(local)=" : " wrapped=") + order[k]->paths[0].string();
+            any_success = attempt_with(label, d.key, &order[k]->paths[0]);
         }
+        // try with no wrapped key (use masterKey directly)
+        if (!any_success) any_success = attempt_with("salt=" + saltp.string() + " (no wrapped key)", d.key, nullptr);
+    }
+    if (any_success) {
+        // runs already under way finish (Argon2 cannot be interrupted); no new ones start
+        { std::lock_guard<std::mutex> lock(mem_mu); found = true; }
+        mem_cv.notify_all();
+        results.close();
     }
+    closer.join();
 
     if (!any_success) {
         std::cerr << "No successful decryption with discovered salts/wrapped keys.\n";